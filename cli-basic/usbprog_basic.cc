@@ -19,6 +19,7 @@
 
 #include <usbprog-core/devices.h>
 #include <usbprog-core/util.h>
+#include <usbprog-core/firmwareimage.h>
 #include <usbprog-core/types.h>
 #include "usbprog_basic.h"
 
@@ -30,18 +31,26 @@ namespace cli_basic {
 UsbprogBasic::UsbprogBasic(int argc, char *argv[])
     : m_argc(argc)
     , m_argv(argv)
+    , m_useSysfs(false)
 {}
 
 UsbprogBasic::~UsbprogBasic()
 {}
 
-Action UsbprogBasic::parseCommandLine(int &deviceNumber, std::string &fw) const
+Action UsbprogBasic::parseCommandLine(int &deviceNumber, std::string &fw, bool &sysfs) const
 {
     // std::string is easier to use
     core::StringVector args;
     for (int i = 1; i < m_argc; i++)
         args.push_back(std::string(m_argv[i]));
 
+    // global options must be specified before the command
+    sysfs = false;
+    if (args.size() > 0 && (args[0] == "-S" || args[0] == "--sysfs")) {
+        sysfs = true;
+        args.erase(args.begin());
+    }
+
     if (args.size() == 0)
         return ACTION_ERROR;
 
@@ -79,7 +88,7 @@ int UsbprogBasic::exec()
     int deviceNumber;
     std::string firmwareFile;
 
-    Action action = parseCommandLine(deviceNumber, firmwareFile);
+    Action action = parseCommandLine(deviceNumber, firmwareFile, m_useSysfs);
     switch (action) {
         case ACTION_PRINT_HELP:
             printHelp();
@@ -103,7 +112,10 @@ int UsbprogBasic::exec()
 
 void UsbprogBasic::printHelp() const
 {
-    std::cout << "Usage: usbprog-basic [-h] <command> [args...]\n"
+    std::cout << "Usage: usbprog-basic [-h] [-S] <command> [args...]\n"
+              << "\n"
+              << "Options:\n"
+              << "  -S, --sysfs : Enumerate USB devices via sysfs (Linux only).\n"
               << "\n"
               << "Where command can be one of following:\n"
               << "  list      : Lists all available USBprog devices.\n"
@@ -122,6 +134,8 @@ ErrorCode UsbprogBasic::listDevices() const
 {
     try {
         core::DeviceManager deviceManager;
+        if (m_useSysfs)
+            deviceManager.setSysfsRoot(DEFAULT_SYSFS_ROOT);
         deviceManager.discoverUpdateDevices();
         deviceManager.printDevices(std::cout, false);
     } catch (const core::IOError &err) {
@@ -135,7 +149,14 @@ ErrorCode UsbprogBasic::listDevices() const
 ErrorCode UsbprogBasic::uploadFirmware(int deviceNumber, const std::string &firmwareFile) const
 {
     core::DeviceManager deviceManager;
-    deviceManager.discoverUpdateDevices();
+    try {
+        if (m_useSysfs)
+            deviceManager.setSysfsRoot(DEFAULT_SYSFS_ROOT);
+        deviceManager.discoverUpdateDevices();
+    } catch (const core::IOError &err) {
+        std::cerr << "I/O Error: " << err.what() << std::endl;
+        return RC_IOERROR;
+    }
 
     //
     // get the update device
@@ -157,21 +178,25 @@ ErrorCode UsbprogBasic::uploadFirmware(int deviceNumber, const std::string &firm
     // read the firmware file
     //
 
-    core::ByteVector firmwareData;
+    core::FirmwareImage firmwareImage;
     try {
-        firmwareData = core::Fileutil::readBytesFromFile(firmwareFile);
+        firmwareImage = core::FirmwareImage::readFromFile(firmwareFile);
     } catch (const core::IOError &err) {
         std::cerr << "Unable to read '" << firmwareFile << "'." << std::endl;
         return RC_FILE_NOT_EXIST;
+    } catch (const core::ParseError &err) {
+        std::cerr << "Invalid firmware file: " << err.what() << std::endl;
+        return RC_INVALID_FILE;
     }
 
     core::UsbprogUpdater updater(updateDevice);
+    updater.setTransferPolicy(deviceManager.getTransferPolicy());
     try {
         std::cout << "Opening device..." << std::endl;
         updater.updateOpen();
 
         std::cout << "Writing firmware..." << std::endl;
-        updater.writeFirmware(firmwareData);
+        updater.writeFirmware(firmwareImage);
 
         std::cout << "Starting device..." << std::endl;
         updater.startDevice();
@@ -42,6 +42,7 @@ enum ErrorCode {
     RC_IOERROR,
     RC_FILE_NOT_EXIST,
     RC_INVALID_COMMANDLINE,
+    RC_INVALID_FILE,
     RC_OTHER_ERROR = 255
 };
 
@@ -58,7 +59,7 @@ public:
     int exec();
 
 protected:
-    Action parseCommandLine(int &deviceNumber, std::string &fw) const;
+    Action parseCommandLine(int &deviceNumber, std::string &fw, bool &sysfs) const;
     void printHelp() const;
     ErrorCode listDevices() const;
     ErrorCode uploadFirmware(int                deviceNumber,
@@ -67,6 +68,7 @@ protected:
 private:
     int m_argc;
     char **m_argv;
+    bool m_useSysfs;
 };
 
 /* }}} */
@@ -27,6 +27,9 @@ namespace cli {
 CliConfiguration *CliConfiguration::m_instance = NULL;
 
 CliConfiguration::CliConfiguration()
+    : m_controllerJobs(4)
+    , m_controllerBandwidth(0)
+    , m_jsonOutput(false)
 {
     QNetworkProxyFactory::setUseSystemConfiguration(true);
 }
@@ -60,11 +63,88 @@ bool CliConfiguration::getBatchMode() const
     return m_batchMode;
 }
 
+void CliConfiguration::setServerSocket(const std::string &socket)
+{
+    m_serverSocket = socket;
+}
+
+std::string CliConfiguration::getServerSocket() const
+{
+    return m_serverSocket;
+}
+
+void CliConfiguration::setConnectSocket(const std::string &socket)
+{
+    m_connectSocket = socket;
+}
+
+std::string CliConfiguration::getConnectSocket() const
+{
+    return m_connectSocket;
+}
+
+void CliConfiguration::setScriptFile(const std::string &fileName)
+{
+    m_scriptFile = fileName;
+}
+
+std::string CliConfiguration::getScriptFile() const
+{
+    return m_scriptFile;
+}
+
+void CliConfiguration::setControllerJobs(size_t jobs)
+{
+    m_controllerJobs = jobs;
+}
+
+size_t CliConfiguration::getControllerJobs() const
+{
+    return m_controllerJobs;
+}
+
+void CliConfiguration::setControllerBandwidth(unsigned long bytesPerSecond)
+{
+    m_controllerBandwidth = bytesPerSecond;
+}
+
+unsigned long CliConfiguration::getControllerBandwidth() const
+{
+    return m_controllerBandwidth;
+}
+
+void CliConfiguration::setTraceFile(const std::string &fileName)
+{
+    m_traceFile = fileName;
+}
+
+std::string CliConfiguration::getTraceFile() const
+{
+    return m_traceFile;
+}
+
+void CliConfiguration::setJsonOutput(bool json)
+{
+    m_jsonOutput = json;
+}
+
+bool CliConfiguration::getJsonOutput() const
+{
+    return m_jsonOutput;
+}
+
 void CliConfiguration::dumpConfig(std::ostream &stream)
 {
     Configuration::dumpConfig(stream);
-    stream << "history     = " << m_historyFile  << std::endl
-           << "batch mode  = " << m_batchMode    << std::endl;
+    stream << "history     = " << m_historyFile   << std::endl
+           << "batch mode  = " << m_batchMode     << std::endl
+           << "server      = " << m_serverSocket  << std::endl
+           << "connect     = " << m_connectSocket << std::endl
+           << "script      = " << m_scriptFile << std::endl
+           << "ctrl jobs   = " << m_controllerJobs << std::endl
+           << "ctrl bw     = " << m_controllerBandwidth << std::endl
+           << "trace       = " << m_traceFile << std::endl
+           << "json        = " << m_jsonOutput << std::endl;
 }
 
 /* }}} */
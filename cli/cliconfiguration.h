@@ -89,6 +89,117 @@ public:
      */
     bool getBatchMode() const;
 
+    /**
+     * @brief Sets the socket on which the job server listens
+     *
+     * @param[in] socket the path of the Unix domain socket, an empty string if the program
+     *            should not run as job server
+     * @see JobServer
+     */
+    void setServerSocket(const std::string &socket);
+
+    /**
+     * @brief Returns the socket on which the job server listens
+     *
+     * @return the path of the socket, an empty string if the program doesn't run as job server
+     */
+    std::string getServerSocket() const;
+
+    /**
+     * @brief Sets the socket of the job server to which the commands should be sent
+     *
+     * @param[in] socket the path of the Unix domain socket, an empty string if the commands
+     *            should be executed locally
+     * @see JobClient
+     */
+    void setConnectSocket(const std::string &socket);
+
+    /**
+     * @brief Returns the socket of the job server to which the commands should be sent
+     *
+     * @return the path of the socket, an empty string if the commands are executed locally
+     */
+    std::string getConnectSocket() const;
+
+    /**
+     * @brief Sets the script whose commands should be executed
+     *
+     * @param[in] fileName the name of the script, <tt>"-"</tt> for the standard input or an
+     *            empty string if the commands are taken from the command line or the terminal
+     * @see Shell::runScript()
+     */
+    void setScriptFile(const std::string &fileName);
+
+    /**
+     * @brief Returns the script whose commands should be executed
+     *
+     * @return the name of the script, an empty string by default
+     */
+    std::string getScriptFile() const;
+
+    /**
+     * @brief Sets the number of concurrent uploads per USB host controller
+     *
+     * @param[in] jobs the number of uploads of <tt>upload -all</tt> that run at the same time
+     *            on one host controller
+     * @see core::FlashScheduler::setMaxJobsPerController()
+     */
+    void setControllerJobs(size_t jobs);
+
+    /**
+     * @brief Returns the number of concurrent uploads per USB host controller
+     *
+     * @return the number of uploads, 4 by default
+     */
+    size_t getControllerJobs() const;
+
+    /**
+     * @brief Sets the bandwidth limit per USB host controller
+     *
+     * @param[in] bytesPerSecond the bandwidth of all uploads of <tt>upload -all</tt> on one
+     *            host controller, 0 for no limit
+     * @see core::FlashScheduler::setBandwidthPerController()
+     */
+    void setControllerBandwidth(unsigned long bytesPerSecond);
+
+    /**
+     * @brief Returns the bandwidth limit per USB host controller
+     *
+     * @return the bandwidth in bytes per second, 0 (no limit) by default
+     */
+    unsigned long getControllerBandwidth() const;
+
+    /**
+     * @brief Sets the file to which the trace of the run should be written
+     *
+     * @param[in] fileName the name of the file in the Chrome trace event format, an empty
+     *            string if no trace should be written
+     * @see core::Tracer
+     */
+    void setTraceFile(const std::string &fileName);
+
+    /**
+     * @brief Returns the file to which the trace of the run should be written
+     *
+     * @return the file name, an empty string by default
+     */
+    std::string getTraceFile() const;
+
+    /**
+     * @brief Sets if the commands print JSON records instead of text
+     *
+     * @param[in] json @c true for one JSON object per line, @c false for text
+     * @see core::JsonWriter
+     */
+    void setJsonOutput(bool json);
+
+    /**
+     * @brief Checks if the commands print JSON records instead of text
+     *
+     * @return @c true for JSON, @c false (the default) for text
+     */
+    bool getJsonOutput() const;
+
     /**
      * @copydoc core::Configuration::dumpConfig()
      */
@@ -102,6 +213,13 @@ private:
     static CliConfiguration *m_instance;
     bool m_batchMode;
     std::string m_historyFile;
+    std::string m_serverSocket;
+    std::string m_connectSocket;
+    std::string m_scriptFile;
+    size_t m_controllerJobs;
+    unsigned long m_controllerBandwidth;
+    std::string m_traceFile;
+    bool m_jsonOutput;
 };
 
 /* }}} */
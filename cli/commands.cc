@@ -24,13 +24,21 @@
 
 #include <usbprog-core/stringutil.h>
 #include <usbprog-core/util.h>
+#include <usbprog-core/firmwareimage.h>
+#include <usbprog-core/flashscheduler.h>
+#include <usbprog-core/progressreporter.h>
+#include <usbprog-core/jsonwriter.h>
 #include <usbprog/firmwarepool.h>
+#include <usbprog/flashplan.h>
 
 #include "commands.h"
 #include "cliconfiguration.h"
 #include "usbprog.h"
 #include "config.h"
 
+// number of decoded images that UploadCommand keeps in memory
+#define MAX_CACHED_IMAGES   16
+
 namespace usbprog {
 namespace cli {
 
@@ -38,19 +46,49 @@ namespace cli {
 
 core::StringVector complete_firmware(const std::string &start, Firmwarepool *pool)
 {
-    core::StringVector result;
-    StringList firmwarelist = pool->getFirmwareNameList();
-
-    for (StringList::const_iterator it = firmwarelist.begin();
-            it != firmwarelist.end(); ++it) {
-        std::string fwname = *it;
-        if (core::str_starts_with(fwname, start))
-            result.push_back(fwname);
-    }
+    return pool->getFirmwareNameIndex().complete(start);
+}
 
-    return result;
+// formats a USB ID like the "devices" command
+static std::string format_id(uint16_t id)
+{
+    std::stringstream ss;
+    ss << std::setw(4) << std::setfill('0') << std::hex << id;
+    return ss.str();
 }
 
+// switches the devices at the locations to update mode, the numbers change with each switch,
+// the locations don't
+static void switch_update_mode(core::DeviceManager                  *deviceManager,
+                               const core::StringVector             &locations,
+                               std::map<std::string, std::string>   &errors,
+                               std::ostream                         &os)
+{
+    for (core::StringVector::const_iterator it = locations.begin(); it != locations.end(); ++it) {
+        int number = deviceManager->getDeviceNumber(*it);
+        if (number < 0 || deviceManager->getDevice(number)->isUpdateMode())
+            continue;
+
+        bool json = CliConfiguration::config().getJsonOutput();
+        try {
+            if (json)
+                core::JsonWriter(os).begin("switch").add("location", *it).end();
+            else
+                os << "Switching " << *it << " to update mode ..." << std::endl;
+            deviceManager->setCurrentUpdateDevice(number);
+            deviceManager->switchUpdateMode();
+        } catch (const core::IOError &err) {
+            errors[*it] = std::string("I/O Error: ") + err.what();
+            if (json)
+                core::JsonWriter(os).begin("error")
+                                    .add("location", *it)
+                                    .add("text", errors[*it])
+                                    .end();
+            else
+                os << "  " << *it << ": " << errors[*it] << std::endl;
+        }
+    }
+}
 
 /* }}} */
 /* ListCommand {{{ */
@@ -65,6 +103,19 @@ bool ListCommand::execute(CommandArgVector   args,
 {
     StringList firmwarelist = m_firmwarepool->getFirmwareNameList();
 
+    if (CliConfiguration::config().getJsonOutput()) {
+        core::JsonWriter json(os);
+        for (StringList::const_iterator it = firmwarelist.begin(); it != firmwarelist.end(); ++it) {
+            Firmware *fw = m_firmwarepool->getFirmware(*it);
+            json.begin("firmware")
+                .add("name", fw->getName())
+                .add("label", fw->getLabel())
+                .add("downloaded", m_firmwarepool->isFirmwareOnDisk(fw->getName()))
+                .end();
+        }
+        return true;
+    }
+
     size_t maxSize = 0;
     for (StringList::const_iterator it = firmwarelist.begin();
             it != firmwarelist.end(); ++it)
@@ -111,6 +162,12 @@ void ListCommand::printLongHelp(std::ostream &os) const
        << std::endl;
 }
 
+unsigned int ListCommand::getDependencies(CommandArgVector   args,
+                                          core::StringVector options) const
+{
+    return DEP_FIRMWAREPOOL;
+}
+
 /* }}} */
 /* InfoCommand {{{ */
 
@@ -127,6 +184,23 @@ bool InfoCommand::execute(CommandArgVector   args,
     if (!fw)
         throw core::ApplicationError(fwstr + ": Invalid firmware specified.");
 
+    if (CliConfiguration::config().getJsonOutput()) {
+        core::JsonWriter json(os);
+        json.begin("firmware_info")
+            .add("name", fw->getName())
+            .add("label", fw->getLabel())
+            .add("url", fw->getUrl())
+            .add("file", fw->getFilename())
+            .add("author", fw->getAuthor())
+            .add("version", fw->formatDateVersion());
+        if (fw->getMD5Sum().size() > 0)
+            json.add("md5", fw->getMD5Sum());
+        if (fw->updateDevice().isValid())
+            json.add("device_id", fw->updateDevice().formatDeviceId());
+        json.add("description", fw->getDescription()).end();
+        return true;
+    }
+
     os << "Identifier   : " << fw->getName() << std::endl;
     os << "Name         : " << fw->getLabel() << std::endl;
     os << "URL          : " << fw->getUrl() << std::endl;
@@ -211,6 +285,12 @@ void InfoCommand::printLongHelp(std::ostream &os) const
        << std::endl;
 }
 
+unsigned int InfoCommand::getDependencies(CommandArgVector   args,
+                                          core::StringVector options) const
+{
+    return DEP_FIRMWAREPOOL;
+}
+
 /* }}} */
 /* PinCommand {{{ */
 
@@ -227,6 +307,18 @@ bool PinCommand::execute(CommandArgVector   args,
     if (!fw)
         throw core::ApplicationError(fwstr + ": Invalid firmware specified.");
 
+    if (CliConfiguration::config().getJsonOutput()) {
+        core::JsonWriter json(os);
+        core::StringVector pins = fw->getPins();
+        for (core::StringVector::const_iterator it = pins.begin(); it != pins.end(); ++it)
+            json.begin("pin")
+                .add("firmware", fw->getName())
+                .add("pin", *it)
+                .add("function", fw->getPin(*it))
+                .end();
+        return true;
+    }
+
     if (!CliConfiguration::config().getBatchMode()) {
         os << "            +----------------+" << std::endl;
         os << "            |  9  7  5  3  1 |" << std::endl;
@@ -329,6 +421,12 @@ void PinCommand::printLongHelp(std::ostream &os) const
        << std::endl;
 }
 
+unsigned int PinCommand::getDependencies(CommandArgVector   args,
+                                         core::StringVector options) const
+{
+    return DEP_FIRMWAREPOOL;
+}
+
 /* }}} */
 /* DownloadCommand {{{ */
 
@@ -339,20 +437,40 @@ DownloadCommand::DownloadCommand(Firmwarepool *firmwarepool)
 bool DownloadCommand::downloadAll(std::ostream &os)
 {
     std::vector<Firmware *> firmwares = m_firmwarepool->getFirmwareList();
+    bool json = CliConfiguration::config().getJsonOutput();
 
     for (std::vector<Firmware *>::const_iterator it = firmwares.begin();
             it != firmwares.end(); ++it) {
         try {
-            if (m_firmwarepool->isFirmwareOnDisk((*it)->getName()))
-                os << "Firmware " << (*it)->getLabel() << " is already there."
-                   << std::endl;
-            else {
-                os << "Downloading " << (*it)->getLabel() << " ..." << std::endl;
+            if (m_firmwarepool->isFirmwareOnDisk((*it)->getName())) {
+                if (json)
+                    core::JsonWriter(os).begin("download")
+                                        .add("firmware", (*it)->getName())
+                                        .add("result", "cached")
+                                        .end();
+                else
+                    os << "Firmware " << (*it)->getLabel() << " is already there."
+                       << std::endl;
+            } else {
+                if (!json)
+                    os << "Downloading " << (*it)->getLabel() << " ..." << std::endl;
                 m_firmwarepool->downloadFirmware((*it)->getName());
+                if (json)
+                    core::JsonWriter(os).begin("download")
+                                        .add("firmware", (*it)->getName())
+                                        .add("result", "ok")
+                                        .end();
             }
         } catch (const std::exception &ex) {
-            os << "Error while downloading firmware " + (*it)->getName() +
-                ": " + ex.what() << std::endl;
+            if (json)
+                core::JsonWriter(os).begin("download")
+                                    .add("firmware", (*it)->getName())
+                                    .add("result", "failed")
+                                    .add("error", ex.what())
+                                    .end();
+            else
+                os << "Error while downloading firmware " + (*it)->getName() +
+                    ": " + ex.what() << std::endl;
         }
     }
 
@@ -365,8 +483,7 @@ bool DownloadCommand::execute(CommandArgVector   args,
 {
     std::string fwstr = args[0]->getString();
     if (CliConfiguration::config().isOffline()) {
-        os << "Software is in offline mode. Downloading is not possbile."
-           << std::endl;
+        print_message(os, "Software is in offline mode. Downloading is not possbile.");
         return true;
     }
 
@@ -377,12 +494,26 @@ bool DownloadCommand::execute(CommandArgVector   args,
     if (!fw)
         throw core::ApplicationError(fwstr + ": Invalid firmware specified.");
 
+    bool json = CliConfiguration::config().getJsonOutput();
     try {
         m_firmwarepool->downloadFirmware(fwstr);
-        os << "Firmware " + fw->getName() + " has been downloaded successfully."
-           << std::endl;
+        if (json)
+            core::JsonWriter(os).begin("download")
+                                .add("firmware", fw->getName())
+                                .add("result", "ok")
+                                .end();
+        else
+            os << "Firmware " + fw->getName() + " has been downloaded successfully."
+               << std::endl;
     } catch (const std::exception &ex) {
-        os << "Error while downloading firmware: " << ex.what() << std::endl;
+        if (json)
+            core::JsonWriter(os).begin("download")
+                                .add("firmware", fw->getName())
+                                .add("result", "failed")
+                                .add("error", ex.what())
+                                .end();
+        else
+            os << "Error while downloading firmware: " << ex.what() << std::endl;
     }
 
     return true;
@@ -444,6 +575,12 @@ void DownloadCommand::printLongHelp(std::ostream &os) const
        << std::endl;
 }
 
+unsigned int DownloadCommand::getDependencies(CommandArgVector   args,
+                                              core::StringVector options) const
+{
+    return DEP_FIRMWAREPOOL;
+}
+
 /* }}} */
 /* CacheCommand {{{ */
 
@@ -524,6 +661,13 @@ void CacheCommand::printLongHelp(std::ostream &os) const
        << std::endl;
 }
 
+unsigned int CacheCommand::getDependencies(CommandArgVector   args,
+                                           core::StringVector options) const
+{
+    // deleting the cache doesn't need to know the firmwares
+    return args[0]->getString() == "delete" ? DEP_NONE : DEP_FIRMWAREPOOL;
+}
+
 /* }}} */
 /* DevicesCommand {{{ */
 
@@ -544,10 +688,43 @@ bool DevicesCommand::execute(CommandArgVector   args,
         throw core::ApplicationError(std::string(err.what()));
     }
 
+    bool verbose = find(options.begin(), options.end(), "-verbose") != options.end();
+
+    if (CliConfiguration::config().getJsonOutput()) {
+        if (verbose)
+            m_deviceManager->probeDeviceStrings();
+
+        core::JsonWriter json(os);
+        core::Device *current = m_deviceManager->getCurrentUpdateDevice();
+        for (size_t i = 0; i < m_deviceManager->getNumberUpdateDevices(); i++) {
+            core::Device *dev = m_deviceManager->getDevice(i);
+            json.begin("device")
+                .add("number", i)
+                .add("bus", dev->getBusNumber())
+                .add("device", dev->getDeviceNumber())
+                .add("vendor", format_id(dev->getVendor()))
+                .add("product", format_id(dev->getProduct()))
+                .add("name", dev->getName())
+                .add("short_name", dev->getShortName())
+                .add("location", dev->getLocation())
+                .add("update_mode", dev->isUpdateMode())
+                .add("current", current == dev);
+            if (verbose)
+                json.add("manufacturer", dev->getManufacturer())
+                    .add("product_name", dev->getProductName())
+                    .add("serial", dev->getSerialNumber());
+            json.end();
+        }
+        return true;
+    }
+
     if (m_deviceManager->getNumberUpdateDevices() == 0)
         os << "No devices found." << std::endl;
-    else
-        m_deviceManager->printDevices(os);
+    else {
+        if (verbose)
+            m_deviceManager->probeDeviceStrings();
+        m_deviceManager->printDevices(os, true, verbose);
+    }
 
     if (!CliConfiguration::config().getBatchMode() &&
             m_deviceManager->getNumberUpdateDevices() > 1)
@@ -564,12 +741,40 @@ std::string DevicesCommand::help() const
 
 void DevicesCommand::printLongHelp(std::ostream &os) const
 {
-    os << "Name:            devices\n\n"
+    os << "Name:            devices\n"
+       << "Option:          -verbose\n\n"
        << "Description:\n"
-       << "Lists all available update devices."
+       << "Lists all available update devices. With -verbose, the port and the\n"
+       << "manufacturer, product and serial number of each device are printed, too.\n"
+       << "That requires opening each device, which is done in parallel."
        << std::endl;
 }
 
+unsigned int DevicesCommand::getDependencies(CommandArgVector   args,
+                                             core::StringVector options) const
+{
+    // devices that run a firmware are only recognized with the index
+    return DEP_FIRMWAREPOOL;
+}
+
+core::StringVector DevicesCommand::getSupportedOptions() const
+{
+    core::StringVector sv;
+    sv.push_back("-verbose");
+    return sv;
+}
+
+core::StringVector DevicesCommand::getCompletions(const std::string &start,
+                                                  size_t            pos,
+                                                  bool              option,
+                                                  bool              *filecompletion) const
+{
+    core::StringVector ret;
+    if (option && pos == 0 && core::str_starts_with("-verbose", start))
+        ret.push_back("-verbose");
+    return ret;
+}
+
 /* }}} */
 /* DeviceCommand {{{ */
 
@@ -587,8 +792,7 @@ bool DeviceCommand::execute(CommandArgVector   args,
     std::string device = args[0]->getString();
 
     try {
-        if (m_deviceManager->getNumberUpdateDevices() == 0)
-            m_deviceManager->discoverUpdateDevices(m_firmwarepool->getUpdateDeviceList());
+        m_deviceManager->refreshUpdateDevices(m_firmwarepool->getUpdateDeviceList());
     } catch (const core::IOError &err) {
         throw core::ApplicationError(std::string(err.what()));
     }
@@ -622,6 +826,10 @@ bool DeviceCommand::execute(CommandArgVector   args,
             }
         }
 
+        // the port like "1-1.3", which stays the same when the device gets re-plugged
+        if (updatedevice == -1)
+            updatedevice = m_deviceManager->getDeviceNumber(device);
+
         if (updatedevice == -1)
             throw core::ApplicationError("Invalid update device name specified.");
     }
@@ -678,23 +886,32 @@ std::string DeviceCommand::help() const
 void DeviceCommand::printLongHelp(std::ostream &os) const
 {
     os << "Name:            cache\n"
-       << "Argument:        device number|device name\n\n"
+       << "Argument:        device number|device name|port\n\n"
        << "Description:\n"
        << "Sets the update device for the \"upload\" command. You have to use\n"
        << "an integer number which you can obtain with the \"devices\" command.\n"
        << "Alternatively, you can also use the short device name in the 2nd line\n"
-       << "of the output of the \"devices\" command\n"
+       << "of the output of the \"devices\" command or the port that is printed\n"
+       << "by \"devices -verbose\"\n"
        << std::endl;
 }
 
+unsigned int DeviceCommand::getDependencies(CommandArgVector   args,
+                                            core::StringVector options) const
+{
+    return DEP_FIRMWAREPOOL;
+}
+
 /* }}} */
 /* UploadCommand {{{ */
 
-UploadCommand::UploadCommand(core::DeviceManager *deviceManager,
-                             Firmwarepool        *firmwarepool)
+UploadCommand::UploadCommand(core::DeviceManager   *deviceManager,
+                             Firmwarepool          *firmwarepool,
+                             DependencyResolver    *resolver)
     : AbstractCommand("upload")
     , m_deviceManager(deviceManager)
     , m_firmwarepool(firmwarepool)
+    , m_resolver(resolver)
 {}
 
 bool UploadCommand::execute(CommandArgVector   args,
@@ -702,50 +919,45 @@ bool UploadCommand::execute(CommandArgVector   args,
                             std::ostream       &os)
 {
     std::string firmware = args[0]->getString();
+    CliConfiguration &conf = CliConfiguration::config();
     HashNotifier hn(DEFAULT_TERMINAL_WIDTH);
+    core::ProgressReporter reporter(&hn);
+    JsonProgressNotifier jsonProgress(os);
+    core::ProgressReporter jsonReporter(&jsonProgress);
+    jsonReporter.setReportAll(true);
 
     try {
-        if (m_deviceManager->getNumberUpdateDevices() == 0)
-            m_deviceManager->discoverUpdateDevices();
+        m_deviceManager->refreshUpdateDevices(m_firmwarepool->getUpdateDeviceList());
     } catch (const core::IOError &err) {
         throw core::ApplicationError(std::string(err.what()));
     }
 
-    core::ByteVector data;
-
-    if (core::Fileutil::isPathName(firmware)) {
-        /* read from file */
-
+    if (core::Fileutil::isPathName(firmware))
         firmware = core::Fileutil::resolvePath(firmware);
-        try {
-            data = core::Fileutil::readBytesFromFile(firmware);
-        } catch (const core::IOError &ioe) {
-            throw core::ApplicationError(std::string("Error while reading data from file: ")+ioe.what());
-        }
-    } else {
-        /* use pool */
+    core::FirmwareImage image = getImage(firmware);
 
-        Firmware *fw = m_firmwarepool->getFirmware(firmware);
-        if (!fw)
-            throw core::ApplicationError(firmware+": Invalid firmware specified.");
+    if (find(options.begin(), options.end(), "-all") != options.end())
+        return uploadAll(image, options, os);
 
+    // A device that runs a firmware is only recognized with the index, which getDependencies()
+    // doesn't request for a local file. The list of the pool is empty until it's read.
+    core::Device *dev = m_deviceManager->getCurrentUpdateDevice();
+    if ((!dev || !dev->isUpdateMode()) && m_resolver) {
+        m_resolver->resolve(DEP_FIRMWAREPOOL);
         try {
-            m_firmwarepool->fillFirmware(firmware);
+            m_deviceManager->refreshUpdateDevices(m_firmwarepool->getUpdateDeviceList());
         } catch (const core::IOError &err) {
-            throw core::ApplicationError(std::string("I/O Error: ") + err.what());
+            throw core::ApplicationError(std::string(err.what()));
         }
-
-        data = fw->getData();
+        dev = m_deviceManager->getCurrentUpdateDevice();
     }
-
-    core::Device *dev = m_deviceManager->getCurrentUpdateDevice();
     if (!dev)
         throw core::ApplicationError("Unable to find update device.");
 
     // switch in update mode
     if (!dev->isUpdateMode()) {
         try {
-            os << "Switching to update mode ..." << std::endl;
+            print_message(os, "Switching to update mode ...");
             m_deviceManager->switchUpdateMode();
         } catch (const core::IOError &err) {
             throw core::ApplicationError(std::string("I/O Error: ") + err.what());
@@ -756,17 +968,22 @@ bool UploadCommand::execute(CommandArgVector   args,
     if (!dev)
         throw core::ApplicationError("Unable to find update device (2).");
     core::UsbprogUpdater updater(dev);
+    updater.setTransferPolicy(m_deviceManager->getTransferPolicy());
 
-    if (!CliConfiguration::config().getBatchMode() && !CliConfiguration::config().getDebug())
-        updater.setProgress(&hn);
+    // JSON readers get each page, the terminal only gets the sampled progress
+    if (conf.getJsonOutput() && !conf.getDebug())
+        updater.setProgress(&jsonReporter);
+    else if (!conf.getBatchMode() && !conf.getDebug())
+        updater.setProgress(&reporter);
 
     try {
-        os << "Opening device ..." << std::endl;
+        print_message(os, "Opening device ...");
         updater.updateOpen();
-        os << "Writing firmware ..." << std::endl;
-        updater.writeFirmware(data);
-        if (options.size() == 0) {
-            os << "Starting device ..." << std::endl;
+        print_message(os, "Writing firmware ...");
+        updater.setSkipErasedPages(find(options.begin(), options.end(), "-skiperased") != options.end());
+        updater.writeFirmware(image);
+        if (find(options.begin(), options.end(), "-nostart") == options.end()) {
+            print_message(os, "Starting device ...");
             updater.startDevice();
         }
         updater.updateClose();
@@ -774,10 +991,10 @@ bool UploadCommand::execute(CommandArgVector   args,
         throw core::ApplicationError(std::string("I/O Error: ") + err.what());
     }
 
-    os << "Detecting new USB devices ..." << std::endl;
+    print_message(os, "Detecting new USB devices ...");
     core::usbprog_sleep(2);
     try {
-        m_deviceManager->discoverUpdateDevices();
+        m_deviceManager->discoverUpdateDevices(m_firmwarepool->getUpdateDeviceList());
     } catch (const core::IOError &err) {
         throw core::ApplicationError(std::string(err.what()));
     }
@@ -818,6 +1035,10 @@ core::StringVector UploadCommand::getCompletions(const std::string &start,
         core::StringVector ret;
         if (core::str_starts_with("-nostart", start))
             ret.push_back("-nostart");
+        if (core::str_starts_with("-skiperased", start))
+            ret.push_back("-skiperased");
+        if (core::str_starts_with("-all", start))
+            ret.push_back("-all");
         return ret;
     } else {
         if (start.size() > 0 && core::Fileutil::isPathName(start)) {
@@ -838,24 +1059,428 @@ std::string UploadCommand::help() const
 void UploadCommand::printLongHelp(std::ostream &os) const
 {
     os << "Name:            upload\n"
-       << "Option:          -nostart\n"
+       << "Option:          -nostart, -skiperased, -all\n"
        << "Argument:        firmware|filename\n\n"
        << "Description:\n"
        << "Uploads a new firmware. The firmware identifier can be found with\n"
        << "the \"list\" command. Alternatively, you can just specify a filename.\n"
+       << "Files can be raw binaries, Intel HEX, Motorola S-record or ELF files;\n"
+       << "only the flash pages that contain data are written.\n"
+       << "With -skiperased, pages that only contain 0xff are not written either.\n"
+       << "That's only done if the bootloader of the device erases the whole\n"
+       << "chip before writing, otherwise the option is ignored.\n"
        << "If you have more than one USBprog device connected, use the \"devices\"\n"
        << "command to obtain a list of available update devices and select one\n"
-       << "with the \"device\" command."
+       << "with the \"device\" command.\n"
+       << "With -all, the firmware is written to all update devices at the same\n"
+       << "time. The number of concurrent uploads and the bandwidth per USB host\n"
+       << "controller are limited by the --controller-jobs and\n"
+       << "--controller-bandwidth command line options."
        << std::endl;
 }
 
+unsigned int UploadCommand::getDependencies(CommandArgVector   args,
+                                            core::StringVector options) const
+{
+    // Switching all devices in firmware mode to update mode needs the index. A local file
+    // can be flashed without it if the device already runs the bootloader, execute() reads
+    // the index otherwise.
+    if (!core::Fileutil::isPathName(args[0]->getString()) ||
+            find(options.begin(), options.end(), "-all") != options.end())
+        return DEP_FIRMWAREPOOL;
+
+    return DEP_NONE;
+}
+
+bool UploadCommand::isFileArgument(size_t pos) const
+{
+    // the firmware may also be the name of a firmware of the pool, see isPathName()
+    return pos == 0;
+}
+
+bool UploadCommand::uploadAll(const core::FirmwareImage    &image,
+                              const core::StringVector     &options,
+                              std::ostream                 &os)
+{
+    CliConfiguration &conf = CliConfiguration::config();
+    std::string current;
+    core::StringVector locations;
+
+    try {
+        m_deviceManager->refreshUpdateDevices(m_firmwarepool->getUpdateDeviceList());
+        if (m_deviceManager->getCurrentUpdateDevice())
+            current = m_deviceManager->getCurrentUpdateDevice()->getLocation();
+        for (size_t i = 0; i < m_deviceManager->getNumberUpdateDevices(); i++)
+            locations.push_back(m_deviceManager->getDevice(i)->getLocation());
+    } catch (const core::IOError &err) {
+        throw core::ApplicationError(std::string(err.what()));
+    }
+
+    if (locations.empty())
+        throw core::ApplicationError("No update devices found.");
+
+    std::map<std::string, std::string> errors;
+    switch_update_mode(m_deviceManager, locations, errors, os);
+    size_t failed = errors.size();
+
+    core::FlashScheduler scheduler;
+    scheduler.setMaxJobsPerController(conf.getControllerJobs());
+    scheduler.setBandwidthPerController(conf.getControllerBandwidth());
+    scheduler.setSkipErasedPages(find(options.begin(), options.end(), "-skiperased") != options.end());
+    scheduler.setStartDevices(find(options.begin(), options.end(), "-nostart") == options.end());
+    scheduler.setTransferPolicy(m_deviceManager->getTransferPolicy());
+
+    for (core::StringVector::const_iterator it = locations.begin(); it != locations.end(); ++it) {
+        core::Device *dev = m_deviceManager->getDeviceByLocation(*it);
+        if (dev && dev->isUpdateMode())
+            scheduler.addJob(dev, &image);
+    }
+
+    if (scheduler.getNumberOfJobs() == 0)
+        throw core::ApplicationError("No update devices found.");
+
+    std::stringstream ss;
+    ss << "Writing firmware to " << scheduler.getNumberOfJobs() << " devices ...";
+    print_message(os, ss.str());
+    scheduler.run();
+    for (size_t i = 0; i < scheduler.getNumberOfJobs(); i++) {
+        std::string error = scheduler.getError(i);
+        if (conf.getJsonOutput()) {
+            core::JsonWriter json(os);
+            json.begin("upload")
+                .add("location", scheduler.getDevice(i)->getLocation())
+                .add("ok", error.empty())
+                .add("ms", scheduler.getDuration(i));
+            if (!error.empty())
+                json.add("error", error);
+            json.end();
+        } else
+            os << "  " << scheduler.getDevice(i)->getLocation() << ": "
+               << (error.empty() ? "OK" : error) << std::endl;
+        if (!error.empty())
+            failed++;
+    }
+
+    print_message(os, "Detecting new USB devices ...");
+    core::usbprog_sleep(2);
+    try {
+        m_deviceManager->discoverUpdateDevices(m_firmwarepool->getUpdateDeviceList());
+        int number = current.empty() ? -1 : m_deviceManager->getDeviceNumber(current);
+        if (number >= 0)
+            m_deviceManager->setCurrentUpdateDevice(number);
+        else
+            m_deviceManager->clearCurrentUpdateDevice();
+    } catch (const core::IOError &err) {
+        throw core::ApplicationError(std::string(err.what()));
+    }
+
+    if (failed > 0) {
+        std::stringstream ss;
+        ss << failed << " of " << locations.size() << " uploads have failed.";
+        throw core::ApplicationError(ss.str());
+    }
+
+    return true;
+}
+
+core::FirmwareImage UploadCommand::getImage(const std::string &firmware)
+{
+    // don't let a server that gets new files all the time grow without limit
+    if (m_imageCache.size() >= MAX_CACHED_IMAGES)
+        m_imageCache.clear();
+
+    ImageCache::iterator cached;
+
+    if (core::Fileutil::isPathName(firmware)) {
+        /* read from file */
+
+        try {
+            core::ByteVector data = core::Fileutil::readBytesFromFile(firmware);
+            cached = m_imageCache.find(firmware);
+            if (cached != m_imageCache.end() && cached->second.data == data)
+                return cached->second.image;
+
+            CachedImage &entry = m_imageCache[firmware];
+            entry.image = core::FirmwareImage::readFromFile(firmware);
+            entry.data = data;
+            return entry.image;
+        } catch (const core::IOError &ioe) {
+            m_imageCache.erase(firmware);
+            throw core::ApplicationError(std::string("Error while reading data from file: ")+ioe.what());
+        } catch (const core::ParseError &pe) {
+            m_imageCache.erase(firmware);
+            throw core::ApplicationError(std::string("Invalid firmware file: ")+pe.what());
+        }
+    } else {
+        /* use pool */
+
+        Firmware *fw = m_firmwarepool->getFirmware(firmware);
+        if (!fw)
+            throw core::ApplicationError(firmware+": Invalid firmware specified.");
+
+        // a version of a firmware never changes
+        cached = m_imageCache.find(fw->getVerFilename());
+        if (cached != m_imageCache.end())
+            return cached->second.image;
+
+        try {
+            m_firmwarepool->fillFirmware(firmware);
+        } catch (const core::IOError &err) {
+            throw core::ApplicationError(std::string("I/O Error: ") + err.what());
+        }
+
+        CachedImage &entry = m_imageCache[fw->getVerFilename()];
+        entry.image = core::FirmwareImage(fw->getData());
+        return entry.image;
+    }
+}
+
 core::StringVector UploadCommand::getSupportedOptions() const
 {
     core::StringVector sv;
     sv.push_back("-nostart");
+    sv.push_back("-skiperased");
+    sv.push_back("-all");
     return sv;
 }
 
+/* }}} */
+/* FlashPlanCommand {{{ */
+
+FlashPlanCommand::FlashPlanCommand(core::DeviceManager *deviceManager,
+                                   Firmwarepool        *firmwarepool)
+    : AbstractCommand("flash-plan")
+    , m_deviceManager(deviceManager)
+    , m_firmwarepool(firmwarepool)
+{}
+
+bool FlashPlanCommand::execute(CommandArgVector     args,
+                               core::StringVector   options,
+                               std::ostream         &os)
+{
+    CliConfiguration &conf = CliConfiguration::config();
+    bool skipErasedPages = find(options.begin(), options.end(), "-skiperased") != options.end();
+
+    FlashPlan plan(m_firmwarepool);
+    try {
+        plan.readFile(core::Fileutil::resolvePath(args[0]->getString()));
+    } catch (const core::IOError &err) {
+        throw core::ApplicationError(std::string(err.what()));
+    } catch (const core::ParseError &err) {
+        throw core::ApplicationError(std::string(err.what()));
+    }
+
+    print_message(os, "Loading firmwares ...");
+    plan.prepare(skipErasedPages);
+
+    // every error that can be detected is reported before the first device is touched
+    core::StringVector locations;
+    std::string missing;
+    try {
+        m_deviceManager->refreshUpdateDevices(m_firmwarepool->getUpdateDeviceList());
+    } catch (const core::IOError &err) {
+        throw core::ApplicationError(std::string(err.what()));
+    }
+    for (size_t i = 0; i < plan.getNumberOfEntries(); i++) {
+        locations.push_back(plan.getLocation(i));
+        if (m_deviceManager->getDeviceNumber(plan.getLocation(i)) < 0)
+            missing += "\n  " + plan.getLocation(i);
+    }
+    if (!missing.empty())
+        throw core::ApplicationError("Devices of the flash plan not found:" + missing);
+
+    // opening truncates the report of the last run, so that's the last check
+    std::ofstream reportFile;
+    if (!plan.getReportFile().empty()) {
+        reportFile.open(plan.getReportFile().c_str());
+        if (!reportFile)
+            throw core::ApplicationError("Unable to write the report " + plan.getReportFile());
+    }
+
+    std::map<std::string, std::string> errors;
+    switch_update_mode(m_deviceManager, locations, errors, os);
+
+    core::FlashScheduler scheduler;
+    scheduler.setMaxJobsPerController(conf.getControllerJobs());
+    scheduler.setBandwidthPerController(conf.getControllerBandwidth());
+    scheduler.setStartDevices(find(options.begin(), options.end(), "-nostart") == options.end());
+    scheduler.setTransferPolicy(m_deviceManager->getTransferPolicy());
+
+    // the entry of the plan for each job
+    std::vector<size_t> jobs;
+    std::vector<size_t> pages;
+    for (size_t i = 0; i < plan.getNumberOfEntries(); i++) {
+        pages.push_back(plan.getPageStream(i, false).getNumberOfPages());
+        if (errors.find(plan.getLocation(i)) != errors.end())
+            continue;
+
+        core::Device *dev = m_deviceManager->getDeviceByLocation(plan.getLocation(i));
+        if (!dev || !dev->isUpdateMode()) {
+            errors[plan.getLocation(i)] = "Device not in update mode";
+            continue;
+        }
+        const core::PageStream &stream = plan.getPageStream(i, dev->isChipEraseOnUpdate());
+        scheduler.addJob(dev, &stream);
+        jobs.push_back(i);
+        pages.back() = stream.getNumberOfPages();
+    }
+
+    if (!jobs.empty()) {
+        std::stringstream ss;
+        ss << "Writing firmware to " << jobs.size() << " devices ...";
+        print_message(os, ss.str());
+        scheduler.run();
+    }
+
+    // one line per device, separated by tabs, in JSON mode one record per device instead
+    bool json = conf.getJsonOutput();
+    bool tabs = reportFile.is_open() || !json;
+    std::ostream &report = reportFile.is_open() ? reportFile : os;
+    if (tabs)
+        report << "# location\tresult\tfirmware\tmd5\tpages\tms\tmessage" << std::endl;
+    for (size_t i = 0, job = 0; i < plan.getNumberOfEntries(); i++) {
+        std::map<std::string, std::string>::const_iterator it = errors.find(plan.getLocation(i));
+        std::string error = it != errors.end() ? it->second : std::string();
+        unsigned long duration = 0;
+
+        if (job < jobs.size() && jobs[job] == i) {
+            error = scheduler.getError(job);
+            duration = scheduler.getDuration(job);
+            job++;
+        }
+        if (!error.empty())
+            errors[plan.getLocation(i)] = error;
+
+        if (json) {
+            core::JsonWriter record(os);
+            record.begin("flash")
+                  .add("location", plan.getLocation(i))
+                  .add("ok", error.empty())
+                  .add("firmware", plan.getSource(i))
+                  .add("md5", plan.getMD5Sum(i))
+                  .add("pages", pages[i])
+                  .add("ms", duration);
+            if (!error.empty())
+                record.add("error", error);
+            record.end();
+        }
+        if (tabs)
+            report << plan.getLocation(i) << '\t'
+                   << (error.empty() ? "ok" : "failed") << '\t'
+                   << plan.getSource(i) << '\t'
+                   << plan.getMD5Sum(i) << '\t'
+                   << pages[i] << '\t'
+                   << duration << '\t'
+                   << error << std::endl;
+    }
+
+    print_message(os, "Detecting new USB devices ...");
+    core::usbprog_sleep(2);
+    try {
+        m_deviceManager->discoverUpdateDevices(m_firmwarepool->getUpdateDeviceList());
+        m_deviceManager->clearCurrentUpdateDevice();
+    } catch (const core::IOError &err) {
+        throw core::ApplicationError(std::string(err.what()));
+    }
+
+    if (!errors.empty()) {
+        std::stringstream ss;
+        ss << errors.size() << " of " << plan.getNumberOfEntries() << " devices have failed.";
+        throw core::ApplicationError(ss.str());
+    }
+
+    return true;
+}
+
+size_t FlashPlanCommand::getArgNumber() const
+{
+    return 1;
+}
+
+CommandArg::Type FlashPlanCommand::getArgType(size_t pos) const
+{
+    switch (pos) {
+        case 0:         return CommandArg::STRING;
+        default:        return CommandArg::INVALID;
+    }
+}
+
+std::string FlashPlanCommand::getArgTitle(size_t pos) const
+{
+    switch (pos) {
+        case 0:         return "plan";
+        default:        return "";
+    }
+}
+
+core::StringVector FlashPlanCommand::getSupportedOptions() const
+{
+    core::StringVector sv;
+    sv.push_back("-nostart");
+    sv.push_back("-skiperased");
+    return sv;
+}
+
+core::StringVector FlashPlanCommand::getCompletions(const std::string &start,
+                                                    size_t            pos,
+                                                    bool              option,
+                                                    bool              *filecompletion) const
+{
+    if (pos != 0)
+        return core::StringVector();
+
+    if (option) {
+        core::StringVector ret;
+        if (core::str_starts_with("-nostart", start))
+            ret.push_back("-nostart");
+        if (core::str_starts_with("-skiperased", start))
+            ret.push_back("-skiperased");
+        return ret;
+    }
+
+    if (filecompletion)
+        *filecompletion = true;
+    return core::StringVector();
+}
+
+std::string FlashPlanCommand::help() const
+{
+    return "Uploads the firmwares of a flash plan.";
+}
+
+void FlashPlanCommand::printLongHelp(std::ostream &os) const
+{
+    os << "Name:            flash-plan\n"
+       << "Option:          -nostart, -skiperased\n"
+       << "Argument:        plan\n\n"
+       << "Description:\n"
+       << "Uploads a firmware to each device of a flash plan. The plan is a text\n"
+       << "file with one section per port path (see \"devices -verbose\") that\n"
+       << "names a firmware of the pool or a file and optionally its MD5 sum:\n\n"
+       << "    report = station1.report\n\n"
+       << "    [1-1.1]\n"
+       << "    firmware = blinkdemo\n\n"
+       << "    [1-1.2]\n"
+       << "    file = test.hex\n"
+       << "    md5 = 0cc175b9c0f1b6a831c399e269772661\n\n"
+       << "All firmwares are loaded and verified and all devices must be present\n"
+       << "before the first device is touched. The result of each device is\n"
+       << "written as tab-separated line to the report file or, without report\n"
+       << "key, to the output. The options are the same as for \"upload\"."
+       << std::endl;
+}
+
+unsigned int FlashPlanCommand::getDependencies(CommandArgVector   args,
+                                               core::StringVector options) const
+{
+    return DEP_FIRMWAREPOOL;
+}
+
+bool FlashPlanCommand::isFileArgument(size_t pos) const
+{
+    return pos == 0;
+}
+
 /* }}} */
 /* StartCommand {{{ */
 
@@ -872,19 +1497,24 @@ bool StartCommand::execute(CommandArgVector     args,
     if (!dev)
         throw core::ApplicationError("Unable to find update device.");
     core::UsbprogUpdater updater(dev);
+    updater.setTransferPolicy(m_deviceManager->getTransferPolicy());
     HashNotifier hn(DEFAULT_TERMINAL_WIDTH);
+    core::ProgressReporter reporter(&hn);
 
     if (!CliConfiguration::config().getBatchMode() && !CliConfiguration::config().getDebug())
-        updater.setProgress(&hn);
+        updater.setProgress(&reporter);
 
     try {
         updater.updateOpen();
         updater.startDevice();
-        os << "Device successfully started." << std::endl;
+        print_message(os, "Device successfully started.");
     } catch (const core::IOError &err) {
         throw core::ApplicationError(std::string("I/O Error: ") + err.what());
     }
 
+    // the device re-enumerates in firmware mode
+    m_deviceManager->invalidateUpdateDevices();
+
     return true;
 }
 
@@ -917,19 +1547,23 @@ bool ResetCommand::execute(CommandArgVector     args,
     if (!dev)
         throw core::ApplicationError("Unable to find update device.");
     core::UsbprogUpdater updater(dev);
+    updater.setTransferPolicy(m_deviceManager->getTransferPolicy());
     HashNotifier hn(DEFAULT_TERMINAL_WIDTH);
+    core::ProgressReporter reporter(&hn);
 
     if (!CliConfiguration::config().getBatchMode() && !CliConfiguration::config().getDebug())
-        updater.setProgress(&hn);
+        updater.setProgress(&reporter);
 
     try {
         updater.updateOpen();
         updater.resetDevice();
-        os << "Device successfully reset." << std::endl;
+        print_message(os, "Device successfully reset.");
     } catch (const core::IOError &err) {
         throw core::ApplicationError(std::string("I/O Error: ") + err.what());
     }
 
+    m_deviceManager->invalidateUpdateDevices();
+
     return true;
 }
 
@@ -958,9 +1592,10 @@ bool CopyingCommand::execute(CommandArgVector   args,
                              core::StringVector options,
                              std::ostream       &os)
 {
-    os << "USBprog " << USBPROG_VERSION_STRING << std::endl;
-    os << "Copyright (c) 2007, 2008 Bernhard Walle <bernhard@bwalle.de>\n\n";
-    os << "This program is free software: you can redistribute it and/or modify\n"
+    std::stringstream ss;
+    ss << "USBprog " << USBPROG_VERSION_STRING << std::endl;
+    ss << "Copyright (c) 2007, 2008 Bernhard Walle <bernhard@bwalle.de>\n\n";
+    ss << "This program is free software: you can redistribute it and/or modify\n"
        << "it under the terms of the GNU General Public License as published by\n"
        << "the Free Software Foundation, either version 2 of the License, or\n"
        << "(at your option) any later version.\n\n"
@@ -969,7 +1604,8 @@ bool CopyingCommand::execute(CommandArgVector   args,
        << "MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the\n"
        << "GNU General Public License for more details.\n\n"
        << "You should have received a copy of the GNU General Public License\n"
-       << "along with this program. If not, see <http://www.gnu.org/licenses/>.\n";
+       << "along with this program. If not, see <http://www.gnu.org/licenses/>.";
+    print_message(os, ss.str(), "text");
 
    return true;
 }
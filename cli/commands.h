@@ -31,6 +31,8 @@
 #define COMMANDS_H
 
 #include <string>
+#include <map>
+#include <usbprog-core/firmwareimage.h>
 #include <usbprog/firmwarepool.h>
 #include <usbprog/usbprog.h>
 
@@ -73,6 +75,10 @@ public:
     /// @copydoc Command::help()
     std::string help() const;
 
+    /// @copydoc Command::getDependencies()
+    unsigned int getDependencies(CommandArgVector   args,
+                                 core::StringVector options) const;
+
     /// @copydoc Command::printLongHelp()
     void printLongHelp(std::ostream &os) const;
 
@@ -130,6 +136,10 @@ public:
     /// @copydoc Command::help()
     std::string help() const;
 
+    /// @copydoc Command::getDependencies()
+    unsigned int getDependencies(CommandArgVector   args,
+                                 core::StringVector options) const;
+
     /// @copydoc Command::printLongHelp()
     void printLongHelp(std::ostream &os) const;
 
@@ -182,6 +192,10 @@ public:
     /// @copydoc Command::help()
     std::string help() const;
 
+    /// @copydoc Command::getDependencies()
+    unsigned int getDependencies(CommandArgVector   args,
+                                 core::StringVector options) const;
+
     /// @copydoc Command::printLongHelp()
     void printLongHelp(std::ostream &os) const;
 
@@ -239,6 +253,10 @@ public:
     /// @copydoc Command::help()
     std::string help() const;
 
+    /// @copydoc Command::getDependencies()
+    unsigned int getDependencies(CommandArgVector   args,
+                                 core::StringVector options) const;
+
     /// @copydoc Command::printLongHelp()
     void printLongHelp(std::ostream &os) const;
 
@@ -303,6 +321,10 @@ public:
     /// @copydoc Command::help()
     std::string help() const;
 
+    /// @copydoc Command::getDependencies()
+    unsigned int getDependencies(CommandArgVector   args,
+                                 core::StringVector options) const;
+
     /// @copydoc Command::printLongHelp()
     void printLongHelp(std::ostream &os) const;
 
@@ -323,7 +345,8 @@ private:
  * @class DevicesCommand cli/commands.h
  * @brief Implements the <tt>"devices"</tt> command.
  *
- * Lists all available devices.
+ * Lists all available devices. With the <tt>-verbose</tt> option, the port and the
+ * manufacturer, product and serial number strings of each device are printed, too.
  *
  * @author Bernhard Walle <bernhard@bwalle.de>
  * @ingroup cli
@@ -344,12 +367,25 @@ public:
                  core::StringVector     options,
                  std::ostream           &os);
 
+    /// @copydoc Command::getSupportedOptions()
+    core::StringVector getSupportedOptions() const;
+
     /// @copydoc Command::help()
     std::string help() const;
 
+    /// @copydoc Command::getDependencies()
+    unsigned int getDependencies(CommandArgVector   args,
+                                 core::StringVector options) const;
+
     /// @copydoc Command::printLongHelp()
     void printLongHelp(std::ostream &os) const;
 
+    /// @copydoc Command::getCompletions()
+    std::vector<std::string> getCompletions(const std::string   &start,
+                                            size_t              pos,
+                                            bool                option,
+                                            bool                *filecompletion) const;
+
 private:
     core::DeviceManager *m_deviceManager;
     Firmwarepool        *m_firmwarepool;
@@ -397,6 +433,10 @@ public:
     /// @copydoc Command::help()
     std::string help() const;
 
+    /// @copydoc Command::getDependencies()
+    unsigned int getDependencies(CommandArgVector   args,
+                                 core::StringVector options) const;
+
     /// @copydoc Command::printLongHelp()
     void printLongHelp(std::ostream &os) const;
 
@@ -432,8 +472,119 @@ public:
      *
      * @param[in] deviceManager the device manager (that is still owned by the caller)
      * @param[in] firmwarepool the firmware pool (that is still owned by the caller)
+     * @param[in] resolver reads the firmware index if a local file is uploaded to a device
+     *            that runs a firmware, may be @c NULL (still owned by the caller)
+     */
+    UploadCommand(core::DeviceManager   *deviceManager,
+                  Firmwarepool          *firmwarepool,
+                  DependencyResolver    *resolver = NULL);
+
+public:
+    /// @copydoc Command::execute()
+    bool execute(CommandArgVector   args,
+                 core::StringVector options,
+                 std::ostream       &os);
+
+    /// @copydoc Command::getArgNumber()
+    size_t getArgNumber() const;
+
+    /// @copydoc Command::getArgType()
+    CommandArg::Type getArgType(size_t pos) const;
+
+    /// @copydoc Command::getArgTitle()
+    std::string getArgTitle(size_t pos) const;
+
+    /// @copydoc Command::getSupportedOptions()
+    core::StringVector getSupportedOptions() const;
+
+    /// @copydoc Command::help()
+    std::string help() const;
+
+    /// @copydoc Command::getDependencies()
+    unsigned int getDependencies(CommandArgVector   args,
+                                 core::StringVector options) const;
+
+    /// @copydoc Command::isFileArgument()
+    bool isFileArgument(size_t pos) const;
+
+    /// @copydoc Command::printLongHelp()
+    void printLongHelp(std::ostream &os) const;
+
+    /// @copydoc Command::getCompletions()
+    std::vector<std::string> getCompletions(const std::string   &start,
+                                            size_t              pos,
+                                            bool                option,
+                                            bool                *filecompletion) const;
+
+protected:
+    /**
+     * @brief Returns the decoded image of @p firmware
+     *
+     * The decoded images are kept in memory, which saves the decoding when the same firmware
+     * is uploaded again by a long-running JobServer. Files are still read each time to
+     * detect changes.
+     *
+     * @param[in] firmware the name of a firmware of the pool or a resolved file name
+     * @return the image
+     * @exception core::ApplicationError if the firmware cannot be read or decoded
+     */
+    core::FirmwareImage getImage(const std::string &firmware);
+
+    /**
+     * @brief Uploads @p image to all update devices at the same time
+     *
+     * Devices that are not in update mode are switched to update mode first. The uploads
+     * are scheduled by core::FlashScheduler with the limits of the CliConfiguration.
+     *
+     * @param[in] image the firmware
+     * @param[in] options the options of the <tt>"upload"</tt> command
+     * @param[in,out] os the output stream
+     * @return @c true on success
+     * @exception core::ApplicationError if there are no update devices or if at least
+     *            one upload has failed
+     */
+    bool uploadAll(const core::FirmwareImage    &image,
+                   const core::StringVector     &options,
+                   std::ostream                 &os);
+
+private:
+    // the raw data of files is compared to detect changes
+    struct CachedImage {
+        core::ByteVector data;
+        core::FirmwareImage image;
+    };
+    typedef std::map<std::string, CachedImage> ImageCache;
+
+    core::DeviceManager *m_deviceManager;
+    Firmwarepool        *m_firmwarepool;
+    DependencyResolver  *m_resolver;
+    ImageCache          m_imageCache;
+};
+
+/* }}} */
+/* FlashPlanCommand {{{ */
+
+/**
+ * @class FlashPlanCommand cli/commands.h
+ * @brief Implements the <tt>"flash-plan"</tt> command
+ *
+ * Uploads the firmwares of a FlashPlan to the devices of a production station and writes
+ * a report with one line per device.
+ *
+ * @author Bernhard Walle <bernhard@bwalle.de>
+ * @ingroup cli
+ */
+class FlashPlanCommand : public AbstractCommand {
+public:
+    /**
+     * @brief Constructor
+     *
+     * Creates a new instance of FlashPlanCommand.
+     *
+     * @param[in] deviceManager the device manager (that is still owned by the caller)
+     * @param[in] firmwarepool the firmware pool (that is still owned by the caller)
      */
-    UploadCommand(core::DeviceManager *deviceManager, Firmwarepool  *firmwarepool);
+    FlashPlanCommand(core::DeviceManager *deviceManager, Firmwarepool *firmwarepool);
 
 public:
     /// @copydoc Command::execute()
@@ -456,6 +607,13 @@ public:
     /// @copydoc Command::help()
     std::string help() const;
 
+    /// @copydoc Command::getDependencies()
+    unsigned int getDependencies(CommandArgVector   args,
+                                 core::StringVector options) const;
+
+    /// @copydoc Command::isFileArgument()
+    bool isFileArgument(size_t pos) const;
+
     /// @copydoc Command::printLongHelp()
     void printLongHelp(std::ostream &os) const;
 
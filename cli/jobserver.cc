@@ -0,0 +1,422 @@
+/*
+ * (c) 2010, Bernhard Walle <bernhard@bwalle.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <streambuf>
+#include <cstring>
+#include <cerrno>
+
+#ifndef _WIN32
+#  include <sys/types.h>
+#  include <sys/stat.h>
+#  include <sys/socket.h>
+#  include <sys/un.h>
+#  include <sys/time.h>
+#  include <unistd.h>
+#  include <signal.h>
+#endif
+
+#include <usbprog-core/error.h>
+#include <usbprog-core/debug.h>
+#include <usbprog-core/util.h>
+#include <usbprog-core/progressreporter.h>
+
+#include "jobserver.h"
+#include "shell.h"
+#include "usbprog.h"
+#include "cliconfiguration.h"
+
+// protect the server against clients that send garbage
+#define MAX_REQUEST_SIZE    65536
+
+// a client that doesn't send its request must not block the job queue
+#define REQUEST_TIMEOUT     10
+
+namespace usbprog {
+namespace cli {
+
+#ifndef _WIN32
+
+/* Helpers {{{ */
+
+static void make_address(const std::string &path, struct sockaddr_un &address)
+{
+    if (path.size() >= sizeof(address.sun_path))
+        throw core::ApplicationError("Socket path " + path + " is too long");
+
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    std::strcpy(address.sun_path, path.c_str());
+}
+
+static bool write_all(int fd, const char *data, size_t length)
+{
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return false;
+
+        data += written;
+        length -= written;
+    }
+
+    return true;
+}
+
+// the server has another working directory, so relative file names must be made absolute
+static std::string absolute_path(const std::string &arg)
+{
+    if (!core::Fileutil::isPathName(arg))
+        return arg;
+
+    std::string path = core::Fileutil::resolvePath(arg);
+    if (path[0] == '/')
+        return path;
+
+    char cwd[4096];
+    if (getcwd(cwd, sizeof(cwd)) == NULL)
+        throw core::ApplicationError("Unable to get the working directory: " +
+                                     std::string(std::strerror(errno)));
+
+    return core::pathconcat(cwd, path);
+}
+
+/* }}} */
+/* SocketStreamBuffer {{{ */
+
+// output to a socket that is sent on each flush, so that the client sees the progress of
+// long jobs with one write() per line or JSON record
+class SocketStreamBuffer : public std::streambuf {
+public:
+    SocketStreamBuffer(int fd)
+        : m_fd(fd)
+    {
+        setp(m_buffer, m_buffer + sizeof(m_buffer));
+    }
+
+    ~SocketStreamBuffer()
+    {
+        sync();
+    }
+
+protected:
+    int overflow(int c)
+    {
+        if (sync() != 0)
+            return traits_type::eof();
+        if (c == traits_type::eof())
+            return traits_type::not_eof(c);
+
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+        return c;
+    }
+
+    int sync()
+    {
+        size_t length = pptr() - pbase();
+        setp(m_buffer, m_buffer + sizeof(m_buffer));
+        return length == 0 || write_all(m_fd, m_buffer, length) ? 0 : -1;
+    }
+
+private:
+    int m_fd;
+    char m_buffer[4096];
+};
+
+/* }}} */
+/* JobServer {{{ */
+
+JobServer::JobServer(Shell *shell, core::DeviceManager *deviceManager, Firmwarepool *firmwarepool)
+    : m_shell(shell)
+    , m_deviceManager(deviceManager)
+    , m_firmwarepool(firmwarepool)
+    , m_socket(-1)
+{}
+
+JobServer::~JobServer()
+{
+    if (m_socket >= 0) {
+        close(m_socket);
+        unlink(m_socketPath.c_str());
+    }
+}
+
+void JobServer::listen(const std::string &socketPath)
+{
+    struct sockaddr_un address;
+    make_address(socketPath, address);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        throw core::ApplicationError("Unable to create socket: " + std::string(std::strerror(errno)));
+
+    // a socket that nobody accepts on is left over from a server that has been killed
+    struct stat st;
+    if (stat(socketPath.c_str(), &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            close(fd);
+            throw core::ApplicationError(socketPath + " exists and is no socket");
+        }
+        if (connect(fd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) == 0) {
+            close(fd);
+            throw core::ApplicationError("Another server is already listening on " + socketPath);
+        }
+        close(fd);
+        unlink(socketPath.c_str());
+
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+            throw core::ApplicationError("Unable to create socket: " + std::string(std::strerror(errno)));
+    }
+
+    // only the owner may send jobs, everybody else could flash the devices
+    mode_t oldUmask = umask(0077);
+    int err = bind(fd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address));
+    umask(oldUmask);
+
+    if (err != 0 || ::listen(fd, SOMAXCONN) != 0) {
+        std::string error = std::strerror(errno);
+        close(fd);
+        throw core::ApplicationError("Unable to listen on " + socketPath + ": " + error);
+    }
+
+    // a client that goes away must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+
+    m_socket = fd;
+    m_socketPath = socketPath;
+    USBPROG_DEBUG_DBG("Listening on %s", socketPath.c_str());
+}
+
+void JobServer::run()
+{
+    if (m_socket < 0)
+        throw core::ApplicationError("The server doesn't listen");
+
+    while (true) {
+        int client = accept(m_socket, NULL, NULL);
+        if (client < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            throw core::ApplicationError("Unable to accept connection: " +
+                                         std::string(std::strerror(errno)));
+        }
+
+        struct timeval timeout;
+        timeout.tv_sec = REQUEST_TIMEOUT;
+        timeout.tv_usec = 0;
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        // read the arguments up to the empty line
+        std::string request;
+        char buffer[4096];
+        while (request.size() < MAX_REQUEST_SIZE && request.find("\n\n") == std::string::npos &&
+                request != "\n") {
+            ssize_t bytes = read(client, buffer, sizeof(buffer));
+            if (bytes < 0 && errno == EINTR)
+                continue;
+            if (bytes <= 0)
+                break;
+            request.append(buffer, bytes);
+        }
+
+        SocketStreamBuffer streamBuffer(client);
+        std::ostream os(&streamBuffer);
+
+        bool success = false;
+        size_t end = request.find("\n\n");
+        if (end != std::string::npos) {
+            core::StringVector args;
+            for (size_t start = 0; start <= end; ) {
+                size_t newline = request.find('\n', start);
+                args.push_back(request.substr(start, newline - start));
+                start = newline + 1;
+            }
+            success = execute(args, os);
+        } else if (request == "\n")
+            os << "Error: No commands given" << std::endl;
+        else
+            os << "Error: Invalid request" << std::endl;
+
+        os << '\0' << (success ? '0' : '1') << std::flush;
+        close(client);
+    }
+}
+
+bool JobServer::execute(const core::StringVector &args, std::ostream &os)
+{
+    USBPROG_DEBUG_DBG("Executing job with %d arguments", int(args.size()));
+
+    // each job starts with the current list of devices and without selected device
+    try {
+        m_deviceManager->discoverUpdateDevices(m_firmwarepool->getUpdateDeviceList());
+        m_deviceManager->clearCurrentUpdateDevice();
+    } catch (const core::IOError &err) {
+        os << "Error: " << err.what() << std::endl;
+        return false;
+    }
+
+    // the downloads of the firmware pool report their progress to the client of the job
+    CliConfiguration &conf = CliConfiguration::config();
+    JsonProgressNotifier jsonProgress(os);
+    core::ProgressReporter reporter(&jsonProgress);
+    if (conf.getJsonOutput() && !conf.getDebug())
+        m_firmwarepool->setProgress(&reporter);
+
+    m_shell->resetFailedCommands();
+    bool success;
+    try {
+        m_shell->run(args, true, os);
+        success = m_shell->getFailedCommands() == 0;
+    } catch (const core::ApplicationError &err) {
+        os << "Error: " << err.what() << std::endl;
+        success = false;
+    }
+
+    m_firmwarepool->setProgress(NULL);
+    return success;
+}
+
+/* }}} */
+/* JobClient {{{ */
+
+JobClient::JobClient(const std::string &socketPath, const Shell *shell)
+    : m_socketPath(socketPath)
+    , m_shell(shell)
+{}
+
+bool JobClient::execute(const core::StringVector &args, std::ostream &os)
+{
+    std::vector<size_t> fileArgs = m_shell->getFileArguments(args);
+
+    std::string request;
+    for (size_t i = 0; i < args.size(); i++) {
+        if (args[i].empty() || args[i].find('\n') != std::string::npos)
+            throw core::ApplicationError("Arguments for the server must not be empty "
+                                         "and must not contain newlines");
+        if (std::find(fileArgs.begin(), fileArgs.end(), i) != fileArgs.end())
+            request += absolute_path(args[i]) + "\n";
+        else
+            request += args[i] + "\n";
+    }
+    request += "\n";
+
+    struct sockaddr_un address;
+    make_address(m_socketPath, address);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        throw core::ApplicationError("Unable to create socket: " + std::string(std::strerror(errno)));
+
+    if (connect(fd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) != 0) {
+        std::string error = std::strerror(errno);
+        close(fd);
+        throw core::ApplicationError("Unable to connect to " + m_socketPath + ": " + error);
+    }
+
+    if (!write_all(fd, request.data(), request.size())) {
+        std::string error = std::strerror(errno);
+        close(fd);
+        throw core::ApplicationError("Unable to send the commands: " + error);
+    }
+
+    // copy the output until the NUL byte, the status follows
+    bool statusFollows = false;
+    int status = -1;
+    char buffer[4096];
+    while (status < 0) {
+        ssize_t bytes = read(fd, buffer, sizeof(buffer));
+        if (bytes < 0 && errno == EINTR)
+            continue;
+        if (bytes <= 0)
+            break;
+
+        ssize_t start = 0;
+        if (!statusFollows) {
+            const char *nul = static_cast<const char *>(std::memchr(buffer, '\0', bytes));
+            ssize_t length = nul ? nul - buffer : bytes;
+            os.write(buffer, length);
+            os.flush();
+            if (!nul)
+                continue;
+            statusFollows = true;
+            start = length + 1;
+        }
+        if (start < bytes)
+            status = buffer[start];
+    }
+    close(fd);
+
+    if (status < 0)
+        throw core::ApplicationError("The server has closed the connection unexpectedly");
+
+    return status == '0';
+}
+
+/* }}} */
+
+#else /* _WIN32 */
+
+/* Dummy implementation {{{ */
+
+JobServer::JobServer(Shell *shell, core::DeviceManager *deviceManager, Firmwarepool *firmwarepool)
+    : m_shell(shell)
+    , m_deviceManager(deviceManager)
+    , m_firmwarepool(firmwarepool)
+    , m_socket(-1)
+{}
+
+JobServer::~JobServer()
+{}
+
+void JobServer::listen(const std::string &socketPath)
+{
+    throw core::ApplicationError("The job server is not available on Microsoft Windows");
+}
+
+void JobServer::run()
+{
+    throw core::ApplicationError("The job server is not available on Microsoft Windows");
+}
+
+bool JobServer::execute(const core::StringVector &args, std::ostream &os)
+{
+    return false;
+}
+
+JobClient::JobClient(const std::string &socketPath, const Shell *shell)
+    : m_socketPath(socketPath)
+    , m_shell(shell)
+{}
+
+bool JobClient::execute(const core::StringVector &args, std::ostream &os)
+{
+    throw core::ApplicationError("The job server is not available on Microsoft Windows");
+}
+
+/* }}} */
+
+#endif /* _WIN32 */
+
+} // end namespace cli
+} // end namespace usbprog
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
@@ -0,0 +1,181 @@
+/*
+ * (c) 2010, Bernhard Walle <bernhard@bwalle.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file jobserver.h
+ * @brief Long-running job server and the client for it
+ *
+ * The server keeps the USB library, the firmware pool and the decoded firmware images in
+ * memory and executes the commands that clients send over a Unix domain socket.
+ *
+ * The protocol is line based: the client sends one command line argument per line,
+ * terminated by an empty line. The server answers with the output of the commands, followed
+ * by a NUL byte and the status character @c '0' (success) or @c '1' (at least one command
+ * has failed). Then the connection is closed.
+ *
+ * @author Bernhard Walle <bernhard@bwalle.de>
+ * @ingroup cli
+ */
+
+#ifndef JOBSERVER_H
+#define JOBSERVER_H
+
+#include <string>
+#include <iostream>
+
+#include <usbprog-core/devices.h>
+#include <usbprog-core/stringutil.h>
+#include <usbprog/firmwarepool.h>
+
+namespace usbprog {
+namespace cli {
+
+class Shell;
+
+/* JobServer {{{ */
+
+/**
+ * @class JobServer cli/jobserver.h
+ * @brief Executes commands sent by JobClient
+ *
+ * The jobs are executed one after another in the order of the connections, so the
+ * listen queue of the socket is the job queue. Before each job the update devices are
+ * discovered again because devices may have been plugged in or out in the meantime.
+ * Only the owner of the socket may connect, and a client that doesn't send its request within
+ * 10 seconds is disconnected.
+ * The output of a job, including the progress of the firmware downloads in JSON mode, goes
+ * to the client of that job.
+ *
+ * Only available on POSIX platforms.
+ *
+ * @author Bernhard Walle <bernhard@bwalle.de>
+ * @ingroup cli
+ */
+class JobServer {
+public:
+    /**
+     * @brief Constructor
+     *
+     * @param[in] shell the shell that executes the commands (still owned by the caller)
+     * @param[in] deviceManager the device manager (still owned by the caller)
+     * @param[in] firmwarepool the firmware pool (still owned by the caller)
+     */
+    JobServer(Shell *shell, core::DeviceManager *deviceManager, Firmwarepool *firmwarepool);
+
+    /**
+     * @brief Destructor
+     *
+     * Closes and removes the socket.
+     */
+    virtual ~JobServer();
+
+public:
+    /**
+     * @brief Creates the socket
+     *
+     * A stale socket of a server that is no longer running gets replaced.
+     *
+     * @param[in] socketPath the path of the Unix domain socket
+     * @exception core::ApplicationError if the socket cannot be created, if another server
+     *            already listens on @p socketPath or if the platform has no Unix domain sockets
+     */
+    void listen(const std::string &socketPath);
+
+    /**
+     * @brief Processes jobs
+     *
+     * This function blocks until the process is terminated.
+     *
+     * @exception core::ApplicationError if accepting connections fails
+     */
+    void run();
+
+protected:
+    /**
+     * @brief Executes one job
+     *
+     * @param[in] args the command line arguments sent by the client
+     * @param[in,out] os the stream that gets sent to the client
+     * @return @c true if all commands have been executed successfully, @c false otherwise
+     */
+    bool execute(const core::StringVector &args, std::ostream &os);
+
+private:
+    // noncopyable
+    JobServer(const JobServer &other);
+    JobServer &operator=(const JobServer &other);
+
+private:
+    Shell *m_shell;
+    core::DeviceManager *m_deviceManager;
+    Firmwarepool *m_firmwarepool;
+    std::string m_socketPath;
+    int m_socket;
+};
+
+/* }}} */
+/* JobClient {{{ */
+
+/**
+ * @class JobClient cli/jobserver.h
+ * @brief Sends commands to a JobServer
+ *
+ * The client needs neither the USB library nor the firmware pool, so it starts fast. Relative
+ * file names in the file name arguments (see Command::isFileArgument()) are made absolute
+ * because the server has another working directory.
+ *
+ * @author Bernhard Walle <bernhard@bwalle.de>
+ * @ingroup cli
+ */
+class JobClient {
+public:
+    /**
+     * @brief Constructor
+     *
+     * @param[in] socketPath the path of the socket of the JobServer
+     * @param[in] shell the shell that knows the commands, only used to find the file name
+     *            arguments (still owned by the caller)
+     */
+    JobClient(const std::string &socketPath, const Shell *shell);
+
+public:
+    /**
+     * @brief Executes commands on the server
+     *
+     * Blocks until the server has executed the commands.
+     *
+     * @param[in] args the commands with their arguments like in batch mode
+     * @param[in,out] os the stream to which the output of the commands is written
+     * @return @c true if all commands have been executed successfully, @c false otherwise
+     * @exception core::ApplicationError if the server cannot be reached or if an argument
+     *            contains a newline
+     */
+    bool execute(const core::StringVector &args, std::ostream &os);
+
+private:
+    std::string m_socketPath;
+    const Shell *m_shell;
+};
+
+/* }}} */
+
+} // end namespace cli
+} // end namespace usbprog
+
+#endif /* JOBSERVER_H */
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
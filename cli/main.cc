@@ -21,25 +21,41 @@
 #include <QCoreApplication>
 
 #include <usbprog/usbprog.h>
+#include <usbprog-core/debug.h>
+#include <usbprog-core/tracer.h>
 
 #include "usbprog.h"
 
 int main(int argc, char *argv[])
 {
     usbprog::cli::Usbprog usbprog(argc, argv);
+    int rc = EXIT_SUCCESS;
+
+    // the recording is stopped in parseCommandLine() if no trace has been requested
+    usbprog::core::Tracer::tracer()->setEnabled(true);
 
     try {
         usbprog.initConfig();
         usbprog.parseCommandLine();
+        if (usbprog.isClient())
+            return usbprog.execClient() ? EXIT_SUCCESS : EXIT_FAILURE;
         usbprog.initFirmwarePool();
         usbprog.initDeviceManager();
         usbprog.exec();
+    } catch (const std::runtime_error &e) {
+        usbprog::core::Debug::debug()->dump();
+        std::cerr << "Error: " << e.what() << std::endl;
+        rc = EXIT_FAILURE;
+    }
+
+    try {
+        usbprog.writeTrace();
     } catch (const std::runtime_error &e) {
         std::cerr << "Error: " << e.what() << std::endl;
-        return EXIT_FAILURE;
+        rc = EXIT_FAILURE;
     }
 
-    return EXIT_SUCCESS;
+    return rc;
 }
 
 // vim: set sw=4 ts=4 et: :collapseFolds=1:
@@ -24,6 +24,10 @@
 #include <libbw/completion.h>
 
 #include <usbprog-core/stringutil.h>
+#include <usbprog-core/debug.h>
+#include <usbprog-core/tracer.h>
+#include <usbprog-core/jsonwriter.h>
+#include <usbpp/clock.h>
 #include <usbprog/usbprog.h>
 
 #include "shell.h"
@@ -32,6 +36,17 @@
 namespace usbprog {
 namespace cli {
 
+/* Functions {{{ */
+
+void print_message(std::ostream &os, const std::string &message, const std::string &type)
+{
+    if (CliConfiguration::config().getJsonOutput())
+        core::JsonWriter(os).begin(type).add("text", message).end();
+    else
+        os << message << std::endl;
+}
+
+/* }}} */
 /* AbstractCommand {{{ */
 
 AbstractCommand::AbstractCommand(const std::string &name)
@@ -76,6 +91,17 @@ core::StringVector AbstractCommand::getCompletions(const std::string &start,
     return core::empty_element_sv();
 }
 
+unsigned int AbstractCommand::getDependencies(CommandArgVector   args,
+                                              core::StringVector options) const
+{
+    return DEP_NONE;
+}
+
+bool AbstractCommand::isFileArgument(size_t pos) const
+{
+    return false;
+}
+
 /* }}} */
 /* CommandArg {{{ */
 
@@ -184,6 +210,9 @@ CommandArg *CommandArg::fromString(const std::string &str, CommandArg::Type type
 /* Shell {{{ */
 
 Shell::Shell(const std::string &prompt)
+    : m_commandIndexValid(false)
+    , m_dependencyResolver(NULL)
+    , m_failedCommands(0)
 {
     m_lineReader = bw::LineReader::defaultLineReader(prompt);
     try {
@@ -235,6 +264,27 @@ void Shell::addCommand(Command *cmd)
     for (core::StringVector::const_iterator it = aliases.begin();
             it != aliases.end(); ++it)
         m_commands[*it] = cmd;
+
+    m_commandIndexValid = false;
+}
+
+const core::PrefixTrie &Shell::getCommandIndex()
+{
+    if (!m_commandIndexValid) {
+        core::StringVector names;
+        for (StringCommandMap::const_iterator it = m_commands.begin(); it != m_commands.end(); ++it)
+            if (it->second)
+                names.push_back(it->first);
+        m_commandIndex.build(names);
+        m_commandIndexValid = true;
+    }
+
+    return m_commandIndex;
+}
+
+void Shell::setDependencyResolver(DependencyResolver *resolver)
+{
+    m_dependencyResolver = resolver;
 }
 
 std::vector<std::string> Shell::complete(const std::string     &text,
@@ -245,16 +295,8 @@ std::vector<std::string> Shell::complete(const std::string     &text,
     //
     // command completion
     //
-    if (start_idx == 0) {
-        core::StringVector result;
-        for (StringCommandMap::const_iterator it = m_commands.begin();
-             it != m_commands.end(); ++it) {
-            std::string cmd = it->first;
-            if (core::str_starts_with(cmd, text))
-                result.push_back(cmd);
-        }
-        return result;
-    }
+    if (start_idx == 0)
+        return getCommandIndex().complete(text);
 
     //
     // argument completion
@@ -322,7 +364,7 @@ void Shell::run()
         std::cout << std::endl;
 }
 
-bool Shell::run(core::StringVector input, bool multiple)
+bool Shell::run(core::StringVector input, bool multiple, std::ostream &os)
 {
     bool result = true;
     int loop = 0;
@@ -331,81 +373,222 @@ bool Shell::run(core::StringVector input, bool multiple)
         throw core::ApplicationError("Input size == 0");
 
     do {
-        std::string cmdstr = input[0];
-        std::string execstr = cmdstr;
-        input.erase(input.begin());
-        StringCommandMap::const_iterator it = m_commands.find(cmdstr);
-        if (it == m_commands.end())
-            throw core::ApplicationError("Invalid command");
-        Command *cmd = it->second;
+        result = runCommand(input, multiple, !multiple, loop, os);
+    } while (result && input.size() > 0 && multiple);
 
-        // separate options from arguments
-        core::StringVector options;
-        for (core::StringVector::iterator it = input.begin(); it != input.end(); ++it) {
-            std::string option = *it;
+    return result;
+}
 
-            if (option == "--") {
-                // treat "--" like with GNU getopt
-                input.erase(it);
-                break;
-            } else if (option[0] != '-') {
-                // the first non-option argument ends the possible options
-                break;
-            } else {
-                options.push_back(option);
-                execstr += " " + option;
+bool Shell::runCommand(core::StringVector     &input,
+                       bool                   multiple,
+                       bool                   interactive,
+                       int                    &loop,
+                       std::ostream           &os)
+{
+    bool result = true;
 
-                core::StringVector supported = cmd->getSupportedOptions();
-                if (find(supported.begin(), supported.end(), option) == supported.end())
-                    throw core::ApplicationError("Option '" + option + "' not supported.");
+    std::string cmdstr = input[0];
+    std::string execstr = cmdstr;
+    input.erase(input.begin());
+    StringCommandMap::const_iterator it = m_commands.find(cmdstr);
+    if (it == m_commands.end())
+        throw core::ApplicationError("Invalid command");
+    Command *cmd = it->second;
+
+    // separate options from arguments
+    core::StringVector options;
+    core::StringVector::iterator argIt = input.begin();
+    while (argIt != input.end()) {
+        std::string option = *argIt;
+
+        if (option == "--") {
+            // treat "--" like with GNU getopt
+            input.erase(argIt);
+            break;
+        } else if (option[0] != '-') {
+            // the first non-option argument ends the possible options
+            break;
+        } else {
+            options.push_back(option);
+            execstr += " " + option;
 
-                input.erase(it);
-            }
-        }
+            core::StringVector supported = cmd->getSupportedOptions();
+            if (find(supported.begin(), supported.end(), option) == supported.end())
+                throw core::ApplicationError("Option '" + option + "' not supported.");
 
-        // check number of arguments
-        if (multiple && cmd->getArgNumber() > input.size())
-            throw core::ApplicationError(cmdstr + ": Not enough arguments provided");
-        if (!multiple && cmd->getArgNumber() < input.size())
-            throw core::ApplicationError(cmdstr + ": Too much arguments provided.");
-
-        CommandArgVector vec;
-        for (unsigned int argNo = 0; argNo < cmd->getArgNumber(); argNo++) {
-            std::string argstr;
-            if (input.size() > 0) {
-                argstr = input[0];
-                input.erase(input.begin());
-            } else {
-                std::string prompt = cmd->getArgTitle(argNo) + "> ";
-                argstr = m_lineReader->readLine(prompt.c_str());
-            }
+            argIt = input.erase(argIt);
+        }
+    }
 
-            execstr += " " + argstr;
-            CommandArg *arg = CommandArg::fromString(argstr,
-                    cmd->getArgType(argNo));
-            vec.push_back(arg);
+    // check number of arguments
+    if (!interactive && cmd->getArgNumber() > input.size())
+        throw core::ApplicationError(cmdstr + ": Not enough arguments provided");
+    if (!multiple && cmd->getArgNumber() < input.size())
+        throw core::ApplicationError(cmdstr + ": Too much arguments provided.");
+
+    CommandArgVector vec;
+    for (unsigned int argNo = 0; argNo < cmd->getArgNumber(); argNo++) {
+        std::string argstr;
+        if (input.size() > 0) {
+            argstr = input[0];
+            input.erase(input.begin());
+        } else {
+            std::string prompt = cmd->getArgTitle(argNo) + "> ";
+            argstr = m_lineReader->readLine(prompt.c_str());
         }
 
+        execstr += " " + argstr;
+        CommandArg *arg = CommandArg::fromString(argstr,
+                cmd->getArgType(argNo));
+        vec.push_back(arg);
+    }
+
+    // a script prints its own records
+    bool json = CliConfiguration::config().getJsonOutput();
+    bool records = json && (multiple || interactive);
+    size_t failedBefore = m_failedCommands;
+    unsigned long long start = usb::usbpp_now_us();
+
+    try {
+        if (records)
+            core::JsonWriter(os).begin("command").add("command", execstr).end();
+        else if (!json && multiple && (input.size() > 0 || loop != 0))
+            os << "===> " << execstr << std::endl;
+        loop++;
+
+        if (m_dependencyResolver)
+            m_dependencyResolver->resolve(cmd->getDependencies(vec, options));
+
+        core::TraceSpan span("Shell::run");
+        if (span.isEnabled())
+            span.addArg("command", execstr);
+        result = cmd->execute(vec, options, os);
+        if (!json && multiple && result && input.size() > 0)
+            os << std::endl;
+
+    } catch (const core::ApplicationError &ex) {
+        core::Debug::debug()->dump();
+        print_message(os, ex.what(), "error");
+        m_failedCommands++;
+    }
+
+    if (records)
+        core::JsonWriter(os).begin("result")
+                            .add("command", execstr)
+                            .add("ok", m_failedCommands == failedBefore)
+                            .add("ms", (usb::usbpp_now_us() - start) / 1000)
+                            .end();
+
+    // free memory
+    for (CommandArgVector::const_iterator it = vec.begin();
+            it != vec.end(); ++it)
+        delete *it;
+
+    return result;
+}
+
+size_t Shell::runScript(std::istream &is, const std::string &name, std::ostream &os)
+{
+    size_t commands = 0;
+    size_t failed = 0;
+    bool result = true;
+    bool json = CliConfiguration::config().getJsonOutput();
+
+    std::string line;
+    for (size_t lineNumber = 1; result && std::getline(is, line); lineNumber++) {
+        line = core::strip(line);
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        core::ShellStringTokenizer tok(line);
+        core::StringVector vec = tok.tokenize();
+        if (vec.size() == 0)
+            continue;
+
+        std::stringstream location;
+        location << name << ":" << lineNumber;
+        if (json)
+            core::JsonWriter(os).begin("command")
+                                .add("location", location.str())
+                                .add("command", line)
+                                .end();
+        else
+            os << "===> " << location.str() << ": " << line << std::endl;
+
+        // one command per line, and the arguments are never read from the terminal
+        size_t failedBefore = m_failedCommands;
+        unsigned long long start = usb::usbpp_now_us();
+        int loop = 0;
         try {
-            if (multiple && (input.size() > 0 || loop != 0))
-                std::cout << "===> " << execstr << std::endl;
-            loop++;
-            result = cmd->execute(vec, options, std::cout);
-            if (multiple && result && input.size() > 0)
-                std::cout << std::endl;
-
-        } catch (const core::ApplicationError &ex) {
-            std::cout << ex.what() << std::endl;
+            result = runCommand(vec, false, false, loop, os);
+        } catch (const core::ApplicationError &err) {
+            core::Debug::debug()->dump();
+            print_message(os, err.what(), "error");
+            m_failedCommands++;
         }
+        unsigned long long ms = (usb::usbpp_now_us() - start) / 1000;
+
+        commands++;
+        bool ok = m_failedCommands == failedBefore;
+        if (!ok)
+            failed++;
+        if (json)
+            core::JsonWriter(os).begin("result")
+                                .add("location", location.str())
+                                .add("command", line)
+                                .add("ok", ok)
+                                .add("ms", ms)
+                                .end();
+        else
+            // commands may leave the stream in hexadecimal mode
+            os << "<=== " << location.str() << ": " << (ok ? "OK" : "FAILED")
+               << " (" << std::dec << ms << " ms)" << std::endl;
+    }
 
-        // free memory
-        for (CommandArgVector::const_iterator it = vec.begin();
-                it != vec.end(); ++it)
-            delete *it;
+    if (json)
+        core::JsonWriter(os).begin("summary")
+                            .add("script", name)
+                            .add("commands", commands)
+                            .add("failed", failed)
+                            .end();
+    else
+        os << "===> " << name << ": " << std::dec << commands << " commands, " << failed
+           << " failed" << std::endl;
+    return failed;
+}
 
-    } while (result && input.size() > 0 && multiple);
+size_t Shell::getFailedCommands() const
+{
+    return m_failedCommands;
+}
 
-    return result;
+void Shell::resetFailedCommands()
+{
+    m_failedCommands = 0;
+}
+
+std::vector<size_t> Shell::getFileArguments(const core::StringVector &input) const
+{
+    std::vector<size_t> ret;
+
+    size_t i = 0;
+    while (i < input.size()) {
+        StringCommandMap::const_iterator it = m_commands.find(input[i++]);
+        if (it == m_commands.end())
+            break;
+        Command *cmd = it->second;
+
+        // skip the options like runCommand()
+        while (i < input.size() && !input[i].empty() && input[i][0] == '-')
+            if (input[i++] == "--")
+                break;
+
+        for (size_t argNo = 0; argNo < cmd->getArgNumber() && i < input.size(); argNo++, i++)
+            if (cmd->isFileArgument(argNo))
+                ret.push_back(i);
+    }
+
+    return ret;
 }
 
 /* }}} */
@@ -458,13 +641,26 @@ bool HelpCommand::execute(CommandArgVector   args,
                           core::StringVector options,
                           std::ostream       &os)
 {
+    bool json = CliConfiguration::config().getJsonOutput();
+
     for (StringCommandMap::const_iterator it = m_sh->m_commands.begin();
             it != m_sh->m_commands.end(); ++it) {
-        if (it->second->name() == it->first)
+        if (it->second->name() != it->first)
+            continue;
+
+        if (json)
+            core::JsonWriter(os).begin("help")
+                                .add("command", it->second->name())
+                                .add("text", it->second->help())
+                                .end();
+        else
             os << std::setw(20) << std::left << it->second->name()
                  << it->second->help() << std::endl;
     }
 
+    if (json)
+        return true;
+
     os << std::endl;
     os << "To get more information about a specific command, use "
        << "\"helpcmd command\"." << std::endl;
@@ -503,8 +699,15 @@ bool HelpCmdCommand::execute(CommandArgVector    args,
     std::string cmd = args[0]->getString();
 
     if (m_sh->m_commands.find(cmd) == m_sh->m_commands.end())
-        os << "Invalid command: " + cmd << std::endl;
-    else {
+        print_message(os, "Invalid command: " + cmd);
+    else if (CliConfiguration::config().getJsonOutput()) {
+        std::stringstream ss;
+        m_sh->m_commands.find(cmd)->second->printLongHelp(ss);
+        core::JsonWriter(os).begin("help")
+                            .add("command", cmd)
+                            .add("text", ss.str())
+                            .end();
+    } else {
         Command *c = m_sh->m_commands.find(cmd)->second;
         c->printLongHelp(os);
     }
@@ -548,14 +751,7 @@ std::vector<std::string> HelpCmdCommand::getCompletions(const std::string &start
     if (pos != 0)
         return core::StringVector();
 
-    core::StringVector result;
-    for (StringCommandMap::const_iterator it = m_sh->m_commands.begin();
-            it != m_sh->m_commands.end(); ++it) {
-        std::string cmd = it->first;
-        if (core::str_starts_with(cmd, start))
-            result.push_back(cmd);
-    }
-    return result;
+    return m_sh->getCommandIndex().complete(start);
 }
 
 
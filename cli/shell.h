@@ -34,6 +34,7 @@
 #include <iostream>
 #include <stdexcept>
 #include <usbprog/usbprog.h>
+#include <usbprog-core/prefixtrie.h>
 
 #include <libbw/completion.h>
 
@@ -54,6 +55,65 @@ typedef std::map<std::string, Command *> StringCommandMap;
 typedef std::vector<CommandArg *> CommandArgVector;
 
 
+/* }}} */
+/* Dependencies {{{ */
+
+/**
+ * @brief Resources that a command needs
+ *
+ * The values are flags, so a command can combine them.
+ *
+ * @ingroup cli
+ */
+enum CommandDependency {
+    DEP_NONE            = 0,            ///< the command needs nothing special
+    DEP_FIRMWAREPOOL    = (1 << 0)      ///< the index of the firmware pool must be read
+};
+
+/**
+ * @class DependencyResolver cli/shell.h
+ * @brief Provides the resources of a command on first use
+ *
+ * The Shell calls resolve() before each command with the result of Command::getDependencies(),
+ * so expensive resources like the firmware index are only loaded if a command needs them.
+ *
+ * @author Bernhard Walle <bernhard@bwalle.de>
+ * @ingroup cli
+ */
+class DependencyResolver {
+public:
+    virtual ~DependencyResolver() {}
+
+public:
+    /**
+     * @brief Provides the resources
+     *
+     * Must return quickly if the resources are already available.
+     *
+     * @param[in] dependencies the resources as combination of CommandDependency flags
+     * @exception core::ApplicationError if a resource cannot be provided
+     */
+    virtual void resolve(unsigned int dependencies) = 0;
+};
+
+/* }}} */
+/* Functions {{{ */
+
+/**
+ * @brief Prints a message of a command
+ *
+ * In text mode, @p message is printed as line. In JSON mode (see
+ * CliConfiguration::getJsonOutput()), a record of @p type with the member @c "text" is printed.
+ *
+ * @param[in,out] os the output stream of the command
+ * @param[in] message the message, without trailing newline
+ * @param[in] type the type of the JSON record, for example @c "error"
+ * @ingroup cli
+ */
+void print_message(std::ostream         &os,
+                   const std::string    &message,
+                   const std::string    &type = "message");
+
 /* }}} */
 /* CommandArg {{{ */
 
@@ -331,6 +391,31 @@ public:
      */
     virtual std::vector<std::string> getCompletions(const std::string &start,
             size_t pos, bool option, bool *filecompletion) const = 0;
+
+    /**
+     * @brief Returns the resources that the command needs
+     *
+     * Gets called with the same arguments and options as execute(), right before execute().
+     * The default implementation AbstractCommand::getDependencies() returns DEP_NONE.
+     *
+     * @param[in] args the arguments for the command
+     * @param[in] options the options for the command
+     * @return a combination of CommandDependency flags
+     */
+    virtual unsigned int getDependencies(CommandArgVector   args,
+                                         core::StringVector options) const = 0;
+
+    /**
+     * @brief Checks if an argument names a file
+     *
+     * The JobClient makes such arguments absolute before they are sent to the server, which
+     * runs in another working directory. The default implementation
+     * AbstractCommand::isFileArgument() returns @c false.
+     *
+     * @param[in] pos the position of the argument, starting with 0
+     * @return @c true if the argument at @p pos is a file name, @c false otherwise
+     */
+    virtual bool isFileArgument(size_t pos) const = 0;
 };
 
 /* }}} */
@@ -382,6 +467,13 @@ public:
                                             bool              option,
                                             bool              *filecompletion) const;
 
+    /// @copydoc Command::getDependencies()
+    unsigned int getDependencies(CommandArgVector   args,
+                                 core::StringVector options) const;
+
+    /// @copydoc Command::isFileArgument()
+    bool isFileArgument(size_t pos) const;
+
 private:
     std::string m_name;
 };
@@ -422,6 +514,15 @@ public:
      */
     void addCommand(Command *cmd);
 
+    /**
+     * @brief Sets the object that provides the resources of the commands
+     *
+     * Without a resolver, the dependencies of the commands are ignored.
+     *
+     * @param[in] resolver the resolver (still owned by the caller) or @c NULL
+     */
+    void setDependencyResolver(DependencyResolver *resolver);
+
     /**
      * @brief Runs the application (interactive mode)
      *
@@ -432,16 +533,62 @@ public:
     /**
      * @brief Runs the application (non-interactive mode)
      *
-     * Passes @p input to the shell.
+     * Passes @p input to the shell. Errors of the commands themselves are printed to @p os
+     * and counted, see getFailedCommands().
      *
      * @param[in] input the user input
      * @param[in] multiple @c true if multiple commands are provided, @c false if only one
      *            command is provided (the second one is only used to call that function from
      *            the interactive run() variant)
+     * @param[in,out] os the stream to which the output of the commands is written
      * @return @c true if the shell should be continued to run, @c false otherwise.
      * @throw core::ApplicationError on any error
      */
-    bool run(core::StringVector input, bool multiple = true);
+    bool run(core::StringVector input, bool multiple = true, std::ostream &os = std::cout);
+
+    /**
+     * @brief Runs a script (non-interactive mode)
+     *
+     * Each line of @p is contains one command with its options and arguments. Empty lines and
+     * lines starting with <tt>#</tt> are ignored. The commands are executed in one process,
+     * so the firmware index and the detected devices are read only once. Before each command
+     * a line <tt>===> name:line: command</tt> is printed, after each command the status line
+     * <tt><=== name:line: OK (ms)</tt> or <tt><=== name:line: FAILED (ms)</tt>.
+     *
+     * A failed command doesn't stop the script, but an <tt>exit</tt> command does.
+     *
+     * @param[in] is the stream from which the script is read, that can also be @c std::cin
+     * @param[in] name the name of the script used in the status lines
+     * @param[in,out] os the stream to which the output of the commands is written
+     * @return the number of commands that have failed, they are also counted in
+     *         getFailedCommands()
+     */
+    size_t runScript(std::istream &is, const std::string &name, std::ostream &os = std::cout);
+
+    /**
+     * @brief Returns the number of commands that have failed
+     *
+     * @return the number of commands that have reported an error since the shell has been
+     *         created or since the last call of resetFailedCommands()
+     */
+    size_t getFailedCommands() const;
+
+    /**
+     * @brief Resets the counter returned by getFailedCommands()
+     */
+    void resetFailedCommands();
+
+    /**
+     * @brief Returns the positions of the file name arguments in @p input
+     *
+     * @p input is split like run() with @c multiple set to @c true splits it, but no command
+     * is executed. Splitting stops at the first unknown command.
+     *
+     * @param[in] input the command line
+     * @return the indexes of the elements of @p input that are file name arguments, see
+     *         Command::isFileArgument()
+     */
+    std::vector<size_t> getFileArguments(const core::StringVector &input) const;
 
     /**
      * @brief Complete function
@@ -460,9 +607,44 @@ public:
                                 size_t                start_idx,
                                 int                   end_idx);
 
+protected:
+    /**
+     * @brief Executes the first command of @p input
+     *
+     * Errors of the command are printed to @p os and counted.
+     *
+     * @param[in,out] input the user input, the command and its options and arguments are
+     *                removed
+     * @param[in] multiple @c true if @p input may contain further commands
+     * @param[in] interactive @c true if missing arguments should be read from the terminal
+     * @param[in,out] loop the number of commands of @p input that have been executed before
+     * @param[in,out] os the stream to which the output of the command is written
+     * @return @c false if the shell should be terminated, @c true otherwise
+     * @throw core::ApplicationError if the command or an option doesn't exist or the number
+     *        of arguments is wrong
+     */
+    bool runCommand(core::StringVector     &input,
+                    bool                   multiple,
+                    bool                   interactive,
+                    int                    &loop,
+                    std::ostream           &os);
+
+    /**
+     * @brief Returns the index of the command names and aliases for the completion
+     *
+     * The index is built with the first completion after a command has been added.
+     *
+     * @return the index
+     */
+    const core::PrefixTrie &getCommandIndex();
+
 private:
     StringCommandMap m_commands;
+    core::PrefixTrie m_commandIndex;
+    bool m_commandIndexValid;
     bw::LineReader *m_lineReader;
+    DependencyResolver *m_dependencyResolver;
+    size_t m_failedCommands;
 };
 
 /* }}} */
@@ -15,13 +15,20 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 #include <iostream>
+#include <fstream>
+#include <sstream>
 #include <cstdlib>
+#include <cstdio>
 #include <stdexcept>
 #include <vector>
+#include <algorithm>
 
 #include <usbprog-core/devices.h>
 #include <usbprog-core/util.h>
 #include <usbprog-core/debug.h>
+#include <usbprog-core/tracer.h>
+#include <usbprog-core/progressreporter.h>
+#include <usbprog-core/jsonwriter.h>
 #include <usbprog/firmwarepool.h>
 #include <usbprog/usbprog.h>
 
@@ -31,8 +38,12 @@
 #include "cliconfiguration.h"
 #include "shell.h"
 #include "commands.h"
+#include "jobserver.h"
 #include "config.h"
 
+// columns right of the hashes for the throughput and the remaining time
+#define RATE_WIDTH          22
+
 namespace usbprog {
 namespace cli {
 
@@ -55,6 +66,16 @@ int HashNotifier::progressed(double total, double now)
         return true;
 
     double percent = now / total;
+
+    if (!m_rate.empty()) {
+        int width = std::max(m_width - RATE_WIDTH, 10);
+        int bars = std::min(int(percent * width), width);
+        std::cout << '\r' << std::string(bars, '#') << std::string(width - bars, ' ')
+                  << m_rate << std::flush;
+        m_lastProgress = std::max(bars, 1);
+        return true;
+    }
+
     int bars = int(percent * m_width);
     while (bars > m_lastProgress) {
         std::cout << '#';
@@ -66,22 +87,128 @@ int HashNotifier::progressed(double total, double now)
     return true;
 }
 
+void HashNotifier::progressedRate(double perSecond, double secondsLeft)
+{
+    // the hashes of a previous line cannot be redrawn
+    if (m_rate.empty() && m_lastProgress != 0)
+        return;
+
+    char buffer[64];
+    if (secondsLeft < 0)
+        std::sprintf(buffer, " %7.1f KiB/s", perSecond / 1024);
+    else {
+        int seconds = int(secondsLeft + 0.5);
+        std::sprintf(buffer, " %7.1f KiB/s %3d:%02d",
+                     perSecond / 1024, seconds / 60, seconds % 60);
+    }
+    m_rate = buffer;
+    m_rate.resize(RATE_WIDTH, ' ');
+}
+
 void HashNotifier::finished()
 {
     if (m_lastProgress != 0) {
         std::cout << std::endl;
         m_lastProgress = 0;
     }
+    m_rate.clear();
+}
+
+/* }}} */
+/* JsonProgressNotifier {{{ */
+
+JsonProgressNotifier::JsonProgressNotifier(std::ostream &os)
+    : m_os(os)
+    , m_total(-1)
+    , m_rate(0)
+    , m_secondsLeft(-1)
+{}
+
+int JsonProgressNotifier::progressed(double total, double now)
+{
+    m_total = total;
+
+    core::JsonWriter json(m_os);
+    json.begin("progress")
+        .add("total", static_cast<unsigned long long>(total))
+        .add("done", static_cast<unsigned long long>(now));
+    if (m_rate > 0)
+        json.add("rate", m_rate);
+    if (m_secondsLeft >= 0)
+        json.add("eta", m_secondsLeft);
+    json.end();
+
+    return true;
+}
+
+void JsonProgressNotifier::progressedRate(double perSecond, double secondsLeft)
+{
+    m_rate = perSecond;
+    m_secondsLeft = secondsLeft;
+}
+
+void JsonProgressNotifier::finished()
+{
+    // the operations report the progress before each step, so the end is missing
+    if (m_total >= 0) {
+        m_rate = 0;
+        m_secondsLeft = -1;
+        progressed(m_total, m_total);
+    }
+
+    m_total = -1;
+    m_rate = 0;
+    m_secondsLeft = -1;
 }
 
+/* }}} */
+/* FirmwareIndexLoader {{{ */
+
+// reads the firmware index before the first command that needs it
+class FirmwareIndexLoader : public DependencyResolver {
+public:
+    FirmwareIndexLoader(Firmwarepool *firmwarepool, core::DeviceManager *deviceManager)
+        : m_firmwarepool(firmwarepool)
+        , m_deviceManager(deviceManager)
+        , m_loaded(false)
+    {}
+
+    void resolve(unsigned int dependencies)
+    {
+        if (!(dependencies & DEP_FIRMWAREPOOL) || m_loaded)
+            return;
+
+        core::TraceSpan span("FirmwareIndexLoader::resolve");
+        CliConfiguration &conf = CliConfiguration::config();
+        try {
+            if (!conf.isOffline())
+                m_firmwarepool->downloadIndex(conf.getIndexUrl());
+            m_firmwarepool->readIndex();
+        } catch (const std::runtime_error &re) {
+            throw core::ApplicationError(re.what());
+        }
+        m_loaded = true;
+
+        // the index adds devices that run a firmware
+        m_deviceManager->invalidateUpdateDevices();
+    }
+
+private:
+    Firmwarepool *m_firmwarepool;
+    core::DeviceManager *m_deviceManager;
+    bool m_loaded;
+};
+
 /* }}} */
 /* Usbprog {{{ */
 
 Usbprog::Usbprog(int argc, char *argv[])
-    : m_coreApp(argc, argv)
+    : m_coreApp(NULL)
     , m_firmwarepool(NULL)
     , m_devicemanager(NULL)
     , m_progressNotifier(NULL)
+    , m_progressReporter(NULL)
+    , m_binaryLog(NULL)
     , m_argc(argc)
     , m_argv(argv)
 {}
@@ -89,12 +216,18 @@ Usbprog::Usbprog(int argc, char *argv[])
 Usbprog::~Usbprog()
 {
     delete m_firmwarepool;
+    delete m_progressReporter;
     delete m_progressNotifier;
     delete m_devicemanager;
+    delete m_coreApp;
+
+    core::Debug::debug()->setBinaryLog(NULL);
+    delete m_binaryLog;
 }
 
 void Usbprog::initConfig()
 {
+    core::TraceSpan span("Usbprog::initConfig");
     CliConfiguration &conf = CliConfiguration::config();
 
     std::string configDir = core::Fileutil::configDir("usbprog");
@@ -120,15 +253,58 @@ void Usbprog::parseCommandLine()
                  "Uses the specified data " "directory instead of " + conf.getDataDir());
     op.addOption("offline", 'o', bw::OT_FLAG,
                  "Use only the local cache and don't connect to the internet");
+    op.addOption("compress-cache", 'z', bw::OT_FLAG,
+                 "Store downloaded firmware files compressed in the cache");
+    op.addOption("sysfs",   'S', bw::OT_FLAG,
+                 "Enumerate USB devices via sysfs (Linux only)");
+    op.addOption("server",  's', bw::OT_STRING,
+                 "Execute the commands sent to the specified socket");
+    op.addOption("connect", 'c', bw::OT_STRING,
+                 "Send the commands to the server listening on the specified socket");
+    op.addOption("file",    'f', bw::OT_STRING,
+                 "Execute the commands of the specified script, one per line ('-' for stdin)");
+    op.addOption("controller-jobs", 'J', bw::OT_INTEGER,
+                 "Maximum number of concurrent uploads per USB host controller");
+    op.addOption("controller-bandwidth", 'B', bw::OT_INTEGER,
+                 "Maximum bytes per second of all uploads on one USB host controller");
+    op.addOption("trace",   'T', bw::OT_STRING,
+                 "Writes a timeline of the run in the Chrome trace event format to the specified file");
+    op.addOption("json",    'j', bw::OT_FLAG,
+                 "Print one JSON record per line instead of text (with commands, --file or --server)");
+    op.addOption("flight-recorder", 'R', bw::OT_INTEGER,
+                 "Keeps the specified number of debug messages in memory and prints them on errors");
+    op.addOption("binary-log", 'L', bw::OT_STRING,
+                 "Writes all debug messages in a compact binary format to the specified file");
     op.addOption("debug",   'D', bw::OT_FLAG,
                  "Enables debug output");
 
     if (!op.parse(m_argc, m_argv))
         throw core::ApplicationError("Parsing command line failed.");
 
-    if (op.getValue("debug").getFlag()) {
+    if (op.getValue("binary-log").getType() != bw::OT_INVALID) {
+        if (op.getValue("debug").getFlag() ||
+                op.getValue("flight-recorder").getType() != bw::OT_INVALID)
+            throw core::ApplicationError("--binary-log cannot be combined with --debug "
+                                         "or --flight-recorder.");
+
+        try {
+            m_binaryLog = new core::BinaryLogWriter(op.getValue("binary-log").getString());
+        } catch (const core::IOError &err) {
+            throw core::ApplicationError(err.what());
+        }
+        core::Debug::debug()->setLevel(core::Debug::DL_TRACE);
+        core::Debug::debug()->setBinaryLog(m_binaryLog);
+    } else if (op.getValue("debug").getFlag()) {
         conf.setDebug(true);
         core::Debug::debug()->setLevel(core::Debug::DL_TRACE);
+        // writing the trace messages of each page must not slow down the upload
+        core::Debug::debug()->setMode(core::Debug::DM_ASYNCHRONOUS);
+    } else if (op.getValue("flight-recorder").getType() != bw::OT_INVALID) {
+        if (op.getValue("flight-recorder").getInteger() < 1)
+            throw core::ApplicationError("The number of recorded debug messages must be at least 1.");
+        core::Debug::debug()->setLevel(core::Debug::DL_TRACE);
+        core::Debug::debug()->setMode(core::Debug::DM_FLIGHT_RECORDER,
+                                      op.getValue("flight-recorder").getInteger());
     }
 
     if (op.getValue("version").getFlag()) {
@@ -140,35 +316,90 @@ void Usbprog::parseCommandLine()
         conf.setDataDir(op.getValue("datadir").getString());
     if (op.getValue("offline").getFlag())
         conf.setOffline(true);
+    if (op.getValue("compress-cache").getFlag())
+        conf.setCompressCache(true);
+    if (op.getValue("sysfs").getFlag())
+        conf.setUseSysfs(true);
+    if (op.getValue("server").getType() != bw::OT_INVALID)
+        conf.setServerSocket(op.getValue("server").getString());
+    if (op.getValue("connect").getType() != bw::OT_INVALID)
+        conf.setConnectSocket(op.getValue("connect").getString());
+    if (op.getValue("file").getType() != bw::OT_INVALID)
+        conf.setScriptFile(op.getValue("file").getString());
+    if (op.getValue("controller-jobs").getType() != bw::OT_INVALID) {
+        if (op.getValue("controller-jobs").getInteger() < 1)
+            throw core::ApplicationError("The number of jobs per controller must be at least 1.");
+        conf.setControllerJobs(op.getValue("controller-jobs").getInteger());
+    }
+    if (op.getValue("controller-bandwidth").getType() != bw::OT_INVALID) {
+        if (op.getValue("controller-bandwidth").getInteger() < 0)
+            throw core::ApplicationError("The bandwidth must not be negative.");
+        conf.setControllerBandwidth(op.getValue("controller-bandwidth").getInteger());
+    }
+
+    if (op.getValue("json").getFlag())
+        conf.setJsonOutput(true);
+
+    // main() records from the start, so the trace also contains initConfig()
+    if (op.getValue("trace").getType() != bw::OT_INVALID)
+        conf.setTraceFile(op.getValue("trace").getString());
+    else {
+        core::Tracer::tracer()->setEnabled(false);
+        core::Tracer::tracer()->clear();
+    }
 
     if (conf.getDebug())
         conf.dumpConfig(std::cerr);
 
     // batch mode?
     std::vector<std::string> args = op.getArgs();
-    conf.setBatchMode(args.size() > 0);
+    conf.setBatchMode(args.size() > 0 || !conf.getServerSocket().empty() ||
+                      !conf.getScriptFile().empty());
     if (conf.getBatchMode())
         m_args = args;
 
+    if (!conf.getServerSocket().empty() && !conf.getConnectSocket().empty())
+        throw core::ApplicationError("The options --server and --connect cannot be combined.");
+    if (!conf.getServerSocket().empty() && args.size() > 0)
+        throw core::ApplicationError("The server doesn't accept commands on the command line.");
+    if (!conf.getConnectSocket().empty() && args.size() == 0)
+        throw core::ApplicationError("No commands for the server specified.");
+    if (!conf.getScriptFile().empty() && (args.size() > 0 || !conf.getServerSocket().empty() ||
+                                          !conf.getConnectSocket().empty()))
+        throw core::ApplicationError("The option --file cannot be combined with commands, "
+                                     "--server or --connect.");
+    if (conf.getJsonOutput() && (!conf.getBatchMode() || !conf.getConnectSocket().empty()))
+        throw core::ApplicationError("The option --json needs commands, --file or --server. "
+                                     "A client gets the output format of the server.");
+
     if (conf.isOffline() && !conf.getBatchMode())
         std::cout << "WARNING: You're using usbprog in offline mode!" << std::endl;
 
-    if (!conf.getBatchMode())
+    // the JobServer reports the progress of each job to the client of the job
+    if (conf.getJsonOutput() && conf.getServerSocket().empty()) {
+        m_progressNotifier = new JsonProgressNotifier(std::cout);
+        m_progressReporter = new core::ProgressReporter(m_progressNotifier);
+    } else if (!conf.getBatchMode()) {
         m_progressNotifier = new HashNotifier(DEFAULT_TERMINAL_WIDTH);
+        m_progressReporter = new core::ProgressReporter(m_progressNotifier);
+    }
 }
 
 void Usbprog::initFirmwarePool()
 {
+    core::TraceSpan span("Usbprog::initFirmwarePool");
     CliConfiguration &conf = CliConfiguration::config();
 
+    // the client doesn't need Qt, so create the application object only here
+    if (!m_coreApp)
+        m_coreApp = new QCoreApplication(m_argc, m_argv);
+
     try {
         m_firmwarepool = new Firmwarepool(conf.getDataDir());
         m_firmwarepool->setIndexUpdatetime(AUTO_NOT_UPDATE_TIME);
-        if (!conf.isOffline())
-            m_firmwarepool->downloadIndex(conf.getIndexUrl());
+        m_firmwarepool->setCompressCache(conf.isCompressCache());
         if (!conf.getDebug())
-            m_firmwarepool->setProgress(m_progressNotifier);
-        m_firmwarepool->readIndex();
+            m_firmwarepool->setProgress(m_progressReporter);
     } catch (const std::runtime_error &re) {
         throw core::ApplicationError(re.what());
     }
@@ -176,14 +407,20 @@ void Usbprog::initFirmwarePool()
 
 void Usbprog::initDeviceManager()
 {
-    bool debug = CliConfiguration::config().getDebug();
-    m_devicemanager = new core::DeviceManager(debug);
+    core::TraceSpan span("Usbprog::initDeviceManager");
+    CliConfiguration &conf = CliConfiguration::config();
+
+    try {
+        m_devicemanager = new core::DeviceManager(conf.getDebug());
+        if (conf.isUseSysfs())
+            m_devicemanager->setSysfsRoot(DEFAULT_SYSFS_ROOT);
+    } catch (const core::IOError &err) {
+        throw core::ApplicationError(err.what());
+    }
 }
 
-void Usbprog::exec()
+void Usbprog::addCommands(Shell &sh, DependencyResolver *resolver)
 {
-    Shell sh("(usbprog) ");
-
     sh.addCommand(new CopyingCommand);
     sh.addCommand(new ListCommand(m_firmwarepool));
     sh.addCommand(new InfoCommand(m_firmwarepool));
@@ -192,15 +429,83 @@ void Usbprog::exec()
     sh.addCommand(new CacheCommand(m_firmwarepool));
     sh.addCommand(new DevicesCommand(m_devicemanager, m_firmwarepool));
     sh.addCommand(new DeviceCommand(m_devicemanager, m_firmwarepool));
-    sh.addCommand(new UploadCommand(m_devicemanager, m_firmwarepool));
+    sh.addCommand(new UploadCommand(m_devicemanager, m_firmwarepool, resolver));
+    sh.addCommand(new FlashPlanCommand(m_devicemanager, m_firmwarepool));
     sh.addCommand(new StartCommand(m_devicemanager));
     sh.addCommand(new ResetCommand(m_devicemanager));
-    if (CliConfiguration::config().getBatchMode())
+}
+
+void Usbprog::exec()
+{
+    FirmwareIndexLoader loader(m_firmwarepool, m_devicemanager);
+    Shell sh("(usbprog) ");
+    addCommands(sh, &loader);
+
+    // the server and the interactive shell (for the completion) need the index anyway
+    CliConfiguration &conf = CliConfiguration::config();
+    if (!conf.getServerSocket().empty() || (conf.getScriptFile().empty() && !conf.getBatchMode()))
+        loader.resolve(DEP_FIRMWAREPOOL);
+    sh.setDependencyResolver(&loader);
+
+    if (!conf.getServerSocket().empty()) {
+        JobServer server(&sh, m_devicemanager, m_firmwarepool);
+        server.listen(conf.getServerSocket());
+        server.run();
+    } else if (!conf.getScriptFile().empty())
+        runScript(sh, conf.getScriptFile());
+    else if (conf.getBatchMode())
         sh.run(m_args);
     else
         sh.run();
 }
 
+bool Usbprog::isClient() const
+{
+    return !CliConfiguration::config().getConnectSocket().empty();
+}
+
+bool Usbprog::execClient()
+{
+    // the commands only tell which arguments are file names, they are not executed here
+    Shell sh("(usbprog) ");
+    addCommands(sh, NULL);
+
+    JobClient client(CliConfiguration::config().getConnectSocket(), &sh);
+    return client.execute(m_args, std::cout);
+}
+
+void Usbprog::runScript(Shell &sh, const std::string &fileName)
+{
+    size_t failed;
+    if (fileName == "-")
+        failed = sh.runScript(std::cin, "stdin");
+    else {
+        std::ifstream file(fileName.c_str());
+        if (!file)
+            throw core::ApplicationError("Unable to open the script " + fileName + ".");
+        failed = sh.runScript(file, fileName);
+    }
+
+    if (failed > 0) {
+        std::stringstream ss;
+        ss << failed << " commands of the script have failed.";
+        throw core::ApplicationError(ss.str());
+    }
+}
+
+void Usbprog::writeTrace()
+{
+    std::string traceFile = CliConfiguration::config().getTraceFile();
+    if (traceFile.empty())
+        return;
+
+    try {
+        core::Tracer::tracer()->writeChromeTrace(traceFile);
+    } catch (const core::IOError &err) {
+        throw core::ApplicationError(err.what());
+    }
+}
+
 /* }}} */
 
 } // end namespace cli
@@ -27,15 +27,21 @@
 #define USBPROG_H
 
 #include <stdexcept>
+#include <string>
+#include <ostream>
 
 #include <QCoreApplication>
 
 #include <usbprog-core/devices.h>
+#include <usbprog-core/binarylog.h>
 #include <usbprog/firmwarepool.h>
 
 namespace usbprog {
 namespace cli {
 
+class Shell;
+class DependencyResolver;
+
 /* constants {{{ */
 
 /// Used when the width of the terminal cannot be retrieved using the ioctl() call.
@@ -71,12 +77,66 @@ public:
     /// @copydoc core::ProgressNotifier::progressed()
     int progressed(double total, double now);
 
+    /**
+     * @brief Shows the throughput and the remaining time right of the hashes
+     *
+     * Once this has been called, progressed() redraws the whole line instead of appending
+     * hashes.
+     *
+     * @param[in] perSecond the throughput in bytes per second
+     * @param[in] secondsLeft the estimated remaining time in seconds
+     */
+    void progressedRate(double perSecond, double secondsLeft);
+
     /// @copydoc core::ProgressNotifier::finished()
     void finished();
 
 private:
     int m_width;
     int m_lastProgress;
+    std::string m_rate;
+};
+
+/* }}} */
+/* JsonProgressNotifier {{{ */
+
+/**
+ * @class JsonProgressNotifier cli/usbprog.h
+ * @brief ProgressNotifier implementation that prints JSON records
+ *
+ * Each call of progressed() prints a record
+ * <tt>{"type":"progress","total":...,"done":...}</tt>, finished() prints a last record with
+ * @c "done" equal to @c "total". If the notifier is wrapped in a
+ * core::ProgressReporter, the record also contains the members @c "rate" (bytes per second)
+ * and @c "eta" (seconds).
+ *
+ * @author Bernhard Walle <bernhard@bwalle.de>
+ * @ingroup cli
+ */
+class JsonProgressNotifier : public core::ProgressNotifier {
+public:
+    /**
+     * @brief Constructor
+     *
+     * @param[in] os the stream to which the records are written
+     */
+    JsonProgressNotifier(std::ostream &os);
+
+public:
+    /// @copydoc core::ProgressNotifier::progressed()
+    int progressed(double total, double now);
+
+    /// @copydoc core::ProgressNotifier::progressedRate()
+    void progressedRate(double perSecond, double secondsLeft);
+
+    /// @copydoc core::ProgressNotifier::finished()
+    void finished();
+
+private:
+    std::ostream &m_os;
+    double m_total;
+    double m_rate;
+    double m_secondsLeft;
 };
 
 /* }}} */
@@ -125,6 +185,10 @@ public:
     /**
      * @brief Initializes the firmware pool
      *
+     * The index is not read here. The interactive shell and the JobServer read it in exec(),
+     * in batch and script mode it is read before the first command that needs it (see
+     * Command::getDependencies()).
+     *
      * @exception core::ApplicationError if initializing of the firmware pool failed
      */
     void initFirmwarePool();
@@ -139,24 +203,72 @@ public:
     /**
      * @brief Executes the application
      *
-     * This function blocks.
+     * Runs the shell in interactive or batch mode or, if a server socket has been specified
+     * on the command line, runs the JobServer. This function blocks.
      *
      * @exception core::ApplicationError if something went wrong
      */
     void exec();
 
+    /**
+     * @brief Checks if the commands should be sent to a JobServer
+     *
+     * In that case, neither initFirmwarePool() nor initDeviceManager() need to be called
+     * before execClient().
+     *
+     * @return @c true if a server socket to connect to has been specified on the command line
+     */
+    bool isClient() const;
+
+    /**
+     * @brief Sends the commands to a JobServer and prints the output
+     *
+     * @return @c true if all commands have been executed successfully, @c false otherwise
+     * @exception core::ApplicationError if the server cannot be reached
+     */
+    bool execClient();
+
+    /**
+     * @brief Writes the trace of the run
+     *
+     * Does nothing if no trace file has been specified on the command line.
+     *
+     * @exception core::ApplicationError if the trace file cannot be written
+     */
+    void writeTrace();
+
 protected:
     /**
      * @brief Prints the help
      */
     void printHelp();
 
+    /**
+     * @brief Adds the commands of the application to @p sh
+     *
+     * @param[in,out] sh the shell
+     * @param[in] resolver the resolver for the commands that need a resource only in some
+     *            cases, may be @c NULL (still owned by the caller)
+     */
+    void addCommands(Shell &sh, DependencyResolver *resolver);
+
+    /**
+     * @brief Executes the commands of a script
+     *
+     * @param[in] sh the shell that executes the commands
+     * @param[in] fileName the name of the script or <tt>"-"</tt> for the standard input
+     * @exception core::ApplicationError if the script cannot be read or if a command has failed
+     */
+    void runScript(Shell &sh, const std::string &fileName);
+
 private:
-    QCoreApplication m_coreApp;
+    QCoreApplication *m_coreApp;
     Firmwarepool *m_firmwarepool;
     std::vector<std::string> m_args;
     core::DeviceManager *m_devicemanager;
     core::ProgressNotifier *m_progressNotifier;
+    core::ProgressNotifier *m_progressReporter;
+    core::BinaryLogWriter *m_binaryLog;
     int m_argc;
     char **m_argv;
 };
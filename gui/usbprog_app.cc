@@ -128,6 +128,8 @@ bool UsbprogApplication::parseCommandLine(int argc, char **argv, int &exitCode)
                  "Uses the specified data " "directory instead of " + conf.getDataDir());
     op.addOption("offline", 'o', bw::OT_FLAG,
                  "Use only the local cache and don't connect to the internet");
+    op.addOption("compress-cache", 'z', bw::OT_FLAG,
+                 "Store downloaded firmware files compressed in the cache");
     op.addOption("debug",   'D', bw::OT_FLAG,
                  "Enables debug output");
 
@@ -148,6 +150,8 @@ bool UsbprogApplication::parseCommandLine(int argc, char **argv, int &exitCode)
         conf.setDataDir(op.getValue("datadir").getString());
     if (op.getValue("offline").getFlag())
         conf.setOffline(true);
+    if (op.getValue("compress-cache").getFlag())
+        conf.setCompressCache(true);
 
     if (conf.getDebug())
         conf.dumpConfig(std::cerr);
@@ -33,8 +33,11 @@
 #include <QFileSystemModel>
 #include <QCompleter>
 
+#include <usbpp/clock.h>
+
 #include <usbprog-core/debug.h>
 #include <usbprog-core/util.h>
+#include <usbprog-core/firmwareimage.h>
 
 #include "usbprog_mainwindow.h"
 #include "usbprog_app.h"
@@ -43,6 +46,9 @@
 #include "config.h"
 #include "pindialog.h"
 
+// minimal time between two updates of the progress bar in microseconds
+#define PROGRESS_UPDATE_INTERVAL    50000
+
 #ifdef WITH_DRIVERINSTALLER
 #  include "driverassistant.h"
 #endif
@@ -54,6 +60,7 @@ namespace gui {
 
 ProgressBarProgressNotifier::ProgressBarProgressNotifier(QProgressBar *progressBar, QStatusBar *statusBar)
     : m_progressBar(progressBar)
+    , m_lastUpdate(0)
     , m_statusBar(statusBar)
 {}
 
@@ -64,6 +71,11 @@ void ProgressBarProgressNotifier::setStatusMessage(const QString &statusMessage)
 
 int ProgressBarProgressNotifier::progressed(double total, double now)
 {
+    unsigned long long time = usb::usbpp_now_us();
+    if (now < total && time - m_lastUpdate < PROGRESS_UPDATE_INTERVAL)
+        return true;
+    m_lastUpdate = time;
+
     m_progressBar->setValue(now*1000);
     m_progressBar->setMaximum(total*1000);
     return true;
@@ -71,6 +83,7 @@ int ProgressBarProgressNotifier::progressed(double total, double now)
 
 void ProgressBarProgressNotifier::finished()
 {
+    m_lastUpdate = 0;
     m_progressBar->setValue(1000);
     m_progressBar->setMaximum(1000);
 
@@ -112,6 +125,7 @@ UsbprogMainWindow::UsbprogMainWindow(UsbprogApplication &app)
     m_deviceManager = new core::DeviceManager;
     m_deviceManager->setCustomSleeper(new QtSleeper);
     m_firmwarepool = new Firmwarepool(GuiConfiguration::config().getDataDir());
+    m_firmwarepool->setCompressCache(GuiConfiguration::config().isCompressCache());
     m_progressNotifier = new ProgressBarProgressNotifier(m_widgets.mainProgress, statusBar());
     m_firmwarepool->setProgress(m_progressNotifier);
 
@@ -532,12 +546,12 @@ void UsbprogMainWindow::uploadFirmware()
     assert(updateDevice != NULL);
 
     // download firmware if necessary
-    core::ByteVector fwData;
+    core::FirmwareImage fwImage;
     std::string fwName;
     if (fw) {
         if (!downloadFirmware(fw->getName()))
             return;
-        fwData = fw->getData();
+        fwImage = core::FirmwareImage(fw->getData());
         fwName = fw->getName();
     } else {
         std::string firmwareFileName = m_widgets.fileEdit->text().toStdString();
@@ -547,12 +561,17 @@ void UsbprogMainWindow::uploadFirmware()
         }
 
         try {
-            fwData = core::Fileutil::readBytesFromFile(firmwareFileName);
+            fwImage = core::FirmwareImage::readFromFile(firmwareFileName);
         } catch (const core::IOError &ioe) {
             QMessageBox::critical(this, UsbprogApplication::NAME,
                                   tr("Error while reading data from file:\n\n%1").arg(
                                       QString::fromUtf8(ioe.what())));
             return;
+        } catch (const core::ParseError &pe) {
+            QMessageBox::critical(this, UsbprogApplication::NAME,
+                                  tr("Invalid firmware file:\n\n%1").arg(
+                                      QString::fromUtf8(pe.what())));
+            return;
         }
         fwName = "File '" + firmwareFileName + "'";
     }
@@ -578,6 +597,7 @@ void UsbprogMainWindow::uploadFirmware()
         return;
     }
     core::UsbprogUpdater updater(updateDevice);
+    updater.setTransferPolicy(m_deviceManager->getTransferPolicy());
 
     try {
         m_progressNotifier->setStatusMessage(QString());
@@ -589,7 +609,7 @@ void UsbprogMainWindow::uploadFirmware()
 
         USBPROG_DEBUG_DBG("Writing firmware");
         statusBar()->showMessage(tr("Writing firmware ..."), DEFAULT_MESSAGE_TIMEOUT);
-        updater.writeFirmware(fwData);
+        updater.writeFirmware(fwImage);
 
         USBPROG_DEBUG_DBG("Starting device");
         statusBar()->showMessage(tr("Starting device ..."), DEFAULT_MESSAGE_TIMEOUT);
@@ -76,7 +76,16 @@ public:
      */
     void setStatusMessage(const QString &statusMessage);
 
-    /// @copydoc core::ProgressNotifier::progressed()
+    /**
+     * @brief Updates the progress bar
+     *
+     * The operation runs in the GUI thread, so the progress bar cannot be updated from a
+     * core::ProgressReporter. Instead, the widget is updated at most every 50 ms.
+     *
+     * @param[in] total the total number of bytes
+     * @param[in] now the number of bytes that have been processed
+     * @return always @c true
+     */
     int progressed(double total, double now);
 
     /// @copydoc core::ProgressNotifier::finished()
@@ -90,6 +99,7 @@ protected slots:
 
 private:
     QProgressBar *m_progressBar;
+    unsigned long long m_lastUpdate;
     QString m_statusMessage;
     QStatusBar *m_statusBar;
 };
@@ -0,0 +1,127 @@
+/*
+ * (c) 2010, Bernhard Walle <bernhard@bwalle.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <cstdlib>
+#include <cstdio>
+#include <ctime>
+
+#include <usbprog-core/binarylog.h>
+#include <usbprog-core/debug.h>
+#include <usbprog-core/types.h>
+
+using usbprog::core::BinaryLogReader;
+using usbprog::core::BinaryLogMessage;
+using usbprog::core::Debug;
+
+/* Helpers {{{ */
+
+static void printUsage(std::ostream &os)
+{
+    os << "Usage: usbprog-logdump [-h] [-l trace|debug|info] file..." << std::endl;
+}
+
+static const char *levelName(int level)
+{
+    if (level >= Debug::DL_INFO)
+        return "INFO";
+    else if (level >= Debug::DL_DEBUG)
+        return "DEBUG";
+    else
+        return "TRACE";
+}
+
+static void dump(const std::string &filename, int minLevel)
+{
+    BinaryLogReader reader(filename);
+    BinaryLogMessage message;
+
+    // the time stamps are relative to the start, the start time has only a resolution of
+    // seconds
+    std::time_t start = reader.getStartTime();
+    char date[40];
+    std::strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", std::localtime(&start));
+    std::cout << "# " << filename << ", started " << date << "\n";
+
+    while (reader.read(message)) {
+        if (message.level < minLevel)
+            continue;
+
+        std::string text = message.text;
+        if (text.size() > 0 && text[text.size()-1] == '\n')
+            text.erase(text.size()-1);
+
+        char timestamp[40];
+        std::sprintf(timestamp, "%6lu.%06lu",
+                     static_cast<unsigned long>(message.timestamp / 1000000),
+                     static_cast<unsigned long>(message.timestamp % 1000000));
+
+        std::cout << timestamp << " [" << message.thread << "] "
+                  << levelName(message.level) << ": " << text << "\n";
+    }
+    std::cout.flush();
+}
+
+/* }}} */
+
+int main(int argc, char *argv[])
+{
+    usbprog::core::StringVector files;
+    int minLevel = Debug::DL_TRACE;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg(argv[i]);
+
+        if (arg == "-h" || arg == "--help") {
+            printUsage(std::cout);
+            return EXIT_SUCCESS;
+        } else if (arg == "-l" || arg == "--level") {
+            std::string level = i+1 < argc ? argv[++i] : "";
+            if (level == "trace")
+                minLevel = Debug::DL_TRACE;
+            else if (level == "debug")
+                minLevel = Debug::DL_DEBUG;
+            else if (level == "info")
+                minLevel = Debug::DL_INFO;
+            else {
+                std::cerr << "Error: Invalid level '" << level << "'." << std::endl;
+                return EXIT_FAILURE;
+            }
+        } else
+            files.push_back(arg);
+    }
+
+    if (files.size() == 0) {
+        printUsage(std::cerr);
+        return EXIT_FAILURE;
+    }
+
+    try {
+        for (usbprog::core::StringVector::const_iterator it = files.begin();
+                it != files.end(); ++it)
+            dump(*it, minLevel);
+    } catch (const std::runtime_error &e) {
+        std::cout.flush();
+        std::cerr << "Error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
@@ -0,0 +1,87 @@
+/*
+ * (c) 2010, Bernhard Walle <bernhard@bwalle.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <iostream>
+#include <stdexcept>
+#include <cstdlib>
+
+#include <usbpp/sim/simulator.h>
+#include <usbprog-core/devices.h>
+#include <usbprog-core/firmwareimage.h>
+#include <usbprog-core/types.h>
+
+using usbprog::core::ByteVector;
+using usbprog::core::Device;
+using usbprog::core::DeviceManager;
+using usbprog::core::FirmwareImage;
+using usbprog::core::UsbprogUpdater;
+
+/* Helpers {{{ */
+
+static bool check(bool condition, const char *message)
+{
+    if (!condition)
+        std::cerr << "FAILED: " << message << std::endl;
+    return condition;
+}
+
+/* }}} */
+/* Tests {{{ */
+
+// the upload must survive messages that reached the bootloader but timed out
+static bool testLostAcknowledgements()
+{
+    usb::Simulator &simulator = usb::Simulator::instance();
+    simulator.setSeed(42);
+    simulator.setFaultRates(0.0, 0.02, 0.05);
+
+    ByteVector data;
+    for (int i = 0; i < 4096; i++)
+        data.push_back((i * 7 + i / 64) & 0xff);
+
+    DeviceManager deviceManager;
+    deviceManager.discoverUpdateDevices();
+    Device *dev = deviceManager.getCurrentUpdateDevice();
+    if (!check(dev != NULL, "no simulated update device"))
+        return false;
+
+    UsbprogUpdater updater(dev);
+    updater.updateOpen();
+    updater.writeFirmware(FirmwareImage(data));
+    updater.updateClose();
+
+    const std::vector<unsigned char> &flash = simulator.getDevice(0)->getFlash();
+    return check(simulator.getLostAckTransfers() > 0, "no acknowledgement got lost") &&
+           check(flash.size() >= data.size() &&
+                 std::equal(data.begin(), data.end(), flash.begin()), "flash differs");
+}
+
+/* }}} */
+
+int main()
+{
+    try {
+        if (!testLostAcknowledgements())
+            return EXIT_FAILURE;
+    } catch (const std::runtime_error &e) {
+        std::cerr << "FAILED: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
@@ -0,0 +1,125 @@
+/*
+ * (c) 2010, Bernhard Walle <bernhard@bwalle.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file bufferpool.h
+ * @brief Contains the BufferPool
+ *
+ * @author Bernhard Walle <bernhard@bwalle.de>
+ * @ingroup usbpp
+ */
+
+#ifndef USBPP_BUFFERPOOL_H
+#define USBPP_BUFFERPOOL_H
+
+#include <cstddef>
+
+#include <usbpp/exceptions.h>
+
+namespace usb {
+
+/* Forward declarations {{{ */
+
+struct BufferPoolPrivate;
+
+/* }}} */
+
+/* BufferPool {{{ */
+/**
+ * @class BufferPool usbpp/usbpp.h
+ * @brief Pool of transfer buffers for one DeviceHandle
+ *
+ * The buffers can be passed to DeviceHandle::bulkTransfer() and
+ * DeviceHandle::controlTransfer() directly. If the backend and the operating system support it
+ * (libusb 1.0.21 or newer on Linux), the buffers are allocated as device memory which is mapped
+ * into the kernel, so libusb doesn't have to copy the data for each transfer. Otherwise, the
+ * buffers are page-aligned heap memory.
+ *
+ * Buffers are allocated on demand and reused after release(). All buffers are freed by the
+ * destructor, so the pool must be deleted @b before the DeviceHandle it has been created from.
+ *
+ * @author Bernhard Walle <bernhard@bwalle.de>
+ * @ingroup usbpp
+ */
+class BufferPool
+{
+    friend class DeviceHandle;
+
+    public:
+        virtual ~BufferPool();
+
+        /**
+         * @brief Returns the size of each buffer
+         *
+         * @return the buffer size in bytes
+         */
+        size_t getBufferSize() const;
+
+        /**
+         * @brief Checks if the buffers are device memory
+         *
+         * @return @c true if the buffers are mapped into the kernel, @c false if they are
+         *         ordinary heap memory
+         */
+        bool isDeviceMemory() const;
+
+        /**
+         * @brief Gets a buffer from the pool
+         *
+         * The contents of the buffer are undefined, except for newly allocated buffers which
+         * are zeroed.
+         *
+         * @return a pointer to getBufferSize() bytes, owned by the pool
+         * @exception Error if no memory could be allocated
+         */
+        unsigned char *acquire();
+
+        /**
+         * @brief Gives a buffer back to the pool
+         *
+         * @param[in] buffer a buffer that has been returned by acquire()
+         * @exception Error if @p buffer doesn't belong to the pool
+         */
+        void release(unsigned char *buffer);
+
+    protected:
+        /**
+         * @brief Constructor
+         *
+         * Creates a new BufferPool object. Use DeviceHandle::createBufferPool().
+         *
+         * @param[in] nativeHandle the libusb handle of the opened device
+         * @param[in] bufferSize the size of each buffer in bytes
+         */
+        BufferPool(void *nativeHandle, size_t bufferSize);
+
+    private:
+        // noncopyable
+        BufferPool(const BufferPool &other);
+        BufferPool &operator=(const BufferPool &other);
+
+    private:
+        BufferPoolPrivate *const m_data;
+};
+
+/* }}} */
+
+} // end namespace usb
+
+#endif /* USBPP_BUFFERPOOL_H */
+
+// vim: set sw=4 ts=4 et: :collapseFolds=1:
@@ -0,0 +1,72 @@
+/*
+ * (c) 2010, Bernhard Walle <bernhard@bwalle.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef _WIN32
+#  include <windows.h>
+#else
+#  include <time.h>
+#  include <sys/time.h>
+#endif
+
+#include <usbpp/clock.h>
+
+namespace usb {
+
+#ifdef _WIN32
+
+unsigned long long usbpp_now_us()
+{
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return counter.QuadPart / frequency.QuadPart * 1000000ULL +
+           counter.QuadPart % frequency.QuadPart * 1000000ULL / frequency.QuadPart;
+}
+
+void usbpp_usleep(unsigned long long us)
+{
+    Sleep(static_cast<DWORD>((us + 999) / 1000));
+}
+
+#else
+
+unsigned long long usbpp_now_us()
+{
+#if defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+        return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+#endif
+
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000000ULL + tv.tv_usec;
+}
+
+void usbpp_usleep(unsigned long long us)
+{
+    struct timespec ts;
+
+    ts.tv_sec = us / 1000000;
+    ts.tv_nsec = (us % 1000000) * 1000;
+    nanosleep(&ts, NULL);
+}
+
+#endif
+
+} // end namespace usb
+
+// vim: set sw=4 ts=4 et: :collapseFolds=1:
@@ -0,0 +1,51 @@
+/*
+ * (c) 2010, Bernhard Walle <bernhard@bwalle.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file clock.h
+ * @brief Time functions with microsecond resolution
+ *
+ * @author Bernhard Walle <bernhard@bwalle.de>
+ * @ingroup usbpp
+ */
+
+#ifndef USBPP_CLOCK_H
+#define USBPP_CLOCK_H
+
+namespace usb {
+
+/**
+ * @brief Returns a monotonic time stamp
+ *
+ * @return the current time in microseconds, relative to an unspecified point in time
+ * @ingroup usbpp
+ */
+unsigned long long usbpp_now_us();
+
+/**
+ * @brief Sleeps
+ *
+ * @param[in] us the number of microseconds to sleep
+ * @ingroup usbpp
+ */
+void usbpp_usleep(unsigned long long us);
+
+} // end namespace usb
+
+#endif /* USBPP_CLOCK_H */
+
+// vim: set sw=4 ts=4 et: :collapseFolds=1:
@@ -26,6 +26,8 @@
 #ifndef USBPP_CONFIGDESCRIPTOR_H
 #define USBPP_CONFIGDESCRIPTOR_H
 
+#include <vector>
+
 #include <usbpp/exceptions.h>
 #include <usbpp/devicedescriptor.h>
 
@@ -85,11 +87,11 @@ public:
      *
      * @param[in] interfaceNumber the interface number for which the interface descriptor should be returned
      * @param[in] altsetting the alternate setting for which  the interface descriptor should be returned
-     * @return the InterfaceDescriptor. The pointer is still owned by the ConfigDescriptor.
+     * @return the InterfaceDescriptor, owned by the ConfigDescriptor
      * @exception Error on any error
      */
-    InterfaceDescriptor *getInterfaceDescriptor(unsigned int interfaceNumber,
-                                                unsigned int altsetting);
+    const InterfaceDescriptor &getInterfaceDescriptor(unsigned int interfaceNumber,
+                                                      unsigned int altsetting) const;
 
 protected:
     /**
@@ -99,6 +101,18 @@ protected:
      */
     ConfigDescriptor(void *nativeHandle);
 
+    /**
+     * @brief Constructor
+     *
+     * Creates a config descriptor that is not backed by the USB library, e.g. when replaying
+     * a transfer trace.
+     *
+     * @param[in] configurationValue the configuration value
+     * @param[in] interfaceNumbers for each interface, the interface numbers of all altsettings
+     */
+    ConfigDescriptor(unsigned short configurationValue,
+                     const std::vector< std::vector<unsigned short> > &interfaceNumbers);
+
 private:
     // noncopyable
     ConfigDescriptor(const ConfigDescriptor &other);
@@ -26,6 +26,9 @@
 #ifndef USBPP_DEVICE_H
 #define USBPP_DEVICE_H
 
+#include <string>
+#include <vector>
+
 #include <usbpp/exceptions.h>
 #include <usbpp/devicedescriptor.h>
 
@@ -36,6 +39,7 @@ namespace usb {
 class DeviceHandle;
 class UsbManager;
 class ConfigDescriptor;
+struct TraceRecord;
 struct DevicePrivate;
 
 /* }}} */
@@ -75,22 +79,39 @@ class Device
          */
         unsigned short getBusNumber() const;
 
+        /**
+         * @brief Returns the physical location of the device
+         *
+         * The port path consists of the bus number and the port numbers from the root hub to
+         * the device in the notation of Linux sysfs, e.g. @c "1-1.3". In contrast to the device
+         * number, it doesn't change when the device re-enumerates.
+         *
+         * @return the port path or an empty string if the USB library doesn't provide the
+         *         port numbers
+         */
+        std::string getPortPath() const;
+
         /**
          * @brief Returns the device descriptor
          *
-         * @return the device descriptor of the device
-         * @exception Error on any error
+         * The descriptor is read once when the Device is created, so calling this function
+         * is cheap.
+         *
+         * @return the device descriptor of the device, valid as long as the Device exists
          */
-        DeviceDescriptor getDescriptor() const;
+        const DeviceDescriptor &getDescriptor() const;
 
         /**
          * @brief Returns the config descriptor for a specific configuration
          *
+         * The descriptors are read when the UsbManager builds the device list, so calling this
+         * function is cheap and doesn't modify the Device.
+         *
          * @param[in] index the configuration number (see the DeviceDescriptor for the number of configurations)
-         * @return the config descriptor for configuration @p index
+         * @return the config descriptor for configuration @p index, valid as long as the Device exists
          * @exception Error on any error
          */
-        ConfigDescriptor *getConfigDescriptor(int index);
+        const ConfigDescriptor &getConfigDescriptor(int index) const;
 
         /**
          * @brief Opens the device and returns a DeviceHandle
@@ -109,10 +130,38 @@ class Device
          * Creates a new device.
          *
          * @param[in] nativeHandle the libusb handle for the InterfaceDescriptor
+         * @exception Error if the device descriptor cannot be read
          */
         Device(void *nativeHandle);
 
+        /**
+         * @brief Constructor
+         *
+         * Creates a new device without native handle, e.g. from the information in sysfs.
+         * The native device is looked up by bus and device number when it's needed.
+         *
+         * @param[in] busNumber the bus number
+         * @param[in] deviceNumber the device number on the bus
+         * @param[in] descriptor the device descriptor
+         * @param[in] portPath the port path (see getPortPath()), may be empty
+         */
+        Device(unsigned short busNumber, unsigned short deviceNumber,
+               const DeviceDescriptor &descriptor, const std::string &portPath = std::string());
+
     private:
+        // returns the native device, looks it up if the Device has been created without one
+        void *getNativeDevice() const;
+
+        // creates a config descriptor from a TR_CONFIG record
+        ConfigDescriptor *configDescriptorFromTrace(const TraceRecord &record) const;
+
+        // reads the config descriptors, called by the UsbManager when it builds the device
+        // list; uses the raw descriptors from sysfs if not empty, the USB library otherwise
+        void readConfigDescriptors(const std::vector<unsigned char> &sysfsDescriptors);
+
+        // appends a config descriptor and records it in the trace
+        void addConfigDescriptor(ConfigDescriptor *configDescriptor);
+
         // noncopyable
         Device(const Device &other);
         Device &operator=(const Device &other);
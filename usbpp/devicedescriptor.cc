@@ -22,6 +22,15 @@ namespace usb {
 
 /* DeviceDescriptor {{{ */
 
+DeviceDescriptor::DeviceDescriptor()
+    : m_bDeviceClass(0)
+    , m_bDeviceSubClass(0)
+    , m_idVendor(0)
+    , m_idProduct(0)
+    , m_bcdDevice(0)
+    , m_bNumConfigurations(0)
+{}
+
 unsigned short DeviceDescriptor::getDeviceClass() const
 {
     return m_bDeviceClass;
@@ -72,6 +81,16 @@ void DeviceDescriptor::setBcdDevice(unsigned short bcdDevice)
     m_bcdDevice = bcdDevice;
 }
 
+unsigned short DeviceDescriptor::getNumConfigurations() const
+{
+    return m_bNumConfigurations;
+}
+
+void DeviceDescriptor::setNumConfigurations(unsigned short numConfigurations)
+{
+    m_bNumConfigurations = numConfigurations;
+}
+
 /* }}} */
 
 std::ostream &operator<<(std::ostream &os, const DeviceDescriptor &desc)
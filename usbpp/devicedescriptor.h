@@ -44,6 +44,14 @@ namespace usb {
  */
 class DeviceDescriptor
 {
+public:
+    /**
+     * @brief Constructor
+     *
+     * Creates an empty descriptor, all values are 0.
+     */
+    DeviceDescriptor();
+
 public:
     /**
      * @brief Returns the USB device class
@@ -114,12 +122,27 @@ public:
      */
     void setBcdDevice(unsigned short bcdDevice);
 
+    /**
+     * @brief Returns the number of configurations
+     *
+     * @return the number of configurations
+     */
+    unsigned short getNumConfigurations() const;
+
+    /**
+     * @brief Sets the number of configurations
+     *
+     * @param[in] numConfigurations the number of configurations
+     */
+    void setNumConfigurations(unsigned short numConfigurations);
+
 private:
     unsigned short  m_bDeviceClass;
     unsigned short  m_bDeviceSubClass;
     unsigned int    m_idVendor;
     unsigned int    m_idProduct;
     unsigned short  m_bcdDevice;
+    unsigned short  m_bNumConfigurations;
 };
 
 /**
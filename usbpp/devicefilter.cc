@@ -0,0 +1,47 @@
+/*
+ * (c) 2010, Bernhard Walle <bernhard@bwalle.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <usbpp/devicefilter.h>
+
+namespace usb {
+
+/* DeviceFilter {{{ */
+
+static unsigned long make_id(unsigned int vendorId, unsigned int productId)
+{
+    return ((vendorId & 0xffffUL) << 16) | (productId & 0xffffUL);
+}
+
+void DeviceFilter::addDevice(unsigned int vendorId, unsigned int productId)
+{
+    m_ids.insert(make_id(vendorId, productId));
+}
+
+bool DeviceFilter::isEmpty() const
+{
+    return m_ids.empty();
+}
+
+bool DeviceFilter::matches(unsigned int vendorId, unsigned int productId) const
+{
+    return m_ids.empty() || m_ids.find(make_id(vendorId, productId)) != m_ids.end();
+}
+
+/* }}} */
+
+} // end namespace usb
+
+// vim: set sw=4 ts=4 et: :collapseFolds=1:
@@ -0,0 +1,82 @@
+/*
+ * (c) 2010, Bernhard Walle <bernhard@bwalle.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file devicefilter.h
+ * @brief Filter for the device enumeration
+ *
+ * @author Bernhard Walle <bernhard@bwalle.de>
+ * @ingroup usbpp
+ */
+
+#ifndef USBPP_DEVICEFILTER_H
+#define USBPP_DEVICEFILTER_H
+
+#include <set>
+
+namespace usb {
+
+/* DeviceFilter {{{ */
+
+/**
+ * @class DeviceFilter usbpp/usbpp.h
+ * @brief Set of vendor/product IDs for UsbManager::detectDevices()
+ *
+ * An empty filter matches all devices. Otherwise, a device matches if its vendor and
+ * product ID have been added with addDevice().
+ *
+ * @author Bernhard Walle <bernhard@bwalle.de>
+ * @ingroup usbpp
+ */
+class DeviceFilter
+{
+public:
+    /**
+     * @brief Adds a vendor/product ID pair to the filter
+     *
+     * @param[in] vendorId the USB vendor ID
+     * @param[in] productId the USB product ID
+     */
+    void addDevice(unsigned int vendorId, unsigned int productId);
+
+    /**
+     * @brief Checks if the filter is empty
+     *
+     * @return @c true if no ID has been added, i.e. the filter matches every device
+     */
+    bool isEmpty() const;
+
+    /**
+     * @brief Checks if a device matches the filter
+     *
+     * @param[in] vendorId the USB vendor ID of the device
+     * @param[in] productId the USB product ID of the device
+     * @return @c true if the filter is empty or contains the ID pair, @c false otherwise
+     */
+    bool matches(unsigned int vendorId, unsigned int productId) const;
+
+private:
+    std::set<unsigned long> m_ids;
+};
+
+/* }}} */
+
+} // end namespace usb
+
+#endif /* USBPP_DEVICEFILTER_H */
+
+// vim: set sw=4 ts=4 et: :collapseFolds=1:
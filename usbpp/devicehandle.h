@@ -26,6 +26,9 @@
 #ifndef USBPP_DEVICE_HANDLE_H
 #define USBPP_DEVICE_HANDLE_H
 
+#include <cstddef>
+#include <string>
+
 #include <usbpp/exceptions.h>
 
 namespace usb {
@@ -33,6 +36,7 @@ namespace usb {
 /* Forward declarations {{{ */
 
 struct DeviceHandlePrivate;
+class BufferPool;
 
 /* }}} */
 
@@ -105,9 +109,10 @@ class DeviceHandle
          * @param[in] data the data that should be transferred (with length @p wLength)
          * @param[in] wLength the length of the data
          * @param[in] timeout the timeout
+         * @return the number of transferred bytes, for IN requests possibly less than @p wLength
          * @exception Error on any error
          */
-        void controlTransfer(unsigned char      bmRequestType,
+        int controlTransfer(unsigned char      bmRequestType,
                              unsigned char      bRequest,
                              unsigned short     wValue,
                              unsigned short     wIndex,
@@ -131,6 +136,17 @@ class DeviceHandle
                           int               *transferred,
                           unsigned int      timeout);
 
+        /**
+         * @brief Clears the halt condition of an endpoint
+         *
+         * After a transfer has failed with Error::PIPE, the endpoint must be cleared before
+         * it accepts transfers again.
+         *
+         * @param[in] endpoint the endpoint number
+         * @exception Error on any error
+         */
+        void clearHalt(unsigned char endpoint);
+
         /**
          * @brief Resets the device
          *
@@ -141,6 +157,49 @@ class DeviceHandle
          */
         void resetDevice();
 
+        /**
+         * @brief Reads a string descriptor
+         *
+         * The descriptor is read with standard control transfers in the first language that
+         * the device supports. Characters that are not ASCII are replaced by @c '?'.
+         *
+         * @param[in] index the index of the string descriptor
+         * @param[in] timeout the timeout of each control transfer in milliseconds
+         * @return the string, empty if @p index is 0
+         * @exception Error on any error
+         */
+        std::string getStringDescriptor(unsigned char index, unsigned int timeout = 1000);
+
+        /**
+         * @brief Reads the manufacturer, product and serial number strings
+         *
+         * The string indices are taken from the device descriptor that is read from the device
+         * (and not from the cache of the USB library), so that works for all ways of
+         * enumeration.
+         *
+         * @param[out] manufacturer the manufacturer, empty if the device doesn't provide one
+         * @param[out] product the product, empty if the device doesn't provide one
+         * @param[out] serialNumber the serial number, empty if the device doesn't provide one
+         * @param[in] timeout the timeout of each control transfer in milliseconds
+         * @exception Error on any error
+         */
+        void getDeviceStrings(std::string   &manufacturer,
+                              std::string   &product,
+                              std::string   &serialNumber,
+                              unsigned int  timeout = 1000);
+
+        /**
+         * @brief Creates a pool of transfer buffers
+         *
+         * Buffers from the pool can be used for bulkTransfer() without being copied
+         * once more by the USB library if the system supports that. See BufferPool.
+         *
+         * @param[in] bufferSize the size of each buffer in bytes
+         * @return a newly created BufferPool that must be freed by the caller before this
+         *         DeviceHandle is deleted
+         */
+        BufferPool *createBufferPool(size_t bufferSize);
+
     protected:
         /**
          * @brief Constructor
@@ -40,6 +40,17 @@ namespace usb {
  * @ingroup usbpp
  */
 class Error : public std::runtime_error {
+public:
+    /**
+     * @brief Error codes that the caller may want to handle
+     */
+    enum Code {
+        OTHER,          /**< any other error */
+        TIMEOUT,        /**< the transfer timed out, the device may have received the data
+                             nevertheless */
+        PIPE            /**< the endpoint has stalled, the device didn't accept the data */
+    };
+
 public:
     /**
      * @brief Constructor
@@ -47,9 +58,24 @@ public:
      * Creates a new instance of Error.
      *
      * @param[in] string the error string
+     * @param[in] code the error code
      */
-    Error(const std::string& string)
-        : std::runtime_error(string) {}
+    Error(const std::string& string, Code code = OTHER)
+        : std::runtime_error(string)
+        , m_code(code) {}
+
+    /**
+     * @brief Returns the error code
+     *
+     * @return the error code
+     */
+    Code getCode() const
+    {
+        return m_code;
+    }
+
+private:
+    Code m_code;
 };
 
 /* }}} */
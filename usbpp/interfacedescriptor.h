@@ -73,6 +73,15 @@ protected:
      */
     InterfaceDescriptor(const void *nativeHandle);
 
+    /**
+     * @brief Constructor
+     *
+     * Creates an interface descriptor that is not backed by the USB library.
+     *
+     * @param[in] interfaceNumber the interface number
+     */
+    InterfaceDescriptor(unsigned short interfaceNumber);
+
 private:
     // noncopyable
     InterfaceDescriptor(const InterfaceDescriptor &other);
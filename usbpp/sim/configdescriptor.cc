@@ -0,0 +1,93 @@
+/*
+ * (c) 2010, Bernhard Walle <bernhard@bwalle.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <sstream>
+#include <vector>
+
+#include <usbpp/configdescriptor.h>
+#include <usbpp/interfacedescriptor.h>
+
+namespace usb {
+
+/* ConfigDescriptorPrivate {{{ */
+
+struct ConfigDescriptorPrivate {
+    unsigned short configuration_value;
+    std::vector< std::vector<InterfaceDescriptor *> > interfaces;
+};
+
+/* }}} */
+/* ConfigDescriptor {{{ */
+
+ConfigDescriptor::ConfigDescriptor(unsigned short configurationValue,
+                                   const std::vector< std::vector<unsigned short> > &interfaceNumbers)
+    : m_data(new ConfigDescriptorPrivate)
+{
+    m_data->configuration_value = configurationValue;
+
+    m_data->interfaces.resize(interfaceNumbers.size());
+    for (size_t i = 0; i < m_data->interfaces.size(); i++)
+        for (size_t j = 0; j < interfaceNumbers[i].size(); j++)
+            m_data->interfaces[i].push_back(new InterfaceDescriptor(interfaceNumbers[i][j]));
+}
+
+ConfigDescriptor::~ConfigDescriptor()
+{
+    for (size_t i = 0; i < m_data->interfaces.size(); i++)
+        for (size_t j = 0; j < m_data->interfaces[i].size(); j++)
+            delete m_data->interfaces[i][j];
+    delete m_data;
+}
+
+unsigned short ConfigDescriptor::getConfigurationValue() const
+{
+    return m_data->configuration_value;
+}
+
+size_t ConfigDescriptor::getNumberOfInterfaces() const
+{
+    return m_data->interfaces.size();
+}
+
+size_t ConfigDescriptor::getNumberOfAltsettings(unsigned int interfaceNumber) const
+{
+    if (interfaceNumber >= getNumberOfInterfaces()) {
+        std::stringstream ss;
+        ss << "Interface number " << interfaceNumber << " does not exist.";
+        throw Error(ss.str());
+    }
+
+    return m_data->interfaces[interfaceNumber].size();
+}
+
+const InterfaceDescriptor &ConfigDescriptor::getInterfaceDescriptor(unsigned interfaceNumber,
+                                                                    unsigned int altsetting) const
+{
+    if (altsetting >= getNumberOfAltsettings(interfaceNumber)) {
+        std::stringstream ss;
+        ss << "Altsetting number " << altsetting << " does not exist.";
+        throw Error(ss.str());
+    }
+
+    return *m_data->interfaces[interfaceNumber][altsetting];
+}
+
+/* }}} */
+
+} // end namespace usb
+
+
+// vim: set sw=4 ts=4 et: :collapseFolds=1:
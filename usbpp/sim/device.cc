@@ -0,0 +1,111 @@
+/*
+ * (c) 2010, Bernhard Walle <bernhard@bwalle.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <vector>
+#include <sstream>
+
+#include <usbpp/device.h>
+#include <usbpp/devicehandle.h>
+#include <usbpp/configdescriptor.h>
+#include <usbpp/sim/simulator.h>
+
+namespace usb {
+
+/* DevicePrivate {{{ */
+
+struct DevicePrivate {
+    SimulatedUsbprog                    *device;
+    unsigned short                      bus_number;
+    unsigned short                      device_number;
+    std::string                         port_path;
+    DeviceDescriptor                    descriptor;
+    std::vector<ConfigDescriptor *>     config_descriptors;
+};
+
+/* }}} */
+/* Device {{{ */
+
+Device::~Device()
+{
+    for (size_t i = 0; i < m_data->config_descriptors.size(); ++i)
+        delete m_data->config_descriptors[i];
+    delete m_data;
+}
+
+unsigned short Device::getDeviceNumber() const
+{
+    return m_data->device_number;
+}
+
+unsigned short Device::getBusNumber() const
+{
+    return m_data->bus_number;
+}
+
+std::string Device::getPortPath() const
+{
+    return m_data->port_path;
+}
+
+Device::Device(void *nativeHandle)
+    : m_data(new DevicePrivate)
+{
+    // the device number changes on re-enumeration, so remember the current state
+    m_data->device = static_cast<SimulatedUsbprog *>(nativeHandle);
+    m_data->bus_number = m_data->device->getBusNumber();
+    m_data->device_number = m_data->device->getDeviceNumber();
+    m_data->descriptor = m_data->device->getDescriptor();
+
+    const std::vector<unsigned char> &portNumbers = m_data->device->getPortNumbers();
+    std::stringstream ss;
+    ss << m_data->bus_number;
+    for (size_t i = 0; i < portNumbers.size(); ++i)
+        ss << (i == 0 ? "-" : ".") << int(portNumbers[i]);
+    m_data->port_path = ss.str();
+
+    // one configuration with one interface
+    std::vector< std::vector<unsigned short> > interfaceNumbers(1, std::vector<unsigned short>(1, 0));
+    m_data->config_descriptors.push_back(new ConfigDescriptor(1, interfaceNumbers));
+}
+
+const DeviceDescriptor &Device::getDescriptor() const
+{
+    return m_data->descriptor;
+}
+
+const ConfigDescriptor &Device::getConfigDescriptor(int index) const
+{
+    if (index < 0 || size_t(index) >= m_data->config_descriptors.size())
+        throw Error("Entity not found");
+
+    return *m_data->config_descriptors[index];
+}
+
+DeviceHandle *Device::open()
+{
+    if (!m_data->device->isConnected() ||
+            m_data->device->getDeviceNumber() != m_data->device_number)
+        throw Error("No such device (it may have been disconnected)");
+
+    return new DeviceHandle(m_data->device);
+}
+
+/* }}} */
+
+} // end namespace usb
+
+
+// vim: set sw=4 ts=4 et: :collapseFolds=1:
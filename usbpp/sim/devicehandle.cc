@@ -0,0 +1,155 @@
+/*
+ * (c) 2010, Bernhard Walle <bernhard@bwalle.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <list>
+#include <algorithm>
+
+#include <usbpp/devicehandle.h>
+#include <usbpp/bufferpool.h>
+#include <usbpp/sim/simulator.h>
+
+namespace usb {
+
+/* DeviceHandlePrivate {{{ */
+
+struct DeviceHandlePrivate {
+    SimulatedUsbprog    *device;
+    unsigned short      device_number;
+    int                 configuration;
+    std::list<int>      claimed_interfaces;
+
+    // a handle becomes invalid when the device re-enumerates
+    void checkDevice() const
+    {
+        if (device->getDeviceNumber() != device_number)
+            throw Error("No such device (it may have been disconnected)");
+    }
+};
+
+/* }}} */
+/* DeviceHandle {{{ */
+
+DeviceHandle::~DeviceHandle()
+{
+    delete m_data;
+}
+
+DeviceHandle::DeviceHandle(void *nativeHandle)
+    : m_data(new DeviceHandlePrivate)
+{
+    m_data->device = static_cast<SimulatedUsbprog *>(nativeHandle);
+    m_data->device_number = m_data->device->getDeviceNumber();
+    m_data->configuration = 0;
+}
+
+int DeviceHandle::getConfiguration() const
+{
+    m_data->checkDevice();
+    return m_data->configuration;
+}
+
+void DeviceHandle::setConfiguration(int newConfiguration)
+{
+    m_data->checkDevice();
+    if (newConfiguration != 0 && newConfiguration != 1)
+        throw Error("Entity not found");
+
+    m_data->configuration = newConfiguration;
+}
+
+void DeviceHandle::claimInterface(int interfaceNumber)
+{
+    m_data->checkDevice();
+    if (interfaceNumber != 0)
+        throw Error("Entity not found");
+    if (std::find(m_data->claimed_interfaces.begin(), m_data->claimed_interfaces.end(),
+                  interfaceNumber) != m_data->claimed_interfaces.end())
+        throw Error("Resource busy");
+
+    m_data->claimed_interfaces.push_back(interfaceNumber);
+}
+
+void DeviceHandle::releaseInterface(int interfaceNumber)
+{
+    m_data->checkDevice();
+
+    std::list<int>::iterator result = std::find(m_data->claimed_interfaces.begin(),
+                                                m_data->claimed_interfaces.end(),
+                                                interfaceNumber);
+    if (result == m_data->claimed_interfaces.end())
+        throw Error("Entity not found");
+
+    m_data->claimed_interfaces.erase(result);
+}
+
+void DeviceHandle::setInterfaceAltSetting(int interfaceNumber, int alternateSetting)
+{
+    m_data->checkDevice();
+    if (interfaceNumber != 0 || alternateSetting != 0)
+        throw Error("Entity not found");
+}
+
+int DeviceHandle::controlTransfer(unsigned char      bmRequestType,
+                                  unsigned char      bRequest,
+                                  unsigned short     wValue,
+                                  unsigned short     wIndex,
+                                  unsigned char      *data,
+                                  unsigned short     wLength,
+                                  unsigned int       timeout)
+{
+    m_data->checkDevice();
+    return m_data->device->controlTransfer(bmRequestType, bRequest, wValue, wIndex,
+                                           data, wLength, timeout);
+}
+
+void DeviceHandle::bulkTransfer(unsigned char     endpoint,
+                                unsigned char     *data,
+                                int               length,
+                                int               *transferred,
+                                unsigned int      timeout)
+{
+    m_data->checkDevice();
+    if (m_data->claimed_interfaces.empty())
+        throw Error("Entity not found");
+
+    int bytes = m_data->device->bulkTransfer(endpoint, data, length, timeout);
+    if (transferred)
+        *transferred = bytes;
+}
+
+void DeviceHandle::clearHalt(unsigned char endpoint)
+{
+    m_data->checkDevice();
+    m_data->device->clearHalt(endpoint);
+}
+
+void DeviceHandle::resetDevice()
+{
+    m_data->checkDevice();
+    m_data->device->reset();
+}
+
+BufferPool *DeviceHandle::createBufferPool(size_t bufferSize)
+{
+    return new BufferPool(m_data->device, bufferSize);
+}
+
+/* }}} */
+
+} // end namespace usb
+
+
+// vim: set sw=4 ts=4 et: :collapseFolds=1:
@@ -0,0 +1,785 @@
+/*
+ * (c) 2010, Bernhard Walle <bernhard@bwalle.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <sstream>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#ifdef _WIN32
+#  include <windows.h>
+#else
+#  include <pthread.h>
+#endif
+
+#include <usbpp/clock.h>
+#include <usbpp/sim/simulator.h>
+
+#define VENDOR_ID_USBPROG       0x1781
+#define PRODUCT_ID_USBPROG      0x0c62
+#define BCDDEVICE_UPDATE        0x0000
+
+/* the bootloader protocol */
+#define BULK_ENDPOINT           0x02
+#define CMD_STARTAPP            0x01
+#define CMD_WRITEPAGE           0x02
+#define REQUEST_UPDATE_MODE     0x01
+
+/* standard requests */
+#define REQUEST_GET_DESCRIPTOR  0x06
+#define DESCRIPTOR_DEVICE       0x01
+#define DESCRIPTOR_STRING       0x03
+#define LANGUAGE_ID_EN_US       0x0409
+#define STRING_MANUFACTURER     1
+#define STRING_PRODUCT          2
+#define STRING_SERIAL_NUMBER    3
+
+/* a root hub has enough ports for all devices of the bus */
+#define ROOT_HUB_PORTS          127
+
+namespace usb {
+
+/* Helpers {{{ */
+
+// little endian, as all multi-byte values in USB descriptors
+static void append_word(std::vector<unsigned char> &vector, unsigned short word)
+{
+    vector.push_back(word & 0xff);
+    vector.push_back(word >> 8);
+}
+
+/* }}} */
+/* SimulatorMutex {{{ */
+
+#ifdef _WIN32
+
+struct SimulatorMutex {
+    CRITICAL_SECTION section;
+
+    SimulatorMutex()  { InitializeCriticalSection(&section); }
+    ~SimulatorMutex() { DeleteCriticalSection(&section); }
+    void lock()       { EnterCriticalSection(&section); }
+    void unlock()     { LeaveCriticalSection(&section); }
+};
+
+#else
+
+struct SimulatorMutex {
+    pthread_mutex_t mutex;
+
+    SimulatorMutex()  { pthread_mutex_init(&mutex, NULL); }
+    ~SimulatorMutex() { pthread_mutex_destroy(&mutex); }
+    void lock()       { pthread_mutex_lock(&mutex); }
+    void unlock()     { pthread_mutex_unlock(&mutex); }
+};
+
+#endif
+
+class SimulatorLocker {
+public:
+    SimulatorLocker(SimulatorMutex *mutex) : m_mutex(mutex) { m_mutex->lock(); }
+    ~SimulatorLocker() { m_mutex->unlock(); }
+
+private:
+    SimulatorMutex *m_mutex;
+};
+
+/* }}} */
+/* SimulatedHub {{{ */
+
+SimulatedHub::SimulatedHub(SimulatedHub *parent, unsigned short busNumber,
+                           unsigned short deviceNumber, unsigned short numberOfPorts)
+    : m_parent(parent)
+    , m_busNumber(busNumber)
+    , m_deviceNumber(deviceNumber)
+    , m_numberOfPorts(numberOfPorts)
+    , m_usedPorts(0)
+    , m_bandwidth(0)
+    , m_busyUntil(0)
+{
+    if (parent)
+        m_portNumbers = parent->allocatePort();
+}
+
+unsigned short SimulatedHub::getBusNumber() const
+{
+    return m_busNumber;
+}
+
+unsigned short SimulatedHub::getDeviceNumber() const
+{
+    return m_deviceNumber;
+}
+
+SimulatedHub *SimulatedHub::getParent() const
+{
+    return m_parent;
+}
+
+const std::vector<unsigned char> &SimulatedHub::getPortNumbers() const
+{
+    return m_portNumbers;
+}
+
+unsigned short SimulatedHub::getNumberOfPorts() const
+{
+    return m_numberOfPorts;
+}
+
+void SimulatedHub::setBandwidth(unsigned long bytesPerSecond)
+{
+    m_bandwidth = bytesPerSecond;
+}
+
+unsigned long SimulatedHub::getBandwidth() const
+{
+    return m_bandwidth;
+}
+
+std::vector<unsigned char> SimulatedHub::allocatePort()
+{
+    if (m_usedPorts >= m_numberOfPorts)
+        throw Error("No free port on the simulated hub");
+
+    std::vector<unsigned char> portNumbers(m_portNumbers);
+    portNumbers.push_back(++m_usedPorts);
+    return portNumbers;
+}
+
+/* }}} */
+/* SimulatedUsbprog {{{ */
+
+SimulatedUsbprog::SimulatedUsbprog(Simulator *simulator, SimulatedHub *hub)
+    : m_simulator(simulator)
+    , m_hub(hub)
+    , m_portNumbers(hub->allocatePort())
+    , m_serialNumber(simulator->nextSerialNumber())
+    , m_deviceNumber(simulator->nextDeviceNumber(hub->getBusNumber()))
+    , m_connectTime(0)
+    , m_updateMode(true)
+    , m_firmwareVendor(simulator->m_firmwareVendor)
+    , m_firmwareProduct(simulator->m_firmwareProduct)
+    , m_firmwareBcdDevice(simulator->m_firmwareBcdDevice)
+    , m_pendingPage(-1)
+    , m_pagesWritten(0)
+    , m_halted(false)
+{}
+
+unsigned short SimulatedUsbprog::getBusNumber() const
+{
+    return m_hub->getBusNumber();
+}
+
+unsigned short SimulatedUsbprog::getDeviceNumber() const
+{
+    // reenumerate() changes it while other threads look up their devices
+    SimulatorLocker locker(m_simulator->m_mutex);
+    return m_deviceNumber;
+}
+
+SimulatedHub *SimulatedUsbprog::getHub() const
+{
+    return m_hub;
+}
+
+const std::vector<unsigned char> &SimulatedUsbprog::getPortNumbers() const
+{
+    return m_portNumbers;
+}
+
+bool SimulatedUsbprog::isConnected() const
+{
+    SimulatorLocker locker(m_simulator->m_mutex);
+    return usbpp_now_us() >= m_connectTime;
+}
+
+bool SimulatedUsbprog::isUpdateMode() const
+{
+    return m_updateMode;
+}
+
+DeviceDescriptor SimulatedUsbprog::getDescriptor() const
+{
+    DeviceDescriptor descriptor;
+    descriptor.setDeviceClass(0xff);
+    descriptor.setDeviceSubclass(0);
+    descriptor.setNumConfigurations(1);
+    if (m_updateMode) {
+        descriptor.setVendorId(VENDOR_ID_USBPROG);
+        descriptor.setProductId(PRODUCT_ID_USBPROG);
+        descriptor.setBcdDevice(BCDDEVICE_UPDATE);
+    } else {
+        descriptor.setVendorId(m_firmwareVendor);
+        descriptor.setProductId(m_firmwareProduct);
+        descriptor.setBcdDevice(m_firmwareBcdDevice);
+    }
+    return descriptor;
+}
+
+void SimulatedUsbprog::setFirmwareIds(unsigned short vendor, unsigned short product,
+                                      unsigned short bcdDevice)
+{
+    m_firmwareVendor = vendor;
+    m_firmwareProduct = product;
+    m_firmwareBcdDevice = bcdDevice;
+}
+
+const std::vector<unsigned char> &SimulatedUsbprog::getFlash() const
+{
+    return m_flash;
+}
+
+unsigned long SimulatedUsbprog::getPagesWritten() const
+{
+    return m_pagesWritten;
+}
+
+std::string SimulatedUsbprog::getSerialNumber() const
+{
+    return m_serialNumber;
+}
+
+int SimulatedUsbprog::controlTransfer(unsigned char bmRequestType, unsigned char bRequest,
+                                      unsigned short wValue, unsigned short,
+                                      unsigned char *data, unsigned short wLength,
+                                      unsigned int timeout)
+{
+    checkConnected();
+    bool ackLost = m_simulator->simulateTransfer(m_hub, wLength, timeout);
+
+    int result = handleControl(bmRequestType, bRequest, wValue, data, wLength);
+    if (ackLost)
+        throw Error("Operation timed out", Error::TIMEOUT);
+
+    return result;
+}
+
+int SimulatedUsbprog::bulkTransfer(unsigned char endpoint, unsigned char *data, int length,
+                                   unsigned int timeout)
+{
+    checkConnected();
+    if (m_halted)
+        throw Error("Pipe error", Error::PIPE);
+
+    bool ackLost;
+    try {
+        ackLost = m_simulator->simulateTransfer(m_hub, length, timeout);
+    } catch (const Error &err) {
+        // a stalled endpoint stays halted until the host clears it
+        if (err.getCode() == Error::PIPE)
+            m_halted = true;
+        throw;
+    }
+
+    int result = handleBulk(endpoint, data, length);
+    if (ackLost)
+        throw Error("Operation timed out", Error::TIMEOUT);
+
+    return result;
+}
+
+void SimulatedUsbprog::clearHalt(unsigned char)
+{
+    checkConnected();
+    m_halted = false;
+}
+
+int SimulatedUsbprog::handleControl(unsigned char bmRequestType, unsigned char bRequest,
+                                    unsigned short wValue, unsigned char *data,
+                                    unsigned short wLength)
+{
+    // both the bootloader and the firmwares answer the standard requests
+    if (bmRequestType == 0x80 && bRequest == REQUEST_GET_DESCRIPTOR)
+        return readDescriptor(wValue, data, wLength);
+
+    if (bmRequestType != 0xC0 || bRequest != REQUEST_UPDATE_MODE)
+        throw Error("Pipe error", Error::PIPE);
+
+    if (data)
+        std::memset(data, 0, wLength);
+
+    // the bootloader ignores the request
+    if (!m_updateMode)
+        reenumerate(true);
+
+    return wLength;
+}
+
+int SimulatedUsbprog::handleBulk(unsigned char endpoint, const unsigned char *data, int length)
+{
+    // the firmwares have their own protocols, only the bootloader is simulated
+    if (!m_updateMode || endpoint != BULK_ENDPOINT || length != int(FLASH_PAGE_SIZE)) {
+        m_halted = true;
+        throw Error("Pipe error", Error::PIPE);
+    }
+
+    if (m_pendingPage >= 0) {
+        size_t offset = size_t(m_pendingPage) * FLASH_PAGE_SIZE;
+        if (m_flash.size() < offset + FLASH_PAGE_SIZE)
+            m_flash.resize(offset + FLASH_PAGE_SIZE, 0xff);
+        std::memcpy(&m_flash[offset], data, FLASH_PAGE_SIZE);
+        m_pendingPage = -1;
+        m_pagesWritten++;
+        return length;
+    }
+
+    switch (data[0]) {
+        case CMD_WRITEPAGE:
+            m_pendingPage = data[1] | (data[2] << 8);
+            break;
+
+        case CMD_STARTAPP:
+            reenumerate(false);
+            break;
+
+        default:
+            // like the real bootloader, unknown commands are ignored
+            break;
+    }
+
+    return length;
+}
+
+void SimulatedUsbprog::reset()
+{
+    checkConnected();
+    reenumerate(m_updateMode);
+}
+
+void SimulatedUsbprog::reenumerate(bool updateMode)
+{
+    m_updateMode = updateMode;
+    m_pendingPage = -1;
+    m_halted = false;
+
+    SimulatorLocker locker(m_simulator->m_mutex);
+    m_deviceNumber = m_simulator->nextDeviceNumber(getBusNumber());
+    m_connectTime = m_simulator->reenumerationTime();
+}
+
+void SimulatedUsbprog::checkConnected() const
+{
+    if (!isConnected())
+        throw Error("No such device (it may have been disconnected)");
+}
+
+int SimulatedUsbprog::readDescriptor(unsigned short wValue, unsigned char *data,
+                                     unsigned short wLength) const
+{
+    std::vector<unsigned char> descriptor;
+    unsigned char type = wValue >> 8;
+    unsigned char index = wValue & 0xff;
+
+    if (type == DESCRIPTOR_DEVICE && index == 0) {
+        DeviceDescriptor deviceDescriptor = getDescriptor();
+        descriptor.push_back(18);
+        descriptor.push_back(DESCRIPTOR_DEVICE);
+        append_word(descriptor, 0x0110);                            // bcdUSB
+        descriptor.push_back(deviceDescriptor.getDeviceClass());
+        descriptor.push_back(deviceDescriptor.getDeviceSubclass());
+        descriptor.push_back(0);                                    // bDeviceProtocol
+        descriptor.push_back(64);                                   // bMaxPacketSize0
+        append_word(descriptor, deviceDescriptor.getVendorId());
+        append_word(descriptor, deviceDescriptor.getProductId());
+        append_word(descriptor, deviceDescriptor.getBcdDevice());
+        descriptor.push_back(STRING_MANUFACTURER);
+        descriptor.push_back(STRING_PRODUCT);
+        descriptor.push_back(STRING_SERIAL_NUMBER);
+        descriptor.push_back(1);                                    // bNumConfigurations
+    } else if (type == DESCRIPTOR_STRING) {
+        std::string string;
+        switch (index) {
+            case 0:
+                descriptor.push_back(4);
+                descriptor.push_back(DESCRIPTOR_STRING);
+                append_word(descriptor, LANGUAGE_ID_EN_US);
+                break;
+            case STRING_MANUFACTURER:   string = "www.embedded-projects.net"; break;
+            case STRING_PRODUCT:        string = "USBprog"; break;
+            case STRING_SERIAL_NUMBER:  string = m_serialNumber; break;
+            default:                    throw Error("Pipe error");
+        }
+
+        if (index != 0) {
+            descriptor.push_back(2 + 2 * string.size());
+            descriptor.push_back(DESCRIPTOR_STRING);
+            for (size_t i = 0; i < string.size(); ++i) {
+                descriptor.push_back(string[i]);
+                descriptor.push_back(0);
+            }
+        }
+    } else
+        throw Error("Pipe error");
+
+    size_t length = std::min<size_t>(wLength, descriptor.size());
+    if (data)
+        std::memcpy(data, &descriptor[0], length);
+
+    return length;
+}
+
+/* }}} */
+/* Simulator {{{ */
+
+Simulator::Simulator()
+    : m_mutex(new SimulatorMutex)
+    , m_latency(0)
+    , m_latencyJitter(0)
+    , m_throughput(0)
+    , m_reenumerationDelay(0)
+    , m_reenumerationJitter(0)
+    , m_dropRate(0.0)
+    , m_stallRate(0.0)
+    , m_lostAckRate(0.0)
+    , m_random(1)
+    , m_droppedTransfers(0)
+    , m_stalledTransfers(0)
+    , m_lostAckTransfers(0)
+    , m_congestedTransfers(0)
+    , m_lastSerialNumber(0)
+    , m_firmwareVendor(VENDOR_ID_USBPROG)
+    , m_firmwareProduct(PRODUCT_ID_USBPROG)
+    , m_firmwareBcdDevice(0x0001)
+{
+    const char *env;
+    if ((env = std::getenv("USBPP_SIM_LATENCY")) != NULL)
+        m_latency = std::strtoul(env, NULL, 10);
+    if ((env = std::getenv("USBPP_SIM_JITTER")) != NULL)
+        m_latencyJitter = std::strtoul(env, NULL, 10);
+    if ((env = std::getenv("USBPP_SIM_THROUGHPUT")) != NULL)
+        m_throughput = std::strtoul(env, NULL, 10);
+    if ((env = std::getenv("USBPP_SIM_REENUMERATION")) != NULL)
+        m_reenumerationDelay = std::strtoul(env, NULL, 10);
+    if ((env = std::getenv("USBPP_SIM_REENUMERATION_JITTER")) != NULL)
+        m_reenumerationJitter = std::strtoul(env, NULL, 10);
+    if ((env = std::getenv("USBPP_SIM_DROP_RATE")) != NULL)
+        m_dropRate = std::strtod(env, NULL);
+    if ((env = std::getenv("USBPP_SIM_STALL_RATE")) != NULL)
+        m_stallRate = std::strtod(env, NULL);
+    if ((env = std::getenv("USBPP_SIM_LOST_ACK_RATE")) != NULL)
+        m_lostAckRate = std::strtod(env, NULL);
+    if ((env = std::getenv("USBPP_SIM_SEED")) != NULL)
+        setSeed(std::strtoul(env, NULL, 10));
+    if ((env = std::getenv("USBPP_SIM_FIRMWARE_ID")) != NULL) {
+        unsigned int vendor, product, bcdDevice;
+        if (std::sscanf(env, "%x:%x:%x", &vendor, &product, &bcdDevice) == 3) {
+            m_firmwareVendor = vendor;
+            m_firmwareProduct = product;
+            m_firmwareBcdDevice = bcdDevice;
+        }
+    }
+
+    // build the topology
+    unsigned long buses = 1, hubs = 0, hubPorts = 7, devices = 1;
+    unsigned long busBandwidth = 0, hubBandwidth = 0;
+    if ((env = std::getenv("USBPP_SIM_BUSES")) != NULL)
+        buses = std::strtoul(env, NULL, 10);
+    if ((env = std::getenv("USBPP_SIM_HUBS")) != NULL)
+        hubs = std::strtoul(env, NULL, 10);
+    if ((env = std::getenv("USBPP_SIM_HUB_PORTS")) != NULL)
+        hubPorts = std::strtoul(env, NULL, 10);
+    if ((env = std::getenv("USBPP_SIM_BUS_BANDWIDTH")) != NULL)
+        busBandwidth = std::strtoul(env, NULL, 10);
+    if ((env = std::getenv("USBPP_SIM_HUB_BANDWIDTH")) != NULL)
+        hubBandwidth = std::strtoul(env, NULL, 10);
+    if ((env = std::getenv("USBPP_SIM_DEVICES")) != NULL)
+        devices = std::strtoul(env, NULL, 10);
+
+    try {
+        std::vector<SimulatedHub *> deviceHubs;
+        for (unsigned long bus = 1; bus <= buses; ++bus) {
+            SimulatedHub *rootHub = getRootHub(bus);
+            rootHub->setBandwidth(busBandwidth);
+            for (unsigned long i = 0; i < hubs; ++i) {
+                SimulatedHub *hub = addHub(rootHub, hubPorts);
+                hub->setBandwidth(hubBandwidth);
+                deviceHubs.push_back(hub);
+            }
+            if (hubs == 0)
+                deviceHubs.push_back(rootHub);
+        }
+
+        for (unsigned long i = 0; i < devices && !deviceHubs.empty(); ++i)
+            addUsbprog(deviceHubs[i % deviceHubs.size()]);
+    } catch (const Error &err) {
+        clear();
+        delete m_mutex;
+        throw;
+    }
+}
+
+Simulator::~Simulator()
+{
+    clear();
+    delete m_mutex;
+}
+
+Simulator &Simulator::instance()
+{
+    static Simulator instance;
+    return instance;
+}
+
+SimulatedHub *Simulator::getRootHub(unsigned short busNumber)
+{
+    SimulatorLocker locker(m_mutex);
+
+    for (size_t i = 0; i < m_hubs.size(); ++i)
+        if (m_hubs[i]->getParent() == NULL && m_hubs[i]->getBusNumber() == busNumber)
+            return m_hubs[i];
+
+    SimulatedHub *hub = new SimulatedHub(NULL, busNumber, 1, ROOT_HUB_PORTS);
+    m_hubs.push_back(hub);
+    return hub;
+}
+
+SimulatedHub *Simulator::addHub(SimulatedHub *parent, unsigned short numberOfPorts)
+{
+    SimulatorLocker locker(m_mutex);
+
+    unsigned short busNumber = parent->getBusNumber();
+    SimulatedHub *hub = new SimulatedHub(parent, busNumber, nextDeviceNumber(busNumber),
+                                         numberOfPorts);
+    m_hubs.push_back(hub);
+    return hub;
+}
+
+SimulatedUsbprog *Simulator::addUsbprog(SimulatedHub *hub)
+{
+    SimulatorLocker locker(m_mutex);
+
+    SimulatedUsbprog *device = new SimulatedUsbprog(this, hub);
+    m_devices.push_back(device);
+    return device;
+}
+
+SimulatedUsbprog *Simulator::addUsbprog(unsigned short busNumber)
+{
+    return addUsbprog(getRootHub(busNumber));
+}
+
+void Simulator::clear()
+{
+    SimulatorLocker locker(m_mutex);
+
+    for (size_t i = 0; i < m_devices.size(); ++i)
+        delete m_devices[i];
+    m_devices.clear();
+    for (size_t i = 0; i < m_hubs.size(); ++i)
+        delete m_hubs[i];
+    m_hubs.clear();
+    m_lastDeviceNumbers.clear();
+}
+
+size_t Simulator::getNumberOfDevices() const
+{
+    return m_devices.size();
+}
+
+SimulatedUsbprog *Simulator::getDevice(size_t number) const
+{
+    if (number >= m_devices.size()) {
+        std::stringstream ss;
+        ss << "Simulated device number " << number << " out of range";
+        throw std::out_of_range(ss.str());
+    }
+
+    return m_devices[number];
+}
+
+void Simulator::setLatency(unsigned long us, unsigned long jitter)
+{
+    m_latency = us;
+    m_latencyJitter = jitter;
+}
+
+void Simulator::setThroughput(unsigned long bytesPerSecond)
+{
+    m_throughput = bytesPerSecond;
+}
+
+void Simulator::setReenumerationDelay(unsigned long us, unsigned long jitter)
+{
+    m_reenumerationDelay = us;
+    m_reenumerationJitter = jitter;
+}
+
+void Simulator::setFaultRates(double dropRate, double stallRate, double lostAckRate)
+{
+    m_dropRate = dropRate;
+    m_stallRate = stallRate;
+    m_lostAckRate = lostAckRate;
+}
+
+void Simulator::setSeed(unsigned long seed)
+{
+    SimulatorLocker locker(m_mutex);
+    m_random = seed;
+}
+
+unsigned long Simulator::getDroppedTransfers() const
+{
+    return m_droppedTransfers;
+}
+
+unsigned long Simulator::getStalledTransfers() const
+{
+    return m_stalledTransfers;
+}
+
+unsigned long Simulator::getLostAckTransfers() const
+{
+    return m_lostAckTransfers;
+}
+
+unsigned long Simulator::getCongestedTransfers() const
+{
+    return m_congestedTransfers;
+}
+
+bool Simulator::simulateTransfer(SimulatedHub *hub, size_t bytes, unsigned int timeout)
+{
+    unsigned long long now = usbpp_now_us();
+    unsigned long long start = now;
+    unsigned long long end = now;
+    bool dropped, stalled, ackLost;
+
+    {
+        SimulatorLocker locker(m_mutex);
+
+        dropped = randomEvent(m_dropRate);
+        stalled = !dropped && randomEvent(m_stallRate);
+        ackLost = !dropped && !stalled && randomEvent(m_lostAckRate);
+        if (dropped)
+            m_droppedTransfers++;
+        if (stalled)
+            m_stalledTransfers++;
+        if (ackLost)
+            m_lostAckTransfers++;
+
+        if (!dropped) {
+            // the transfer starts when all hubs on the way to the host controller are free
+            for (SimulatedHub *h = hub; h != NULL; h = h->m_parent)
+                if (h->m_bandwidth > 0 && h->m_busyUntil > start)
+                    start = h->m_busyUntil;
+
+            // the host controller gives up on transfers that wait too long
+            if (timeout > 0 && start - now > timeout * 1000ULL) {
+                dropped = true;
+                m_congestedTransfers++;
+            }
+        }
+
+        if (!dropped) {
+            end = start;
+            for (SimulatedHub *h = hub; h != NULL; h = h->m_parent) {
+                if (h->m_bandwidth == 0)
+                    continue;
+                h->m_busyUntil = start + bytes * 1000000ULL / h->m_bandwidth;
+                if (h->m_busyUntil > end)
+                    end = h->m_busyUntil;
+            }
+
+            end += m_latency + random(m_latencyJitter);
+        }
+    }
+
+    if (dropped) {
+        usbpp_usleep(timeout * 1000ULL);
+        throw Error("Operation timed out", Error::TIMEOUT);
+    }
+
+    unsigned long long us = end - now;
+    if (m_throughput > 0)
+        us += bytes * 1000000ULL / m_throughput;
+    // the host waits for the acknowledgement until the timeout
+    if (ackLost)
+        us = std::max(us, timeout * 1000ULL);
+    if (us > 0)
+        usbpp_usleep(us);
+
+    if (stalled)
+        throw Error("Pipe error", Error::PIPE);
+
+    return ackLost;
+}
+
+unsigned short Simulator::nextDeviceNumber(unsigned short busNumber)
+{
+    if (m_lastDeviceNumbers.size() <= busNumber)
+        m_lastDeviceNumbers.resize(busNumber + 1, 1);
+
+    // device numbers are 7 bit, number 1 is the root hub, and with many devices the
+    // numbers wrap around, so skip the numbers that are in use
+    unsigned short &last = m_lastDeviceNumbers[busNumber];
+    for (int tries = 0; tries < 126; ++tries) {
+        last = last >= 127 ? 2 : last + 1;
+
+        bool used = false;
+        for (size_t i = 0; !used && i < m_hubs.size(); ++i)
+            used = m_hubs[i]->getBusNumber() == busNumber && m_hubs[i]->getDeviceNumber() == last;
+        for (size_t i = 0; !used && i < m_devices.size(); ++i)
+            used = m_devices[i]->getBusNumber() == busNumber && m_devices[i]->m_deviceNumber == last;
+        if (!used)
+            return last;
+    }
+
+    throw Error("No free device number on the simulated bus");
+}
+
+unsigned long Simulator::random(unsigned long max)
+{
+    if (max == 0)
+        return 0;
+
+    // 64 bit LCG (Knuth's MMIX constants). Every other output of the plain LCG is
+    // correlated, which lets lost transfers come in bursts, so the output gets mixed
+    // like in SplitMix64.
+    m_random = m_random * 6364136223846793005ULL + 1442695040888963407ULL;
+    unsigned long long z = m_random;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    z ^= z >> 31;
+    return static_cast<unsigned long>((z >> 33) % (max + 1ULL));
+}
+
+bool Simulator::randomEvent(double probability)
+{
+    if (probability <= 0.0)
+        return false;
+    if (probability >= 1.0)
+        return true;
+
+    return random(1000000) < probability * 1000000.0;
+}
+
+std::string Simulator::nextSerialNumber()
+{
+    char serialNumber[16];
+    std::sprintf(serialNumber, "SIM%05lu", ++m_lastSerialNumber);
+    return serialNumber;
+}
+
+unsigned long long Simulator::reenumerationTime()
+{
+    return usbpp_now_us() + m_reenumerationDelay + random(m_reenumerationJitter);
+}
+
+/* }}} */
+
+} // end namespace usb
+
+// vim: set sw=4 ts=4 et: :collapseFolds=1:
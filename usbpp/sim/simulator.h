@@ -0,0 +1,602 @@
+/*
+ * (c) 2010, Bernhard Walle <bernhard@bwalle.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file simulator.h
+ * @brief Simulated USBprog devices for the "sim" backend of usbpp
+ *
+ * @author Bernhard Walle <bernhard@bwalle.de>
+ * @ingroup usbpp
+ */
+
+#ifndef USBPP_SIM_SIMULATOR_H
+#define USBPP_SIM_SIMULATOR_H
+
+#include <string>
+#include <vector>
+
+#include <usbpp/exceptions.h>
+#include <usbpp/devicedescriptor.h>
+
+namespace usb {
+
+/* Forward declarations {{{ */
+
+class Simulator;
+class SimulatedUsbprog;
+struct SimulatorMutex;
+
+/* }}} */
+/* SimulatedHub {{{ */
+
+/**
+ * @class SimulatedHub usbpp/sim/simulator.h
+ * @brief A simulated USB hub
+ *
+ * Each bus has a root hub (see Simulator::getRootHub()) that represents the host controller.
+ * External hubs can be cascaded below. All transfers of the devices below a hub share the
+ * bandwidth of the hub, so the contention of many devices on one hub or one controller can be
+ * reproduced.
+ *
+ * @author Bernhard Walle <bernhard@bwalle.de>
+ * @ingroup usbpp
+ */
+class SimulatedHub
+{
+    friend class Simulator;
+    friend class SimulatedUsbprog;
+
+public:
+    /**
+     * @brief Returns the bus number
+     *
+     * @return the bus number
+     */
+    unsigned short getBusNumber() const;
+
+    /**
+     * @brief Returns the device number of the hub
+     *
+     * @return 1 for the root hub, the device number of the external hub otherwise
+     */
+    unsigned short getDeviceNumber() const;
+
+    /**
+     * @brief Returns the parent hub
+     *
+     * @return the hub this hub is attached to or @c NULL for a root hub
+     */
+    SimulatedHub *getParent() const;
+
+    /**
+     * @brief Returns the port numbers from the root hub to this hub
+     *
+     * @return the port numbers, empty for the root hub
+     */
+    const std::vector<unsigned char> &getPortNumbers() const;
+
+    /**
+     * @brief Returns the number of downstream ports
+     *
+     * @return the number of ports
+     */
+    unsigned short getNumberOfPorts() const;
+
+    /**
+     * @brief Sets the bandwidth that all devices below the hub share
+     *
+     * @param[in] bytesPerSecond the bandwidth, 0 means unlimited
+     */
+    void setBandwidth(unsigned long bytesPerSecond);
+
+    /**
+     * @brief Returns the bandwidth
+     *
+     * @return the bandwidth in bytes per second, 0 means unlimited
+     */
+    unsigned long getBandwidth() const;
+
+protected:
+    /**
+     * @brief Constructor
+     *
+     * Use Simulator::getRootHub() or Simulator::addHub().
+     *
+     * @param[in] parent the parent hub or @c NULL for a root hub
+     * @param[in] busNumber the bus number
+     * @param[in] deviceNumber the device number
+     * @param[in] numberOfPorts the number of downstream ports
+     */
+    SimulatedHub(SimulatedHub *parent, unsigned short busNumber, unsigned short deviceNumber,
+                 unsigned short numberOfPorts);
+
+    // returns the port numbers of the next free port
+    std::vector<unsigned char> allocatePort();
+
+private:
+    SimulatedHub                *m_parent;
+    unsigned short              m_busNumber;
+    unsigned short              m_deviceNumber;
+    std::vector<unsigned char>  m_portNumbers;
+    unsigned short              m_numberOfPorts;
+    unsigned short              m_usedPorts;
+    unsigned long               m_bandwidth;
+    unsigned long long          m_busyUntil;
+};
+
+/* }}} */
+/* SimulatedUsbprog {{{ */
+
+/**
+ * @class SimulatedUsbprog usbpp/sim/simulator.h
+ * @brief One simulated USBprog
+ *
+ * The device implements the protocol of the USBprog bootloader: in update mode, a bulk
+ * transfer of 64 bytes on endpoint 2 with the command @c WRITEPAGE (0x02) and the page
+ * number (little endian) in the next two bytes is followed by the 64 bytes of page data. The
+ * command @c STARTAPP (0x01) starts the firmware. The device then disconnects and
+ * re-enumerates with the firmware IDs (see setFirmwareIds()).
+ *
+ * In firmware mode, the vendor control transfer 0xC0/0x01 switches the device back to
+ * update mode, which again means re-enumeration.
+ *
+ * Each re-enumeration assigns a new device number as real hardware does.
+ *
+ * Transfers of different devices may be performed in parallel from different threads, but
+ * each device must only be used by one thread at a time.
+ *
+ * @author Bernhard Walle <bernhard@bwalle.de>
+ * @ingroup usbpp
+ */
+class SimulatedUsbprog
+{
+    friend class Simulator;
+
+public:
+    /**
+     * @brief Size of a flash page in bytes
+     */
+    static const size_t FLASH_PAGE_SIZE = 64;
+
+public:
+    /**
+     * @brief Returns the bus number
+     *
+     * @return the bus number
+     */
+    unsigned short getBusNumber() const;
+
+    /**
+     * @brief Returns the current device number
+     *
+     * @return the device number, which changes with each re-enumeration
+     */
+    unsigned short getDeviceNumber() const;
+
+    /**
+     * @brief Returns the hub the device is attached to
+     *
+     * @return the hub
+     */
+    SimulatedHub *getHub() const;
+
+    /**
+     * @brief Returns the port numbers from the root hub to the device
+     *
+     * In contrast to the device number, the port numbers don't change on re-enumeration.
+     *
+     * @return the port numbers
+     */
+    const std::vector<unsigned char> &getPortNumbers() const;
+
+    /**
+     * @brief Checks if the device is connected
+     *
+     * @return @c false while the device re-enumerates, @c true otherwise
+     */
+    bool isConnected() const;
+
+    /**
+     * @brief Checks if the device runs the bootloader
+     *
+     * @return @c true in update mode, @c false if the firmware runs
+     */
+    bool isUpdateMode() const;
+
+    /**
+     * @brief Returns the device descriptor for the current mode
+     *
+     * @return the descriptor
+     */
+    DeviceDescriptor getDescriptor() const;
+
+    /**
+     * @brief Sets the IDs the device uses when the firmware runs
+     *
+     * @param[in] vendor the vendor ID
+     * @param[in] product the product ID
+     * @param[in] bcdDevice the device version
+     */
+    void setFirmwareIds(unsigned short vendor, unsigned short product, unsigned short bcdDevice);
+
+    /**
+     * @brief Returns the flash contents
+     *
+     * The flash is as large as the highest page that has been written. Unwritten bytes
+     * are 0xff.
+     *
+     * @return a reference to the flash contents
+     */
+    const std::vector<unsigned char> &getFlash() const;
+
+    /**
+     * @brief Returns the number of pages written since the device has been created
+     *
+     * @return the number of WRITEPAGE commands
+     */
+    unsigned long getPagesWritten() const;
+
+    /**
+     * @brief Returns the serial number
+     *
+     * @return the serial number that the device reports in its string descriptor
+     */
+    std::string getSerialNumber() const;
+
+    /**
+     * @brief Handles a control transfer
+     *
+     * Apart from the request to switch to update mode, the standard request GET_DESCRIPTOR
+     * for the device descriptor and the string descriptors is supported.
+     *
+     * @param[in] bmRequestType the request type
+     * @param[in] bRequest the request
+     * @param[in] wValue the value
+     * @param[in] wIndex the index
+     * @param[in,out] data the data
+     * @param[in] wLength the length of @p data
+     * @param[in] timeout the timeout in milliseconds, 0 means unlimited
+     * @return the number of transferred bytes
+     * @exception Error if the device is not connected, if the request is not supported or if
+     *            the Simulator injected a fault
+     */
+    int controlTransfer(unsigned char bmRequestType, unsigned char bRequest,
+                        unsigned short wValue, unsigned short wIndex,
+                        unsigned char *data, unsigned short wLength, unsigned int timeout = 0);
+
+    /**
+     * @brief Handles a bulk transfer
+     *
+     * @param[in] endpoint the endpoint
+     * @param[in,out] data the data
+     * @param[in] length the length of @p data
+     * @param[in] timeout the timeout in milliseconds, 0 means unlimited
+     * @return the number of transferred bytes
+     * @exception Error if the device is not connected, if the transfer violates the
+     *            bootloader protocol or if the Simulator injected a fault. After a stall, all
+     *            bulk transfers fail until clearHalt() has been called.
+     */
+    int bulkTransfer(unsigned char endpoint, unsigned char *data, int length,
+                     unsigned int timeout = 0);
+
+    /**
+     * @brief Clears the halt condition of the bulk endpoint after a stall
+     *
+     * @param[in] endpoint the endpoint
+     * @exception Error if the device is not connected
+     */
+    void clearHalt(unsigned char endpoint);
+
+    /**
+     * @brief Resets the device
+     *
+     * The device re-enumerates in the same mode.
+     */
+    void reset();
+
+protected:
+    /**
+     * @brief Constructor
+     *
+     * Use Simulator::addUsbprog().
+     *
+     * @param[in] simulator the simulator the device belongs to
+     * @param[in] hub the hub the device is attached to
+     */
+    SimulatedUsbprog(Simulator *simulator, SimulatedHub *hub);
+
+    // disconnects the device and lets it reappear after the re-enumeration delay
+    void reenumerate(bool updateMode);
+
+    // throws if the device is disconnected
+    void checkConnected() const;
+
+    // answers GET_DESCRIPTOR, returns the length of the answer
+    int readDescriptor(unsigned short wValue, unsigned char *data, unsigned short wLength) const;
+
+    // process a transfer that has reached the device
+    int handleControl(unsigned char bmRequestType, unsigned char bRequest, unsigned short wValue,
+                      unsigned char *data, unsigned short wLength);
+    int handleBulk(unsigned char endpoint, const unsigned char *data, int length);
+
+private:
+    Simulator                   *m_simulator;
+    SimulatedHub                *m_hub;
+    std::vector<unsigned char>  m_portNumbers;
+    std::string                 m_serialNumber;
+    unsigned short              m_deviceNumber;
+    unsigned long long          m_connectTime;
+    bool                        m_updateMode;
+    unsigned short              m_firmwareVendor;
+    unsigned short              m_firmwareProduct;
+    unsigned short              m_firmwareBcdDevice;
+    std::vector<unsigned char>  m_flash;
+    int                         m_pendingPage;
+    unsigned long               m_pagesWritten;
+    bool                        m_halted;
+};
+
+/* }}} */
+/* Simulator {{{ */
+
+/**
+ * @class Simulator usbpp/sim/simulator.h
+ * @brief Configuration of the simulated USB buses (singleton)
+ *
+ * When usbpp is built with the simulator backend (CMake option @c USE_USB_SIMULATOR), the
+ * UsbManager doesn't access any hardware but the devices of the Simulator. Initially, the
+ * Simulator creates one USBprog in update mode. The environment variables
+ *
+ *  - @c USBPP_SIM_DEVICES (number of USBprogs),
+ *  - @c USBPP_SIM_BUSES (number of buses, i.e. host controllers, default 1),
+ *  - @c USBPP_SIM_HUBS (number of external hubs per bus, default 0),
+ *  - @c USBPP_SIM_HUB_PORTS (number of ports per external hub, default 7),
+ *  - @c USBPP_SIM_BUS_BANDWIDTH and @c USBPP_SIM_HUB_BANDWIDTH (bytes per second that all
+ *    devices of a bus or of an external hub share),
+ *  - @c USBPP_SIM_LATENCY (latency of each transfer in microseconds),
+ *  - @c USBPP_SIM_JITTER (random additional latency up to the given microseconds),
+ *  - @c USBPP_SIM_THROUGHPUT (bytes per second of each device),
+ *  - @c USBPP_SIM_DROP_RATE (probability of a transfer that gets lost and times out),
+ *  - @c USBPP_SIM_STALL_RATE (probability of a transfer that stalls),
+ *  - @c USBPP_SIM_LOST_ACK_RATE (probability of a transfer that reaches the device but times
+ *    out because the acknowledgement gets lost),
+ *  - @c USBPP_SIM_REENUMERATION (re-enumeration delay in microseconds),
+ *  - @c USBPP_SIM_REENUMERATION_JITTER (random additional delay in microseconds),
+ *  - @c USBPP_SIM_SEED (seed of the random number generator, so that runs are reproducible) and
+ *  - @c USBPP_SIM_FIRMWARE_ID (<tt>vendor:product:bcdDevice</tt> in hex)
+ *
+ * change the defaults, so that the unmodified programs can be tested and benchmarked. The
+ * devices are distributed round-robin over the external hubs of all buses or over the root
+ * hubs if there are no external hubs.
+ *
+ * The topology must not be changed while transfers are running.
+ *
+ * @author Bernhard Walle <bernhard@bwalle.de>
+ * @ingroup usbpp
+ */
+class Simulator
+{
+    friend class SimulatedUsbprog;
+
+public:
+    /**
+     * @brief Singleton accessor
+     *
+     * @return the only instance of Simulator
+     */
+    static Simulator &instance();
+
+public:
+    /**
+     * @brief Returns the root hub of a bus
+     *
+     * The bus is created if it doesn't exist yet.
+     *
+     * @param[in] busNumber the bus number
+     * @return the root hub, owned by the Simulator
+     */
+    SimulatedHub *getRootHub(unsigned short busNumber = 1);
+
+    /**
+     * @brief Adds an external hub
+     *
+     * @param[in] parent the hub the new hub is attached to
+     * @param[in] numberOfPorts the number of downstream ports
+     * @return the new hub, owned by the Simulator
+     * @exception Error if @p parent has no free port
+     */
+    SimulatedHub *addHub(SimulatedHub *parent, unsigned short numberOfPorts = 7);
+
+    /**
+     * @brief Adds a USBprog in update mode
+     *
+     * @param[in] hub the hub the device is attached to
+     * @return the new device, owned by the Simulator
+     * @exception Error if @p hub has no free port
+     */
+    SimulatedUsbprog *addUsbprog(SimulatedHub *hub);
+
+    /**
+     * @brief Adds a USBprog in update mode to the root hub of a bus
+     *
+     * @param[in] busNumber the bus the device is attached to
+     * @return the new device, owned by the Simulator
+     */
+    SimulatedUsbprog *addUsbprog(unsigned short busNumber = 1);
+
+    /**
+     * @brief Removes all devices and hubs
+     *
+     * Device and DeviceHandle objects of the removed devices must not be used anymore.
+     */
+    void clear();
+
+    /**
+     * @brief Returns the number of simulated devices
+     *
+     * @return the number of devices, including disconnected ones
+     */
+    size_t getNumberOfDevices() const;
+
+    /**
+     * @brief Returns a simulated device
+     *
+     * @param[in] number the index between 0 and getNumberOfDevices() (exclusive)
+     * @return the device
+     * @exception std::out_of_range if @p number is invalid
+     */
+    SimulatedUsbprog *getDevice(size_t number) const;
+
+    /**
+     * @brief Sets the latency of each transfer
+     *
+     * @param[in] us the latency in microseconds
+     * @param[in] jitter the maximum random latency in microseconds that gets added
+     */
+    void setLatency(unsigned long us, unsigned long jitter = 0);
+
+    /**
+     * @brief Sets the throughput of each device
+     *
+     * @param[in] bytesPerSecond the throughput, 0 means unlimited
+     */
+    void setThroughput(unsigned long bytesPerSecond);
+
+    /**
+     * @brief Sets the time that a device needs for re-enumeration
+     *
+     * @param[in] us the time in microseconds
+     * @param[in] jitter the maximum random time in microseconds that gets added
+     */
+    void setReenumerationDelay(unsigned long us, unsigned long jitter = 0);
+
+    /**
+     * @brief Sets the fault injection rates
+     *
+     * A dropped transfer fails with "Operation timed out" after the timeout of the transfer
+     * has elapsed (immediately if the timeout is unlimited). A stalled transfer fails with
+     * "Pipe error". In both cases the device doesn't see the transfer. A transfer with a lost
+     * acknowledgement is processed by the device, but fails with "Operation timed out" like
+     * a dropped one, so sending it again is not safe.
+     *
+     * @param[in] dropRate the probability (0.0 to 1.0) that a transfer gets lost
+     * @param[in] stallRate the probability (0.0 to 1.0) that a transfer stalls
+     * @param[in] lostAckRate the probability (0.0 to 1.0) that the acknowledgement of a
+     *            transfer gets lost
+     */
+    void setFaultRates(double dropRate, double stallRate, double lostAckRate = 0.0);
+
+    /**
+     * @brief Seeds the random number generator
+     *
+     * @param[in] seed the seed
+     */
+    void setSeed(unsigned long seed);
+
+    /**
+     * @brief Returns the number of dropped transfers
+     *
+     * @return the number of transfers that failed with a timeout
+     */
+    unsigned long getDroppedTransfers() const;
+
+    /**
+     * @brief Returns the number of stalled transfers
+     *
+     * @return the number of transfers that failed with a stall
+     */
+    unsigned long getStalledTransfers() const;
+
+    /**
+     * @brief Returns the number of transfers with a lost acknowledgement
+     *
+     * @return the number of transfers that reached the device but failed with a timeout
+     */
+    unsigned long getLostAckTransfers() const;
+
+    /**
+     * @brief Returns the number of transfers that timed out waiting for the bus
+     *
+     * @return the number of transfers that couldn't start within their timeout because
+     *         the bandwidth of a hub was used by other transfers
+     */
+    unsigned long getCongestedTransfers() const;
+
+    /**
+     * @brief Waits like the hardware would for a transfer
+     *
+     * Reserves the bandwidth of all hubs between the device and the host controller and
+     * injects faults. Like on real hardware, a transfer that cannot start within @p timeout
+     * because the bus is busy times out.
+     *
+     * @param[in] hub the hub of the device
+     * @param[in] bytes the number of transferred bytes
+     * @param[in] timeout the timeout of the transfer in milliseconds
+     * @return @c true if the acknowledgement got lost, i.e. the device must process the
+     *         transfer and the caller must fail with a timeout afterwards
+     * @exception Error if the transfer has been dropped or stalled
+     */
+    bool simulateTransfer(SimulatedHub *hub, size_t bytes, unsigned int timeout);
+
+private:
+    Simulator();
+    virtual ~Simulator();
+
+    // noncopyable
+    Simulator(const Simulator &other);
+    Simulator &operator=(const Simulator &other);
+
+    // must be called with m_mutex held
+    unsigned short nextDeviceNumber(unsigned short busNumber);
+    unsigned long random(unsigned long max);
+    bool randomEvent(double probability);
+    std::string nextSerialNumber();
+
+    // returns the time when a re-enumerating device reappears
+    unsigned long long reenumerationTime();
+
+private:
+    SimulatorMutex                  *m_mutex;
+    std::vector<SimulatedHub *>     m_hubs;
+    std::vector<SimulatedUsbprog *> m_devices;
+    std::vector<unsigned short>     m_lastDeviceNumbers;
+    unsigned long                   m_latency;
+    unsigned long                   m_latencyJitter;
+    unsigned long                   m_throughput;
+    unsigned long                   m_reenumerationDelay;
+    unsigned long                   m_reenumerationJitter;
+    double                          m_dropRate;
+    double                          m_stallRate;
+    double                          m_lostAckRate;
+    unsigned long long              m_random;
+    unsigned long                   m_droppedTransfers;
+    unsigned long                   m_stalledTransfers;
+    unsigned long                   m_lostAckTransfers;
+    unsigned long                   m_congestedTransfers;
+    unsigned long                   m_lastSerialNumber;
+    unsigned short                  m_firmwareVendor;
+    unsigned short                  m_firmwareProduct;
+    unsigned short                  m_firmwareBcdDevice;
+};
+
+/* }}} */
+
+} // end namespace usb
+
+#endif /* USBPP_SIM_SIMULATOR_H */
+
+// vim: set sw=4 ts=4 et: :collapseFolds=1:
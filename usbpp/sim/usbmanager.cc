@@ -0,0 +1,137 @@
+/*
+ * (c) 2010, Bernhard Walle <bernhard@bwalle.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <sstream>
+#include <vector>
+
+#include <usbpp/usbmanager.h>
+#include <usbpp/device.h>
+#include <usbpp/sim/simulator.h>
+
+namespace usb {
+
+/* UsbManagerPrivate {{{ */
+
+struct UsbManagerPrivate {
+    std::vector<Device *>   devices;
+};
+
+/* }}} */
+/* UsbManager {{{ */
+
+UsbManager::UsbManager()
+  : m_data(new UsbManagerPrivate)
+{}
+
+UsbManager::~UsbManager()
+{
+    for (size_t i = 0; i < m_data->devices.size(); ++i)
+        delete m_data->devices[i];
+    m_data->devices.clear();
+    delete m_data;
+}
+
+UsbManager &UsbManager::instance()
+{
+    static UsbManager instance;
+    return instance;
+}
+
+void UsbManager::setDebug(bool)
+{}
+
+bool UsbManager::isSysfsSupported() const
+{
+    return false;
+}
+
+void UsbManager::setSysfsRoot(const std::string &root)
+{
+    if (!root.empty())
+        throw Error("Enumeration via sysfs is not supported by the simulator");
+}
+
+std::string UsbManager::getSysfsRoot() const
+{
+    return std::string();
+}
+
+void UsbManager::startRecording(const std::string &)
+{
+    throw Error("Recording of USB traces is not supported by the simulator");
+}
+
+void UsbManager::stopRecording()
+{}
+
+bool UsbManager::isRecording() const
+{
+    return false;
+}
+
+void UsbManager::startReplay(const std::string &, bool)
+{
+    throw Error("Replaying of USB traces is not supported by the simulator");
+}
+
+void UsbManager::stopReplay()
+{}
+
+bool UsbManager::isReplaying() const
+{
+    return false;
+}
+
+void UsbManager::detectDevices(const DeviceFilter &filter)
+{
+    for (size_t i = 0; i < m_data->devices.size(); ++i)
+        delete m_data->devices[i];
+    m_data->devices.clear();
+
+    Simulator &simulator = Simulator::instance();
+    for (size_t i = 0; i < simulator.getNumberOfDevices(); ++i) {
+        SimulatedUsbprog *device = simulator.getDevice(i);
+        if (!device->isConnected())
+            continue;
+
+        DeviceDescriptor descriptor = device->getDescriptor();
+        if (filter.matches(descriptor.getVendorId(), descriptor.getProductId()))
+            m_data->devices.push_back(new Device(device));
+    }
+}
+
+size_t UsbManager::getNumberOfDevices() const
+{
+    return m_data->devices.size();
+}
+
+Device *UsbManager::getDevice(size_t number)
+{
+    if (number >= m_data->devices.size()) {
+        std::stringstream ss;
+        ss << "Device number " << number << " out of range";
+        throw std::out_of_range(ss.str());
+    }
+
+    return m_data->devices[number];
+}
+
+/* }}} */
+
+} // end namespace usb
+
+
+// vim: set sw=4 ts=4 et: :collapseFolds=1:
@@ -0,0 +1,112 @@
+/*
+ * (c) 2010, Bernhard Walle <bernhard@bwalle.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+
+#include <usbpp/devicehandle.h>
+
+/* standard requests, see chapter 9 of the USB specification */
+#define REQUEST_TYPE_STANDARD_IN    0x80
+#define REQUEST_GET_DESCRIPTOR      0x06
+#define DESCRIPTOR_TYPE_DEVICE      0x01
+#define DESCRIPTOR_TYPE_STRING      0x03
+#define DEVICE_DESCRIPTOR_SIZE      18
+#define MAX_DESCRIPTOR_SIZE         255
+
+namespace usb {
+
+/* Helpers {{{ */
+
+// string descriptor 0 contains the supported language IDs
+static unsigned short read_language(DeviceHandle *handle, unsigned int timeout)
+{
+    unsigned char buffer[MAX_DESCRIPTOR_SIZE] = { 0 };
+    int length = handle->controlTransfer(REQUEST_TYPE_STANDARD_IN, REQUEST_GET_DESCRIPTOR,
+                                         DESCRIPTOR_TYPE_STRING << 8, 0,
+                                         buffer, sizeof(buffer), timeout);
+    if (length < 4 || buffer[0] < 4 || buffer[1] != DESCRIPTOR_TYPE_STRING)
+        throw Error("Invalid string descriptor");
+
+    return buffer[2] | (buffer[3] << 8);
+}
+
+static std::string read_string(DeviceHandle *handle, unsigned char index,
+                               unsigned short language, unsigned int timeout)
+{
+    if (index == 0)
+        return std::string();
+
+    unsigned char buffer[MAX_DESCRIPTOR_SIZE] = { 0 };
+    int length = handle->controlTransfer(REQUEST_TYPE_STANDARD_IN, REQUEST_GET_DESCRIPTOR,
+                                         (DESCRIPTOR_TYPE_STRING << 8) | index, language,
+                                         buffer, sizeof(buffer), timeout);
+    if (length < 2 || buffer[0] < 2 || buffer[1] != DESCRIPTOR_TYPE_STRING)
+        throw Error("Invalid string descriptor");
+
+    // UTF-16LE, a short answer is truncated
+    size_t end = std::min<size_t>(buffer[0], length);
+    std::string result;
+    for (size_t i = 2; i + 1 < end; i += 2)
+        result += (buffer[i+1] == 0 && buffer[i] < 0x80) ? char(buffer[i]) : '?';
+    return result;
+}
+
+/* }}} */
+/* DeviceHandle {{{ */
+
+std::string DeviceHandle::getStringDescriptor(unsigned char index, unsigned int timeout)
+{
+    if (index == 0)
+        return std::string();
+
+    return read_string(this, index, read_language(this, timeout), timeout);
+}
+
+void DeviceHandle::getDeviceStrings(std::string   &manufacturer,
+                                    std::string   &product,
+                                    std::string   &serialNumber,
+                                    unsigned int  timeout)
+{
+    unsigned char descriptor[DEVICE_DESCRIPTOR_SIZE] = { 0 };
+    int length = controlTransfer(REQUEST_TYPE_STANDARD_IN, REQUEST_GET_DESCRIPTOR,
+                                 DESCRIPTOR_TYPE_DEVICE << 8, 0,
+                                 descriptor, sizeof(descriptor), timeout);
+    if (length < DEVICE_DESCRIPTOR_SIZE || descriptor[0] != DEVICE_DESCRIPTOR_SIZE ||
+            descriptor[1] != DESCRIPTOR_TYPE_DEVICE)
+        throw Error("Invalid device descriptor");
+
+    // iManufacturer, iProduct and iSerialNumber
+    unsigned char manufacturerIndex = descriptor[14];
+    unsigned char productIndex = descriptor[15];
+    unsigned char serialNumberIndex = descriptor[16];
+
+    manufacturer.clear();
+    product.clear();
+    serialNumber.clear();
+    if (manufacturerIndex == 0 && productIndex == 0 && serialNumberIndex == 0)
+        return;
+
+    unsigned short language = read_language(this, timeout);
+    manufacturer = read_string(this, manufacturerIndex, language, timeout);
+    product = read_string(this, productIndex, language, timeout);
+    serialNumber = read_string(this, serialNumberIndex, language, timeout);
+}
+
+/* }}} */
+
+} // end namespace usb
+
+// vim: set sw=4 ts=4 et: :collapseFolds=1:
@@ -0,0 +1,244 @@
+/*
+ * (c) 2010, Bernhard Walle <bernhard@bwalle.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <sstream>
+#include <cstring>
+#include <cstdio>
+
+#include <usbpp/transfertrace.h>
+
+#define TRACE_MAGIC     "USBT"
+#define TRACE_VERSION   3
+
+namespace usb {
+
+/* Encoding {{{ */
+
+static void write_varint(std::ostream &os, unsigned long long value)
+{
+    do {
+        unsigned char byte = value & 0x7f;
+        value >>= 7;
+        if (value != 0)
+            byte |= 0x80;
+        os.put(byte);
+    } while (value != 0);
+}
+
+static bool read_varint(std::istream &is, unsigned long long &value)
+{
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int byte = is.get();
+        if (byte == EOF)
+            return false;
+        value |= static_cast<unsigned long long>(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+
+    return false;
+}
+
+// zigzag encoding, so that small negative error codes need only one byte
+static unsigned long long encode_signed(int value)
+{
+    return value < 0 ? (static_cast<unsigned long long>(-(value + 1)) << 1) | 1
+                     : static_cast<unsigned long long>(value) << 1;
+}
+
+static int decode_signed(unsigned long long value)
+{
+    return (value & 1) ? -static_cast<int>(value >> 1) - 1 : static_cast<int>(value >> 1);
+}
+
+static std::string record_to_string(const TraceRecord &record)
+{
+    std::stringstream ss;
+    ss << "type=" << record.type << " handle=" << record.handle << " values=(";
+    for (size_t i = 0; i < record.values.size(); ++i)
+        ss << (i == 0 ? "" : ",") << record.values[i];
+    ss << ")";
+    return ss.str();
+}
+
+/* }}} */
+/* TraceRecord {{{ */
+
+TraceRecord::TraceRecord(Type type, unsigned int handle)
+    : type(type)
+    , timestamp(0)
+    , handle(handle)
+    , status(0)
+{}
+
+/* }}} */
+/* TraceWriter {{{ */
+
+TraceWriter::TraceWriter(const std::string &filename)
+    : m_stream(filename.c_str(), std::ios::binary | std::ios::out | std::ios::trunc)
+    , m_filename(filename)
+    , m_start(usbpp_now_us())
+    , m_lastTimestamp(0)
+    , m_lastHandle(0)
+{
+    if (!m_stream)
+        throw Error("Unable to create trace file " + filename);
+
+    m_stream.write(TRACE_MAGIC, std::strlen(TRACE_MAGIC));
+    m_stream.put(TRACE_VERSION);
+}
+
+TraceWriter::~TraceWriter()
+{
+    m_stream.close();
+}
+
+unsigned int TraceWriter::newHandle()
+{
+    return ++m_lastHandle;
+}
+
+void TraceWriter::write(TraceRecord &record)
+{
+    record.timestamp = usbpp_now_us() - m_start;
+
+    m_stream.put(record.type);
+    write_varint(m_stream, record.timestamp - m_lastTimestamp);
+    write_varint(m_stream, record.handle);
+    write_varint(m_stream, record.values.size());
+    for (size_t i = 0; i < record.values.size(); ++i)
+        write_varint(m_stream, record.values[i]);
+    write_varint(m_stream, encode_signed(record.status));
+    write_varint(m_stream, record.data.size());
+    if (!record.data.empty())
+        m_stream.write(reinterpret_cast<const char *>(&record.data[0]), record.data.size());
+
+    // a trace is most useful when the program crashes, so don't keep the end of a session
+    // in the buffer
+    if (record.type == TraceRecord::TR_CLOSE)
+        m_stream.flush();
+
+    if (!m_stream)
+        throw Error("Unable to write trace file " + m_filename);
+
+    m_lastTimestamp = record.timestamp;
+}
+
+/* }}} */
+/* TraceReader {{{ */
+
+TraceReader::TraceReader(const std::string &filename, bool realTiming)
+    : m_stream(filename.c_str(), std::ios::binary | std::ios::in)
+    , m_filename(filename)
+    , m_realTiming(realTiming)
+    , m_start(0)
+    , m_lastTimestamp(0)
+    , m_recordNumber(0)
+    , m_lastHandle(0)
+{
+    if (!m_stream)
+        throw Error("Unable to open trace file " + filename);
+
+    char magic[4];
+    m_stream.read(magic, sizeof(magic));
+    if (!m_stream || std::memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0)
+        throw Error(filename + " is not a USB trace file");
+    if (m_stream.get() != TRACE_VERSION)
+        throw Error(filename + ": Unsupported trace file version");
+}
+
+TraceReader::~TraceReader()
+{}
+
+bool TraceReader::read(TraceRecord &record)
+{
+    int type = m_stream.get();
+    if (type == EOF)
+        return false;
+
+    unsigned long long delta, handle, count, status, size;
+    if (!read_varint(m_stream, delta) || !read_varint(m_stream, handle) ||
+            !read_varint(m_stream, count))
+        throw Error(m_filename + ": Truncated trace record");
+
+    record.type = static_cast<TraceRecord::Type>(type);
+    record.timestamp = m_lastTimestamp + delta;
+    record.handle = handle;
+    record.values.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        unsigned long long value;
+        if (!read_varint(m_stream, value))
+            throw Error(m_filename + ": Truncated trace record");
+        record.values[i] = value;
+    }
+
+    if (!read_varint(m_stream, status) || !read_varint(m_stream, size))
+        throw Error(m_filename + ": Truncated trace record");
+    record.status = decode_signed(status);
+    record.data.resize(size);
+    if (size > 0) {
+        m_stream.read(reinterpret_cast<char *>(&record.data[0]), size);
+        if (!m_stream)
+            throw Error(m_filename + ": Truncated trace record");
+    }
+
+    m_lastTimestamp = record.timestamp;
+    m_recordNumber++;
+    return true;
+}
+
+unsigned int TraceReader::newHandle()
+{
+    return ++m_lastHandle;
+}
+
+void TraceReader::replay(TraceRecord &record)
+{
+    if (m_recordNumber == 0)
+        m_start = usbpp_now_us();
+
+    TraceRecord traceRecord;
+    if (!read(traceRecord))
+        throw Error("Trace " + m_filename + " has ended, expected " + record_to_string(record));
+
+    bool matches = traceRecord.type == record.type && traceRecord.handle == record.handle &&
+                   traceRecord.values.size() >= record.values.size();
+    for (size_t i = 0; matches && i < record.values.size(); ++i)
+        matches = traceRecord.values[i] == record.values[i];
+
+    if (!matches) {
+        std::stringstream ss;
+        ss << "Trace " << m_filename << " doesn't match at record " << m_recordNumber
+           << ": expected " << record_to_string(record)
+           << ", got " << record_to_string(traceRecord);
+        throw Error(ss.str());
+    }
+
+    if (m_realTiming) {
+        unsigned long long elapsed = usbpp_now_us() - m_start;
+        if (traceRecord.timestamp > elapsed)
+            usbpp_usleep(traceRecord.timestamp - elapsed);
+    }
+
+    record = traceRecord;
+}
+
+/* }}} */
+
+} // end namespace usb
+
+// vim: set sw=4 ts=4 et: :collapseFolds=1:
@@ -0,0 +1,255 @@
+/*
+ * (c) 2010, Bernhard Walle <bernhard@bwalle.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file transfertrace.h
+ * @brief Recording and replaying of USB transfers
+ *
+ * @author Bernhard Walle <bernhard@bwalle.de>
+ * @ingroup usbpp
+ */
+
+#ifndef USBPP_TRANSFERTRACE_H
+#define USBPP_TRANSFERTRACE_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+
+#include <usbpp/exceptions.h>
+#include <usbpp/clock.h>
+
+namespace usb {
+
+/* TraceRecord {{{ */
+
+/**
+ * @class TraceRecord usbpp/transfertrace.h
+ * @brief One entry of a transfer trace
+ *
+ * A record consists of the type, the time when the operation has finished, the handle number
+ * of the DeviceHandle, a list of type specific integer values, the status (0 or the error code
+ * of the USB library) and the transferred data.
+ *
+ * The values of the various types are:
+ *
+ *  - TR_ENUMERATE: 8 values for each device (bus number, device number, vendor ID, product ID,
+ *    bcdDevice, device class, device subclass, number of configurations). The data contains the
+ *    port path of each device (see Device::getPortPath()), terminated by a null byte.
+ *  - TR_CONFIG: bus number, device number, config index, configuration value, number of
+ *    interfaces and for each interface the number of altsettings followed by the interface
+ *    numbers. The records of all configurations of all devices follow the TR_ENUMERATE record.
+ *  - TR_OPEN: bus number, device number. The handle numbers are assigned in the order of
+ *    the successful TR_OPEN records, starting at 1.
+ *  - TR_CONTROL: bmRequestType, bRequest, wValue, wIndex, wLength, timeout
+ *  - TR_BULK: endpoint, length, timeout, transferred bytes
+ *  - TR_GET_CONFIGURATION: configuration
+ *  - TR_SET_CONFIGURATION: configuration
+ *  - TR_CLAIM_INTERFACE, TR_RELEASE_INTERFACE: interface number
+ *  - TR_SET_ALTSETTING: interface number, alternate setting
+ *  - TR_CLEAR_HALT: endpoint
+ *  - TR_RESET, TR_CLOSE: none
+ *
+ * The data of control and bulk transfers is the sent data for OUT transfers and the received
+ * data for IN transfers.
+ *
+ * @author Bernhard Walle <bernhard@bwalle.de>
+ * @ingroup usbpp
+ */
+struct TraceRecord
+{
+    /**
+     * @brief Record types
+     */
+    enum Type {
+        TR_ENUMERATE = 1,           /**< UsbManager::detectDevices() */
+        TR_CONFIG,                  /**< UsbManager::detectDevices() */
+        TR_OPEN,                    /**< Device::open() */
+        TR_CLOSE,                   /**< the DeviceHandle has been deleted */
+        TR_CONTROL,                 /**< DeviceHandle::controlTransfer() */
+        TR_BULK,                    /**< DeviceHandle::bulkTransfer() */
+        TR_GET_CONFIGURATION,       /**< DeviceHandle::getConfiguration() */
+        TR_SET_CONFIGURATION,       /**< DeviceHandle::setConfiguration() */
+        TR_CLAIM_INTERFACE,         /**< DeviceHandle::claimInterface() */
+        TR_RELEASE_INTERFACE,       /**< DeviceHandle::releaseInterface() */
+        TR_SET_ALTSETTING,          /**< DeviceHandle::setInterfaceAltSetting() */
+        TR_RESET,                   /**< DeviceHandle::resetDevice() */
+        TR_CLEAR_HALT               /**< DeviceHandle::clearHalt() */
+    };
+
+    /**
+     * @brief Constructor
+     *
+     * @param[in] type the record type
+     * @param[in] handle the handle number, 0 if the record doesn't belong to a DeviceHandle
+     */
+    TraceRecord(Type type = TR_ENUMERATE, unsigned int handle = 0);
+
+    Type                        type;       /**< the record type */
+    unsigned long long          timestamp;  /**< microseconds since the start of the trace */
+    unsigned int                handle;     /**< handle number of the DeviceHandle */
+    std::vector<unsigned long>  values;     /**< type specific values, see above */
+    int                         status;     /**< 0 on success, the error code otherwise */
+    std::vector<unsigned char>  data;       /**< transferred data */
+};
+
+/* }}} */
+/* TraceWriter {{{ */
+
+/**
+ * @class TraceWriter usbpp/transfertrace.h
+ * @brief Writes a transfer trace
+ *
+ * The file starts with the magic @c "USBT" and a version byte. Each record is stored as type
+ * byte followed by the time since the previous record, the handle number, the values, the
+ * status and the data, all encoded as variable length integers (7 bits per byte, least
+ * significant group first). So a typical bulk transfer of 64 bytes needs about 75 bytes.
+ *
+ * @author Bernhard Walle <bernhard@bwalle.de>
+ * @ingroup usbpp
+ */
+class TraceWriter
+{
+public:
+    /**
+     * @brief Constructor
+     *
+     * Creates the trace file. An existing file gets overwritten.
+     *
+     * @param[in] filename the name of the trace file
+     * @exception Error if the file cannot be created
+     */
+    TraceWriter(const std::string &filename);
+
+    /**
+     * @brief Destructor
+     *
+     * Flushes and closes the trace file.
+     */
+    virtual ~TraceWriter();
+
+public:
+    /**
+     * @brief Allocates a new handle number
+     *
+     * @return a handle number that is unique within the trace, starting at 1
+     */
+    unsigned int newHandle();
+
+    /**
+     * @brief Appends a record to the trace
+     *
+     * @param[in,out] record the record to write. The timestamp is set to the current time.
+     * @exception Error if writing fails
+     */
+    void write(TraceRecord &record);
+
+private:
+    // noncopyable
+    TraceWriter(const TraceWriter &other);
+    TraceWriter &operator=(const TraceWriter &other);
+
+private:
+    std::ofstream       m_stream;
+    std::string         m_filename;
+    unsigned long long  m_start;
+    unsigned long long  m_lastTimestamp;
+    unsigned int        m_lastHandle;
+};
+
+/* }}} */
+/* TraceReader {{{ */
+
+/**
+ * @class TraceReader usbpp/transfertrace.h
+ * @brief Reads and replays a transfer trace
+ *
+ * @author Bernhard Walle <bernhard@bwalle.de>
+ * @ingroup usbpp
+ */
+class TraceReader
+{
+public:
+    /**
+     * @brief Constructor
+     *
+     * @param[in] filename the name of a file that has been created by TraceWriter
+     * @param[in] realTiming @c true if replay() should wait until the time of the record in the
+     *            original trace has been reached, @c false if the records should be returned
+     *            as fast as possible
+     * @exception Error if the file cannot be opened or is no trace file
+     */
+    TraceReader(const std::string &filename, bool realTiming = false);
+
+    /**
+     * @brief Destructor
+     */
+    virtual ~TraceReader();
+
+public:
+    /**
+     * @brief Reads the next record
+     *
+     * @param[out] record the record
+     * @return @c true on success, @c false at the end of the trace
+     * @exception Error if the file is corrupted
+     */
+    bool read(TraceRecord &record);
+
+    /**
+     * @brief Allocates a new handle number
+     *
+     * Returns the same sequence of numbers as TraceWriter::newHandle() did while recording.
+     *
+     * @return the handle number for the next DeviceHandle
+     */
+    unsigned int newHandle();
+
+    /**
+     * @brief Replays the next record
+     *
+     * Reads the next record and checks that it matches @p record: the type and the handle
+     * number must be equal and the values of @p record must be a prefix of the values of the
+     * trace record. Then @p record is replaced by the trace record.
+     *
+     * @param[in,out] record the expected record on input, the record from the trace on output
+     * @exception Error if the trace has ended or if the next record doesn't match
+     */
+    void replay(TraceRecord &record);
+
+private:
+    // noncopyable
+    TraceReader(const TraceReader &other);
+    TraceReader &operator=(const TraceReader &other);
+
+private:
+    std::ifstream       m_stream;
+    std::string         m_filename;
+    bool                m_realTiming;
+    unsigned long long  m_start;
+    unsigned long long  m_lastTimestamp;
+    unsigned long       m_recordNumber;
+    unsigned int        m_lastHandle;
+};
+
+/* }}} */
+
+} // end namespace usb
+
+#endif /* USBPP_TRANSFERTRACE_H */
+
+// vim: set sw=4 ts=4 et: :collapseFolds=1:
@@ -27,11 +27,16 @@
 #define USBPP_LIBUSB_H
 
 #include <usbpp/exceptions.h>
+#include <string>
+
+#include <usbpp/devicefilter.h>
 
 namespace usb {
 
 struct UsbManagerPrivate;
 class Device;
+class TraceWriter;
+class TraceReader;
 
 /* UsbManager {{{ */
 
@@ -44,6 +49,9 @@ class Device;
  */
 class UsbManager
 {
+    friend class Device;
+    friend class DeviceHandle;
+
 public:
     /**
      * @brief Singleton accessor
@@ -64,13 +72,114 @@ public:
      */
     void setDebug(bool debug);
 
+    /**
+     * @brief Checks if devices can be enumerated via sysfs
+     *
+     * @return @c true if setSysfsRoot() accepts a non-empty directory, @c false otherwise
+     */
+    bool isSysfsSupported() const;
+
+    /**
+     * @brief Enumerates the devices via sysfs instead of the USB library
+     *
+     * If a sysfs root is set, detectDevices() only reads the attribute files below @p root
+     * (normally <tt>/sys/bus/usb/devices</tt>) and doesn't initialise the USB library at all.
+     * That's much faster than asking libusb, which opens and parses the descriptors of every
+     * device on the system. The USB library is used only when a device gets opened or a config
+     * descriptor is requested.
+     *
+     * The initial value is taken from the environment variable @c USBPP_SYSFS_ROOT.
+     *
+     * @param[in] root the sysfs directory that contains one subdirectory per device, or an
+     *            empty string to use the USB library for enumeration
+     * @exception Error if @p root is not empty and isSysfsSupported() returns @c false
+     */
+    void setSysfsRoot(const std::string &root);
+
+    /**
+     * @brief Returns the sysfs root
+     *
+     * @return the directory set with setSysfsRoot(), empty if sysfs is not used
+     */
+    std::string getSysfsRoot() const;
+
+    /**
+     * @brief Records all USB operations into a trace file
+     *
+     * Every call of detectDevices(), Device::getConfigDescriptor(), Device::open() and of the
+     * DeviceHandle functions is appended to the trace together with the result, the
+     * transferred data and a time stamp. See TraceWriter for the file format. The trace can be
+     * replayed with startReplay().
+     *
+     * Recording should be started before any device is opened. It can also be enabled with the
+     * environment variable @c USBPP_RECORD.
+     *
+     * @param[in] filename the name of the trace file that gets overwritten
+     * @exception Error if the file cannot be created or if a trace is being replayed
+     */
+    void startRecording(const std::string &filename);
+
+    /**
+     * @brief Stops the recording and closes the trace file
+     *
+     * Does nothing if nothing is being recorded.
+     */
+    void stopRecording();
+
+    /**
+     * @brief Checks if a trace is being recorded
+     *
+     * @return @c true if startRecording() has been called, @c false otherwise
+     */
+    bool isRecording() const;
+
+    /**
+     * @brief Replays a trace instead of accessing the USB hardware
+     *
+     * In replay mode, detectDevices() returns the devices from the trace and all operations
+     * on devices and device handles return the recorded results and data. The USB library is
+     * not used at all. The program has to perform the same operations in the same order as
+     * during the recording, otherwise the operation throws an Error.
+     *
+     * Replay can also be enabled with the environment variable @c USBPP_REPLAY. If
+     * @c USBPP_REPLAY_TIMING is set to @c 1, the original timing is used.
+     *
+     * @param[in] filename the name of the trace file created by startRecording()
+     * @param[in] realTiming @c true if each operation should take as long as in the recording,
+     *            @c false if operations should return immediately
+     * @exception Error if the file cannot be read or if a trace is being recorded
+     */
+    void startReplay(const std::string &filename, bool realTiming = false);
+
+    /**
+     * @brief Stops replaying
+     *
+     * Device handles that have been opened in replay mode become invalid.
+     */
+    void stopReplay();
+
+    /**
+     * @brief Checks if a trace is being replayed
+     *
+     * @return @c true if startReplay() has been called, @c false otherwise
+     */
+    bool isReplaying() const;
+
     /**
      * @brief Detects the devices
      *
      * This function must be called every time new devices are attached or old devices are removed,
      * i.e. to keep the information up to date.
+     *
+     * Only devices that match @p filter are wrapped in a Device object and are available with
+     * getDevice(). The IDs are taken from the device descriptors that the USB library has already
+     * read, so filtering out a device doesn't cause any I/O.
+     *
+     * @param[in] filter the vendor/product IDs of the interesting devices. The default filter
+     *            matches all devices.
+     * @exception Error on any error
      */
-    void detectDevices();
+    void detectDevices(const DeviceFilter &filter = DeviceFilter());
 
     /**
      * @brief Returns the number of currently attached devices
@@ -99,6 +208,23 @@ private:
     UsbManager(const UsbManager &other);
     UsbManager &operator=(const UsbManager &other);
 
+    // returns the native library context, initialises the library on the first call
+    void *getContext();
+
+    // looks up the native device for a Device that has been created from sysfs; the
+    // caller owns a reference of the returned device
+    void *findNativeDevice(unsigned short busNumber, unsigned short deviceNumber);
+
+    // write the detected devices to the trace
+    void recordDevices();
+
+    // read the detected devices from the trace
+    void replayDevices(const DeviceFilter &filter);
+
+    // the active trace writer and reader, NULL if not recording resp. replaying
+    TraceWriter *getTraceWriter() const;
+    TraceReader *getTraceReader() const;
+
 private:
     UsbManagerPrivate *const m_data;
 };
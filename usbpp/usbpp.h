@@ -19,7 +19,9 @@
 
 #include <usbpp/usbmanager.h>
 #include <usbpp/device.h>
+#include <usbpp/devicefilter.h>
 #include <usbpp/devicehandle.h>
+#include <usbpp/bufferpool.h>
 #include <usbpp/configdescriptor.h>
 #include <usbpp/interfacedescriptor.h>
 
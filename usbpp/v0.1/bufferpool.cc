@@ -0,0 +1,124 @@
+/*
+ * (c) 2010, Bernhard Walle <bernhard@bwalle.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#ifdef _WIN32
+#  include <malloc.h>
+#endif
+
+#include "libusb_0.1.h"
+
+#include <usbpp/bufferpool.h>
+
+#define BUFFER_ALIGNMENT 4096
+
+namespace usb {
+
+/* Aligned memory {{{ */
+
+static unsigned char *aligned_alloc_buffer(size_t size)
+{
+#ifdef _WIN32
+    return static_cast<unsigned char *>(_aligned_malloc(size, BUFFER_ALIGNMENT));
+#else
+    void *ptr;
+    if (posix_memalign(&ptr, BUFFER_ALIGNMENT, size) != 0)
+        return NULL;
+    return static_cast<unsigned char *>(ptr);
+#endif
+}
+
+static void aligned_free_buffer(unsigned char *buffer)
+{
+#ifdef _WIN32
+    _aligned_free(buffer);
+#else
+    free(buffer);
+#endif
+}
+
+/* }}} */
+/* BufferPoolPrivate {{{ */
+
+struct BufferPoolPrivate {
+    usb_dev_handle              *device_handle;
+    size_t                      buffer_size;
+    std::vector<unsigned char *> buffers;
+    std::vector<unsigned char *> free_buffers;
+};
+
+/* }}} */
+/* BufferPool {{{ */
+
+BufferPool::BufferPool(void *nativeHandle, size_t bufferSize)
+    : m_data(new BufferPoolPrivate)
+{
+    m_data->device_handle = static_cast<usb_dev_handle *>(nativeHandle);
+    m_data->buffer_size = bufferSize;
+}
+
+BufferPool::~BufferPool()
+{
+    for (std::vector<unsigned char *>::iterator it = m_data->buffers.begin();
+            it != m_data->buffers.end(); ++it)
+        aligned_free_buffer(*it);
+    delete m_data;
+}
+
+size_t BufferPool::getBufferSize() const
+{
+    return m_data->buffer_size;
+}
+
+bool BufferPool::isDeviceMemory() const
+{
+    // libusb 0.1 has no support for device memory
+    return false;
+}
+
+unsigned char *BufferPool::acquire()
+{
+    if (!m_data->free_buffers.empty()) {
+        unsigned char *buffer = m_data->free_buffers.back();
+        m_data->free_buffers.pop_back();
+        return buffer;
+    }
+
+    unsigned char *buffer = aligned_alloc_buffer(m_data->buffer_size);
+    if (!buffer)
+        throw Error("Unable to allocate transfer buffer");
+
+    std::memset(buffer, 0, m_data->buffer_size);
+    m_data->buffers.push_back(buffer);
+    return buffer;
+}
+
+void BufferPool::release(unsigned char *buffer)
+{
+    if (std::find(m_data->buffers.begin(), m_data->buffers.end(), buffer) == m_data->buffers.end())
+        throw Error("Buffer doesn't belong to the pool");
+
+    m_data->free_buffers.push_back(buffer);
+}
+
+/* }}} */
+
+} // end namespace usb
+
+// vim: set sw=4 ts=4 et: :collapseFolds=1:
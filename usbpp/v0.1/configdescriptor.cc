@@ -15,6 +15,7 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 #include <sstream>
+#include <vector>
 
 #include "libusb_0.1.h"
 
@@ -27,6 +28,7 @@ namespace usb {
 
 struct ConfigDescriptorPrivate {
     usb_config_descriptor *config_descriptor;
+    std::vector< std::vector<InterfaceDescriptor *> > interfaces;
 };
 
 /* }}} */
@@ -36,10 +38,22 @@ ConfigDescriptor::ConfigDescriptor(void *nativeHandle)
     : m_data(new ConfigDescriptorPrivate)
 {
     m_data->config_descriptor = static_cast<usb_config_descriptor *>(nativeHandle);
+
+    // wrap all interface descriptors once, they live as long as the config descriptor
+    m_data->interfaces.resize(m_data->config_descriptor->bNumInterfaces);
+    for (size_t i = 0; i < m_data->interfaces.size(); i++) {
+        const int numAltsettings = m_data->config_descriptor->interface[i].num_altsetting;
+        for (int j = 0; j < numAltsettings; j++)
+            m_data->interfaces[i].push_back(
+                new InterfaceDescriptor(&m_data->config_descriptor->interface[i].altsetting[j]));
+    }
 }
 
 ConfigDescriptor::~ConfigDescriptor()
 {
+    for (size_t i = 0; i < m_data->interfaces.size(); i++)
+        for (size_t j = 0; j < m_data->interfaces[i].size(); j++)
+            delete m_data->interfaces[i][j];
     delete m_data;
 }
 
@@ -61,11 +75,11 @@ size_t ConfigDescriptor::getNumberOfAltsettings(unsigned int interfaceNumber) co
         throw Error(ss.str());
     }
 
-    return m_data->config_descriptor->interface[interfaceNumber].num_altsetting;
+    return m_data->interfaces[interfaceNumber].size();
 }
 
-InterfaceDescriptor *ConfigDescriptor::getInterfaceDescriptor(unsigned interfaceNumber,
-                                                              unsigned int altsetting)
+const InterfaceDescriptor &ConfigDescriptor::getInterfaceDescriptor(unsigned interfaceNumber,
+                                                                    unsigned int altsetting) const
 {
     if (altsetting >= getNumberOfAltsettings(interfaceNumber)) {
         std::stringstream ss;
@@ -73,7 +87,7 @@ InterfaceDescriptor *ConfigDescriptor::getInterfaceDescriptor(unsigned interface
         throw Error(ss.str());
     }
 
-    return new InterfaceDescriptor(&m_data->config_descriptor->interface[interfaceNumber].altsetting[altsetting]);
+    return *m_data->interfaces[interfaceNumber][altsetting];
 }
 
 
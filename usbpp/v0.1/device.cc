@@ -14,6 +14,9 @@
  * You should have received a copy of the GNU General Public License
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
+#include <vector>
+#include <sstream>
+
 #include "libusb_0.1.h"
 
 #include <usbpp/device.h>
@@ -25,7 +28,9 @@ namespace usb {
 /* DevicePrivate {{{ */
 
 struct DevicePrivate {
-    struct usb_device *device;
+    struct usb_device                   *device;
+    DeviceDescriptor                    descriptor;
+    std::vector<ConfigDescriptor *>     config_descriptors;
 };
 
 /* }}} */
@@ -33,6 +38,8 @@ struct DevicePrivate {
 
 Device::~Device()
 {
+    for (size_t i = 0; i < m_data->config_descriptors.size(); ++i)
+        delete m_data->config_descriptors[i];
     delete m_data;
 }
 
@@ -46,32 +53,47 @@ unsigned short Device::getBusNumber() const
     return m_data->device->bus->location;
 }
 
+std::string Device::getPortPath() const
+{
+    // libusb 0.1 doesn't know the topology
+    return std::string();
+}
+
 Device::Device(void *nativeHandle)
     : m_data(new DevicePrivate)
 {
     m_data->device = static_cast<struct usb_device *>(nativeHandle);
-}
 
-DeviceDescriptor Device::getDescriptor() const
-{
-    DeviceDescriptor ret;
+    const struct usb_device_descriptor &usbDescriptor = m_data->device->descriptor;
 
-    struct usb_device_descriptor usbDescriptor = m_data->device->descriptor;
+    m_data->descriptor.setDeviceClass(usbDescriptor.bDeviceClass);
+    m_data->descriptor.setDeviceSubclass(usbDescriptor.bDeviceSubClass);
+    m_data->descriptor.setVendorId(usbDescriptor.idVendor);
+    m_data->descriptor.setProductId(usbDescriptor.idProduct);
+    m_data->descriptor.setBcdDevice(usbDescriptor.bcdDevice);
 
-    ret.setDeviceClass(usbDescriptor.bDeviceClass);
-    ret.setDeviceSubclass(usbDescriptor.bDeviceSubClass);
-    ret.setVendorId(usbDescriptor.idVendor);
-    ret.setProductId(usbDescriptor.idProduct);
-    ret.setBcdDevice(usbDescriptor.bcdDevice);
+    // libusb 0.1 has already read the configurations, they are only wrapped
+    if (m_data->device->config) {
+        m_data->descriptor.setNumConfigurations(usbDescriptor.bNumConfigurations);
+        for (int i = 0; i < usbDescriptor.bNumConfigurations; i++)
+            m_data->config_descriptors.push_back(new ConfigDescriptor(&m_data->device->config[i]));
+    }
+}
 
-    return ret;
+const DeviceDescriptor &Device::getDescriptor() const
+{
+    return m_data->descriptor;
 }
 
-ConfigDescriptor *Device::getConfigDescriptor(int index)
+const ConfigDescriptor &Device::getConfigDescriptor(int index) const
 {
-    struct usb_config_descriptor *usb_config_descriptor = m_data->device->config;
+    if (index < 0 || size_t(index) >= m_data->config_descriptors.size()) {
+        std::stringstream ss;
+        ss << "Configuration " << index << " does not exist.";
+        throw Error(ss.str());
+    }
 
-    return new ConfigDescriptor(usb_config_descriptor);
+    return *m_data->config_descriptors[index];
 }
 
 DeviceHandle *Device::open()
@@ -16,13 +16,28 @@
  */
 #include <list>
 #include <algorithm>
+#include <cerrno>
 
 #include "libusb_0.1.h"
 
 #include <usbpp/devicehandle.h>
+#include <usbpp/bufferpool.h>
 
 namespace usb {
 
+/* Helpers {{{ */
+
+// libusb 0.1 returns the negative errno
+static Error::Code errorcodeToCode(int err)
+{
+    switch (-err) {
+        case ETIMEDOUT: return Error::TIMEOUT;
+        case EPIPE:     return Error::PIPE;
+        default:        return Error::OTHER;
+    }
+}
+
+/* }}} */
 /* DeviceHandlePrivate {{{ */
 
 struct DeviceHandlePrivate {
@@ -91,18 +106,21 @@ void DeviceHandle::setInterfaceAltSetting(int interfaceNumber, int alternateSett
         throw Error(usb_strerror());
 }
 
-void DeviceHandle::controlTransfer(unsigned char      bmRequestType,
-                                   unsigned char      bRequest,
-                                   unsigned short     wValue,
-                                   unsigned short     wIndex,
-                                   unsigned char      *data,
-                                   unsigned short     wLength,
-                                   unsigned int       timeout)
+int DeviceHandle::controlTransfer(unsigned char      bmRequestType,
+                                  unsigned char      bRequest,
+                                  unsigned short     wValue,
+                                  unsigned short     wIndex,
+                                  unsigned char      *data,
+                                  unsigned short     wLength,
+                                  unsigned int       timeout)
 {
     int err = usb_control_msg(m_data->device_handle, bmRequestType, bRequest, wValue, wIndex,
                               reinterpret_cast<char *>(data), wLength, timeout);
-    if (err != 0)
-        throw Error(usb_strerror());
+    // on success, the number of transferred bytes is returned
+    if (err < 0)
+        throw Error(usb_strerror(), errorcodeToCode(err));
+
+    return err;
 }
 
 void DeviceHandle::bulkTransfer(unsigned char     endpoint,
@@ -113,12 +131,19 @@ void DeviceHandle::bulkTransfer(unsigned char     endpoint,
 {
     int ret = usb_bulk_write(m_data->device_handle, endpoint, reinterpret_cast<char *>(data), length, timeout);
     if (ret < 0)
-        throw Error(usb_strerror());
+        throw Error(usb_strerror(), errorcodeToCode(ret));
 
     if (transferred)
         *transferred = ret;
 }
 
+void DeviceHandle::clearHalt(unsigned char endpoint)
+{
+    int err = usb_clear_halt(m_data->device_handle, endpoint);
+    if (err != 0)
+        throw Error(usb_strerror());
+}
+
 void DeviceHandle::resetDevice()
 {
     int err = usb_reset(m_data->device_handle);
@@ -126,6 +151,11 @@ void DeviceHandle::resetDevice()
         throw Error(usb_strerror());
 }
 
+BufferPool *DeviceHandle::createBufferPool(size_t bufferSize)
+{
+    return new BufferPool(m_data->device_handle, bufferSize);
+}
+
 /* }}} */
 
 } // end namespace usb
@@ -20,6 +20,7 @@
 
 #include "libusb_0.1.h"
 
+#include <usbpp/exceptions.h>
 #include <usbpp/usbmanager.h>
 #include <usbpp/device.h>
 
@@ -62,7 +63,50 @@ void UsbManager::setDebug(bool debug)
         usb_set_debug(0);
 }
 
-void UsbManager::detectDevices()
+bool UsbManager::isSysfsSupported() const
+{
+    // libusb 0.1 reads the descriptors on enumeration anyway
+    return false;
+}
+
+void UsbManager::setSysfsRoot(const std::string &root)
+{
+    if (!root.empty())
+        throw Error("Enumeration via sysfs is not supported with libusb 0.1");
+}
+
+std::string UsbManager::getSysfsRoot() const
+{
+    return std::string();
+}
+
+void UsbManager::startRecording(const std::string &filename)
+{
+    throw Error("Recording of USB traces is not supported with libusb 0.1");
+}
+
+void UsbManager::stopRecording()
+{}
+
+bool UsbManager::isRecording() const
+{
+    return false;
+}
+
+void UsbManager::startReplay(const std::string &filename, bool realTiming)
+{
+    throw Error("Replaying of USB traces is not supported with libusb 0.1");
+}
+
+void UsbManager::stopReplay()
+{}
+
+bool UsbManager::isReplaying() const
+{
+    return false;
+}
+
+void UsbManager::detectDevices(const DeviceFilter &filter)
 {
     for (size_t i = 0; i < m_data->devices.size(); ++i)
         delete m_data->devices[i];
@@ -73,7 +117,8 @@ void UsbManager::detectDevices()
 
     for (struct usb_bus *bus = usb_get_busses(); bus; bus = bus->next) {
         for (struct usb_device *dev = bus->devices; dev; dev = dev->next)
-            m_data->devices.push_back(new Device(dev));
+            if (filter.matches(dev->descriptor.idVendor, dev->descriptor.idProduct))
+                m_data->devices.push_back(new Device(dev));
     }
 }
 
@@ -15,6 +15,7 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 #include <sstream>
+#include <vector>
 
 #include "libusb_1.0.h"
 #include "error.h"
@@ -28,6 +29,8 @@ namespace usb {
 
 struct ConfigDescriptorPrivate {
     libusb_config_descriptor *config_descriptor;
+    unsigned short configuration_value;
+    std::vector< std::vector<InterfaceDescriptor *> > interfaces;
 };
 
 /* }}} */
@@ -37,22 +40,49 @@ ConfigDescriptor::ConfigDescriptor(void *nativeHandle)
     : m_data(new ConfigDescriptorPrivate)
 {
     m_data->config_descriptor = static_cast<libusb_config_descriptor *>(nativeHandle);
+    m_data->configuration_value = m_data->config_descriptor->bConfigurationValue;
+
+    // wrap all interface descriptors once, they live as long as the config descriptor
+    m_data->interfaces.resize(m_data->config_descriptor->bNumInterfaces);
+    for (size_t i = 0; i < m_data->interfaces.size(); i++) {
+        const int numAltsettings = m_data->config_descriptor->interface[i].num_altsetting;
+        for (int j = 0; j < numAltsettings; j++)
+            m_data->interfaces[i].push_back(
+                new InterfaceDescriptor(&m_data->config_descriptor->interface[i].altsetting[j]));
+    }
+}
+
+ConfigDescriptor::ConfigDescriptor(unsigned short configurationValue,
+                                   const std::vector< std::vector<unsigned short> > &interfaceNumbers)
+    : m_data(new ConfigDescriptorPrivate)
+{
+    m_data->config_descriptor = NULL;
+    m_data->configuration_value = configurationValue;
+
+    m_data->interfaces.resize(interfaceNumbers.size());
+    for (size_t i = 0; i < m_data->interfaces.size(); i++)
+        for (size_t j = 0; j < interfaceNumbers[i].size(); j++)
+            m_data->interfaces[i].push_back(new InterfaceDescriptor(interfaceNumbers[i][j]));
 }
 
 ConfigDescriptor::~ConfigDescriptor()
 {
-    libusb_free_config_descriptor(m_data->config_descriptor);
+    for (size_t i = 0; i < m_data->interfaces.size(); i++)
+        for (size_t j = 0; j < m_data->interfaces[i].size(); j++)
+            delete m_data->interfaces[i][j];
+    if (m_data->config_descriptor)
+        libusb_free_config_descriptor(m_data->config_descriptor);
     delete m_data;
 }
 
 unsigned short ConfigDescriptor::getConfigurationValue() const
 {
-    return m_data->config_descriptor->bConfigurationValue;
+    return m_data->configuration_value;
 }
 
 size_t ConfigDescriptor::getNumberOfInterfaces() const
 {
-    return m_data->config_descriptor->bNumInterfaces;
+    return m_data->interfaces.size();
 }
 
 size_t ConfigDescriptor::getNumberOfAltsettings(unsigned int interfaceNumber) const
@@ -63,11 +93,11 @@ size_t ConfigDescriptor::getNumberOfAltsettings(unsigned int interfaceNumber) co
         throw Error(ss.str());
     }
 
-    return m_data->config_descriptor->interface[interfaceNumber].num_altsetting;
+    return m_data->interfaces[interfaceNumber].size();
 }
 
-InterfaceDescriptor *ConfigDescriptor::getInterfaceDescriptor(unsigned interfaceNumber,
-                                                              unsigned int altsetting)
+const InterfaceDescriptor &ConfigDescriptor::getInterfaceDescriptor(unsigned interfaceNumber,
+                                                                    unsigned int altsetting) const
 {
     if (altsetting >= getNumberOfAltsettings(interfaceNumber)) {
         std::stringstream ss;
@@ -75,7 +105,7 @@ InterfaceDescriptor *ConfigDescriptor::getInterfaceDescriptor(unsigned interface
         throw Error(ss.str());
     }
 
-    return new InterfaceDescriptor(&m_data->config_descriptor->interface[interfaceNumber].altsetting[altsetting]);
+    return *m_data->interfaces[interfaceNumber][altsetting];
 }
 
 
@@ -14,19 +14,32 @@
  * You should have received a copy of the GNU General Public License
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
+#include <vector>
+#include <sstream>
+
 #include "libusb_1.0.h"
 #include "error.h"
 
 #include <usbpp/device.h>
 #include <usbpp/devicehandle.h>
 #include <usbpp/configdescriptor.h>
+#include <usbpp/interfacedescriptor.h>
+#include <usbpp/usbmanager.h>
+#include <usbpp/transfertrace.h>
 
 namespace usb {
 
 /* DevicePrivate {{{ */
 
 struct DevicePrivate {
-    libusb_device *device;
+    libusb_device                       *device;
+    bool                                owns_reference;
+    unsigned short                      bus_number;
+    unsigned short                      device_number;
+    std::string                         port_path;
+    DeviceDescriptor                    descriptor;
+    std::vector<ConfigDescriptor *>     config_descriptors;
+    int                                 config_error;
 };
 
 /* }}} */
@@ -34,57 +47,248 @@ struct DevicePrivate {
 
 Device::~Device()
 {
+    for (size_t i = 0; i < m_data->config_descriptors.size(); ++i)
+        delete m_data->config_descriptors[i];
+    if (m_data->device && m_data->owns_reference)
+        libusb_unref_device(m_data->device);
     delete m_data;
 }
 
 unsigned short Device::getDeviceNumber() const
 {
-    return libusb_get_device_address(m_data->device);
+    return m_data->device_number;
 }
 
 unsigned short Device::getBusNumber() const
 {
-    return libusb_get_bus_number(m_data->device);
+    return m_data->bus_number;
+}
+
+std::string Device::getPortPath() const
+{
+    return m_data->port_path;
 }
 
 Device::Device(void *nativeHandle)
     : m_data(new DevicePrivate)
 {
     m_data->device = static_cast<libusb_device *>(nativeHandle);
-}
+    m_data->owns_reference = false;
+    m_data->config_error = 0;
+    m_data->bus_number = libusb_get_bus_number(m_data->device);
+    m_data->device_number = libusb_get_device_address(m_data->device);
 
-DeviceDescriptor Device::getDescriptor() const
-{
-    DeviceDescriptor ret;
+    // libusb_get_port_numbers() is available since libusb 1.0.16
+#if defined(LIBUSB_API_VERSION) && LIBUSB_API_VERSION >= 0x01000102
+    uint8_t portNumbers[7];
+    int numberOfPorts = libusb_get_port_numbers(m_data->device, portNumbers, sizeof(portNumbers));
+    if (numberOfPorts > 0) {
+        std::stringstream ss;
+        ss << m_data->bus_number;
+        for (int i = 0; i < numberOfPorts; ++i)
+            ss << (i == 0 ? "-" : ".") << int(portNumbers[i]);
+        m_data->port_path = ss.str();
+    }
+#endif
 
     struct libusb_device_descriptor usbDescriptor;
     int err = libusb_get_device_descriptor(m_data->device, &usbDescriptor);
-    if (err != 0)
+    if (err != 0) {
+        delete m_data;
         throw Error(errorcodeToString(err));
+    }
 
-    ret.setDeviceClass(usbDescriptor.bDeviceClass);
-    ret.setDeviceSubclass(usbDescriptor.bDeviceSubClass);
-    ret.setVendorId(usbDescriptor.idVendor);
-    ret.setProductId(usbDescriptor.idProduct);
-    ret.setBcdDevice(usbDescriptor.bcdDevice);
+    m_data->descriptor.setDeviceClass(usbDescriptor.bDeviceClass);
+    m_data->descriptor.setDeviceSubclass(usbDescriptor.bDeviceSubClass);
+    m_data->descriptor.setVendorId(usbDescriptor.idVendor);
+    m_data->descriptor.setProductId(usbDescriptor.idProduct);
+    m_data->descriptor.setBcdDevice(usbDescriptor.bcdDevice);
+    m_data->descriptor.setNumConfigurations(usbDescriptor.bNumConfigurations);
+}
 
-    return ret;
+Device::Device(unsigned short busNumber, unsigned short deviceNumber,
+               const DeviceDescriptor &descriptor, const std::string &portPath)
+    : m_data(new DevicePrivate)
+{
+    m_data->device = NULL;
+    m_data->owns_reference = false;
+    m_data->config_error = 0;
+    m_data->bus_number = busNumber;
+    m_data->device_number = deviceNumber;
+    m_data->port_path = portPath;
+    m_data->descriptor = descriptor;
 }
 
-ConfigDescriptor *Device::getConfigDescriptor(int index)
+void *Device::getNativeDevice() const
 {
-    struct libusb_config_descriptor *usb_config_descriptor;
-    int err = libusb_get_config_descriptor(m_data->device, index, &usb_config_descriptor);
-    if (err != 0)
-        throw Error(errorcodeToString(err));
+    if (!m_data->device) {
+        void *device = UsbManager::instance().findNativeDevice(m_data->bus_number,
+                                                               m_data->device_number);
+        m_data->device = static_cast<libusb_device *>(device);
+        m_data->owns_reference = true;
+    }
+
+    return m_data->device;
+}
 
-    return new ConfigDescriptor(usb_config_descriptor);
+const DeviceDescriptor &Device::getDescriptor() const
+{
+    return m_data->descriptor;
+}
+
+const ConfigDescriptor &Device::getConfigDescriptor(int index) const
+{
+    if (index < 0 || size_t(index) >= m_data->config_descriptors.size())
+        throw Error(errorcodeToString(index < m_data->descriptor.getNumConfigurations() &&
+                                      m_data->config_error != 0
+                                      ? m_data->config_error
+                                      : LIBUSB_ERROR_NOT_FOUND));
+
+    return *m_data->config_descriptors[index];
+}
+
+void Device::readConfigDescriptors(const std::vector<unsigned char> &sysfsDescriptors)
+{
+    UsbManager &usbManager = UsbManager::instance();
+
+    if (usbManager.getTraceReader()) {
+        for (int index = 0; index < m_data->descriptor.getNumConfigurations(); index++) {
+            TraceRecord record(TraceRecord::TR_CONFIG);
+            record.values.push_back(m_data->bus_number);
+            record.values.push_back(m_data->device_number);
+            record.values.push_back(index);
+
+            usbManager.getTraceReader()->replay(record);
+            if (record.status != 0) {
+                m_data->config_error = record.status;
+                return;
+            }
+            m_data->config_descriptors.push_back(configDescriptorFromTrace(record));
+        }
+        return;
+    }
+
+    if (!sysfsDescriptors.empty()) {
+        // the device descriptor is followed by each configuration with its interfaces
+        std::vector< std::vector<unsigned short> > interfaceNumbers;
+        unsigned short configurationValue = 0;
+        bool haveConfig = false;
+
+        size_t pos = 0;
+        while (pos + 2 <= sysfsDescriptors.size()) {
+            size_t length = sysfsDescriptors[pos];
+            unsigned char type = sysfsDescriptors[pos+1];
+            if (length < 2 || pos + length > sysfsDescriptors.size())
+                break;
+
+            if (type == LIBUSB_DT_CONFIG && length >= LIBUSB_DT_CONFIG_SIZE) {
+                if (haveConfig)
+                    addConfigDescriptor(new ConfigDescriptor(configurationValue, interfaceNumbers));
+                configurationValue = sysfsDescriptors[pos+5];
+                interfaceNumbers.clear();
+                haveConfig = true;
+            } else if (type == LIBUSB_DT_INTERFACE && length >= LIBUSB_DT_INTERFACE_SIZE &&
+                       haveConfig) {
+                // the altsettings of an interface follow each other
+                unsigned short number = sysfsDescriptors[pos+2];
+                if (interfaceNumbers.empty() || interfaceNumbers.back().front() != number)
+                    interfaceNumbers.push_back(std::vector<unsigned short>());
+                interfaceNumbers.back().push_back(number);
+            }
+
+            pos += length;
+        }
+        if (haveConfig)
+            addConfigDescriptor(new ConfigDescriptor(configurationValue, interfaceNumbers));
+
+        return;
+    }
+
+    for (int index = 0; index < m_data->descriptor.getNumConfigurations(); index++) {
+        libusb_device *device = static_cast<libusb_device *>(getNativeDevice());
+        struct libusb_config_descriptor *usb_config_descriptor;
+        int err = libusb_get_config_descriptor(device, index, &usb_config_descriptor);
+        if (err != 0) {
+            // getConfigDescriptor() reports the error for the missing configurations
+            m_data->config_error = err;
+            if (usbManager.getTraceWriter()) {
+                TraceRecord record(TraceRecord::TR_CONFIG);
+                record.values.push_back(m_data->bus_number);
+                record.values.push_back(m_data->device_number);
+                record.values.push_back(index);
+                record.status = err;
+                usbManager.getTraceWriter()->write(record);
+            }
+            return;
+        }
+
+        addConfigDescriptor(new ConfigDescriptor(usb_config_descriptor));
+    }
+}
+
+void Device::addConfigDescriptor(ConfigDescriptor *configDescriptor)
+{
+    m_data->config_descriptors.push_back(configDescriptor);
+
+    UsbManager &usbManager = UsbManager::instance();
+    if (!usbManager.getTraceWriter())
+        return;
+
+    TraceRecord record(TraceRecord::TR_CONFIG);
+    record.values.push_back(m_data->bus_number);
+    record.values.push_back(m_data->device_number);
+    record.values.push_back(m_data->config_descriptors.size() - 1);
+    record.values.push_back(configDescriptor->getConfigurationValue());
+    record.values.push_back(configDescriptor->getNumberOfInterfaces());
+    for (size_t i = 0; i < configDescriptor->getNumberOfInterfaces(); i++) {
+        record.values.push_back(configDescriptor->getNumberOfAltsettings(i));
+        for (size_t j = 0; j < configDescriptor->getNumberOfAltsettings(i); j++)
+            record.values.push_back(
+                configDescriptor->getInterfaceDescriptor(i, j).getInterfaceNumber());
+    }
+    usbManager.getTraceWriter()->write(record);
+}
+
+ConfigDescriptor *Device::configDescriptorFromTrace(const TraceRecord &record) const
+{
+    // bus, device, index, configuration value, number of interfaces
+    if (record.values.size() < 5)
+        throw Error("Invalid config descriptor in trace");
+
+    std::vector< std::vector<unsigned short> > interfaceNumbers(record.values[4]);
+    size_t pos = 5;
+    for (size_t i = 0; i < interfaceNumbers.size(); i++) {
+        if (pos >= record.values.size())
+            throw Error("Invalid config descriptor in trace");
+        size_t numAltsettings = record.values[pos++];
+        for (size_t j = 0; j < numAltsettings && pos < record.values.size(); j++)
+            interfaceNumbers[i].push_back(record.values[pos++]);
+    }
+
+    return new ConfigDescriptor(record.values[3], interfaceNumbers);
 }
 
 DeviceHandle *Device::open()
 {
+    UsbManager &usbManager = UsbManager::instance();
+    TraceRecord record(TraceRecord::TR_OPEN);
+    record.values.push_back(m_data->bus_number);
+    record.values.push_back(m_data->device_number);
+
+    if (usbManager.getTraceReader()) {
+        usbManager.getTraceReader()->replay(record);
+        if (record.status != 0)
+            throw Error(errorcodeToString(record.status));
+        return new DeviceHandle(NULL);
+    }
+
+    libusb_device *device = static_cast<libusb_device *>(getNativeDevice());
     libusb_device_handle *handle;
-    int err = libusb_open(m_data->device, &handle);
+    int err = libusb_open(device, &handle);
+    if (usbManager.getTraceWriter()) {
+        record.status = err;
+        usbManager.getTraceWriter()->write(record);
+    }
     if (err != 0)
         throw Error(errorcodeToString(err));
 
@@ -21,26 +21,67 @@
 #include "error.h"
 
 #include <usbpp/devicehandle.h>
+#include <usbpp/bufferpool.h>
+#include <usbpp/usbmanager.h>
+#include <usbpp/transfertrace.h>
 
 namespace usb {
 
 /* DeviceHandlePrivate {{{ */
 
 struct DeviceHandlePrivate {
-    libusb_device_handle *device_handle;
+    libusb_device_handle *device_handle;    // NULL when replaying a trace
     std::list<int>       claimed_interfaces;
+    unsigned int         trace_handle;
 };
 
+/* }}} */
+/* Tracing {{{ */
+
+static void replay_record(TraceReader *reader, TraceRecord &record)
+{
+    if (!reader)
+        throw Error("The device handle has been opened from a trace that is not replayed anymore");
+
+    reader->replay(record);
+    if (record.status != 0)
+        throw Error(errorcodeToString(record.status), errorcodeToCode(record.status));
+}
+
+static void write_record(TraceWriter *writer, TraceRecord &record, int status)
+{
+    if (!writer)
+        return;
+
+    record.status = status;
+    writer->write(record);
+}
+
 /* }}} */
 /* DeviceHandle {{{ */
 
 DeviceHandle::~DeviceHandle()
 {
+    TraceRecord record(TraceRecord::TR_CLOSE, m_data->trace_handle);
+
+    if (!m_data->device_handle) {
+        // never throw in the destructor
+        try {
+            replay_record(UsbManager::instance().getTraceReader(), record);
+        } catch (const Error &) {}
+        delete m_data;
+        return;
+    }
+
     for (std::list<int>::iterator it = m_data->claimed_interfaces.begin();
          it != m_data->claimed_interfaces.end(); ++it) {
         libusb_release_interface(m_data->device_handle, *it);
     }
     libusb_close(m_data->device_handle);
+
+    try {
+        write_record(UsbManager::instance().getTraceWriter(), record, 0);
+    } catch (const Error &) {}
     delete m_data;
 }
 
@@ -48,12 +89,27 @@ DeviceHandle::DeviceHandle(void *nativeHandle)
     : m_data(new DeviceHandlePrivate)
 {
     m_data->device_handle = static_cast<libusb_device_handle *>(nativeHandle);
+    m_data->trace_handle = 0;
+
+    UsbManager &usbManager = UsbManager::instance();
+    if (usbManager.getTraceWriter())
+        m_data->trace_handle = usbManager.getTraceWriter()->newHandle();
+    else if (usbManager.getTraceReader())
+        m_data->trace_handle = usbManager.getTraceReader()->newHandle();
 }
 
 int DeviceHandle::getConfiguration() const
 {
+    TraceRecord record(TraceRecord::TR_GET_CONFIGURATION, m_data->trace_handle);
+    if (!m_data->device_handle) {
+        replay_record(UsbManager::instance().getTraceReader(), record);
+        return record.values.empty() ? 0 : record.values[0];
+    }
+
     int configuration;
     int err = libusb_get_configuration(m_data->device_handle, &configuration);
+    record.values.push_back(err == 0 ? configuration : 0);
+    write_record(UsbManager::instance().getTraceWriter(), record, err);
     if (err != 0)
         throw Error(errorcodeToString(err));
 
@@ -62,14 +118,30 @@ int DeviceHandle::getConfiguration() const
 
 void DeviceHandle::setConfiguration(int newConfiguration)
 {
+    TraceRecord record(TraceRecord::TR_SET_CONFIGURATION, m_data->trace_handle);
+    record.values.push_back(newConfiguration);
+    if (!m_data->device_handle) {
+        replay_record(UsbManager::instance().getTraceReader(), record);
+        return;
+    }
+
     int err = libusb_set_configuration(m_data->device_handle, newConfiguration);
+    write_record(UsbManager::instance().getTraceWriter(), record, err);
     if (err != 0)
         throw Error(errorcodeToString(err));
 }
 
 void DeviceHandle::claimInterface(int interfaceNumber)
 {
+    TraceRecord record(TraceRecord::TR_CLAIM_INTERFACE, m_data->trace_handle);
+    record.values.push_back(interfaceNumber);
+    if (!m_data->device_handle) {
+        replay_record(UsbManager::instance().getTraceReader(), record);
+        return;
+    }
+
     int err = libusb_claim_interface(m_data->device_handle, interfaceNumber);
+    write_record(UsbManager::instance().getTraceWriter(), record, err);
     if (err != 0)
         throw Error(errorcodeToString(err));
 
@@ -78,7 +150,15 @@ void DeviceHandle::claimInterface(int interfaceNumber)
 
 void DeviceHandle::releaseInterface(int interfaceNumber)
 {
+    TraceRecord record(TraceRecord::TR_RELEASE_INTERFACE, m_data->trace_handle);
+    record.values.push_back(interfaceNumber);
+    if (!m_data->device_handle) {
+        replay_record(UsbManager::instance().getTraceReader(), record);
+        return;
+    }
+
     int err = libusb_release_interface(m_data->device_handle, interfaceNumber);
+    write_record(UsbManager::instance().getTraceWriter(), record, err);
     if (err != 0)
         throw Error(errorcodeToString(err));
 
@@ -91,23 +171,66 @@ void DeviceHandle::releaseInterface(int interfaceNumber)
 
 void DeviceHandle::setInterfaceAltSetting(int interfaceNumber, int alternateSetting)
 {
+    TraceRecord record(TraceRecord::TR_SET_ALTSETTING, m_data->trace_handle);
+    record.values.push_back(interfaceNumber);
+    record.values.push_back(alternateSetting);
+    if (!m_data->device_handle) {
+        replay_record(UsbManager::instance().getTraceReader(), record);
+        return;
+    }
+
     int err =libusb_set_interface_alt_setting(m_data->device_handle, interfaceNumber, alternateSetting);
+    write_record(UsbManager::instance().getTraceWriter(), record, err);
     if (err != 0)
         throw Error(errorcodeToString(err));
 }
 
-void DeviceHandle::controlTransfer(unsigned char      bmRequestType,
-                                   unsigned char      bRequest,
-                                   unsigned short     wValue,
-                                   unsigned short     wIndex,
-                                   unsigned char      *data,
-                                   unsigned short     wLength,
-                                   unsigned int       timeout)
+int DeviceHandle::controlTransfer(unsigned char      bmRequestType,
+                                  unsigned char      bRequest,
+                                  unsigned short     wValue,
+                                  unsigned short     wIndex,
+                                  unsigned char      *data,
+                                  unsigned short     wLength,
+                                  unsigned int       timeout)
 {
+    const bool in = (bmRequestType & LIBUSB_ENDPOINT_IN) != 0;
+
+    // the timeout is not compared when replaying
+    TraceRecord record(TraceRecord::TR_CONTROL, m_data->trace_handle);
+    record.values.push_back(bmRequestType);
+    record.values.push_back(bRequest);
+    record.values.push_back(wValue);
+    record.values.push_back(wIndex);
+    record.values.push_back(wLength);
+
+    if (!m_data->device_handle) {
+        replay_record(UsbManager::instance().getTraceReader(), record);
+        if (!in)
+            return wLength;
+
+        size_t length = std::min<size_t>(record.data.size(), wLength);
+        if (data)
+            std::copy(record.data.begin(), record.data.begin() + length, data);
+        return length;
+    }
+
+    TraceWriter *writer = UsbManager::instance().getTraceWriter();
+    if (writer && !in && data)
+        record.data.assign(data, data + wLength);
+
     int err = libusb_control_transfer(m_data->device_handle, bmRequestType, bRequest,
                                       wValue, wIndex, data, wLength, timeout);
-    if (err != 0)
-        throw Error(errorcodeToString(err));
+    if (writer) {
+        record.values.push_back(timeout);
+        if (in && data && err > 0)
+            record.data.assign(data, data + err);
+        write_record(writer, record, err < 0 ? err : 0);
+    }
+    // on success, the number of transferred bytes is returned
+    if (err < 0)
+        throw Error(errorcodeToString(err), errorcodeToCode(err));
+
+    return err;
 }
 
 void DeviceHandle::bulkTransfer(unsigned char     endpoint,
@@ -120,19 +243,74 @@ void DeviceHandle::bulkTransfer(unsigned char     endpoint,
     if (transferred == NULL)
         transferred = &dummy;
 
+    const bool in = (endpoint & LIBUSB_ENDPOINT_IN) != 0;
+
+    // the timeout is not compared when replaying
+    TraceRecord record(TraceRecord::TR_BULK, m_data->trace_handle);
+    record.values.push_back(endpoint);
+    record.values.push_back(length);
+
+    if (!m_data->device_handle) {
+        replay_record(UsbManager::instance().getTraceReader(), record);
+        *transferred = record.values.size() > 3 ? record.values[3] : 0;
+        if (in)
+            std::copy(record.data.begin(),
+                      record.data.begin() + std::min<size_t>(record.data.size(), length),
+                      data);
+        return;
+    }
+
     int err = libusb_bulk_transfer(m_data->device_handle, endpoint, data, length,
                                    transferred, timeout);
+
+    TraceWriter *writer = UsbManager::instance().getTraceWriter();
+    if (writer) {
+        record.values.push_back(timeout);
+        record.values.push_back(*transferred);
+        if (in)
+            record.data.assign(data, data + *transferred);
+        else
+            record.data.assign(data, data + length);
+        write_record(writer, record, err);
+    }
+    if (err != 0)
+        throw Error(errorcodeToString(err), errorcodeToCode(err));
+}
+
+void DeviceHandle::clearHalt(unsigned char endpoint)
+{
+    TraceRecord record(TraceRecord::TR_CLEAR_HALT, m_data->trace_handle);
+    record.values.push_back(endpoint);
+    if (!m_data->device_handle) {
+        replay_record(UsbManager::instance().getTraceReader(), record);
+        return;
+    }
+
+    int err = libusb_clear_halt(m_data->device_handle, endpoint);
+    write_record(UsbManager::instance().getTraceWriter(), record, err);
     if (err != 0)
         throw Error(errorcodeToString(err));
 }
 
 void DeviceHandle::resetDevice()
 {
+    TraceRecord record(TraceRecord::TR_RESET, m_data->trace_handle);
+    if (!m_data->device_handle) {
+        replay_record(UsbManager::instance().getTraceReader(), record);
+        return;
+    }
+
     int err = libusb_reset_device(m_data->device_handle);
+    write_record(UsbManager::instance().getTraceWriter(), record, err);
     if (err != 0)
         throw Error(errorcodeToString(err));
 }
 
+BufferPool *DeviceHandle::createBufferPool(size_t bufferSize)
+{
+    return new BufferPool(m_data->device_handle, bufferSize);
+}
+
 /* }}} */
 
 } // end namespace usb
@@ -14,6 +14,7 @@
  * You should have received a copy of the GNU General Public License
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
+#include "libusb_1.0.h"
 #include "error.h"
 
 namespace usb {
@@ -44,4 +45,13 @@ const char *errorcodeToString(int err)
         return errortable[-err];
 }
 
+Error::Code errorcodeToCode(int err)
+{
+    switch (err) {
+        case LIBUSB_ERROR_TIMEOUT:  return Error::TIMEOUT;
+        case LIBUSB_ERROR_PIPE:     return Error::PIPE;
+        default:                    return Error::OTHER;
+    }
+}
+
 } // end namespace usb
@@ -17,10 +17,14 @@
 #ifndef USBPP_ERROR_H
 #define USBPP_ERROR_H
 
+#include <usbpp/exceptions.h>
+
 namespace usb {
 
 const char *errorcodeToString(int error);
 
+Error::Code errorcodeToCode(int error);
+
 } // end namespace usb
 
 
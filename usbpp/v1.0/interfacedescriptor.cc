@@ -27,7 +27,7 @@ namespace usb {
 /* InterfaceDescriptorPrivate {{{ */
 
 struct InterfaceDescriptorPrivate {
-    const libusb_interface_descriptor *interface_descriptor;
+    unsigned short interface_number;
 };
 
 /* }}} */
@@ -36,7 +36,15 @@ struct InterfaceDescriptorPrivate {
 InterfaceDescriptor::InterfaceDescriptor(const void *nativeHandle)
     : m_data(new InterfaceDescriptorPrivate)
 {
-    m_data->interface_descriptor = static_cast<const libusb_interface_descriptor *>(nativeHandle);
+    const libusb_interface_descriptor *interfaceDescriptor =
+        static_cast<const libusb_interface_descriptor *>(nativeHandle);
+    m_data->interface_number = interfaceDescriptor->bInterfaceNumber;
+}
+
+InterfaceDescriptor::InterfaceDescriptor(unsigned short interfaceNumber)
+    : m_data(new InterfaceDescriptorPrivate)
+{
+    m_data->interface_number = interfaceNumber;
 }
 
 InterfaceDescriptor::~InterfaceDescriptor()
@@ -46,7 +54,7 @@ InterfaceDescriptor::~InterfaceDescriptor()
 
 unsigned short InterfaceDescriptor::getInterfaceNumber() const
 {
-    return m_data->interface_descriptor->bInterfaceNumber;
+    return m_data->interface_number;
 }
 
 /* }}} */
@@ -15,14 +15,25 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 #include <sstream>
+#include <fstream>
 #include <vector>
+#include <string>
+#include <algorithm>
+#include <iterator>
+#include <cstdlib>
 #include <cassert>
 
+#ifdef __linux__
+#  include <sys/types.h>
+#  include <dirent.h>
+#endif
+
 #include "libusb_1.0.h"
 #include "error.h"
 
 #include <usbpp/usbmanager.h>
 #include <usbpp/device.h>
+#include <usbpp/transfertrace.h>
 
 namespace usb {
 
@@ -30,32 +41,153 @@ namespace usb {
 
 struct UsbManagerPrivate {
     libusb_context          *context;
+    int                     debug_level;
+    std::string             sysfs_root;
+    TraceWriter             *trace_writer;
+    TraceReader             *trace_reader;
     libusb_device           **devicelist;
     size_t                  device_number;
     std::vector<Device *>   devices;
 };
 
+/* }}} */
+/* sysfs {{{ */
+
+#ifdef __linux__
+
+struct SysfsDevice {
+    unsigned short              bus;
+    unsigned short              devnum;
+    std::string                 port_path;
+    DeviceDescriptor            descriptor;
+    std::vector<unsigned char>  raw_descriptors;
+
+    bool operator<(const SysfsDevice &other) const
+    {
+        return bus < other.bus || (bus == other.bus && devnum < other.devnum);
+    }
+};
+
+static bool read_sysfs_attribute(const std::string &dir, const char *attribute,
+                                 int base, unsigned int &value)
+{
+    std::ifstream fin((dir + "/" + attribute).c_str());
+    std::string contents;
+    if (!(fin >> contents))
+        return false;
+
+    char *end;
+    value = std::strtoul(contents.c_str(), &end, base);
+    return *end == '\0';
+}
+
+static std::vector<SysfsDevice> read_sysfs_devices(const std::string &root)
+{
+    std::vector<SysfsDevice> result;
+
+    DIR *dir = opendir(root.c_str());
+    if (!dir)
+        throw Error("Unable to open sysfs directory " + root);
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        std::string name(entry->d_name);
+
+        // "." and "..", and interfaces like "1-1.2:1.0"
+        if (name[0] == '.' || name.find(':') != std::string::npos)
+            continue;
+
+        std::string path = root + "/" + name;
+        unsigned int bus, devnum, vendor, product, bcdDevice, deviceClass, deviceSubClass;
+        unsigned int numConfigurations;
+        if (!read_sysfs_attribute(path, "busnum", 10, bus) ||
+                !read_sysfs_attribute(path, "devnum", 10, devnum) ||
+                !read_sysfs_attribute(path, "idVendor", 16, vendor) ||
+                !read_sysfs_attribute(path, "idProduct", 16, product))
+            continue;
+        if (!read_sysfs_attribute(path, "bcdDevice", 16, bcdDevice))
+            bcdDevice = 0;
+        if (!read_sysfs_attribute(path, "bDeviceClass", 16, deviceClass))
+            deviceClass = 0;
+        if (!read_sysfs_attribute(path, "bDeviceSubClass", 16, deviceSubClass))
+            deviceSubClass = 0;
+        if (!read_sysfs_attribute(path, "bNumConfigurations", 10, numConfigurations))
+            numConfigurations = 0;
+
+        SysfsDevice dev;
+        dev.bus = bus;
+        dev.devnum = devnum;
+        // the directory name is the port path, except for root hubs ("usb1")
+        if (name.compare(0, 3, "usb") != 0)
+            dev.port_path = name;
+        dev.descriptor.setVendorId(vendor);
+        dev.descriptor.setProductId(product);
+        dev.descriptor.setBcdDevice(bcdDevice);
+        dev.descriptor.setDeviceClass(deviceClass);
+        dev.descriptor.setDeviceSubclass(deviceSubClass);
+        dev.descriptor.setNumConfigurations(numConfigurations);
+
+        // the config descriptors, so that the USB library isn't needed for them
+        std::ifstream descriptors((path + "/descriptors").c_str(), std::ios::binary);
+        dev.raw_descriptors.assign(std::istreambuf_iterator<char>(descriptors),
+                                   std::istreambuf_iterator<char>());
+
+        result.push_back(dev);
+    }
+    closedir(dir);
+
+    // same order as libusb on Linux, independent from the directory order
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+#endif
+
 /* }}} */
 /* UsbManager {{{ */
 
 UsbManager::UsbManager()
   : m_data(new UsbManagerPrivate)
 {
-    int err = libusb_init(&m_data->context);
-    if (err != 0)
-        throw Error(errorcodeToString(err));
-
+    // libusb is initialised on first use, so listing devices via sysfs doesn't pay for it
+    m_data->context = NULL;
+    m_data->debug_level = 0;
     m_data->devicelist = NULL;
     m_data->device_number = 0;
+    m_data->trace_writer = NULL;
+    m_data->trace_reader = NULL;
+
+#ifdef __linux__
+    const char *sysfsRoot = std::getenv("USBPP_SYSFS_ROOT");
+    if (sysfsRoot && *sysfsRoot)
+        m_data->sysfs_root = sysfsRoot;
+#endif
+
+    try {
+        const char *replay = std::getenv("USBPP_REPLAY");
+        const char *timing = std::getenv("USBPP_REPLAY_TIMING");
+        const char *record = std::getenv("USBPP_RECORD");
+        if (replay && *replay)
+            startReplay(replay, timing && std::string(timing) == "1");
+        else if (record && *record)
+            startRecording(record);
+    } catch (...) {
+        delete m_data;
+        throw;
+    }
 }
 
 UsbManager::~UsbManager()
 {
-    for (size_t i = 0; i < m_data->device_number; ++i)
+    for (size_t i = 0; i < m_data->devices.size(); ++i)
         delete m_data->devices[i];
     m_data->devices.clear();
-    libusb_free_device_list(m_data->devicelist, true);
-    libusb_exit(m_data->context);
+    delete m_data->trace_writer;
+    delete m_data->trace_reader;
+    if (m_data->devicelist)
+        libusb_free_device_list(m_data->devicelist, true);
+    if (m_data->context)
+        libusb_exit(m_data->context);
     delete m_data;
 }
 
@@ -65,38 +197,263 @@ UsbManager &UsbManager::instance()
     return instance;
 }
 
+void *UsbManager::getContext()
+{
+    if (!m_data->context) {
+        int err = libusb_init(&m_data->context);
+        if (err != 0) {
+            m_data->context = NULL;
+            throw Error(errorcodeToString(err));
+        }
+        libusb_set_debug(m_data->context, m_data->debug_level);
+    }
+
+    return m_data->context;
+}
+
 void UsbManager::setDebug(bool debug)
 {
-    if (debug)
-        libusb_set_debug(m_data->context, 3);
-    else
-        libusb_set_debug(m_data->context, 0);
+    m_data->debug_level = debug ? 3 : 0;
+    if (m_data->context)
+        libusb_set_debug(m_data->context, m_data->debug_level);
+}
+
+bool UsbManager::isSysfsSupported() const
+{
+#ifdef __linux__
+    return true;
+#else
+    return false;
+#endif
 }
 
-void UsbManager::detectDevices()
+void UsbManager::setSysfsRoot(const std::string &root)
 {
+    if (!root.empty() && !isSysfsSupported())
+        throw Error("Enumeration via sysfs is only supported on Linux");
+
+    m_data->sysfs_root = root;
+}
+
+std::string UsbManager::getSysfsRoot() const
+{
+    return m_data->sysfs_root;
+}
+
+void UsbManager::startRecording(const std::string &filename)
+{
+    if (m_data->trace_reader)
+        throw Error("Cannot record a trace while replaying");
+
+    TraceWriter *writer = new TraceWriter(filename);
+    delete m_data->trace_writer;
+    m_data->trace_writer = writer;
+}
+
+void UsbManager::stopRecording()
+{
+    delete m_data->trace_writer;
+    m_data->trace_writer = NULL;
+}
+
+bool UsbManager::isRecording() const
+{
+    return m_data->trace_writer != NULL;
+}
+
+void UsbManager::startReplay(const std::string &filename, bool realTiming)
+{
+    if (m_data->trace_writer)
+        throw Error("Cannot replay a trace while recording");
+
+    TraceReader *reader = new TraceReader(filename, realTiming);
+    delete m_data->trace_reader;
+    m_data->trace_reader = reader;
+}
+
+void UsbManager::stopReplay()
+{
+    delete m_data->trace_reader;
+    m_data->trace_reader = NULL;
+}
+
+bool UsbManager::isReplaying() const
+{
+    return m_data->trace_reader != NULL;
+}
+
+TraceWriter *UsbManager::getTraceWriter() const
+{
+    return m_data->trace_writer;
+}
+
+TraceReader *UsbManager::getTraceReader() const
+{
+    return m_data->trace_reader;
+}
+
+void UsbManager::detectDevices(const DeviceFilter &filter)
+{
+    for (size_t i = 0; i < m_data->devices.size(); ++i)
+        delete m_data->devices[i];
+    m_data->devices.clear();
     if (m_data->devicelist != NULL) {
-        for (size_t i = 0; i < m_data->device_number; ++i)
-            delete m_data->devices[i];
-        m_data->devices.clear();
         libusb_free_device_list(m_data->devicelist, true);
+        m_data->devicelist = NULL;
+    }
+    m_data->device_number = 0;
+
+    if (m_data->trace_reader) {
+        replayDevices(filter);
+        return;
+    }
+
+#ifdef __linux__
+    if (!m_data->sysfs_root.empty()) {
+        std::vector<SysfsDevice> sysfsDevices = read_sysfs_devices(m_data->sysfs_root);
+        std::vector<const SysfsDevice *> matching;
+        for (std::vector<SysfsDevice>::const_iterator it = sysfsDevices.begin();
+                it != sysfsDevices.end(); ++it) {
+            if (filter.matches(it->descriptor.getVendorId(), it->descriptor.getProductId())) {
+                m_data->devices.push_back(new Device(it->bus, it->devnum, it->descriptor,
+                                                     it->port_path));
+                matching.push_back(&*it);
+            }
+        }
+        recordDevices();
+
+        // the trace contains the config descriptors after the device list
+        for (size_t i = 0; i < m_data->devices.size(); ++i)
+            m_data->devices[i]->readConfigDescriptors(matching[i]->raw_descriptors);
+        return;
+    }
+#endif
+
+    libusb_context *context = static_cast<libusb_context *>(getContext());
+    ssize_t number = libusb_get_device_list(context, &m_data->devicelist);
+    if (number < 0) {
+        m_data->devicelist = NULL;
+        throw Error(errorcodeToString(number));
     }
+    m_data->device_number = number;
 
-    m_data->device_number = libusb_get_device_list(m_data->context,
-                                                   &m_data->devicelist);
+    // the list keeps a reference to all devices, so the Device objects stay valid
+    // until the next call
+    for (size_t i = 0; i < m_data->device_number; ++i) {
+        if (!filter.isEmpty()) {
+            struct libusb_device_descriptor descriptor;
+            if (libusb_get_device_descriptor(m_data->devicelist[i], &descriptor) != 0)
+                continue;
+            if (!filter.matches(descriptor.idVendor, descriptor.idProduct))
+                continue;
+        }
 
-    for (size_t i = 0; i < m_data->device_number; ++i)
         m_data->devices.push_back(new Device(m_data->devicelist[i]));
+    }
+    recordDevices();
+
+    // the trace contains the config descriptors after the device list
+    for (size_t i = 0; i < m_data->devices.size(); ++i)
+        m_data->devices[i]->readConfigDescriptors(std::vector<unsigned char>());
+}
+
+void UsbManager::recordDevices()
+{
+    if (!m_data->trace_writer)
+        return;
+
+    TraceRecord record(TraceRecord::TR_ENUMERATE);
+    for (size_t i = 0; i < m_data->devices.size(); ++i) {
+        const Device *device = m_data->devices[i];
+        const DeviceDescriptor &descriptor = device->getDescriptor();
+        record.values.push_back(device->getBusNumber());
+        record.values.push_back(device->getDeviceNumber());
+        record.values.push_back(descriptor.getVendorId());
+        record.values.push_back(descriptor.getProductId());
+        record.values.push_back(descriptor.getBcdDevice());
+        record.values.push_back(descriptor.getDeviceClass());
+        record.values.push_back(descriptor.getDeviceSubclass());
+        record.values.push_back(descriptor.getNumConfigurations());
+
+        std::string portPath = device->getPortPath();
+        record.data.insert(record.data.end(), portPath.begin(), portPath.end());
+        record.data.push_back('\0');
+    }
+    m_data->trace_writer->write(record);
+}
+
+void UsbManager::replayDevices(const DeviceFilter &filter)
+{
+    TraceRecord record(TraceRecord::TR_ENUMERATE);
+    m_data->trace_reader->replay(record);
+
+    std::vector<unsigned char>::iterator portPath = record.data.begin();
+    for (size_t i = 0; i + 8 <= record.values.size(); i += 8) {
+        std::vector<unsigned char>::iterator end =
+            std::find(portPath, record.data.end(), '\0');
+        std::string path(portPath, end);
+        portPath = end != record.data.end() ? end + 1 : end;
+
+        DeviceDescriptor descriptor;
+        descriptor.setVendorId(record.values[i+2]);
+        descriptor.setProductId(record.values[i+3]);
+        descriptor.setBcdDevice(record.values[i+4]);
+        descriptor.setDeviceClass(record.values[i+5]);
+        descriptor.setDeviceSubclass(record.values[i+6]);
+        descriptor.setNumConfigurations(record.values[i+7]);
+
+        // the config descriptors of all recorded devices follow in the trace
+        Device *device = new Device(record.values[i], record.values[i+1], descriptor, path);
+        try {
+            device->readConfigDescriptors(std::vector<unsigned char>());
+        } catch (...) {
+            delete device;
+            throw;
+        }
+
+        if (filter.matches(descriptor.getVendorId(), descriptor.getProductId()))
+            m_data->devices.push_back(device);
+        else
+            delete device;
+    }
+}
+
+void *UsbManager::findNativeDevice(unsigned short busNumber, unsigned short deviceNumber)
+{
+    libusb_context *context = static_cast<libusb_context *>(getContext());
+
+    libusb_device **list;
+    ssize_t number = libusb_get_device_list(context, &list);
+    if (number < 0)
+        throw Error(errorcodeToString(number));
+
+    libusb_device *result = NULL;
+    for (ssize_t i = 0; i < number; ++i) {
+        if (libusb_get_bus_number(list[i]) == busNumber &&
+                libusb_get_device_address(list[i]) == deviceNumber) {
+            result = libusb_ref_device(list[i]);
+            break;
+        }
+    }
+    libusb_free_device_list(list, true);
+
+    if (!result) {
+        std::stringstream ss;
+        ss << "Device " << deviceNumber << " on bus " << busNumber << " not found";
+        throw Error(ss.str());
+    }
+
+    return result;
 }
 
 size_t UsbManager::getNumberOfDevices() const
 {
-    return m_data->device_number;
+    return m_data->devices.size();
 }
 
 Device *UsbManager::getDevice(size_t number)
 {
-    if (number >= m_data->device_number) {
+    if (number >= m_data->devices.size()) {
         std::stringstream ss;
         ss << "Device number " << number << " out of range";
         throw std::out_of_range(ss.str());
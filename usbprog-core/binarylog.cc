@@ -0,0 +1,501 @@
+/*
+ * (c) 2010, Bernhard Walle <bernhard@bwalle.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cstddef>
+#include <algorithm>
+
+#include <usbpp/clock.h>
+
+#include <usbprog-core/binarylog.h>
+#include <usbprog-core/error.h>
+
+#define LOG_MAGIC           "USBL"
+#define LOG_VERSION         1
+
+#define RECORD_FORMAT       1
+#define RECORD_MESSAGE      2
+
+namespace usbprog {
+namespace core {
+
+/* Encoding {{{ */
+
+// the same encoding as the USB transfer trace of usbpp
+static void put_varint(std::string &buffer, unsigned long long value)
+{
+    do {
+        unsigned char byte = value & 0x7f;
+        value >>= 7;
+        if (value != 0)
+            byte |= 0x80;
+        buffer += static_cast<char>(byte);
+    } while (value != 0);
+}
+
+static bool read_varint(std::istream &is, unsigned long long &value)
+{
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int byte = is.get();
+        if (byte == EOF)
+            return false;
+        value |= static_cast<unsigned long long>(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+
+    return false;
+}
+
+// zigzag encoding, so that small negative numbers need only one byte
+static unsigned long long encode_signed(long long value)
+{
+    return value < 0 ? (static_cast<unsigned long long>(-(value + 1)) << 1) | 1
+                     : static_cast<unsigned long long>(value) << 1;
+}
+
+static long long decode_signed(unsigned long long value)
+{
+    return (value & 1) ? -static_cast<long long>(value >> 1) - 1
+                       : static_cast<long long>(value >> 1);
+}
+
+// doubles are stored as their IEEE 754 representation, least significant byte first
+static void put_double(std::string &buffer, double value)
+{
+    unsigned long long bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    for (int i = 0; i < 8; ++i)
+        buffer += static_cast<char>((bits >> (i * 8)) & 0xff);
+}
+
+static bool read_double(std::istream &is, double &value)
+{
+    unsigned long long bits = 0;
+    for (int i = 0; i < 8; ++i) {
+        int byte = is.get();
+        if (byte == EOF)
+            return false;
+        bits |= static_cast<unsigned long long>(byte) << (i * 8);
+    }
+    std::memcpy(&value, &bits, sizeof(value));
+    return true;
+}
+
+/* }}} */
+/* Format strings {{{ */
+
+struct Conversion {
+    const char  *end;           // the character after the conversion
+    const char  *length;        // the start of the length modifier
+    char        conversion;
+};
+
+// parses the conversion that starts after a '%'
+static bool parse_conversion(const char *start, Conversion &conv)
+{
+    const char *p = start;
+
+    while (*p && std::strchr("-+ #0'", *p))
+        p++;
+    while (*p == '*' || (*p >= '0' && *p <= '9'))
+        p++;
+    if (*p == '.') {
+        p++;
+        while (*p == '*' || (*p >= '0' && *p <= '9'))
+            p++;
+    }
+
+    conv.length = p;
+    while (*p && std::strchr("hlLqjzt", *p))
+        p++;
+
+    if (!*p || !std::strchr("diouxXcsfFeEgGaApn%", *p))
+        return false;
+
+    conv.conversion = *p;
+    conv.end = p + 1;
+    return true;
+}
+
+static bool has_length(const Conversion &conv, const char *length)
+{
+    size_t len = conv.end - 1 - conv.length;
+    return len == std::strlen(length) && std::strncmp(conv.length, length, len) == 0;
+}
+
+/* }}} */
+/* BinaryLogWriter {{{ */
+
+BinaryLogWriter::BinaryLogWriter(const std::string &filename)
+    : m_stream(filename.c_str(), std::ios::binary | std::ios::out | std::ios::trunc)
+    , m_lastTimestamp(usb::usbpp_now_us())
+    , m_nextFormat(1)
+{
+    if (!m_stream)
+        throw IOError("Unable to create log file " + filename);
+
+    std::string header(LOG_MAGIC);
+    header += static_cast<char>(LOG_VERSION);
+    put_varint(header, std::time(NULL));
+    m_stream.write(header.data(), header.size());
+}
+
+BinaryLogWriter::~BinaryLogWriter()
+{
+    m_stream.close();
+}
+
+void BinaryLogWriter::write(int level, const char *format, std::va_list args)
+{
+    unsigned long threadId = Thread::currentId();
+
+    MutexLocker locker(&m_mutex);
+
+    // the buffers are members, so they don't need to be allocated for each message
+    std::string &arguments = m_arguments;
+    unsigned int count = 0;
+    arguments.clear();
+    for (const char *p = format; *p; ++p) {
+        Conversion conv;
+        if (*p != '%')
+            continue;
+        if (!parse_conversion(p + 1, conv))
+            break;
+
+        for (const char *star = p + 1; star < conv.length; ++star) {
+            if (*star == '*') {
+                arguments += 'i';
+                put_varint(arguments, encode_signed(va_arg(args, int)));
+                count++;
+            }
+        }
+        p = conv.end - 1;
+
+        switch (conv.conversion) {
+            case 'd':
+            case 'i':
+            case 'c': {
+                long long value;
+                if (has_length(conv, "ll") || has_length(conv, "q") || has_length(conv, "j"))
+                    value = va_arg(args, long long);
+                else if (has_length(conv, "l"))
+                    value = va_arg(args, long);
+                else if (has_length(conv, "z"))
+                    value = va_arg(args, size_t);
+                else if (has_length(conv, "t"))
+                    value = va_arg(args, ptrdiff_t);
+                else if (has_length(conv, "hh"))
+                    value = static_cast<signed char>(va_arg(args, int));
+                else if (has_length(conv, "h"))
+                    value = static_cast<short>(va_arg(args, int));
+                else
+                    value = va_arg(args, int);
+                arguments += 'i';
+                put_varint(arguments, encode_signed(value));
+                count++;
+                break;
+            }
+
+            case 'o':
+            case 'u':
+            case 'x':
+            case 'X': {
+                unsigned long long value;
+                if (has_length(conv, "ll") || has_length(conv, "q") || has_length(conv, "j"))
+                    value = va_arg(args, unsigned long long);
+                else if (has_length(conv, "l"))
+                    value = va_arg(args, unsigned long);
+                else if (has_length(conv, "z"))
+                    value = va_arg(args, size_t);
+                else if (has_length(conv, "t"))
+                    value = va_arg(args, ptrdiff_t);
+                else if (has_length(conv, "hh"))
+                    value = static_cast<unsigned char>(va_arg(args, unsigned int));
+                else if (has_length(conv, "h"))
+                    value = static_cast<unsigned short>(va_arg(args, unsigned int));
+                else
+                    value = va_arg(args, unsigned int);
+                arguments += 'u';
+                put_varint(arguments, value);
+                count++;
+                break;
+            }
+
+            case 'p':
+                arguments += 'p';
+                put_varint(arguments, reinterpret_cast<size_t>(va_arg(args, void *)));
+                count++;
+                break;
+
+            case 's': {
+                const char *value = va_arg(args, const char *);
+                if (!value)
+                    value = "(null)";
+                size_t len = std::strlen(value);
+                arguments += 's';
+                put_varint(arguments, len);
+                arguments.append(value, len);
+                count++;
+                break;
+            }
+
+            case 'n':
+                va_arg(args, void *);
+                break;
+
+            case '%':
+                break;
+
+            default:
+                arguments += 'd';
+                put_double(arguments, has_length(conv, "L") ? double(va_arg(args, long double))
+                                                           : va_arg(args, double));
+                count++;
+                break;
+        }
+    }
+
+    m_record.clear();
+
+    std::map<const char *, Format>::iterator it = m_formats.find(format);
+    if (it == m_formats.end() || it->second.text != format) {
+        // a different string at the same address if the format is no literal
+        Format fmt;
+        fmt.id = m_nextFormat++;
+        fmt.text = format;
+        it = m_formats.insert(std::make_pair(format, fmt)).first;
+        it->second = fmt;
+
+        m_record += static_cast<char>(RECORD_FORMAT);
+        put_varint(m_record, fmt.id);
+        put_varint(m_record, fmt.text.size());
+        m_record += fmt.text;
+    }
+
+    std::map<unsigned long, unsigned int>::const_iterator thread = m_threads.find(threadId);
+    if (thread == m_threads.end())
+        thread = m_threads.insert(std::make_pair(threadId, (unsigned int)m_threads.size() + 1)).first;
+
+    unsigned long long now = usb::usbpp_now_us();
+    m_record += static_cast<char>(RECORD_MESSAGE);
+    put_varint(m_record, now - m_lastTimestamp);
+    put_varint(m_record, encode_signed(level));
+    put_varint(m_record, thread->second);
+    put_varint(m_record, it->second.id);
+    put_varint(m_record, count);
+    m_record += arguments;
+    m_lastTimestamp = now;
+
+    m_stream.write(m_record.data(), m_record.size());
+}
+
+void BinaryLogWriter::flush()
+{
+    MutexLocker locker(&m_mutex);
+    m_stream.flush();
+}
+
+/* }}} */
+/* BinaryLogReader {{{ */
+
+BinaryLogReader::BinaryLogReader(const std::string &filename)
+    : m_stream(filename.c_str(), std::ios::binary | std::ios::in)
+    , m_filename(filename)
+    , m_startTime(0)
+    , m_lastTimestamp(0)
+{
+    if (!m_stream)
+        throw IOError("Unable to open log file " + filename);
+
+    char magic[4];
+    m_stream.read(magic, sizeof(magic));
+    if (!m_stream || std::memcmp(magic, LOG_MAGIC, sizeof(magic)) != 0)
+        throw ParseError(filename + " is not a binary usbprog log");
+    if (m_stream.get() != LOG_VERSION)
+        throw ParseError(filename + ": Unsupported log version");
+
+    unsigned long long startTime;
+    if (!read_varint(m_stream, startTime))
+        throw ParseError(filename + ": Truncated header");
+    m_startTime = startTime;
+}
+
+std::time_t BinaryLogReader::getStartTime() const
+{
+    return m_startTime;
+}
+
+bool BinaryLogReader::read(BinaryLogMessage &message)
+{
+    for (;;) {
+        int type = m_stream.get();
+        if (type == EOF)
+            return false;
+
+        if (type == RECORD_FORMAT) {
+            unsigned long long id, size;
+            if (!read_varint(m_stream, id) || !read_varint(m_stream, size))
+                throw ParseError(m_filename + ": Truncated format string");
+            std::string text(size, '\0');
+            if (size > 0)
+                m_stream.read(&text[0], size);
+            if (!m_stream)
+                throw ParseError(m_filename + ": Truncated format string");
+            m_formats[id] = text;
+            continue;
+        }
+
+        if (type != RECORD_MESSAGE)
+            throw ParseError(m_filename + ": Invalid record");
+
+        unsigned long long delta, level, thread, id, count;
+        if (!read_varint(m_stream, delta) || !read_varint(m_stream, level) ||
+                !read_varint(m_stream, thread) || !read_varint(m_stream, id) ||
+                !read_varint(m_stream, count))
+            throw ParseError(m_filename + ": Truncated message");
+
+        std::vector<Argument> args(count);
+        for (std::vector<Argument>::iterator arg = args.begin(); arg != args.end(); ++arg) {
+            arg->type = m_stream.get();
+            arg->value = 0;
+            arg->number = 0;
+
+            bool ok;
+            if (arg->type == 'd')
+                ok = read_double(m_stream, arg->number);
+            else if (arg->type == 's') {
+                ok = read_varint(m_stream, arg->value);
+                if (ok) {
+                    arg->string.resize(arg->value);
+                    if (arg->value > 0)
+                        m_stream.read(&arg->string[0], arg->value);
+                    ok = !m_stream.fail();
+                }
+            } else if (arg->type == 'i' || arg->type == 'u' || arg->type == 'p')
+                ok = read_varint(m_stream, arg->value);
+            else
+                ok = false;
+
+            if (!ok)
+                throw ParseError(m_filename + ": Truncated message");
+        }
+
+        std::map<unsigned long long, std::string>::const_iterator fmt = m_formats.find(id);
+        if (fmt == m_formats.end())
+            throw ParseError(m_filename + ": Unknown format string");
+
+        m_lastTimestamp += delta;
+        message.timestamp = m_lastTimestamp;
+        message.level = decode_signed(level);
+        message.thread = thread;
+        message.text = format(fmt->second, args);
+        return true;
+    }
+}
+
+std::string BinaryLogReader::format(const std::string &format,
+                                    const std::vector<Argument> &args) const
+{
+    std::string result;
+    std::vector<Argument>::const_iterator arg = args.begin();
+
+    for (const char *p = format.c_str(); *p; ++p) {
+        Conversion conv;
+        if (*p != '%') {
+            result += *p;
+            continue;
+        }
+        if (!parse_conversion(p + 1, conv)) {
+            result += p;
+            break;
+        }
+
+        // flags, width and precision with the '*' replaced, without the length modifier
+        std::string spec("%");
+        unsigned long width = 0;
+        for (const char *c = p + 1; c < conv.length; ++c) {
+            if (*c == '*' && arg != args.end()) {
+                char number[32];
+                long long value = decode_signed(arg->value);
+                std::sprintf(number, "%lld", value);
+                spec += number;
+                width = std::max(width, static_cast<unsigned long>(value < 0 ? -value : value));
+                ++arg;
+            } else
+                spec += *c;
+            if (*c >= '1' && *c <= '9')
+                width = std::max(width, std::strtoul(c, NULL, 10));
+        }
+        p = conv.end - 1;
+
+        if (conv.conversion == '%') {
+            result += '%';
+            continue;
+        }
+        if (conv.conversion == 'n')
+            continue;
+        if (arg == args.end()) {
+            result += "<missing>";
+            continue;
+        }
+
+        // "%f" prints all digits before the decimal point of a double, up to 309
+        std::vector<char> buffer(400 + width + arg->string.size());
+        switch (arg->type) {
+            case 'i':
+                if (conv.conversion == 'c')
+                    std::sprintf(&buffer[0], (spec + "c").c_str(), int(decode_signed(arg->value)));
+                else
+                    std::sprintf(&buffer[0], (spec + "ll" + conv.conversion).c_str(),
+                                 decode_signed(arg->value));
+                break;
+
+            case 'u':
+                std::sprintf(&buffer[0], (spec + "ll" + conv.conversion).c_str(), arg->value);
+                break;
+
+            case 'p':
+                if (arg->value)
+                    std::sprintf(&buffer[0], "0x%llx", arg->value);
+                else
+                    std::strcpy(&buffer[0], "(nil)");
+                break;
+
+            case 'd':
+                std::sprintf(&buffer[0], (spec + conv.conversion).c_str(), arg->number);
+                break;
+
+            case 's':
+                std::sprintf(&buffer[0], (spec + "s").c_str(), arg->string.c_str());
+                break;
+        }
+        result += &buffer[0];
+        ++arg;
+    }
+
+    return result;
+}
+
+/* }}} */
+
+} // end namespace core
+} // end namespace usbprog
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
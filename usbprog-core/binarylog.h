@@ -0,0 +1,206 @@
+/*
+ * (c) 2010, Bernhard Walle <bernhard@bwalle.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file binarylog.h
+ * @brief Compact binary format for debug messages
+ *
+ * @author Bernhard Walle <bernhard@bwalle.de>
+ * @ingroup core
+ */
+
+#ifndef USBPROG_BINARYLOG_H
+#define USBPROG_BINARYLOG_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <cstdarg>
+#include <ctime>
+
+#include <usbprog-core/thread.h>
+
+namespace usbprog {
+namespace core {
+
+/* BinaryLogWriter {{{ */
+
+/**
+ * @brief Writes debug messages without formatting them
+ *
+ * Instead of the text, each message is stored as the number of its format string, the raw
+ * values of the arguments, the time and the thread. Each format string is written only once,
+ * before its first message. BinaryLogReader and the tool <tt>usbprog-logdump</tt> format the
+ * messages later, so writing a message costs no printf() and typically less than 20 bytes.
+ *
+ * The file starts with the magic @c "USBL", a version byte and the start time. All numbers are
+ * variable length integers like in the USB transfer trace of usbpp. Records:
+ *
+ *  - 1 (format): number, length and text of a format string
+ *  - 2 (message): microseconds since the previous message, level, thread number, format
+ *    number, number of arguments and the arguments. Each argument is a tag (@c 'i' signed,
+ *    @c 'u' unsigned, @c 'p' pointer, @c 'd' double as 8 bytes, @c 's' string with length)
+ *    followed by the value.
+ *
+ * The writer is used by Debug, see Debug::setBinaryLog(). Several threads may write at the
+ * same time.
+ *
+ * @author Bernhard Walle <bernhard@bwalle.de>
+ * @ingroup core
+ */
+class BinaryLogWriter
+{
+public:
+    /**
+     * @brief Constructor
+     *
+     * Creates the log file. An existing file gets overwritten.
+     *
+     * @param[in] filename the name of the log file
+     * @exception IOError if the file cannot be created
+     */
+    BinaryLogWriter(const std::string &filename);
+
+    /**
+     * @brief Destructor
+     *
+     * Flushes and closes the file.
+     */
+    virtual ~BinaryLogWriter();
+
+public:
+    /**
+     * @brief Appends a message
+     *
+     * Errors are ignored since there's no place to report them.
+     *
+     * @param[in] level the level of the message, see Debug::Level
+     * @param[in] format the printf() format string
+     * @param[in] args the arguments of @p format
+     */
+    void write(int level, const char *format, std::va_list args);
+
+    /**
+     * @brief Writes the buffered messages to the file
+     */
+    void flush();
+
+private:
+    // noncopyable
+    BinaryLogWriter(const BinaryLogWriter &other);
+    BinaryLogWriter &operator=(const BinaryLogWriter &other);
+
+private:
+    struct Format {
+        unsigned int    id;
+        std::string     text;
+    };
+
+    std::ofstream m_stream;
+    unsigned long long m_lastTimestamp;
+    // the format strings are string literals, so the address identifies them
+    std::map<const char *, Format> m_formats;
+    unsigned int m_nextFormat;
+    std::map<unsigned long, unsigned int> m_threads;
+    std::string m_record;
+    std::string m_arguments;
+    Mutex m_mutex;
+};
+
+/* }}} */
+/* BinaryLogMessage {{{ */
+
+/**
+ * @brief One message of a binary log
+ *
+ * @author Bernhard Walle <bernhard@bwalle.de>
+ * @ingroup core
+ */
+struct BinaryLogMessage
+{
+    unsigned long long  timestamp;  /**< microseconds since the start of the log */
+    int                 level;      /**< the level, see Debug::Level */
+    unsigned int        thread;     /**< the thread number, starting at 1 */
+    std::string         text;       /**< the formatted message */
+};
+
+/* }}} */
+/* BinaryLogReader {{{ */
+
+/**
+ * @brief Reads a log of BinaryLogWriter and formats the messages
+ *
+ * @author Bernhard Walle <bernhard@bwalle.de>
+ * @ingroup core
+ */
+class BinaryLogReader
+{
+public:
+    /**
+     * @brief Constructor
+     *
+     * @param[in] filename the name of the log file
+     * @exception IOError if the file cannot be opened
+     * @exception ParseError if the file is no binary log
+     */
+    BinaryLogReader(const std::string &filename);
+
+public:
+    /**
+     * @brief Returns the time when the log has been created
+     *
+     * @return the time in seconds since the epoch
+     */
+    std::time_t getStartTime() const;
+
+    /**
+     * @brief Reads the next message
+     *
+     * @param[out] message the message
+     * @return @c true if a message has been read, @c false at the end of the file
+     * @exception ParseError if the file is truncated or invalid. A log that was written while
+     *            the program crashed may end with a truncated message.
+     */
+    bool read(BinaryLogMessage &message);
+
+private:
+    struct Argument {
+        char                type;
+        unsigned long long  value;
+        double              number;
+        std::string         string;
+    };
+
+    std::string format(const std::string &format, const std::vector<Argument> &args) const;
+
+private:
+    std::ifstream m_stream;
+    std::string m_filename;
+    std::time_t m_startTime;
+    unsigned long long m_lastTimestamp;
+    std::map<unsigned long long, std::string> m_formats;
+};
+
+/* }}} */
+
+} // end namespace core
+} // end namespace usbprog
+
+#endif /* USBPROG_BINARYLOG_H */
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
@@ -24,6 +24,8 @@ namespace core {
 Configuration::Configuration()
     : m_debug(false)
     , m_offline(false)
+    , m_compressCache(false)
+    , m_useSysfs(false)
 {}
 
 Configuration::~Configuration()
@@ -59,6 +61,26 @@ void Configuration::setOffline(bool offline)
     m_offline = offline;
 }
 
+bool Configuration::isCompressCache() const
+{
+    return m_compressCache;
+}
+
+void Configuration::setCompressCache(bool compress)
+{
+    m_compressCache = compress;
+}
+
+bool Configuration::isUseSysfs() const
+{
+    return m_useSysfs;
+}
+
+void Configuration::setUseSysfs(bool sysfs)
+{
+    m_useSysfs = sysfs;
+}
+
 std::string Configuration::getIndexUrl() const
 {
     return m_indexUrl;
@@ -74,6 +96,8 @@ void Configuration::dumpConfig(std::ostream &stream)
     stream << "dataDir     = " << m_dataDir  << std::endl
            << "debug       = " << m_debug    << std::endl
            << "offline     = " << m_offline  << std::endl
+           << "compress    = " << m_compressCache << std::endl
+           << "sysfs       = " << m_useSysfs << std::endl
            << "indexURL    = " << m_indexUrl << std::endl;
 }
 
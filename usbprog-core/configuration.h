@@ -91,6 +91,35 @@ public:
      */
     void setOffline(bool offline);
 
+    /**
+     * @brief Checks if firmware files in the cache should be stored compressed
+     *
+     * @return @c true if the firmware cache is compressed, @c false otherwise.
+     */
+    bool isCompressCache() const;
+
+    /**
+     * @brief Enables/disables compression of the firmware cache
+     *
+     * @param[in] compress @c true if newly downloaded firmware files should be compressed,
+     *            @c false otherwise.
+     */
+    void setCompressCache(bool compress);
+
+    /**
+     * @brief Checks if USB devices should be enumerated via sysfs
+     *
+     * @return @c true if sysfs is used for enumeration, @c false if the USB library is used
+     */
+    bool isUseSysfs() const;
+
+    /**
+     * @brief Enables/disables the enumeration of USB devices via sysfs
+     *
+     * @param[in] sysfs @c true if sysfs should be used, @c false otherwise
+     */
+    void setUseSysfs(bool sysfs);
+
     /**
      * @brief Returns the index URL
      *
@@ -124,6 +153,8 @@ private:
     std::string m_dataDir;
     bool m_debug;
     bool m_offline;
+    bool m_compressCache;
+    bool m_useSysfs;
     std::string m_indexUrl;
 };
 
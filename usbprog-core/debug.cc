@@ -17,27 +17,70 @@
 #include <cstdio>
 #include <cstring>
 #include <cstdarg>
+#include <cstdlib>
+
+#include <usbpp/clock.h>
 
 #include <usbprog-core/debug.h>
+#include <usbprog-core/logbuffer.h>
+#include <usbprog-core/binarylog.h>
+#include <usbprog-core/error.h>
+
+// the flusher thread sleeps that long if there are no messages, in microseconds
+#define FLUSH_INTERVAL      10000
 
 namespace usbprog {
 namespace core {
 
-/* Debug {{{ */
+/* Helpers {{{ */
 
-Debug *Debug::m_instance = NULL;
+// writes the pending messages when the program exits
+static void flush_debug_messages()
+{
+    Debug::debug()->setMode(Debug::DM_SYNCHRONOUS);
+}
+
+/* }}} */
+/* DebugFlusherThread {{{ */
 
-Debug *Debug::debug()
+class DebugFlusherThread : public Thread
 {
-    if (!m_instance)
-        m_instance = new Debug();
+public:
+    DebugFlusherThread(Debug *debug)
+        : m_debug(debug)
+    {}
+
+    void stop()
+    {
+        m_stop.set(1);
+        join();
+    }
 
-    return m_instance;
-}
+protected:
+    void run()
+    {
+        while (!m_stop.get())
+            if (!m_debug->writeBuffer())
+                usb::usbpp_usleep(FLUSH_INTERVAL);
+    }
+
+private:
+    Debug *m_debug;
+    AtomicCounter m_stop;
+};
+
+/* }}} */
+/* Debug {{{ */
+
+Debug *Debug::m_instance = NULL;
 
 Debug::Debug()
     : m_debuglevel(DL_NONE)
     , m_handle(stderr)
+    , m_mode(DM_SYNCHRONOUS)
+    , m_buffer(NULL)
+    , m_flusher(NULL)
+    , m_binaryLog(NULL)
 {}
 
 void Debug::setLevel(Debug::Level level)
@@ -100,42 +143,151 @@ void Debug::vmsg(Debug::Level level, const char *msg, std::va_list list)
     if (level < m_debuglevel)
         return;
 
-    size_t len = strlen(msg) + 20;
-    char *newmsg = new char[len];
-    if (!newmsg)
+    if (m_binaryLog) {
+        m_binaryLog->write(level, msg, list);
         return;
-    memset(newmsg, 0, len);
+    }
+
+    // the message is formatted on the stack and written at once, the last byte is reserved
+    // for the '\n'
+    char buffer[LogBuffer::ENTRY_SIZE];
+    size_t size = sizeof(buffer) - 1;
+    size_t len;
 
     // prepend dump level
     switch (level) {
         case DL_TRACE:
-            strcat(newmsg, "TRACE: ");
+            std::strcpy(buffer, "TRACE: ");
             break;
 
         case DL_INFO:
-            strcat(newmsg, "INFO: ");
+            std::strcpy(buffer, "INFO: ");
             break;
 
         case DL_DEBUG:
-            strcat(newmsg, "DEBUG: ");
+            std::strcpy(buffer, "DEBUG: ");
             break;
 
-        case DL_NONE:
+        default:
+            buffer[0] = '\0';
             break;
     }
-    strcat(newmsg, msg);
+    len = std::strlen(buffer);
+
+    int ret = vsnprintf(buffer + len, size - len, msg, list);
+    if (ret > 0 && size_t(ret) >= size - len) {
+        len = size - 1;
+        std::memcpy(buffer + len - 3, "...", 3);
+    } else if (ret > 0)
+        len += ret;
 
     // append '\n' if there's no one at the end
-    len = strlen(newmsg);
-    if (newmsg[len-1] != '\n') {
-        newmsg[len++] = '\n';
-        newmsg[len] = '\0';
+    if (len == 0 || buffer[len-1] != '\n')
+        buffer[len++] = '\n';
+
+    switch (m_mode) {
+        case DM_SYNCHRONOUS:
+            fwrite(buffer, 1, len, m_handle);
+            fflush(m_handle);
+            break;
+
+        case DM_ASYNCHRONOUS:
+            m_buffer->push(buffer, len, false);
+            break;
+
+        case DM_FLIGHT_RECORDER:
+            m_buffer->push(buffer, len, true);
+            break;
+    }
+}
+
+void Debug::setMode(Debug::Mode mode, size_t entries)
+{
+    static bool exitHandlerRegistered = false;
+
+    if (m_flusher) {
+        m_flusher->stop();
+        delete m_flusher;
+        m_flusher = NULL;
+    }
+    if (m_mode == DM_ASYNCHRONOUS)
+        writeBuffer();
+
+    m_mode = DM_SYNCHRONOUS;
+    delete m_buffer;
+    m_buffer = NULL;
+
+    if (mode == DM_SYNCHRONOUS)
+        return;
+
+    m_buffer = new LogBuffer(entries);
+    if (mode == DM_ASYNCHRONOUS) {
+        m_flusher = new DebugFlusherThread(this);
+        try {
+            m_flusher->start();
+        } catch (const ApplicationError &err) {
+            delete m_flusher;
+            m_flusher = NULL;
+            delete m_buffer;
+            m_buffer = NULL;
+            dbg("%s, writing the debug messages synchronously", err.what());
+            return;
+        }
+
+        if (!exitHandlerRegistered) {
+            std::atexit(flush_debug_messages);
+            exitHandlerRegistered = true;
+        }
+    }
+
+    m_mode = mode;
+}
+
+Debug::Mode Debug::getMode() const
+{
+    return m_mode;
+}
+
+void Debug::dump()
+{
+    if (m_buffer)
+        writeBuffer();
+    if (m_binaryLog)
+        m_binaryLog->flush();
+}
+
+void Debug::setBinaryLog(BinaryLogWriter *writer)
+{
+    m_binaryLog = writer;
+}
+
+BinaryLogWriter *Debug::getBinaryLog() const
+{
+    return m_binaryLog;
+}
+
+bool Debug::writeBuffer()
+{
+    MutexLocker locker(&m_writeMutex);
+
+    char buffer[LogBuffer::ENTRY_SIZE];
+    bool written = false;
+    size_t len;
+    while ((len = m_buffer->pop(buffer)) > 0) {
+        fwrite(buffer, 1, len, m_handle);
+        written = true;
+    }
+
+    unsigned long dropped = m_buffer->takeDropped();
+    if (dropped > 0) {
+        fprintf(m_handle, "DEBUG: %lu debug messages dropped\n", dropped);
+        written = true;
     }
 
-    vfprintf(m_handle, newmsg, list);
-    fflush(m_handle);
+    if (written)
+        fflush(m_handle);
 
-    delete[] newmsg;
+    return written;
 }
 
 Debug::Level Debug::getLevel() const
@@ -32,12 +32,43 @@
 #include <map>
 #include <stdexcept>
 #include <cstdarg>
+#include <cstdio>
+
+#include <usbprog-core/thread.h>
+
+#include "config.h"
 
 /* Macros {{{ */
 
+#ifndef USBPROG_DEBUG_MIN_LEVEL
+/**
+ * @brief The lowest debug level that is compiled in
+ *
+ * Set by the build system in config.h (CMake variable @c MIN_DEBUG_LEVEL). Messages with a lower
+ * level are removed by the compiler, including the evaluation of their arguments.
+ *
+ * @ingroup core
+ */
+#  define USBPROG_DEBUG_MIN_LEVEL 0
+#endif
+
+/**
+ * @brief Checks if messages of a level are written
+ *
+ * @param[in] level the debugging level
+ * @return @c false at compile time if @p level is below USBPROG_DEBUG_MIN_LEVEL, else the
+ *         result of Debug::isEnabled()
+ * @ingroup core
+ */
+#define USBPROG_DEBUG_ENABLED(level) \
+    ((level) >= USBPROG_DEBUG_MIN_LEVEL && usbprog::core::Debug::debug()->isEnabled(level))
+
 /**
  * @brief Writes a debug message with a specified level
  *
+ * The level is checked before the arguments are evaluated and formatted. Messages below
+ * USBPROG_DEBUG_MIN_LEVEL compile to nothing.
+ *
  * Example:
  *
  * @code
@@ -49,8 +80,11 @@
  * @ingroup core
  * @see USBPROG_DEBUG_DBG(), USBPROG_DEBUG_INFO(), USBPROG_DEBUG_TRACE()
  */
-#define USBPROG_DEBUG(level, ...) \
-    usbprog::core::Debug::debug()->msg(level, __VA_ARGS__)
+#define USBPROG_DEBUG(level, ...)                                       \
+    do {                                                                \
+        if (USBPROG_DEBUG_ENABLED(level))                               \
+            usbprog::core::Debug::debug()->msg(level, __VA_ARGS__);     \
+    } while (0)
 
 /**
  * @brief Writes a debug message (debug level)
@@ -66,7 +100,7 @@
  * @see USBPROG_DEBUG_INFO(), USBPROG_DEBUG_TRACE()
  */
 #define USBPROG_DEBUG_DBG(...) \
-    usbprog::core::Debug::debug()->dbg(__VA_ARGS__)
+    USBPROG_DEBUG(usbprog::core::Debug::DL_DEBUG, __VA_ARGS__)
 
 /**
  * @brief Writes a debug message (info level)
@@ -82,7 +116,7 @@
  * @see USBPROG_DEBUG_DBG(), USBPROG_DEBUG_TRACE()
  */
 #define USBPROG_DEBUG_INFO(...) \
-    usbprog::core::Debug::debug()->info(__VA_ARGS__)
+    USBPROG_DEBUG(usbprog::core::Debug::DL_INFO, __VA_ARGS__)
 
 /**
  * @brief Writes a debug message (trace level)
@@ -90,7 +124,7 @@
  * Example:
  *
  * @code
- * USBPROG_DEBUG_DBG("Message: %d", 5);
+ * USBPROG_DEBUG_TRACE("Message: %d", 5);
  * @endcode
  *
  * @param[in] ... the format string and an arbitrary number of arguments.
@@ -98,7 +132,7 @@
  * @see USBPROG_DEBUG_INFO(), USBPROG_DEBUG_DBG()
  */
 #define USBPROG_DEBUG_TRACE(...) \
-    usbprog::core::Debug::debug()->trace(__VA_ARGS__)
+    USBPROG_DEBUG(usbprog::core::Debug::DL_TRACE, __VA_ARGS__)
 
 /* }}} */
 
@@ -134,13 +168,26 @@ namespace core {
  * Currently the class supports only one debugging file handle, by default the
  * standard error console but that can also be a file. See setFileHandle().
  *
+ * By default, each message is written immediately. In the mode Debug::DM_ASYNCHRONOUS, the
+ * messages are formatted on the stack and copied into a LogBuffer, and a background thread
+ * writes them, so the cost of a message in the calling thread is bounded. In the mode
+ * Debug::DM_FLIGHT_RECORDER, only the last messages are kept in memory and dump() writes them,
+ * typically when an error occurred. See setMode(). For long unattended runs, setBinaryLog()
+ * writes the messages unformatted in a compact binary format.
+ *
  * @note Consider using the macros USBPROG_DEBUG(), USBPROG_DEBUG_DBG(), USBPROG_DEBUG_INFO() and
  *       USBPROG_DEBUG_TRACE().
  *
  * @author Bernhard Walle <bernhard@bwalle.de>
  * @ingroup core
  */
+class LogBuffer;
+class BinaryLogWriter;
+class DebugFlusherThread;
+
 class Debug {
+    friend class DebugFlusherThread;
+
 public:
     /**
      * @brief Debug level.
@@ -157,13 +204,29 @@ public:
         DL_NONE     = 100           /**< no debugging at all, be silent */
     };
 
+    /**
+     * @brief How the messages are written
+     */
+    enum Mode {
+        DM_SYNCHRONOUS,             /**< each message is written immediately (default) */
+        DM_ASYNCHRONOUS,            /**< a background thread writes the messages, if it
+                                         falls behind, messages are dropped and counted */
+        DM_FLIGHT_RECORDER          /**< the last messages are kept in memory until dump()
+                                         is called */
+    };
+
 public:
     /**
      * @brief Singleton getter
      *
      * @return the only instance of Debug.
      */
-    static Debug *debug();
+    static Debug *debug()
+    {
+        if (!m_instance)
+            m_instance = new Debug();
+        return m_instance;
+    }
 
     /**
      * @brief Print a debugging message
@@ -257,6 +320,17 @@ public:
      */
     bool isDebugEnabled() const;
 
+    /**
+     * @brief Checks if messages of a level are written
+     *
+     * Inline, so the macros check the level before the arguments are evaluated.
+     *
+     * @param[in] level the debug level (see Debug::Level)
+     * @return @c true if messages with @p level are written, @c false otherwise
+     */
+    bool isEnabled(Debug::Level level) const
+    { return level >= m_debuglevel; }
+
     /**
      * @brief Set the file handle for output
      *
@@ -279,15 +353,79 @@ public:
      */
     FILE *getFileHandle() const;
 
+    /**
+     * @brief Sets how the messages are written
+     *
+     * Messages that have not been written yet in the mode Debug::DM_ASYNCHRONOUS are written
+     * before the mode is changed, the messages of the flight recorder are discarded. Must not
+     * be called while other threads write messages.
+     *
+     * Messages are cut after 511 bytes in all modes. If the background thread cannot be
+     * started, the mode stays Debug::DM_SYNCHRONOUS.
+     *
+     * @param[in] mode the new mode
+     * @param[in] entries the number of messages that are kept in memory
+     */
+    void setMode(Debug::Mode mode, size_t entries = 1024);
+
+    /**
+     * @brief Returns how the messages are written
+     *
+     * @return the mode, see Debug::Mode
+     */
+    Debug::Mode getMode() const;
+
+    /**
+     * @brief Writes the messages that are kept in memory
+     *
+     * In the mode Debug::DM_FLIGHT_RECORDER, the last messages are written and forgotten. In
+     * the mode Debug::DM_ASYNCHRONOUS, all pending messages are written, so the output is
+     * complete before an error message is printed. Does nothing in the mode
+     * Debug::DM_SYNCHRONOUS.
+     */
+    void dump();
+
+    /**
+     * @brief Writes the messages in a binary format
+     *
+     * While a writer is set, the messages are neither formatted nor written to the file
+     * handle, independent of the mode. Instead, the format string and the arguments are passed
+     * to @p writer. dump() flushes the writer. Must not be called while other threads write
+     * messages.
+     *
+     * @param[in] writer the writer (still owned by the caller) or @c NULL to write text again
+     */
+    void setBinaryLog(BinaryLogWriter *writer);
+
+    /**
+     * @brief Returns the binary writer
+     *
+     * @return the writer that has been set with setBinaryLog() or @c NULL
+     */
+    BinaryLogWriter *getBinaryLog() const;
+
 protected:
     Debug();
 
+    /**
+     * @brief Writes all messages from the buffer to the file handle
+     *
+     * @return @c true if at least one message has been written
+     */
+    bool writeBuffer();
+
 private:
     static Debug *m_instance;
 
 private:
     Level m_debuglevel;
     FILE *m_handle;
+    Mode m_mode;
+    LogBuffer *m_buffer;
+    DebugFlusherThread *m_flusher;
+    BinaryLogWriter *m_binaryLog;
+    // serializes the threads that write the buffer
+    Mutex m_writeMutex;
 };
 
 /* }}} */
@@ -24,16 +24,25 @@
 #include <memory>
 
 #include <usbpp/usbpp.h>
+#include <usbpp/clock.h>
 
 #include <usbprog-core/devices.h>
 #include <usbprog-core/util.h>
 #include <usbprog-core/debug.h>
+#include <usbprog-core/thread.h>
+#include <usbprog-core/tracer.h>
 #include <usbprog/usbprog.h>
 
 #define VENDOR_ID_USBPROG       0x1781
 #define PRODUCT_ID_USBPROG      0x0c62
 #define BCDDEVICE_UPDATE        0x0000
 
+/*
+ * The USBprog bootloader erases and writes the flash page by page, so a page that
+ * is not written keeps its old contents.
+ */
+#define USBPROG_CHIP_ERASE      false
+
 namespace usbprog {
 namespace core {
 
@@ -129,11 +138,21 @@ std::string UpdateDevice::formatDeviceId() const
 Device::Device(usb::Device *handle)
     : m_handle(handle)
     , m_updateMode(false)
+    , m_chipEraseOnUpdate(false)
+    , m_portPath(handle->getPortPath())
     , m_vendorId(handle->getDescriptor().getVendorId())
     , m_productId(handle->getDescriptor().getProductId())
     , m_deviceNumber(handle->getDeviceNumber())
     , m_busNumber(handle->getBusNumber())
-{}
+{
+    if (!m_portPath.empty())
+        m_location = m_portPath;
+    else {
+        std::stringstream ss;
+        ss << "bus" << m_busNumber << "dev" << m_deviceNumber;
+        m_location = ss.str();
+    }
+}
 
 uint16_t Device::getVendor() const
 {
@@ -155,6 +174,46 @@ unsigned short Device::getBusNumber() const
     return m_busNumber;
 }
 
+std::string Device::getPortPath() const
+{
+    return m_portPath;
+}
+
+const std::string &Device::getLocation() const
+{
+    return m_location;
+}
+
+std::string Device::getManufacturer() const
+{
+    return m_manufacturer;
+}
+
+void Device::setManufacturer(const std::string &manufacturer)
+{
+    m_manufacturer = manufacturer;
+}
+
+std::string Device::getProductName() const
+{
+    return m_productName;
+}
+
+void Device::setProductName(const std::string &productName)
+{
+    m_productName = productName;
+}
+
+std::string Device::getSerialNumber() const
+{
+    return m_serialNumber;
+}
+
+void Device::setSerialNumber(const std::string &serialNumber)
+{
+    m_serialNumber = serialNumber;
+}
+
 bool Device::isUpdateMode() const
 {
     return m_updateMode;
@@ -180,6 +239,16 @@ usb::Device *Device::getHandle() const
     return m_handle;
 }
 
+bool Device::isChipEraseOnUpdate() const
+{
+    return m_chipEraseOnUpdate;
+}
+
+void Device::setChipEraseOnUpdate(bool chipErase)
+{
+    m_chipEraseOnUpdate = chipErase;
+}
+
 void Device::setName(const std::string &name)
 {
     m_name = name;
@@ -232,19 +301,104 @@ bool operator==(const DeviceVector &a, const DeviceVector &b)
     return true;
 }
 
+/* }}} */
+/* StringProbe {{{ */
+
+static bool probe_device_strings(Device *dev, unsigned int timeout)
+{
+    try {
+        std::auto_ptr<usb::DeviceHandle> handle(dev->getHandle()->open());
+
+        std::string manufacturer, productName, serialNumber;
+        handle->getDeviceStrings(manufacturer, productName, serialNumber, timeout);
+
+        dev->setManufacturer(manufacturer);
+        dev->setProductName(productName);
+        dev->setSerialNumber(serialNumber);
+        return true;
+    } catch (const usb::Error &err) {
+        USBPROG_DEBUG_DBG("Unable to read the strings of %s: %s",
+                          dev->getLocation().c_str(), err.what());
+        return false;
+    }
+}
+
+// the devices that still have to be probed, shared by all StringProbeWorker threads
+class StringProbeQueue
+{
+public:
+    StringProbeQueue(const DeviceVector &devices, unsigned int timeout)
+        : m_devices(devices)
+        , m_timeout(timeout)
+        , m_next(0)
+        , m_success(devices.size(), false)
+    {}
+
+    // probes devices until the queue is empty
+    void work()
+    {
+        size_t current;
+        while (take(current))
+            m_success[current] = probe_device_strings(m_devices[current], m_timeout);
+    }
+
+    bool isSuccessful(size_t number) const
+    {
+        return m_success[number];
+    }
+
+private:
+    bool take(size_t &number)
+    {
+        MutexLocker locker(&m_mutex);
+        if (m_next >= m_devices.size())
+            return false;
+        number = m_next++;
+        return true;
+    }
+
+private:
+    Mutex m_mutex;
+    DeviceVector m_devices;
+    unsigned int m_timeout;
+    size_t m_next;
+    std::vector<char> m_success; // each element is written by one thread only
+};
+
+class StringProbeWorker : public Thread
+{
+public:
+    StringProbeWorker(StringProbeQueue *queue)
+        : m_queue(queue)
+    {}
+
+protected:
+    void run()
+    {
+        m_queue->work();
+    }
+
+private:
+    StringProbeQueue *m_queue;
+};
+
 /* }}} */
 /* DeviceManager {{{ */
 
 DeviceManager::DeviceManager()
-    : m_currentUpdateDevice(-1)
+    : m_updateDevicesValid(false)
+    , m_currentUpdateDevice(-1)
     , m_sleeper(NULL)
+    , m_transferPolicy(NULL)
 {
     init();
 }
 
 DeviceManager::DeviceManager(bool debuggingEnabled)
-    : m_currentUpdateDevice(-1)
+    : m_updateDevicesValid(false)
+    , m_currentUpdateDevice(-1)
     , m_sleeper(NULL)
+    , m_transferPolicy(NULL)
 {
     init(debuggingEnabled);
 }
@@ -254,6 +408,7 @@ DeviceManager::~DeviceManager()
     for (DeviceVector::const_iterator it = m_updateDevices.begin(); it != m_updateDevices.end(); ++it)
         delete *it;
     delete m_sleeper;
+    delete m_transferPolicy;
 }
 
 void DeviceManager::init(bool debuggingEnabled)
@@ -262,6 +417,7 @@ void DeviceManager::init(bool debuggingEnabled)
     USBPROG_DEBUG_TRACE("usb::UsbManager::init()");
     setUsbDebugging(debuggingEnabled);
     m_sleeper = new BlockingSleeper;
+    m_transferPolicy = new AdaptiveTransferPolicy;
 }
 
 void DeviceManager::setUsbDebugging(bool enabled)
@@ -270,27 +426,64 @@ void DeviceManager::setUsbDebugging(bool enabled)
     usb::UsbManager::instance().setDebug(enabled);
 }
 
+void DeviceManager::setSysfsRoot(const std::string &root)
+{
+    USBPROG_DEBUG_TRACE("usb::UsbManager::setSysfsRoot(%s)", root.c_str());
+    try {
+        usb::UsbManager::instance().setSysfsRoot(root);
+    } catch (const usb::Error &err) {
+        throw IOError(err.what());
+    }
+}
+
 void DeviceManager::setCustomSleeper(Sleeper *sleeper)
 {
     delete m_sleeper;
     m_sleeper = sleeper;
 }
 
+void DeviceManager::setTransferPolicy(TransferPolicy *policy)
+{
+    delete m_transferPolicy;
+    m_transferPolicy = policy;
+}
+
+TransferPolicy *DeviceManager::getTransferPolicy() const
+{
+    return m_transferPolicy;
+}
+
 void DeviceManager::discoverUpdateDevices(const std::vector<UpdateDevice> &updateDevices)
 {
+    TraceSpan span("DeviceManager::discoverUpdateDevices");
+
     try {
+        // only wrap the devices that can be USBprog devices
+        usb::DeviceFilter filter;
+        filter.addDevice(VENDOR_ID_USBPROG, PRODUCT_ID_USBPROG);
+        for (std::vector<UpdateDevice>::const_iterator it = updateDevices.begin(); it != updateDevices.end(); ++it)
+            if (it->getVendor() != 0 && it->getProduct() != 0)
+                filter.addDevice(it->getVendor(), it->getProduct());
+
         usb::UsbManager &usbManager = usb::UsbManager::instance();
-        usbManager.detectDevices();
+        usbManager.detectDevices(filter);
+        m_updateDeviceList = updateDevices;
+
+        std::string currentLocation;
+        if (m_currentUpdateDevice >= 0 && m_currentUpdateDevice < int(m_updateDevices.size()))
+            currentLocation = m_updateDevices[m_currentUpdateDevice]->getLocation();
 
         DeviceVector oldDevices = m_updateDevices;
         m_updateDevices.clear();
+        m_locations.clear();
 
         for (size_t deviceNumber = 0; deviceNumber < usbManager.getNumberOfDevices(); ++deviceNumber) {
             usb::Device *dev = usbManager.getDevice(deviceNumber);
 
-            uint16_t vendorid = dev->getDescriptor().getVendorId();
-            uint16_t productid = dev->getDescriptor().getProductId();
-            uint16_t bcddevice = dev->getDescriptor().getBcdDevice();
+            const usb::DeviceDescriptor &descriptor = dev->getDescriptor();
+            uint16_t vendorid = descriptor.getVendorId();
+            uint16_t productid = descriptor.getProductId();
+            uint16_t bcddevice = descriptor.getBcdDevice();
             Device *d = NULL;
 
             USBPROG_DEBUG_DBG("Found USB device [%04x:%04x:%04x]", int(vendorid), int(productid), int(bcddevice));
@@ -300,6 +493,7 @@ void DeviceManager::discoverUpdateDevices(const std::vector<UpdateDevice> &updat
                     bcddevice == BCDDEVICE_UPDATE) {
                 d = new Device(dev);
                 d->setUpdateMode(true);
+                d->setChipEraseOnUpdate(USBPROG_CHIP_ERASE);
                 d->setName("USBprog in update mode");
                 d->setShortName("usbprog");
             } else {
@@ -315,23 +509,142 @@ void DeviceManager::discoverUpdateDevices(const std::vector<UpdateDevice> &updat
                     }
             }
 
-            if (d)
+            if (d) {
+                m_locations[d->getLocation()] = m_updateDevices.size();
                 m_updateDevices.push_back(d);
+            }
         }
 
-        // reset update device only when something has changed
-        if (oldDevices != m_updateDevices)
-            m_currentUpdateDevice = -1;
+        // keep the update device if it's still plugged in at the same location
+        m_currentUpdateDevice = currentLocation.empty() ? -1 : getDeviceNumber(currentLocation);
+
+        // forget the strings of devices that have been unplugged or that have re-enumerated
+        // (e.g. after a firmware upload), use the others for the new Device objects
+        DeviceStringsMap deviceStrings;
+        for (DeviceVector::const_iterator it = m_updateDevices.begin(); it != m_updateDevices.end(); ++it) {
+            Device *dev = *it;
+            DeviceStringsMap::const_iterator cached = m_deviceStrings.find(dev->getLocation());
+            if (cached == m_deviceStrings.end() || cached->second.deviceNumber != dev->getDeviceNumber())
+                continue;
+
+            dev->setManufacturer(cached->second.manufacturer);
+            dev->setProductName(cached->second.productName);
+            dev->setSerialNumber(cached->second.serialNumber);
+            deviceStrings.insert(*cached);
+        }
+        m_deviceStrings.swap(deviceStrings);
 
         // free memory
         for (DeviceVector::const_iterator it = oldDevices.begin(); it != oldDevices.end(); ++it)
             delete *it;
+
+        m_updateDevicesValid = true;
     } catch (const usb::Error &err) {
+        m_updateDevicesValid = false;
         throw IOError("USB error: " + std::string(err.what()));
     }
 }
 
-void DeviceManager::printDevices(std::ostream &os, bool showActive) const
+void DeviceManager::refreshUpdateDevices(const std::vector<UpdateDevice> &updateDevices)
+{
+    if (m_updateDevicesValid && !m_updateDevices.empty()) {
+        USBPROG_DEBUG_DBG("Reusing %d update devices", int(m_updateDevices.size()));
+        return;
+    }
+
+    discoverUpdateDevices(updateDevices);
+}
+
+void DeviceManager::invalidateUpdateDevices()
+{
+    m_updateDevicesValid = false;
+}
+
+void DeviceManager::probeDeviceStrings(unsigned int timeout, size_t maxThreads)
+{
+    DeviceVector devices;
+    for (DeviceVector::const_iterator it = m_updateDevices.begin(); it != m_updateDevices.end(); ++it)
+        if (m_deviceStrings.find((*it)->getLocation()) == m_deviceStrings.end())
+            devices.push_back(*it);
+
+    if (devices.empty())
+        return;
+
+    // a trace has exactly one order of operations
+    usb::UsbManager &usbManager = usb::UsbManager::instance();
+    if (usbManager.isRecording() || usbManager.isReplaying())
+        maxThreads = 1;
+
+    size_t numberOfThreads = std::min(maxThreads, devices.size());
+    USBPROG_DEBUG_DBG("Probing the strings of %d devices with %d threads",
+                      int(devices.size()), int(numberOfThreads));
+
+    StringProbeQueue queue(devices, timeout);
+    if (numberOfThreads <= 1)
+        queue.work();
+    else {
+        // the calling thread is one of the workers
+        std::vector<StringProbeWorker *> workers;
+        try {
+            for (size_t i = 1; i < numberOfThreads; ++i) {
+                workers.push_back(new StringProbeWorker(&queue));
+                workers.back()->start();
+            }
+        } catch (const ApplicationError &err) {
+            USBPROG_DEBUG_DBG("%s, continuing with %d threads", err.what(), int(workers.size()));
+        }
+
+        queue.work();
+
+        // join before deleting, ~Thread() would run after the vtable of the worker is gone
+        for (std::vector<StringProbeWorker *>::iterator it = workers.begin(); it != workers.end(); ++it) {
+            (*it)->join();
+            delete *it;
+        }
+    }
+
+    // only cache successful results, so that a busy device gets another try next time
+    for (size_t i = 0; i < devices.size(); ++i) {
+        if (!queue.isSuccessful(i))
+            continue;
+
+        DeviceStrings strings;
+        strings.deviceNumber = devices[i]->getDeviceNumber();
+        strings.manufacturer = devices[i]->getManufacturer();
+        strings.productName = devices[i]->getProductName();
+        strings.serialNumber = devices[i]->getSerialNumber();
+        m_deviceStrings[devices[i]->getLocation()] = strings;
+    }
+}
+
+Device *DeviceManager::waitForDevice(const std::string                &location,
+                                     bool                             updateMode,
+                                     unsigned int                     timeout,
+                                     const std::vector<UpdateDevice>  &updateDevices)
+{
+    const unsigned int interval = 100;
+
+    TraceSpan span("DeviceManager::waitForDevice");
+    if (span.isEnabled())
+        span.addArg("location", location);
+
+    USBPROG_DEBUG_DBG("Waiting %d ms for device at %s", timeout, location.c_str());
+    for (unsigned int waited = 0; ; waited += interval) {
+        discoverUpdateDevices(updateDevices);
+
+        Device *dev = getDeviceByLocation(location);
+        if (dev && dev->isUpdateMode() == updateMode)
+            return dev;
+
+        if (waited >= timeout)
+            return NULL;
+
+        TraceSpan sleepSpan("sleep");
+        m_sleeper->sleep(interval);
+    }
+}
+
+void DeviceManager::printDevices(std::ostream &os, bool showActive, bool verbose) const
 {
     int i = 0;
     Device *up = getCurrentUpdateDevice();
@@ -361,6 +674,28 @@ void DeviceManager::printDevices(std::ostream &os, bool showActive) const
                << dev->getName() << std::endl;
         }
 
+        if (verbose) {
+            std::string product = dev->getManufacturer();
+            if (!product.empty() && !dev->getProductName().empty())
+                product += " ";
+            product += dev->getProductName();
+
+            std::stringstream ss;
+            if (!dev->getPortPath().empty())
+                ss << "Port " << dev->getPortPath();
+            if (!product.empty())
+                ss << (ss.str().empty() ? "" : ", ") << product;
+            if (!dev->getSerialNumber().empty())
+                ss << (ss.str().empty() ? "" : ", ") << "Serial " << dev->getSerialNumber();
+
+            if (!ss.str().empty()) {
+                os << "      ";
+                if (showActive)
+                    os << "    ";
+                os << ss.str() << std::endl;
+            }
+        }
+
         // reset fill character
         os << std::setfill(' ');
     }
@@ -372,6 +707,10 @@ void DeviceManager::switchUpdateMode()
     if (dev->isUpdateMode())
         return;
 
+    TraceSpan span("DeviceManager::switchUpdateMode");
+    if (span.isEnabled())
+        span.addArg("location", dev->getLocation());
+
     USBPROG_DEBUG_DBG("DeviceManager::switchUpdateMode()");
     USBPROG_DEBUG_TRACE("usb_open(%p)", dev->getHandle());
 
@@ -384,18 +723,17 @@ void DeviceManager::switchUpdateMode()
     }
 
     try {
-        std::auto_ptr<usb::ConfigDescriptor> configDescriptor(dev->getHandle()->getConfigDescriptor(0));
-        USBPROG_DEBUG_TRACE("usb::DeviceHandle::setConfiguration(%d)", configDescriptor->getConfigurationValue());
-        usb_handle->setConfiguration(configDescriptor->getConfigurationValue());
+        const usb::ConfigDescriptor &configDescriptor = dev->getHandle()->getConfigDescriptor(0);
+        USBPROG_DEBUG_TRACE("usb::DeviceHandle::setConfiguration(%d)", configDescriptor.getConfigurationValue());
+        usb_handle->setConfiguration(configDescriptor.getConfigurationValue());
     } catch (const usb::Error &err) {
         throw IOError("Unable to set configuration: " + std::string(err.what()));
     }
 
     unsigned int interfaceNumber;
     try {
-        std::auto_ptr<usb::ConfigDescriptor> configDescriptor(dev->getHandle()->getConfigDescriptor(0));
-        std::auto_ptr<usb::InterfaceDescriptor> interfaceDescriptor(configDescriptor->getInterfaceDescriptor(0, 0));
-        interfaceNumber = interfaceDescriptor->getInterfaceNumber();
+        const usb::ConfigDescriptor &configDescriptor = dev->getHandle()->getConfigDescriptor(0);
+        interfaceNumber = configDescriptor.getInterfaceDescriptor(0, 0).getInterfaceNumber();
         USBPROG_DEBUG_TRACE("usb::DeviceHandle::claimInterface(%d)", interfaceNumber);
         usb_handle->claimInterface(interfaceNumber);
     } catch (const usb::Error &err) {
@@ -413,15 +751,27 @@ void DeviceManager::switchUpdateMode()
 
     USBPROG_DEBUG_TRACE("usb::DeviceHandle::controlTransfer() (multiple times)");
 
-    int timeout = 6;
-    bool successfully = false;
-    while (!successfully && --timeout > 0) {
-        try {
-            usb_handle->controlTransfer(0xC0, 0x01, 0, 0, NULL, 8, 1000);
-            successfully = true;
-        } catch (const usb::Error &) {}
+    const TransferPolicy::TransferType type = TransferPolicy::TT_MODE_SWITCH;
+    unsigned int retries = m_transferPolicy->getRetries(type);
+    for (unsigned int retry = 0; retry <= retries; ++retry) {
+        if (retry > 0) {
+            TraceSpan sleepSpan("sleep");
+            m_sleeper->sleep(m_transferPolicy->getRetryDelay(type, retry));
+        }
 
-        m_sleeper->sleep(1);
+        TraceSpan transferSpan("controlTransfer");
+        transferSpan.addArg("retry", retry);
+        unsigned long long start = usb::usbpp_now_us();
+        try {
+            usb_handle->controlTransfer(0xC0, 0x01, 0, 0, NULL, 8, m_transferPolicy->getTimeout(dev, type));
+            m_transferPolicy->transferFinished(dev, type, usb::usbpp_now_us() - start, true);
+            break;
+        } catch (const usb::Error &err) {
+            m_transferPolicy->transferFinished(dev, type, usb::usbpp_now_us() - start, false);
+            if (transferSpan.isEnabled())
+                transferSpan.addArg("error", err.what());
+            USBPROG_DEBUG_DBG("Switching to update mode failed: %s", err.what());
+        }
     }
 
     // Calling the d'tor of usb::DeviceHandle also releases the claimed interface
@@ -429,14 +779,21 @@ void DeviceManager::switchUpdateMode()
     USBPROG_DEBUG_TRACE("Delete usb::DeviceHandle");
     usb_handle.reset(NULL);
 
-    m_sleeper->sleep(2000);
-
-    // set again the update device
-    int updatedev = m_currentUpdateDevice;
-    discoverUpdateDevices();
+    // without port path, the device cannot be recognised after re-enumeration, so fall back
+    // to the first device in update mode
+    std::string location = dev->getLocation();
+    if (dev->getPortPath().empty()) {
+        TraceSpan sleepSpan("sleep");
+        m_sleeper->sleep(2000);
+        discoverUpdateDevices(m_updateDeviceList);
+        clearCurrentUpdateDevice();
+        return;
+    }
 
-    // TODO: Verify that the m_currentUpdateDevice is still valid!
-    setCurrentUpdateDevice(updatedev);
+    // that's the same device after re-enumeration
+    if (!waitForDevice(location, true, 5000, m_updateDeviceList))
+        throw IOError("Device at port " + location + " didn't come back in update mode");
+    setCurrentUpdateDevice(getDeviceNumber(location));
 }
 
 size_t DeviceManager::getNumberUpdateDevices() const
@@ -474,6 +831,18 @@ Device *DeviceManager::getDevice(size_t number) const
     return m_updateDevices[number];
 }
 
+int DeviceManager::getDeviceNumber(const std::string &location) const
+{
+    LocationMap::const_iterator it = m_locations.find(location);
+    return it != m_locations.end() ? it->second : -1;
+}
+
+Device *DeviceManager::getDeviceByLocation(const std::string &location) const
+{
+    int number = getDeviceNumber(location);
+    return number >= 0 ? m_updateDevices[number] : NULL;
+}
+
 void DeviceManager::setCurrentUpdateDevice(int number)
 {
     if (number < 0 || number >= int(m_updateDevices.size()))
@@ -495,16 +864,69 @@ bool operator!=(const Device &a, const Device &b)
 }
 
 /* }}} */
-/* UsbprogUpdater {{{ */
 
 #define USB_PAGESIZE 64
 #define WRITEPAGE      0x02
 #define STARTAPP       0x01
 
+/* PageStream {{{ */
+
+PageStream::PageStream()
+{}
+
+PageStream::PageStream(const FirmwareImage &image, bool skipErasedPages)
+{
+    std::vector<uint32_t> pages = image.getPageNumbers(USB_PAGESIZE);
+    m_messages.reserve(pages.size() * 2 * USB_PAGESIZE);
+
+    unsigned char cmd[USB_PAGESIZE];
+    unsigned char buf[USB_PAGESIZE];
+    std::memset(cmd, 0, USB_PAGESIZE);
+    cmd[0] = WRITEPAGE;
+
+    size_t skipped = 0;
+    for (std::vector<uint32_t>::const_iterator it = pages.begin(); it != pages.end(); ++it) {
+        if (*it > 0xffff)
+            throw IOError("Firmware address out of range for the USBprog bootloader");
+
+        image.readPage(*it, USB_PAGESIZE, buf);
+        if (skipErasedPages && FirmwareImage::isErased(buf, USB_PAGESIZE)) {
+            skipped++;
+            continue;
+        }
+
+        cmd[1] = (char)*it;
+        cmd[2] = (char)(*it >> 8);
+        m_messages.insert(m_messages.end(), cmd, cmd + USB_PAGESIZE);
+        m_messages.insert(m_messages.end(), buf, buf + USB_PAGESIZE);
+    }
+
+    if (skipErasedPages)
+        USBPROG_DEBUG_DBG("Skipping %d erased pages", skipped);
+}
+
+size_t PageStream::getNumberOfPages() const
+{
+    return m_messages.size() / (2 * USB_PAGESIZE);
+}
+
+const unsigned char *PageStream::getPage(size_t page) const
+{
+    return &m_messages[page * 2 * USB_PAGESIZE];
+}
+
+/* }}} */
+/* UsbprogUpdater {{{ */
+
 UsbprogUpdater::UsbprogUpdater(Device *dev)
     : m_dev(dev)
     , m_progressNotifier(NULL)
+    , m_skipErasedPages(false)
+    , m_transferPolicy(&m_defaultTransferPolicy)
     , m_devHandle(NULL)
+    , m_bufferPool(NULL)
+    , m_cmdBuffer(NULL)
+    , m_pageBuffer(NULL)
 {}
 
 UsbprogUpdater::~UsbprogUpdater()
@@ -518,44 +940,147 @@ void UsbprogUpdater::setProgress(ProgressNotifier *progress)
     m_progressNotifier = progress;
 }
 
-void UsbprogUpdater::writeFirmware(const ByteVector &bv)
+void UsbprogUpdater::setSkipErasedPages(bool skip)
 {
-    unsigned char buf[USB_PAGESIZE];
-    unsigned char cmd[USB_PAGESIZE];
+    m_skipErasedPages = skip;
+}
 
-    USBPROG_DEBUG_DBG("UsbprogUpdater::writeFirmware, size=%d", bv.size());
+void UsbprogUpdater::setTransferPolicy(TransferPolicy *policy)
+{
+    m_transferPolicy = policy ? policy : &m_defaultTransferPolicy;
+}
 
-    if (!m_devHandle)
-        throw IOError("Device not opened");
+void UsbprogUpdater::bulkWrite(unsigned char *data)
+{
+    const TransferPolicy::TransferType type = TransferPolicy::TT_BULK_WRITE;
+    unsigned int retries = m_transferPolicy->getRetries(type);
+
+    // A message that timed out may have reached the bootloader nevertheless, so only stalled
+    // messages, which the bootloader hasn't accepted, are sent again. writePage() recovers
+    // from timeouts.
+    for (unsigned int retry = 0; ; ++retry) {
+        unsigned int timeout = m_transferPolicy->getTimeout(m_dev, type);
+        unsigned long long start = usb::usbpp_now_us();
+
+        USBPROG_DEBUG_TRACE("usb::DeviceHandle::bulkTransfer(2, %p, %d, NULL, %d)",
+                data, USB_PAGESIZE, timeout);
+        try {
+            m_devHandle->bulkTransfer(2, data, USB_PAGESIZE, NULL, timeout);
+            m_transferPolicy->transferFinished(m_dev, type, usb::usbpp_now_us() - start, true);
+            return;
+        } catch (const usb::Error &err) {
+            m_transferPolicy->transferFinished(m_dev, type, usb::usbpp_now_us() - start, false);
+            if (retry >= retries || err.getCode() != usb::Error::PIPE)
+                throw;
 
-    int page = 0;
-    memset(cmd, 0, USB_PAGESIZE);
+            USBPROG_DEBUG_DBG("Bulk write stalled (%s), retry %d of %d", err.what(), retry + 1, retries);
+        }
 
-    for (unsigned int i = 0; i < bv.size(); i += 64) {
-        size_t sz = std::min(USB_PAGESIZE, int(bv.size()-i));
-        memset(buf, 0, USB_PAGESIZE);
-        copy(bv.begin() + i, bv.begin() + i + sz, buf);
+        // only the retries show up in the trace, one span per page would be too much
+        TraceSpan sleepSpan("sleep");
+        sleepSpan.addArg("retry", retry + 1);
+        usb::usbpp_usleep(m_transferPolicy->getRetryDelay(type, retry + 1) * 1000ULL);
 
-        cmd[0] = WRITEPAGE;
-        cmd[1] = (char)page;
-        cmd[2] = (char)(page++ >> 8);
+        USBPROG_DEBUG_TRACE("usb::DeviceHandle::clearHalt(2)");
+        m_devHandle->clearHalt(2);
+    }
+}
 
-        USBPROG_DEBUG_TRACE("usb::DeviceHandle::bulkTransfer(2, %p, %d, NULL, 100)", 2, cmd, USB_PAGESIZE);
+void UsbprogUpdater::writePage(unsigned char *cmd, unsigned char *data)
+{
+    const TransferPolicy::TransferType type = TransferPolicy::TT_BULK_WRITE;
+    unsigned int retries = m_transferPolicy->getRetries(type);
 
+    // After a timeout, it's unknown whether the bootloader still waits for the data of the
+    // page. So it's resynchronized and the whole pair is sent again, writing the same page
+    // twice does no harm.
+    for (unsigned int retry = 0; ; ++retry) {
         try {
-            m_devHandle->bulkTransfer(2, cmd, USB_PAGESIZE, NULL, 100);
+            if (retry > 0)
+                resync();
+            bulkWrite(cmd);
+            bulkWrite(data);
+            return;
         } catch (const usb::Error &err) {
-            updateClose();
-            if (m_progressNotifier)
-                m_progressNotifier->finished();
-            throw IOError("Error while writing to USB device: "+
-                    std::string(err.what()));
+            if (retry >= retries || err.getCode() != usb::Error::TIMEOUT)
+                throw;
+
+            USBPROG_DEBUG_DBG("Writing page timed out (%s), retry %d of %d", err.what(), retry + 1, retries);
+        }
+
+        TraceSpan sleepSpan("sleep");
+        sleepSpan.addArg("retry", retry + 1);
+        usb::usbpp_usleep(m_transferPolicy->getRetryDelay(type, retry + 1) * 1000ULL);
+    }
+}
+
+void UsbprogUpdater::resync()
+{
+    // the bootloader stores the message as page data if it waits for data, otherwise it
+    // ignores the unknown command. Either way it expects a command afterwards.
+    unsigned char buf[USB_PAGESIZE];
+    std::memset(buf, 0, USB_PAGESIZE);
+
+    // also resets the data toggle after the failed transfer
+    USBPROG_DEBUG_TRACE("usb::DeviceHandle::clearHalt(2)");
+    m_devHandle->clearHalt(2);
+
+    USBPROG_DEBUG_TRACE("Resynchronizing the bootloader");
+    bulkWrite(buf);
+}
+
+void UsbprogUpdater::writeFirmware(const ByteVector &bv)
+{
+    writeFirmware(FirmwareImage(bv));
+}
+
+void UsbprogUpdater::writeFirmware(const FirmwareImage &image)
+{
+    TraceSpan span("UsbprogUpdater::writeFirmware");
+    if (span.isEnabled())
+        span.addArg("location", m_dev->getLocation());
+
+    USBPROG_DEBUG_DBG("UsbprogUpdater::writeFirmware, size=%d", image.getSize());
+
+    bool skipErasedPages = m_skipErasedPages;
+    if (skipErasedPages && !m_dev->isChipEraseOnUpdate()) {
+        USBPROG_DEBUG_INFO("Bootloader doesn't erase the chip, writing erased pages anyway");
+        skipErasedPages = false;
+    }
+
+    writePageStream(PageStream(image, skipErasedPages));
+}
+
+void UsbprogUpdater::writePageStream(const PageStream &stream)
+{
+    TraceSpan span("UsbprogUpdater::writePageStream");
+    if (span.isEnabled()) {
+        span.addArg("location", m_dev->getLocation());
+        span.addArg("pages", stream.getNumberOfPages());
+    }
+
+    USBPROG_DEBUG_DBG("UsbprogUpdater::writePageStream, pages=%d", stream.getNumberOfPages());
+
+    if (!m_devHandle)
+        throw IOError("Device not opened");
+
+    double total = double(stream.getNumberOfPages()) * USB_PAGESIZE;
+
+    for (size_t i = 0; i < stream.getNumberOfPages(); i++) {
+        // only device memory is worth a copy: the kernel then submits it without copying
+        // once more. Heap buffers would get copied anyway, so send the stream directly
+        // (the USB library doesn't write to OUT buffers).
+        unsigned char *cmd = const_cast<unsigned char *>(stream.getPage(i));
+        unsigned char *data = cmd + USB_PAGESIZE;
+        if (m_bufferPool->isDeviceMemory()) {
+            std::memcpy(m_cmdBuffer, cmd, USB_PAGESIZE);
+            std::memcpy(m_pageBuffer, data, USB_PAGESIZE);
+            cmd = m_cmdBuffer;
+            data = m_pageBuffer;
         }
 
-        // data message
-        USBPROG_DEBUG_TRACE("usb::DeviceHandle::bulkTransfer(2, %p, %d, NULL, 100)", buf, USB_PAGESIZE);
         try {
-            m_devHandle->bulkTransfer(2, buf, USB_PAGESIZE, NULL, 100);
+            writePage(cmd, data);
         } catch (const usb::Error &err) {
             updateClose();
             if (m_progressNotifier)
@@ -565,7 +1090,7 @@ void UsbprogUpdater::writeFirmware(const ByteVector &bv)
         }
 
         if (m_progressNotifier)
-            m_progressNotifier->progressed(bv.size(), i);
+            m_progressNotifier->progressed(total, double(i) * USB_PAGESIZE);
     }
 
     if (m_progressNotifier)
@@ -576,6 +1101,10 @@ void UsbprogUpdater::updateOpen()
 {
     usb::Device *dev = m_dev->getHandle();
 
+    TraceSpan span("UsbprogUpdater::updateOpen");
+    if (span.isEnabled())
+        span.addArg("location", m_dev->getLocation());
+
     USBPROG_DEBUG_DBG("UsbprogUpdater::updateOpen()");
 
     if (m_devHandle)
@@ -589,18 +1118,27 @@ void UsbprogUpdater::updateOpen()
     }
 
     try {
-        std::auto_ptr<usb::ConfigDescriptor> configDescriptor(dev->getConfigDescriptor(0));
-        USBPROG_DEBUG_TRACE("usb::DeviceHandle::setConfiguration(%d)", configDescriptor->getConfigurationValue());
-        m_devHandle->setConfiguration(configDescriptor->getConfigurationValue());
+        m_bufferPool = m_devHandle->createBufferPool(USB_PAGESIZE);
+        m_cmdBuffer = m_bufferPool->acquire();
+        m_pageBuffer = m_bufferPool->acquire();
+        USBPROG_DEBUG_TRACE("Transfer buffers allocated as %s memory",
+                m_bufferPool->isDeviceMemory() ? "device" : "heap");
+    } catch (const usb::Error &err) {
+        throw IOError("Unable to allocate transfer buffers: " + std::string(err.what()));
+    }
+
+    try {
+        const usb::ConfigDescriptor &configDescriptor = dev->getConfigDescriptor(0);
+        USBPROG_DEBUG_TRACE("usb::DeviceHandle::setConfiguration(%d)", configDescriptor.getConfigurationValue());
+        m_devHandle->setConfiguration(configDescriptor.getConfigurationValue());
     } catch (const usb::Error &err) {
         throw IOError("Unable to set configuration: " + std::string(err.what()));
     }
 
     unsigned int interfaceNumber;
     try {
-        std::auto_ptr<usb::ConfigDescriptor> configDescriptor(dev->getConfigDescriptor(0));
-        std::auto_ptr<usb::InterfaceDescriptor> interfaceDescriptor(configDescriptor->getInterfaceDescriptor(0, 0));
-        interfaceNumber = interfaceDescriptor->getInterfaceNumber();
+        const usb::ConfigDescriptor &configDescriptor = dev->getConfigDescriptor(0);
+        interfaceNumber = configDescriptor.getInterfaceDescriptor(0, 0).getInterfaceNumber();
         USBPROG_DEBUG_TRACE("usb::DeviceHandle::claimInterface(%d)", interfaceNumber);
         m_devHandle->claimInterface(interfaceNumber);
     } catch (const usb::Error &err) {
@@ -615,6 +1153,11 @@ void UsbprogUpdater::updateClose()
     if (!m_devHandle)
         throw IOError("Device already closed");
 
+    // the buffers belong to the device handle, so free them first
+    delete m_bufferPool;
+    m_bufferPool = NULL;
+    m_cmdBuffer = m_pageBuffer = NULL;
+
     USBPROG_DEBUG_TRACE("Closing usb::Device");
     delete m_devHandle;
     m_devHandle = NULL;
@@ -622,19 +1165,21 @@ void UsbprogUpdater::updateClose()
 
 void UsbprogUpdater::startDevice()
 {
+    TraceSpan span("UsbprogUpdater::startDevice");
+    if (span.isEnabled())
+        span.addArg("location", m_dev->getLocation());
+
     if (!m_devHandle)
         throw IOError("Device not opened");
 
-    unsigned char buf[USB_PAGESIZE];
+    unsigned char *buf = m_cmdBuffer;
     std::memset(buf, 0, USB_PAGESIZE);
 
     USBPROG_DEBUG_DBG("Starting device");
 
     buf[0] = STARTAPP;
-    USBPROG_DEBUG_TRACE("usb::DeviceHandle::bulkTransfer(2, %p, %d, NULL, 100)",
-            buf, USB_PAGESIZE);
     try {
-        m_devHandle->bulkTransfer(2, buf, USB_PAGESIZE, NULL, 100);
+        bulkWrite(buf);
     } catch (const usb::Error &err) {
         throw IOError("Error in bulk write: " + std::string(err.what()));
     }
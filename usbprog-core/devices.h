@@ -30,6 +30,7 @@
 
 #include <string>
 #include <vector>
+#include <map>
 #include <iostream>
 #include <stdint.h>
 
@@ -39,6 +40,19 @@
 #include <usbprog-core/error.h>
 #include <usbprog-core/progressnotifier.h>
 #include <usbprog-core/sleeper.h>
+#include <usbprog-core/firmwareimage.h>
+#include <usbprog-core/transferpolicy.h>
+
+/* Preprocessor definitions {{{ */
+
+/**
+ * @brief The sysfs directory with the USB devices on Linux
+ *
+ * @see DeviceManager::setSysfsRoot()
+ */
+#define DEFAULT_SYSFS_ROOT      "/sys/bus/usb/devices"
+
+/* }}} */
 
 namespace usbprog {
 namespace core {
@@ -233,6 +247,73 @@ public:
      */
     unsigned short getBusNumber() const;
 
+    /**
+     * @brief Returns the physical location of the device
+     *
+     * @return the port path like @c "1-1.3", empty if the USB library doesn't provide it
+     * @see usb::Device::getPortPath()
+     */
+    std::string getPortPath() const;
+
+    /**
+     * @brief Returns a key that identifies the physical location of the device
+     *
+     * That's the port path if the USB library provides it, so the location stays the same when
+     * the device re-enumerates, e.g. after switching to update mode. Otherwise it's built from
+     * the bus and the device number, which changes on re-enumeration.
+     *
+     * The location is built once when the object is created.
+     *
+     * @return the location, never empty
+     * @see DeviceManager::getDeviceByLocation()
+     */
+    const std::string &getLocation() const;
+
+    /**
+     * @brief Returns the manufacturer string of the device
+     *
+     * @return the manufacturer, empty if the strings have not been read with
+     *         DeviceManager::probeDeviceStrings()
+     */
+    std::string getManufacturer() const;
+
+    /**
+     * @brief Sets the manufacturer string
+     *
+     * @param[in] manufacturer the manufacturer
+     */
+    void setManufacturer(const std::string &manufacturer);
+
+    /**
+     * @brief Returns the product string of the device
+     *
+     * @return the product, empty if the strings have not been read with
+     *         DeviceManager::probeDeviceStrings()
+     */
+    std::string getProductName() const;
+
+    /**
+     * @brief Sets the product string
+     *
+     * @param[in] productName the product
+     */
+    void setProductName(const std::string &productName);
+
+    /**
+     * @brief Returns the serial number of the device
+     *
+     * @return the serial number, empty if the strings have not been read with
+     *         DeviceManager::probeDeviceStrings()
+     */
+    std::string getSerialNumber() const;
+
+    /**
+     * @brief Sets the serial number
+     *
+     * @param[in] serialNumber the serial number
+     */
+    void setSerialNumber(const std::string &serialNumber);
+
     /**
      * @brief Creates a string representation of the device
      *
@@ -299,11 +380,36 @@ public:
      */
     usb::Device *getHandle() const;
 
+    /**
+     * @brief Checks if the bootloader erases the whole flash before writing
+     *
+     * If that's the case, pages that only contain FirmwareImage::ERASED_BYTE don't need
+     * to be written. See UsbprogUpdater::setSkipErasedPages().
+     *
+     * @return @c true if the bootloader erases the whole chip when an update starts,
+     *         @c false if the pages are erased one by one while writing
+     */
+    bool isChipEraseOnUpdate() const;
+
+    /**
+     * @brief Sets if the bootloader erases the whole flash before writing
+     *
+     * @param[in] chipErase @c true if the bootloader erases the whole chip when an update
+     *            starts, @c false otherwise
+     */
+    void setChipEraseOnUpdate(bool chipErase);
+
 private:
     usb::Device *m_handle;
     bool m_updateMode;
+    bool m_chipEraseOnUpdate;
     std::string m_name;
     std::string m_shortName;
+    std::string m_portPath;
+    std::string m_location;
+    std::string m_manufacturer;
+    std::string m_productName;
+    std::string m_serialNumber;
     uint16_t m_vendorId;
     uint16_t m_productId;
     unsigned short m_deviceNumber;
@@ -400,6 +506,24 @@ public:
      */
     void setCustomSleeper(Sleeper *sleeper);
 
+    /**
+     * @brief Sets the policy for timeouts and retries
+     *
+     * The policy is used by switchUpdateMode(). Pass it to UsbprogUpdater::setTransferPolicy()
+     * so that the uploads learn from the previous ones. The default policy is an instance of
+     * AdaptiveTransferPolicy.
+     *
+     * @param[in] policy the new policy that gets freed by the DeviceManager
+     */
+    void setTransferPolicy(TransferPolicy *policy);
+
+    /**
+     * @brief Returns the policy for timeouts and retries
+     *
+     * @return the policy that is still owned by the DeviceManager
+     */
+    TransferPolicy *getTransferPolicy() const;
+
     /**
      * @brief Enables or diables USB debugging
      *
@@ -408,9 +532,25 @@ public:
      */
     void setUsbDebugging(bool enabled);
 
+    /**
+     * @brief Enumerates the USB devices via sysfs
+     *
+     * Reading the device IDs from sysfs is much faster than letting the USB library open each
+     * device. The USB library is only used when a device is actually opened. Only supported
+     * on Linux.
+     *
+     * @param[in] root the sysfs directory with one subdirectory per USB device, normally
+     *            DEFAULT_SYSFS_ROOT, or an empty string to use the USB library
+     * @exception IOError if sysfs enumeration is not supported on this platform
+     */
+    void setSysfsRoot(const std::string &root);
+
     /**
      * @brief Discover update devices
      *
+     * The current update device stays selected as long as a device is present at the same
+     * location (see Device::getLocation()), even if its number has changed.
+     *
      * @param[in] updateDevices a vector with devices that should be treated as update devices
      *            in addition to USBprog in base mode. That vector is normally retrieved from the
      *            firmware pool. This is needed to have a weak coupling between the FirmwarePool
@@ -419,18 +559,83 @@ public:
      */
     void discoverUpdateDevices(const std::vector<UpdateDevice> &updateDevices =  std::vector<UpdateDevice>());
 
+    /**
+     * @brief Discovers update devices unless the last discovery is still valid
+     *
+     * The result of the last discoverUpdateDevices() call is reused until
+     * invalidateUpdateDevices() has been called, so a script with many commands doesn't scan
+     * the bus for each command. An empty device list is never reused.
+     *
+     * @param[in] updateDevices see discoverUpdateDevices()
+     * @throw IOError on any I/O error when communicating with USB device(s)
+     */
+    void refreshUpdateDevices(const std::vector<UpdateDevice> &updateDevices = std::vector<UpdateDevice>());
+
+    /**
+     * @brief Marks the result of the last discovery as outdated
+     *
+     * Must be called after an operation that lets a device re-enumerate (like starting or
+     * resetting it) without discovering the devices again, so that the next
+     * refreshUpdateDevices() call scans the bus.
+     */
+    void invalidateUpdateDevices();
+
+    /**
+     * @brief Waits until a device shows up at @p location
+     *
+     * Rediscovers the update devices every 100 ms until there's a device at @p location
+     * that is in the requested mode or until @p timeout has elapsed. The Sleeper set with
+     * setCustomSleeper() is used for waiting.
+     *
+     * @param[in] location the location as returned by Device::getLocation()
+     * @param[in] updateMode @c true if the device must be in update mode, @c false if it must
+     *            be in firmware mode
+     * @param[in] timeout the maximum time to wait in milliseconds
+     * @param[in] updateDevices the devices that should be treated as update devices, see
+     *            discoverUpdateDevices()
+     * @return the device (still owned by the DeviceManager) or @c NULL on timeout
+     * @throw IOError on any I/O error when communicating with USB device(s)
+     */
+    Device *waitForDevice(const std::string                 &location,
+                          bool                              updateMode,
+                          unsigned int                      timeout,
+                          const std::vector<UpdateDevice>   &updateDevices = std::vector<UpdateDevice>());
+
+    /**
+     * @brief Reads the string descriptors of all update devices
+     *
+     * Reading the manufacturer, product and serial number requires opening each device, so
+     * the devices are probed in parallel by up to @p maxThreads threads. The strings are
+     * cached by port path until the device is unplugged or re-enumerates, so calling that
+     * function again after discoverUpdateDevices() only probes new devices. Devices that
+     * cannot be opened or don't answer within @p timeout keep empty strings.
+     *
+     * While USB traces are recorded or replayed, the devices are probed one after another
+     * to get a reproducible order.
+     *
+     * It's necessary to call discoverUpdateDevices() before.
+     *
+     * @param[in] timeout the timeout of each USB request in milliseconds
+     * @param[in] maxThreads the maximum number of devices that are probed at the same time
+     * @see Device::getManufacturer(), Device::getProductName(), Device::getSerialNumber()
+     */
+    void probeDeviceStrings(unsigned int timeout = 1000, size_t maxThreads = 8);
+
     /**
      * @brief Prints the list of devices
      *
      * @param[in,out] os the stream to which the device list should be printed
      * @param[in] showActive @c true if the active device should be marked with a star
+     * @param[in] verbose @c true if the port path and the strings read by
+     *            probeDeviceStrings() should be printed
      */
-    void printDevices(std::ostream &os, bool showActive=true) const;
+    void printDevices(std::ostream &os, bool showActive=true, bool verbose=false) const;
 
     /**
      * @brief Switch to update mode
      *
-     * Switches the current update device to update mode.
+     * Switches the current update device to update mode. The devices are discovered again
+     * with the list of update devices passed to the last discoverUpdateDevices() call.
      *
      * @throw IOError on any I/O error when communicating with USB device(s)
      * @see setCurrentUpdateDevice()
@@ -457,6 +662,25 @@ public:
      */
     Device *getDevice(size_t number) const;
 
+    /**
+     * @brief Returns the number of the update device at @p location
+     *
+     * @param[in] location the location as returned by Device::getLocation()
+     * @return the number that can be passed to getDevice() or setCurrentUpdateDevice(),
+     *         -1 if there's no update device at @p location
+     */
+    int getDeviceNumber(const std::string &location) const;
+
+    /**
+     * @brief Returns the update device at @p location
+     *
+     * @param[in] location the location as returned by Device::getLocation()
+     * @return a pointer to the device object that is still owned by the DeviceManager and only
+     *         valid until the DeviceManager is valid and until discoverUpdateDevices() is called the
+     *         next time, @c NULL if there's no update device at @p location
+     */
+    Device *getDeviceByLocation(const std::string &location) const;
+
     /**
      * @brief Returns the current update device
      *
@@ -493,9 +717,80 @@ protected:
     void init(bool debuggingEnabled = false);
 
 private:
+    // the strings of a device, see probeDeviceStrings()
+    struct DeviceStrings {
+        unsigned short deviceNumber;
+        std::string manufacturer;
+        std::string productName;
+        std::string serialNumber;
+    };
+    typedef std::map<std::string, DeviceStrings> DeviceStringsMap;
+
+    // location -> index in m_updateDevices
+    typedef std::map<std::string, int> LocationMap;
+
     DeviceVector m_updateDevices;
+    std::vector<UpdateDevice> m_updateDeviceList;
+    bool m_updateDevicesValid;
+    LocationMap m_locations;
     int m_currentUpdateDevice;
     Sleeper *m_sleeper;
+    TransferPolicy *m_transferPolicy;
+    DeviceStringsMap m_deviceStrings;
+};
+
+/* }}} */
+/* PageStream {{{ */
+
+/**
+ * @brief Precomputed messages for the USBprog bootloader
+ *
+ * The USBprog bootloader receives a firmware as pairs of bulk messages: a command with the
+ * page number, followed by the page data. A PageStream contains these messages for a whole
+ * firmware image, so they can be computed once and sent to many devices with
+ * UsbprogUpdater::writePageStream().
+ *
+ * @author Bernhard Walle <bernhard@bwalle.de>
+ * @ingroup core
+ */
+class PageStream {
+public:
+    /**
+     * @brief Creates an empty stream
+     */
+    PageStream();
+
+    /**
+     * @brief Creates the messages for @p image
+     *
+     * @param[in] image the firmware image
+     * @param[in] skipErasedPages @c true if pages that only contain FirmwareImage::ERASED_BYTE
+     *            should be left out, see UsbprogUpdater::setSkipErasedPages()
+     * @exception IOError if @p image contains data that cannot be addressed by the
+     *            bootloader
+     */
+    PageStream(const FirmwareImage &image, bool skipErasedPages);
+
+public:
+    /**
+     * @brief Returns the number of pages
+     *
+     * @return the number of pages, i.e. half of the number of messages
+     */
+    size_t getNumberOfPages() const;
+
+    /**
+     * @brief Returns the messages of a page
+     *
+     * @param[in] page the index of the page which must be between 0 (inclusive) and
+     *            getNumberOfPages() (exclusive)
+     * @return the command message of the page, immediately followed by the data message.
+     *         Both messages have the size of a USB page.
+     */
+    const unsigned char *getPage(size_t page) const;
+
+private:
+    ByteVector m_messages;
 };
 
 /* }}} */
@@ -547,11 +842,63 @@ public:
      *
      * It's necessary that updateOpen() has been called before.
      *
+     * The bytes are written starting at address 0. Unused bytes in the last page are
+     * filled with FirmwareImage::ERASED_BYTE.
+     *
      * @param[in] bv the firmware bytes
      * @exception IOError on any error when communicating with the USBprog device.
      */
     void writeFirmware(const ByteVector &bv);
 
+    /**
+     * @brief Writes a sparse firmware image to the device.
+     *
+     * Only the pages that contain data of @p image are written, the gaps between the segments
+     * are skipped. It's necessary that updateOpen() has been called before.
+     *
+     * @param[in] image the firmware image
+     * @exception IOError on any error when communicating with the USBprog device or if
+     *            @p image contains data that cannot be addressed by the bootloader.
+     */
+    void writeFirmware(const FirmwareImage &image);
+
+    /**
+     * @brief Writes precomputed messages to the device.
+     *
+     * In contrast to writeFirmware(), setSkipErasedPages() has no effect because the
+     * erased pages have already been left out when @p stream was created.
+     * It's necessary that updateOpen() has been called before.
+     *
+     * @param[in] stream the messages
+     * @exception IOError on any error when communicating with the USBprog device.
+     */
+    void writePageStream(const PageStream &stream);
+
+    /**
+     * @brief Skips pages that only contain erased bytes
+     *
+     * When enabled, writeFirmware() doesn't write pages that consist only of
+     * FirmwareImage::ERASED_BYTE. That's only safe if the bootloader erases the whole chip
+     * before writing, so the pages are still written if Device::isChipEraseOnUpdate() returns
+     * @c false for the update device. The default is @c false.
+     *
+     * @param[in] skip @c true if erased pages should be skipped, @c false otherwise
+     */
+    void setSkipErasedPages(bool skip);
+
+    /**
+     * @brief Sets the policy for timeouts and retries
+     *
+     * A page that cannot be written is retried as the policy says, so a transient error
+     * doesn't abort the whole upload. Without a policy set, the updater uses its own
+     * AdaptiveTransferPolicy.
+     *
+     * @param[in] policy the policy which is still owned by the caller and must be valid
+     *            during the whole life time of UsbprogUpdater, or @c NULL for the own policy
+     * @see DeviceManager::getTransferPolicy()
+     */
+    void setTransferPolicy(TransferPolicy *policy);
+
     /**
      * @brief Starts the firmware of the device.
      *
@@ -577,10 +924,47 @@ public:
      */
     void updateClose();
 
+protected:
+    /**
+     * @brief Writes one bulk message, retrying as the TransferPolicy says
+     *
+     * @param[in] data the message of USB page size, allocated from the buffer pool
+     * @exception usb::Error if the last retry has failed
+     */
+    void bulkWrite(unsigned char *data);
+
+    /**
+     * @brief Writes the command message and the data message of one page
+     *
+     * If a message times out, the bootloader is resynchronized with resync() and both
+     * messages are sent again, as often as the TransferPolicy says.
+     *
+     * @param[in] cmd the WRITEPAGE command, from the buffer pool if that is device memory
+     * @param[in] data the page data, from the buffer pool if that is device memory
+     * @exception usb::Error if the last retry has failed
+     */
+    void writePage(unsigned char *cmd, unsigned char *data);
+
+    /**
+     * @brief Brings the bootloader into a known state
+     *
+     * Clears the halt of the endpoint and sends a message that the bootloader either takes as
+     * data of a pending page or ignores as unknown command. Afterwards, it waits for a command.
+     *
+     * @exception usb::Error if the message couldn't be sent
+     */
+    void resync();
+
 private:
     Device              *m_dev;
     ProgressNotifier    *m_progressNotifier;
+    bool                m_skipErasedPages;
+    AdaptiveTransferPolicy m_defaultTransferPolicy;
+    TransferPolicy      *m_transferPolicy;
     usb::DeviceHandle   *m_devHandle;
+    usb::BufferPool     *m_bufferPool;
+    unsigned char       *m_cmdBuffer;
+    unsigned char       *m_pageBuffer;
 };
 
 /* }}} */
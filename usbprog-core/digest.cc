@@ -110,6 +110,21 @@ bool check_digest(const std::string &file, const std::string &reference,
     return result == reference;
 }
 
+bool check_digest(const ByteVector &data, const std::string &reference,
+        Digest::Algorithm da)
+{
+    std::auto_ptr<Digest> digest(Digest::create(da));
+    if (digest.get() == NULL)
+        return false;
+
+    // process() doesn't modify the buffer, it's just not declared const
+    if (!data.empty())
+        digest->process(const_cast<unsigned char *>(&data[0]), data.size());
+
+    std::string result = digest->end();
+    return result == reference;
+}
+
 /* }}} */
 
 } // end namespace core
@@ -32,6 +32,7 @@
 #include <string>
 
 #include <usbprog-core/error.h>
+#include <usbprog-core/types.h>
 
 namespace usbprog {
 namespace core {
@@ -151,6 +152,22 @@ bool check_digest(const std::string     &file,
                   const std::string     &reference,
                   Digest::Algorithm     da);
 
+/**
+ * @brief Checks the hash sum of @p data against @p reference
+ *
+ * Same as above, but for data that is already in memory, e.g. a firmware that has been
+ * decompressed from the cache.
+ *
+ * @param[in] data the bytes to check
+ * @param[in] reference the reference hash sum in string format (see Digest::end())
+ * @param[in] da the hash algorithm that should be used to compare against
+ * @return @c true if the reference digest matches the computed one, @c false otherwise
+ * @ingroup core
+ */
+bool check_digest(const ByteVector      &data,
+                  const std::string     &reference,
+                  Digest::Algorithm     da);
+
 
 /* }}} */
 
@@ -0,0 +1,626 @@
+/*
+ * (c) 2007-2010, Bernhard Walle <bernhard@bwalle.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string>
+#include <sstream>
+#include <algorithm>
+#include <cstring>
+#include <cctype>
+
+#include <usbprog-core/firmwareimage.h>
+#include <usbprog-core/util.h>
+#include <usbprog-core/debug.h>
+
+namespace usbprog {
+namespace core {
+
+/* Constants {{{ */
+
+#define ELF_EI_NIDENT           16
+#define ELF_ELFCLASS32          1
+#define ELF_ELFDATA2LSB         1
+#define ELF_ELFDATA2MSB         2
+#define ELF_ET_EXEC             2
+#define ELF_EM_ARM              40
+#define ELF_EM_AVR              83
+#define ELF_PT_LOAD             1
+#define ELF_EHDR_SIZE           52
+#define ELF_PHDR_SIZE           32
+
+/*
+ * avr-ld maps RAM to 0x800000, EEPROM to 0x810000 and the fuses, lock bits and signature
+ * above. Only the flash contents below can be written by the bootloader.
+ */
+#define AVR_FLASH_END           0x800000
+
+/* }}} */
+/* Helpers {{{ */
+
+static int hex_digit(unsigned char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    else if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    else if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    else
+        return -1;
+}
+
+/*
+ * Splits a text record file into lines, strips the line end and converts the hex digits
+ * after the first @p prefixLen characters into bytes. Returns false if the line contains
+ * anything else than hex digits.
+ */
+static bool decode_hex_line(const std::string &line, size_t prefixLen, ByteVector &bytes)
+{
+    bytes.clear();
+    if ((line.size() - prefixLen) % 2 != 0)
+        return false;
+
+    for (size_t i = prefixLen; i < line.size(); i += 2) {
+        int hi = hex_digit(line[i]);
+        int lo = hex_digit(line[i+1]);
+        if (hi < 0 || lo < 0)
+            return false;
+        bytes.push_back( (hi << 4) | lo );
+    }
+
+    return true;
+}
+
+static StringVector split_lines(const ByteVector &data)
+{
+    StringVector lines;
+    std::string current;
+
+    for (ByteVector::const_iterator it = data.begin(); it != data.end(); ++it) {
+        if (*it == '\n') {
+            lines.push_back(current);
+            current.clear();
+        } else if (*it != '\r')
+            current += static_cast<char>(*it);
+    }
+    if (!current.empty())
+        lines.push_back(current);
+
+    return lines;
+}
+
+static std::string strip_blanks(const std::string &line)
+{
+    std::string::size_type start = line.find_first_not_of(" \t");
+    if (start == std::string::npos)
+        return std::string();
+    std::string::size_type end = line.find_last_not_of(" \t");
+    return line.substr(start, end - start + 1);
+}
+
+static std::string line_error(size_t lineno, const std::string &message)
+{
+    std::stringstream ss;
+    ss << "Line " << lineno << ": " << message;
+    return ss.str();
+}
+
+/* true if the first line of @p data looks like a record of a text format */
+static bool is_record_line(const ByteVector &data, char start, bool digitAfterStart)
+{
+    size_t i = 0;
+    while (i < data.size() && std::isspace(data[i]))
+        i++;
+    if (i >= data.size() || data[i] != start)
+        return false;
+    i++;
+
+    if (digitAfterStart) {
+        if (i >= data.size() || !std::isdigit(data[i]))
+            return false;
+        i++;
+    }
+
+    size_t digits = 0;
+    for (; i < data.size() && data[i] != '\n' && data[i] != '\r'; i++, digits++)
+        if (hex_digit(data[i]) < 0)
+            return false;
+
+    return digits >= 8;
+}
+
+/* }}} */
+/* Intel HEX {{{ */
+
+static FirmwareImage parse_ihex(const ByteVector &data)
+{
+    FirmwareImage image;
+    StringVector lines = split_lines(data);
+    uint32_t base = 0;
+    bool eof = false;
+
+    for (size_t i = 0; i < lines.size() && !eof; i++) {
+        std::string line = strip_blanks(lines[i]);
+        size_t lineno = i + 1;
+
+        if (line.empty())
+            continue;
+        if (line[0] != ':')
+            throw ParseError(line_error(lineno, "Intel HEX record doesn't start with ':'"));
+
+        ByteVector rec;
+        if (!decode_hex_line(line, 1, rec) || rec.size() < 5)
+            throw ParseError(line_error(lineno, "Invalid Intel HEX record"));
+
+        size_t count = rec[0];
+        if (rec.size() != count + 5)
+            throw ParseError(line_error(lineno, "Length of Intel HEX record doesn't match"));
+
+        unsigned char sum = 0;
+        for (ByteVector::const_iterator it = rec.begin(); it != rec.end(); ++it)
+            sum += *it;
+        if (sum != 0)
+            throw ParseError(line_error(lineno, "Checksum error in Intel HEX record"));
+
+        uint32_t offset = (rec[1] << 8) | rec[2];
+        const unsigned char *payload = &rec[4];
+
+        switch (rec[3]) {
+            case 0x00: /* data */
+                image.addData(base + offset, payload, count);
+                break;
+
+            case 0x01: /* end of file */
+                eof = true;
+                break;
+
+            case 0x02: /* extended segment address */
+                if (count != 2)
+                    throw ParseError(line_error(lineno, "Invalid extended segment address record"));
+                base = ((payload[0] << 8) | payload[1]) << 4;
+                break;
+
+            case 0x04: /* extended linear address */
+                if (count != 2)
+                    throw ParseError(line_error(lineno, "Invalid extended linear address record"));
+                base = ((payload[0] << 8) | payload[1]) << 16;
+                break;
+
+            case 0x03: /* start segment address */
+            case 0x05: /* start linear address */
+                break;
+
+            default:
+                throw ParseError(line_error(lineno, "Unknown Intel HEX record type"));
+        }
+    }
+
+    if (!eof)
+        throw ParseError("Intel HEX file has no end of file record");
+
+    return image;
+}
+
+/* }}} */
+/* Motorola S-record {{{ */
+
+static FirmwareImage parse_srec(const ByteVector &data)
+{
+    FirmwareImage image;
+    StringVector lines = split_lines(data);
+
+    for (size_t i = 0; i < lines.size(); i++) {
+        std::string line = strip_blanks(lines[i]);
+        size_t lineno = i + 1;
+
+        if (line.empty())
+            continue;
+        if (line.size() < 2 || line[0] != 'S' || !std::isdigit(line[1]))
+            throw ParseError(line_error(lineno, "Invalid S-record"));
+
+        ByteVector rec;
+        if (!decode_hex_line(line, 2, rec) || rec.size() < 3)
+            throw ParseError(line_error(lineno, "Invalid S-record"));
+
+        size_t count = rec[0];
+        if (rec.size() != count + 1)
+            throw ParseError(line_error(lineno, "Length of S-record doesn't match"));
+
+        unsigned char sum = 0;
+        for (ByteVector::const_iterator it = rec.begin(); it != rec.end(); ++it)
+            sum += *it;
+        if (sum != 0xff)
+            throw ParseError(line_error(lineno, "Checksum error in S-record"));
+
+        size_t addressLen;
+        switch (line[1]) {
+            case '1':
+                addressLen = 2;
+                break;
+            case '2':
+                addressLen = 3;
+                break;
+            case '3':
+                addressLen = 4;
+                break;
+
+            case '0': /* header */
+            case '5': /* record count */
+            case '6':
+            case '7': /* start address */
+            case '8':
+            case '9':
+                continue;
+
+            default:
+                throw ParseError(line_error(lineno, "Unknown S-record type"));
+        }
+
+        if (count < addressLen + 1)
+            throw ParseError(line_error(lineno, "S-record too short"));
+
+        uint32_t address = 0;
+        for (size_t j = 0; j < addressLen; j++)
+            address = (address << 8) | rec[1 + j];
+
+        image.addData(address, &rec[1 + addressLen], count - addressLen - 1);
+    }
+
+    return image;
+}
+
+/* }}} */
+/* ELF {{{ */
+
+class ElfReader {
+public:
+    ElfReader(const ByteVector &data, bool bigEndian)
+        : m_data(data), m_bigEndian(bigEndian) {}
+
+    uint16_t half(size_t offset) const
+    {
+        check(offset, 2);
+        if (m_bigEndian)
+            return (m_data[offset] << 8) | m_data[offset+1];
+        else
+            return (m_data[offset+1] << 8) | m_data[offset];
+    }
+
+    uint32_t word(size_t offset) const
+    {
+        check(offset, 4);
+        if (m_bigEndian)
+            return (uint32_t(m_data[offset]) << 24) | (m_data[offset+1] << 16) |
+                   (m_data[offset+2] << 8) | m_data[offset+3];
+        else
+            return (uint32_t(m_data[offset+3]) << 24) | (m_data[offset+2] << 16) |
+                   (m_data[offset+1] << 8) | m_data[offset];
+    }
+
+    void check(size_t offset, size_t len) const
+    {
+        if (offset > m_data.size() || len > m_data.size() - offset)
+            throw ParseError("ELF file truncated");
+    }
+
+private:
+    const ByteVector &m_data;
+    bool m_bigEndian;
+};
+
+static FirmwareImage parse_elf(const ByteVector &data)
+{
+    if (data.size() < ELF_EHDR_SIZE || data[0] != 0x7f || data[1] != 'E' ||
+            data[2] != 'L' || data[3] != 'F')
+        throw ParseError("Not an ELF file");
+    if (data[4] != ELF_ELFCLASS32)
+        throw ParseError("Only 32 bit ELF files are supported");
+    if (data[5] != ELF_ELFDATA2LSB && data[5] != ELF_ELFDATA2MSB)
+        throw ParseError("Invalid data encoding in ELF file");
+
+    ElfReader elf(data, data[5] == ELF_ELFDATA2MSB);
+
+    if (elf.half(16) != ELF_ET_EXEC)
+        throw ParseError("ELF file is not an executable");
+
+    uint16_t machine = elf.half(18);
+    if (machine != ELF_EM_AVR && machine != ELF_EM_ARM)
+        throw ParseError("Unsupported machine in ELF file (only AVR and ARM)");
+
+    uint32_t phoff = elf.word(28);
+    uint16_t phentsize = elf.half(42);
+    uint16_t phnum = elf.half(44);
+    if (phnum == 0)
+        throw ParseError("ELF file has no program headers");
+    if (phentsize < ELF_PHDR_SIZE)
+        throw ParseError("Invalid program header size in ELF file");
+
+    FirmwareImage image;
+    for (uint16_t i = 0; i < phnum; i++) {
+        size_t ph = phoff + size_t(i) * phentsize;
+
+        if (elf.word(ph) != ELF_PT_LOAD)
+            continue;
+
+        uint32_t offset = elf.word(ph + 4);
+        uint32_t paddr = elf.word(ph + 12);
+        uint32_t filesz = elf.word(ph + 16);
+
+        if (filesz == 0)
+            continue;
+        if (machine == ELF_EM_AVR && paddr >= AVR_FLASH_END) {
+            USBPROG_DEBUG_DBG("Skipping AVR segment at 0x%x (not in flash)", paddr);
+            continue;
+        }
+
+        elf.check(offset, filesz);
+        image.addData(paddr, &data[offset], filesz);
+    }
+
+    return image;
+}
+
+/* }}} */
+/* MemorySegment {{{ */
+
+MemorySegment::MemorySegment(uint32_t address, const ByteVector &data)
+    : m_address(address)
+    , m_data(data)
+{}
+
+uint32_t MemorySegment::getAddress() const
+{
+    return m_address;
+}
+
+uint32_t MemorySegment::getEndAddress() const
+{
+    return m_address + m_data.size();
+}
+
+const ByteVector &MemorySegment::getData() const
+{
+    return m_data;
+}
+
+ByteVector &MemorySegment::getData()
+{
+    return m_data;
+}
+
+/* }}} */
+/* FirmwareImage {{{ */
+
+static bool segment_address_less(uint32_t address, const MemorySegment &segment)
+{
+    return address < segment.getAddress();
+}
+
+FirmwareImage::FirmwareImage()
+{}
+
+FirmwareImage::FirmwareImage(const ByteVector &data, uint32_t address)
+{
+    if (!data.empty())
+        addData(address, &data[0], data.size());
+}
+
+void FirmwareImage::addData(uint32_t address, const unsigned char *data, size_t len)
+{
+    if (len == 0)
+        return;
+
+    if (uint64_t(address) + len > 0xffffffffULL)
+        throw ParseError("Firmware data exceeds the 32 bit address space");
+    uint32_t end = address + len;
+
+    // first segment that starts behind the new data
+    MemorySegmentVector::iterator next = std::upper_bound(m_segments.begin(), m_segments.end(),
+                                                          address, segment_address_less);
+
+    if (next != m_segments.end() && end > next->getAddress())
+        throw ParseError("Overlapping data in firmware image");
+
+    if (next != m_segments.begin()) {
+        MemorySegmentVector::iterator prev = next - 1;
+
+        if (prev->getEndAddress() > address)
+            throw ParseError("Overlapping data in firmware image");
+
+        if (prev->getEndAddress() == address) {
+            ByteVector &prevData = prev->getData();
+            prevData.insert(prevData.end(), data, data + len);
+
+            if (next != m_segments.end() && next->getAddress() == end) {
+                prevData.insert(prevData.end(), next->getData().begin(), next->getData().end());
+                m_segments.erase(next);
+            }
+            return;
+        }
+    }
+
+    if (next != m_segments.end() && next->getAddress() == end) {
+        ByteVector merged(data, data + len);
+        merged.insert(merged.end(), next->getData().begin(), next->getData().end());
+        *next = MemorySegment(address, merged);
+        return;
+    }
+
+    m_segments.insert(next, MemorySegment(address, ByteVector(data, data + len)));
+}
+
+const MemorySegmentVector &FirmwareImage::getSegments() const
+{
+    return m_segments;
+}
+
+bool FirmwareImage::empty() const
+{
+    return m_segments.empty();
+}
+
+size_t FirmwareImage::getSize() const
+{
+    size_t size = 0;
+    for (MemorySegmentVector::const_iterator it = m_segments.begin(); it != m_segments.end(); ++it)
+        size += it->getData().size();
+    return size;
+}
+
+std::vector<uint32_t> FirmwareImage::getPageNumbers(size_t pageSize) const
+{
+    std::vector<uint32_t> pages;
+
+    for (MemorySegmentVector::const_iterator it = m_segments.begin(); it != m_segments.end(); ++it) {
+        uint32_t first = it->getAddress() / pageSize;
+        uint32_t last = (it->getEndAddress() - 1) / pageSize;
+
+        for (uint32_t page = first; page <= last; page++)
+            if (pages.empty() || pages.back() != page)
+                pages.push_back(page);
+    }
+
+    return pages;
+}
+
+void FirmwareImage::readPage(uint32_t page, size_t pageSize, unsigned char *buffer) const
+{
+    std::memset(buffer, ERASED_BYTE, pageSize);
+
+    uint64_t pageStart = uint64_t(page) * pageSize;
+    uint64_t pageEnd = pageStart + pageSize;
+
+    // the segment before the first one that starts behind the page start may reach into the page
+    MemorySegmentVector::const_iterator it = std::upper_bound(m_segments.begin(), m_segments.end(),
+                                                              uint32_t(pageStart), segment_address_less);
+    if (it != m_segments.begin())
+        --it;
+
+    for (; it != m_segments.end() && it->getAddress() < pageEnd; ++it) {
+        uint64_t from = std::max<uint64_t>(pageStart, it->getAddress());
+        uint64_t to = std::min<uint64_t>(pageEnd, it->getEndAddress());
+        if (from >= to)
+            continue;
+
+        std::memcpy(buffer + (from - pageStart),
+                    &it->getData()[from - it->getAddress()],
+                    to - from);
+    }
+}
+
+FirmwareImage::Format FirmwareImage::detectFormat(const std::string &filename, const ByteVector &data)
+{
+    std::string::size_type dot = filename.rfind('.');
+    if (dot != std::string::npos) {
+        std::string ext = filename.substr(dot + 1);
+        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+
+        if (ext == "hex" || ext == "ihx" || ext == "ihex")
+            return FMT_IHEX;
+        else if (ext == "srec" || ext == "s19" || ext == "s28" || ext == "s37" || ext == "mot")
+            return FMT_SREC;
+        else if (ext == "elf" || ext == "axf")
+            return FMT_ELF;
+        else if (ext == "bin")
+            return FMT_BINARY;
+    }
+
+    if (data.size() >= 4 && data[0] == 0x7f && data[1] == 'E' && data[2] == 'L' && data[3] == 'F')
+        return FMT_ELF;
+    else if (is_record_line(data, ':', false))
+        return FMT_IHEX;
+    else if (is_record_line(data, 'S', true))
+        return FMT_SREC;
+    else
+        return FMT_BINARY;
+}
+
+FirmwareImage FirmwareImage::parse(const ByteVector &data, Format format)
+{
+    switch (format) {
+        case FMT_IHEX:
+            return parse_ihex(data);
+        case FMT_SREC:
+            return parse_srec(data);
+        case FMT_ELF:
+            return parse_elf(data);
+        case FMT_AUTO:
+        case FMT_BINARY:
+        default:
+            return FirmwareImage(data);
+    }
+}
+
+FirmwareImage FirmwareImage::readFromFile(const std::string &file, Format format)
+{
+    ByteVector data = Fileutil::readBytesFromFile(file);
+
+    if (format == FMT_AUTO)
+        format = detectFormat(file, data);
+
+    USBPROG_DEBUG_DBG("Reading %s as %s", file.c_str(), formatToString(format).c_str());
+
+    try {
+        FirmwareImage image = parse(data, format);
+        if (image.empty())
+            throw ParseError("No data");
+        return image;
+    } catch (const ParseError &err) {
+        throw ParseError(file + " (" + formatToString(format) + "): " + err.what());
+    }
+}
+
+std::string FirmwareImage::formatToString(Format format)
+{
+    switch (format) {
+        case FMT_AUTO:
+            return "auto";
+        case FMT_BINARY:
+            return "binary";
+        case FMT_IHEX:
+            return "Intel HEX";
+        case FMT_SREC:
+            return "Motorola S-record";
+        case FMT_ELF:
+            return "ELF";
+        default:
+            return "unknown";
+    }
+}
+
+bool FirmwareImage::isErased(const unsigned char *buffer, size_t len)
+{
+    const size_t wordSize = sizeof(unsigned long);
+    unsigned long acc = ~0UL;
+    size_t i = 0;
+
+    // no early exit, that keeps the loop vectorizable and a page is only 64 bytes anyway
+    for (; i + wordSize <= len; i += wordSize) {
+        unsigned long word;
+        std::memcpy(&word, buffer + i, wordSize);
+        acc &= word;
+    }
+    for (; i < len; i++)
+        acc &= buffer[i] | ~0xffUL;
+
+    return acc == ~0UL;
+}
+
+/* }}} */
+
+} // end namespace core
+} // end namespace usbprog
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
@@ -0,0 +1,277 @@
+/*
+ * (c) 2007-2010, Bernhard Walle <bernhard@bwalle.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file firmwareimage.h
+ * @ingroup core
+ * @brief Sparse firmware images read from binary, Intel HEX, S-record and ELF files
+ *
+ * The USBprog bootloader only knows about flash pages. This file contains a sparse
+ * representation of a firmware image (a sorted list of memory segments) and the parsers
+ * that create such an image from the usual output formats of the AVR and ARM toolchains,
+ * so that no @c objcopy step is needed before uploading.
+ *
+ * @author Bernhard Walle <bernhard@bwalle.de>
+ */
+
+#ifndef USBPROG_CORE_FIRMWAREIMAGE_H
+#define USBPROG_CORE_FIRMWAREIMAGE_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include <usbprog-core/types.h>
+#include <usbprog-core/error.h>
+
+namespace usbprog {
+namespace core {
+
+/* MemorySegment {{{ */
+
+/**
+ * @brief Contiguous block of firmware bytes at a fixed address
+ *
+ * @author Bernhard Walle <bernhard@bwalle.de>
+ * @ingroup core
+ */
+class MemorySegment {
+public:
+    /**
+     * @brief Constructor
+     *
+     * @param[in] address the start address of the segment
+     * @param[in] data the contents of the segment
+     */
+    MemorySegment(uint32_t address, const ByteVector &data);
+
+public:
+    /**
+     * @brief Returns the start address
+     *
+     * @return the address of the first byte of the segment
+     */
+    uint32_t getAddress() const;
+
+    /**
+     * @brief Returns the end address
+     *
+     * @return the address of the first byte @b after the segment
+     */
+    uint32_t getEndAddress() const;
+
+    /**
+     * @brief Returns the contents
+     *
+     * @return a reference to the bytes of the segment
+     */
+    const ByteVector &getData() const;
+
+    /**
+     * @brief Returns the contents for modification
+     *
+     * @return a reference to the bytes of the segment
+     */
+    ByteVector &getData();
+
+private:
+    uint32_t m_address;
+    ByteVector m_data;
+};
+
+/**
+ * @brief Vector of memory segments
+ *
+ * @ingroup core
+ */
+typedef std::vector<MemorySegment> MemorySegmentVector;
+
+/* }}} */
+/* FirmwareImage {{{ */
+
+/**
+ * @brief Sparse firmware image
+ *
+ * A firmware image consists of a list of non-overlapping memory segments sorted by address.
+ * Adjacent segments are merged. Gaps between the segments are not stored at all, so an
+ * updater can skip the flash pages that don't contain any data.
+ *
+ * Use FirmwareImage::readFromFile() to read an image in one of the supported formats:
+ *
+ * @code
+ * FirmwareImage image = FirmwareImage::readFromFile("blinkdemo.hex");
+ * updater.writeFirmware(image);
+ * @endcode
+ *
+ * @author Bernhard Walle <bernhard@bwalle.de>
+ * @ingroup core
+ */
+class FirmwareImage {
+public:
+    /**
+     * @brief Supported file formats
+     */
+    enum Format {
+        FMT_AUTO,       /**< detect the format from the file name and the contents */
+        FMT_BINARY,     /**< raw binary, loaded at address 0 */
+        FMT_IHEX,       /**< Intel HEX (I8HEX, I16HEX and I32HEX) */
+        FMT_SREC,       /**< Motorola S-record (S19, S28 and S37) */
+        FMT_ELF         /**< ELF32 executable for AVR or ARM */
+    };
+
+    /**
+     * @brief Value of a flash byte that has not been programmed
+     */
+    static const unsigned char ERASED_BYTE = 0xff;
+
+public:
+    /**
+     * @brief Creates an empty image
+     */
+    FirmwareImage();
+
+    /**
+     * @brief Creates an image from a raw binary
+     *
+     * @param[in] data the bytes of the binary
+     * @param[in] address the load address of the first byte
+     */
+    FirmwareImage(const ByteVector &data, uint32_t address = 0);
+
+public:
+    /**
+     * @brief Adds data to the image
+     *
+     * @param[in] address the load address of the first byte
+     * @param[in] data pointer to @p len bytes
+     * @param[in] len the number of bytes in @p data
+     * @exception ParseError if the new data overlaps with data already in the image or
+     *            exceeds the 32 bit address space
+     */
+    void addData(uint32_t address, const unsigned char *data, size_t len);
+
+    /**
+     * @brief Returns the memory segments
+     *
+     * @return the segments, sorted by address and not overlapping
+     */
+    const MemorySegmentVector &getSegments() const;
+
+    /**
+     * @brief Checks if the image contains any data
+     *
+     * @return @c true if there are no segments, @c false otherwise
+     */
+    bool empty() const;
+
+    /**
+     * @brief Returns the number of data bytes
+     *
+     * Gaps between the segments are not counted.
+     *
+     * @return the sum of the segment sizes
+     */
+    size_t getSize() const;
+
+    /**
+     * @brief Returns the pages that contain data
+     *
+     * @param[in] pageSize the page size in bytes
+     * @return the sorted page numbers (address / @p pageSize) that contain at least one byte of
+     *         the image
+     */
+    std::vector<uint32_t> getPageNumbers(size_t pageSize) const;
+
+    /**
+     * @brief Copies a page into a buffer
+     *
+     * Bytes that are not covered by a segment are filled with ERASED_BYTE.
+     *
+     * @param[in] page the page number
+     * @param[in] pageSize the page size in bytes
+     * @param[out] buffer a buffer of at least @p pageSize bytes
+     */
+    void readPage(uint32_t page, size_t pageSize, unsigned char *buffer) const;
+
+public:
+    /**
+     * @brief Guesses the format of a file
+     *
+     * The file name extension is checked first (@c .hex, @c .ihx, @c .srec, @c .s19, @c .mot,
+     * @c .elf, ...). If that doesn't help, the contents are checked for the ELF magic or the
+     * record start characters of Intel HEX and S-record files. Everything else is treated as
+     * raw binary.
+     *
+     * @param[in] filename the file name, only the extension is used
+     * @param[in] data the contents of the file
+     * @return the detected format, never FMT_AUTO
+     */
+    static Format detectFormat(const std::string &filename, const ByteVector &data);
+
+    /**
+     * @brief Parses a firmware image from memory
+     *
+     * @param[in] data the contents of the file
+     * @param[in] format the format of @p data; FMT_AUTO is treated like FMT_BINARY because there's
+     *            no file name
+     * @return the parsed image
+     * @exception ParseError if @p data is not valid in @p format
+     */
+    static FirmwareImage parse(const ByteVector &data, Format format);
+
+    /**
+     * @brief Reads a firmware image from a file
+     *
+     * @param[in] file the path of the file
+     * @param[in] format the format of the file or FMT_AUTO to use detectFormat()
+     * @return the parsed image
+     * @exception IOError if the file could not be read
+     * @exception ParseError if the contents of the file are invalid
+     */
+    static FirmwareImage readFromFile(const std::string &file, Format format = FMT_AUTO);
+
+    /**
+     * @brief Returns a human-readable name of @p format
+     *
+     * @param[in] format the format
+     * @return the name, e.g. "Intel HEX"
+     */
+    static std::string formatToString(Format format);
+
+    /**
+     * @brief Checks if a buffer contains only erased bytes
+     *
+     * The check is done word by word so that the compiler can vectorize it.
+     *
+     * @param[in] buffer the buffer to check
+     * @param[in] len the number of bytes in @p buffer
+     * @return @c true if all bytes of @p buffer are ERASED_BYTE, @c false otherwise
+     */
+    static bool isErased(const unsigned char *buffer, size_t len);
+
+private:
+    MemorySegmentVector m_segments;
+};
+
+/* }}} */
+
+} // end namespace core
+} // end namespace usbprog
+
+#endif /* USBPROG_CORE_FIRMWAREIMAGE_H */
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
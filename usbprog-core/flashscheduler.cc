@@ -0,0 +1,389 @@
+/*
+ * (c) 2010, Bernhard Walle <bernhard@bwalle.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string>
+#include <sstream>
+#include <vector>
+#include <deque>
+#include <map>
+#include <algorithm>
+
+#include <usbpp/usbpp.h>
+#include <usbpp/clock.h>
+
+#include <usbprog-core/flashscheduler.h>
+#include <usbprog-core/progressnotifier.h>
+#include <usbprog-core/thread.h>
+#include <usbprog-core/tracer.h>
+#include <usbprog-core/debug.h>
+
+namespace usbprog {
+namespace core {
+
+/* FlashQueue {{{ */
+
+// the jobs of all controllers, shared by the FlashWorker threads
+class FlashQueue
+{
+public:
+    FlashQueue(FlashScheduler *scheduler);
+
+    // executes jobs until there's no job that can be started any more
+    void work(size_t home);
+
+    size_t getNumberOfControllers() const
+    {
+        return m_controllers.size();
+    }
+
+    // sleeps if the controller has exceeded its bandwidth
+    void throttle(size_t controller, double bytes);
+
+private:
+    bool take(size_t home, size_t &controller, size_t &job);
+    void finish(size_t controller);
+    void execute(size_t controller, size_t job);
+
+private:
+    struct Controller {
+        std::string name;
+        std::deque<size_t> jobs;
+        size_t active;
+        double tokens;
+        unsigned long long lastRefill;
+    };
+
+    FlashScheduler *m_scheduler;
+    std::vector<Controller> m_controllers;
+    Mutex m_mutex;
+};
+
+// reports the progress of an upload to the bandwidth limit of the controller; the progress
+// counts the data bytes, but each page is preceded by a command message of the same size
+class ThrottlingNotifier : public ProgressNotifier
+{
+public:
+    ThrottlingNotifier(FlashQueue *queue, size_t controller)
+        : m_queue(queue)
+        , m_controller(controller)
+        , m_last(0)
+    {}
+
+    int progressed(double, double now)
+    {
+        m_queue->throttle(m_controller, 2 * (now - m_last));
+        m_last = now;
+        return true;
+    }
+
+    void finished()
+    {}
+
+private:
+    FlashQueue *m_queue;
+    size_t m_controller;
+    double m_last;
+};
+
+FlashQueue::FlashQueue(FlashScheduler *scheduler)
+    : m_scheduler(scheduler)
+{
+    std::map<std::string, size_t> controllerNumbers;
+
+    for (size_t i = 0; i < scheduler->m_jobs.size(); ++i) {
+        std::string name = FlashScheduler::getController(scheduler->m_jobs[i].device);
+
+        std::map<std::string, size_t>::const_iterator it = controllerNumbers.find(name);
+        if (it == controllerNumbers.end()) {
+            Controller controller;
+            controller.name = name;
+            controller.active = 0;
+            controller.tokens = 0;
+            controller.lastRefill = usb::usbpp_now_us();
+
+            it = controllerNumbers.insert(std::make_pair(name, m_controllers.size())).first;
+            m_controllers.push_back(controller);
+        }
+
+        m_controllers[it->second].jobs.push_back(i);
+    }
+}
+
+void FlashQueue::work(size_t home)
+{
+    size_t controller = home;
+    size_t job;
+
+    while (take(home, controller, job)) {
+        execute(controller, job);
+        finish(controller);
+    }
+}
+
+bool FlashQueue::take(size_t home, size_t &controller, size_t &job)
+{
+    MutexLocker locker(&m_mutex);
+
+    // the controller of the last job first, then the own one, then steal from the others
+    size_t n = m_controllers.size();
+    for (size_t i = 0; i <= n; ++i) {
+        size_t candidate = i == 0 ? controller : (home + i - 1) % n;
+        Controller &c = m_controllers[candidate];
+
+        if (!c.jobs.empty() && c.active < m_scheduler->m_maxJobsPerController) {
+            if (candidate != home && candidate != controller)
+                USBPROG_DEBUG_TRACE("Stealing job from controller %s", c.name.c_str());
+
+            job = c.jobs.front();
+            c.jobs.pop_front();
+            c.active++;
+            controller = candidate;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void FlashQueue::finish(size_t controller)
+{
+    MutexLocker locker(&m_mutex);
+    m_controllers[controller].active--;
+}
+
+void FlashQueue::execute(size_t controller, size_t job)
+{
+    FlashScheduler::Job &j = m_scheduler->m_jobs[job];
+    ThrottlingNotifier throttlingNotifier(this, controller);
+
+    TraceSpan span("FlashScheduler::job");
+    if (span.isEnabled()) {
+        span.addArg("location", j.device->getLocation());
+        span.addArg("controller", m_controllers[controller].name);
+    }
+
+    USBPROG_DEBUG_DBG("Uploading to %s on controller %s", j.device->getLocation().c_str(),
+                      m_controllers[controller].name.c_str());
+
+    unsigned long long start = usb::usbpp_now_us();
+    try {
+        UsbprogUpdater updater(j.device);
+        if (m_scheduler->m_bandwidthPerController > 0)
+            updater.setProgress(&throttlingNotifier);
+        updater.setSkipErasedPages(m_scheduler->m_skipErasedPages);
+        updater.setTransferPolicy(m_scheduler->m_transferPolicy);
+
+        updater.updateOpen();
+        if (j.stream)
+            updater.writePageStream(*j.stream);
+        else
+            updater.writeFirmware(*j.image);
+        if (m_scheduler->m_startDevices)
+            updater.startDevice();
+        updater.updateClose();
+    } catch (const IOError &err) {
+        j.error = err.what();
+        span.addArg("error", j.error);
+    }
+    j.duration = (usb::usbpp_now_us() - start) / 1000;
+}
+
+void FlashQueue::throttle(size_t controller, double bytes)
+{
+    double bytesPerSecond = m_scheduler->m_bandwidthPerController;
+    double wait;
+
+    {
+        MutexLocker locker(&m_mutex);
+        Controller &c = m_controllers[controller];
+
+        // token bucket that allows bursts of 100 ms
+        unsigned long long now = usb::usbpp_now_us();
+        c.tokens = std::min(bytesPerSecond / 10, c.tokens + (now - c.lastRefill) * bytesPerSecond / 1000000);
+        c.lastRefill = now;
+        c.tokens -= bytes;
+        wait = c.tokens < 0 ? -c.tokens * 1000000 / bytesPerSecond : 0;
+    }
+
+    if (wait > 0)
+        usb::usbpp_usleep(static_cast<unsigned long long>(wait));
+}
+
+/* }}} */
+/* FlashWorker {{{ */
+
+class FlashWorker : public Thread
+{
+public:
+    FlashWorker(FlashQueue *queue, size_t home)
+        : m_queue(queue)
+        , m_home(home)
+    {}
+
+protected:
+    void run()
+    {
+        m_queue->work(m_home);
+    }
+
+private:
+    FlashQueue *m_queue;
+    size_t m_home;
+};
+
+/* }}} */
+/* FlashScheduler {{{ */
+
+FlashScheduler::FlashScheduler()
+    : m_maxThreads(16)
+    , m_maxJobsPerController(4)
+    , m_bandwidthPerController(0)
+    , m_skipErasedPages(false)
+    , m_startDevices(true)
+    , m_transferPolicy(NULL)
+{}
+
+FlashScheduler::~FlashScheduler()
+{}
+
+void FlashScheduler::setMaxThreads(size_t threads)
+{
+    m_maxThreads = threads;
+}
+
+void FlashScheduler::setMaxJobsPerController(size_t jobs)
+{
+    m_maxJobsPerController = std::max(jobs, size_t(1));
+}
+
+void FlashScheduler::setBandwidthPerController(unsigned long bytesPerSecond)
+{
+    m_bandwidthPerController = bytesPerSecond;
+}
+
+void FlashScheduler::setSkipErasedPages(bool skip)
+{
+    m_skipErasedPages = skip;
+}
+
+void FlashScheduler::setStartDevices(bool start)
+{
+    m_startDevices = start;
+}
+
+void FlashScheduler::setTransferPolicy(TransferPolicy *policy)
+{
+    m_transferPolicy = policy;
+}
+
+void FlashScheduler::addJob(Device *device, const FirmwareImage *image)
+{
+    Job job;
+    job.device = device;
+    job.image = image;
+    job.stream = NULL;
+    job.duration = 0;
+    m_jobs.push_back(job);
+}
+
+void FlashScheduler::addJob(Device *device, const PageStream *stream)
+{
+    Job job;
+    job.device = device;
+    job.image = NULL;
+    job.stream = stream;
+    job.duration = 0;
+    m_jobs.push_back(job);
+}
+
+bool FlashScheduler::run()
+{
+    if (m_jobs.empty())
+        return true;
+
+    FlashQueue queue(this);
+
+    // a trace has exactly one order of operations
+    size_t numberOfThreads = std::min(m_maxThreads, m_jobs.size());
+    usb::UsbManager &usbManager = usb::UsbManager::instance();
+    if (usbManager.isRecording() || usbManager.isReplaying())
+        numberOfThreads = 1;
+
+    USBPROG_DEBUG_DBG("Uploading to %d devices on %d controllers with %d threads",
+                      int(m_jobs.size()), int(queue.getNumberOfControllers()), int(numberOfThreads));
+
+    // the calling thread is one of the workers, the homes are distributed round-robin
+    std::vector<FlashWorker *> workers;
+    try {
+        for (size_t i = 1; i < numberOfThreads; ++i) {
+            workers.push_back(new FlashWorker(&queue, i % queue.getNumberOfControllers()));
+            workers.back()->start();
+        }
+    } catch (const ApplicationError &err) {
+        USBPROG_DEBUG_DBG("%s, continuing with %d threads", err.what(), int(workers.size()) + 1);
+    }
+
+    queue.work(0);
+
+    // join before deleting, ~Thread() would run after the vtable of the worker is gone
+    for (std::vector<FlashWorker *>::iterator it = workers.begin(); it != workers.end(); ++it) {
+        (*it)->join();
+        delete *it;
+    }
+
+    for (std::vector<Job>::const_iterator it = m_jobs.begin(); it != m_jobs.end(); ++it)
+        if (!it->error.empty())
+            return false;
+    return true;
+}
+
+size_t FlashScheduler::getNumberOfJobs() const
+{
+    return m_jobs.size();
+}
+
+Device *FlashScheduler::getDevice(size_t job) const
+{
+    return m_jobs[job].device;
+}
+
+std::string FlashScheduler::getError(size_t job) const
+{
+    return m_jobs[job].error;
+}
+
+unsigned long FlashScheduler::getDuration(size_t job) const
+{
+    return m_jobs[job].duration;
+}
+
+std::string FlashScheduler::getController(const Device *device)
+{
+    std::string portPath = device->getPortPath();
+    if (!portPath.empty())
+        return portPath.substr(0, portPath.find('-'));
+
+    std::stringstream ss;
+    ss << device->getBusNumber();
+    return ss.str();
+}
+
+/* }}} */
+
+} // end namespace core
+} // end namespace usbprog
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
@@ -0,0 +1,225 @@
+/*
+ * (c) 2010, Bernhard Walle <bernhard@bwalle.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file flashscheduler.h
+ * @brief Uploads firmware to many devices at the same time
+ *
+ * @author Bernhard Walle <bernhard@bwalle.de>
+ * @ingroup core
+ */
+
+#ifndef USBPROG_FLASHSCHEDULER_H
+#define USBPROG_FLASHSCHEDULER_H
+
+#include <string>
+#include <vector>
+
+#include <usbprog-core/devices.h>
+#include <usbprog-core/firmwareimage.h>
+
+namespace usbprog {
+namespace core {
+
+/* FlashScheduler {{{ */
+
+/**
+ * @brief Uploads firmware to many devices at the same time
+ *
+ * All devices behind one USB host controller share its bandwidth. Uploading to too many
+ * devices of a controller at the same time leads to timeouts of the bulk transfers, so the
+ * scheduler groups the jobs by controller (the bus number, which is the first component
+ * of the port path) and limits the number of concurrent uploads and the bandwidth per
+ * controller.
+ *
+ * Each worker thread prefers the controller it has worked on before, then its own
+ * controller. If neither has work or free capacity, it steals a job from another
+ * controller that has capacity left. That way, idle controllers don't keep threads
+ * waiting while others still have queued jobs.
+ *
+ * All devices must be in update mode. While USB traces are recorded or replayed, the jobs
+ * are executed one after another.
+ *
+ * @author Bernhard Walle <bernhard@bwalle.de>
+ * @ingroup core
+ */
+class FlashScheduler
+{
+public:
+    /**
+     * @brief Constructor
+     *
+     * Creates a scheduler without jobs, with 16 threads, 4 concurrent uploads per controller
+     * and without bandwidth limit.
+     */
+    FlashScheduler();
+
+    /**
+     * @brief Destructor
+     */
+    virtual ~FlashScheduler();
+
+public:
+    /**
+     * @brief Sets the maximum number of threads
+     *
+     * @param[in] threads the number of uploads that run at the same time in total
+     */
+    void setMaxThreads(size_t threads);
+
+    /**
+     * @brief Sets the maximum number of concurrent uploads per host controller
+     *
+     * @param[in] jobs the number of uploads, at least 1
+     */
+    void setMaxJobsPerController(size_t jobs);
+
+    /**
+     * @brief Sets the bandwidth limit per host controller
+     *
+     * The limit is shared by all uploads of a controller and is enforced after each page. Both
+     * the command message and the data message of a page count against it.
+     *
+     * @param[in] bytesPerSecond the maximum number of bytes per second, 0 for no limit
+     */
+    void setBandwidthPerController(unsigned long bytesPerSecond);
+
+    /**
+     * @brief Sets whether erased pages should be skipped
+     *
+     * @param[in] skip see UsbprogUpdater::setSkipErasedPages()
+     */
+    void setSkipErasedPages(bool skip);
+
+    /**
+     * @brief Sets whether the firmware should be started after the upload
+     *
+     * @param[in] start @c true if the devices should be switched to firmware mode after the
+     *            upload (which is the default), @c false otherwise
+     */
+    void setStartDevices(bool start);
+
+    /**
+     * @brief Sets the policy for timeouts and retries
+     *
+     * @param[in] policy the policy that is shared by all uploads, see
+     *            UsbprogUpdater::setTransferPolicy(). The policy is still owned by the caller.
+     *            @c NULL means that each upload uses its own policy, which is the default.
+     */
+    void setTransferPolicy(TransferPolicy *policy);
+
+    /**
+     * @brief Adds an upload
+     *
+     * @param[in] device the device in update mode, still owned by the caller
+     * @param[in] image the firmware. The image is referenced, so it must be valid until
+     *            run() has returned.
+     */
+    void addJob(Device *device, const FirmwareImage *image);
+
+    /**
+     * @brief Adds an upload of precomputed messages
+     *
+     * setSkipErasedPages() has no effect on that job, see UsbprogUpdater::writePageStream().
+     *
+     * @param[in] device the device in update mode, still owned by the caller
+     * @param[in] stream the messages. The stream is referenced, so it must be valid until
+     *            run() has returned. Many jobs can share one stream.
+     */
+    void addJob(Device *device, const PageStream *stream);
+
+    /**
+     * @brief Executes all jobs
+     *
+     * Blocks until all uploads have finished. Failed uploads don't stop the others.
+     *
+     * @return @c true if all uploads were successful, @c false otherwise
+     */
+    bool run();
+
+    /**
+     * @brief Returns the number of jobs
+     *
+     * @return the number of jobs added with addJob()
+     */
+    size_t getNumberOfJobs() const;
+
+    /**
+     * @brief Returns the device of a job
+     *
+     * @param[in] job the number of the job in the order of addJob()
+     * @return the device
+     */
+    Device *getDevice(size_t job) const;
+
+    /**
+     * @brief Returns the error message of a job
+     *
+     * @param[in] job the number of the job in the order of addJob()
+     * @return the error message, an empty string if the upload has been successful
+     */
+    std::string getError(size_t job) const;
+
+    /**
+     * @brief Returns how long a job took
+     *
+     * @param[in] job the number of the job in the order of addJob()
+     * @return the time between opening and closing the device in milliseconds
+     */
+    unsigned long getDuration(size_t job) const;
+
+    /**
+     * @brief Returns the host controller of a device
+     *
+     * @param[in] device the device
+     * @return the name of the host controller, i.e. the bus number
+     */
+    static std::string getController(const Device *device);
+
+private:
+    // noncopyable
+    FlashScheduler(const FlashScheduler &other);
+    FlashScheduler &operator=(const FlashScheduler &other);
+
+private:
+    // the result is written by the worker thread that executes the job
+    struct Job {
+        Device *device;
+        const FirmwareImage *image;
+        const PageStream *stream;
+        std::string error;
+        unsigned long duration;
+    };
+    friend class FlashQueue;
+
+    std::vector<Job> m_jobs;
+    size_t m_maxThreads;
+    size_t m_maxJobsPerController;
+    unsigned long m_bandwidthPerController;
+    bool m_skipErasedPages;
+    bool m_startDevices;
+    TransferPolicy *m_transferPolicy;
+};
+
+/* }}} */
+
+} // end namespace core
+} // end namespace usbprog
+
+#endif /* USBPROG_FLASHSCHEDULER_H */
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
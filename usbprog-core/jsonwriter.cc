@@ -0,0 +1,133 @@
+/*
+ * (c) 2010, Bernhard Walle <bernhard@bwalle.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <sstream>
+#include <iomanip>
+
+#include <usbprog-core/jsonwriter.h>
+#include <usbprog-core/stringutil.h>
+#include <usbprog-core/thread.h>
+
+namespace usbprog {
+namespace core {
+
+/* Helpers {{{ */
+
+// serializes the lines of all writers
+static Mutex s_outputMutex;
+
+template <typename T>
+static std::string to_string(T value)
+{
+    std::ostringstream ss;
+    ss << value;
+    return ss.str();
+}
+
+/* }}} */
+/* JsonWriter {{{ */
+
+JsonWriter::JsonWriter(std::ostream &os)
+    : m_os(os)
+{}
+
+JsonWriter &JsonWriter::begin(const std::string &type)
+{
+    m_record = "{\"type\":" + json_string(type);
+    return *this;
+}
+
+JsonWriter &JsonWriter::add(const std::string &key, const std::string &value)
+{
+    return addRaw(key, json_string(value));
+}
+
+JsonWriter &JsonWriter::add(const std::string &key, const char *value)
+{
+    return addRaw(key, value ? json_string(value) : std::string("null"));
+}
+
+JsonWriter &JsonWriter::add(const std::string &key, bool value)
+{
+    return addRaw(key, value ? "true" : "false");
+}
+
+JsonWriter &JsonWriter::add(const std::string &key, int value)
+{
+    return addRaw(key, to_string(value));
+}
+
+JsonWriter &JsonWriter::add(const std::string &key, unsigned int value)
+{
+    return addRaw(key, to_string(value));
+}
+
+JsonWriter &JsonWriter::add(const std::string &key, long value)
+{
+    return addRaw(key, to_string(value));
+}
+
+JsonWriter &JsonWriter::add(const std::string &key, unsigned long value)
+{
+    return addRaw(key, to_string(value));
+}
+
+JsonWriter &JsonWriter::add(const std::string &key, long long value)
+{
+    return addRaw(key, to_string(value));
+}
+
+JsonWriter &JsonWriter::add(const std::string &key, unsigned long long value)
+{
+    return addRaw(key, to_string(value));
+}
+
+JsonWriter &JsonWriter::add(const std::string &key, double value)
+{
+    // NaN is the only value that is not equal to itself
+    if (value != value || value - value != 0)
+        return addRaw(key, "null");
+
+    std::ostringstream ss;
+    ss << std::setprecision(15) << value;
+    return addRaw(key, ss.str());
+}
+
+JsonWriter &JsonWriter::addRaw(const std::string &key, const std::string &value)
+{
+    m_record += "," + json_string(key) + ":" + value;
+    return *this;
+}
+
+void JsonWriter::end()
+{
+    if (m_record.empty())
+        return;
+
+    m_record += "}\n";
+    {
+        MutexLocker locker(&s_outputMutex);
+        m_os << m_record << std::flush;
+    }
+    m_record.clear();
+}
+
+/* }}} */
+
+} // end namespace core
+} // end namespace usbprog
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
@@ -0,0 +1,168 @@
+/*
+ * (c) 2010, Bernhard Walle <bernhard@bwalle.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file jsonwriter.h
+ * @brief Streaming output of JSON records
+ *
+ * @author Bernhard Walle <bernhard@bwalle.de>
+ * @ingroup core
+ */
+
+#ifndef USBPROG_JSONWRITER_H
+#define USBPROG_JSONWRITER_H
+
+#include <string>
+#include <ostream>
+
+namespace usbprog {
+namespace core {
+
+/* JsonWriter {{{ */
+
+/**
+ * @brief Writes flat JSON objects, one per line
+ *
+ * Each record is a JSON object on its own line (<em>JSON Lines</em>) with a @c "type" member
+ * that tells the reader how to interpret the other members. The line is written with a single
+ * write and flushed when end() is called, so a reader on a pipe sees each record as soon as it
+ * is complete, and records of different threads that write to the same stream don't get mixed.
+ *
+ * @code
+ * JsonWriter json(std::cout);
+ * json.begin("device").add("number", 0).add("update_mode", true).end();
+ * @endcode
+ *
+ * prints
+ *
+ * @code
+ * {"type":"device","number":0,"update_mode":true}
+ * @endcode
+ *
+ * One JsonWriter object must only be used by one thread.
+ *
+ * @author Bernhard Walle <bernhard@bwalle.de>
+ * @ingroup core
+ */
+class JsonWriter
+{
+public:
+    /**
+     * @brief Constructor
+     *
+     * @param[in] os the stream to which the records are written
+     */
+    JsonWriter(std::ostream &os);
+
+public:
+    /**
+     * @brief Starts a new record
+     *
+     * A record that has not been ended is discarded.
+     *
+     * @param[in] type the value of the @c "type" member
+     * @return the writer itself
+     */
+    JsonWriter &begin(const std::string &type);
+
+    /**
+     * @brief Adds a string member
+     *
+     * @param[in] key the name of the member
+     * @param[in] value the value that is quoted
+     * @return the writer itself
+     */
+    JsonWriter &add(const std::string &key, const std::string &value);
+
+    /// @copydoc add(const std::string &, const std::string &)
+    JsonWriter &add(const std::string &key, const char *value);
+
+    /**
+     * @brief Adds a boolean member
+     *
+     * @param[in] key the name of the member
+     * @param[in] value the value
+     * @return the writer itself
+     */
+    JsonWriter &add(const std::string &key, bool value);
+
+    /**
+     * @brief Adds a numeric member
+     *
+     * @param[in] key the name of the member
+     * @param[in] value the value
+     * @return the writer itself
+     */
+    JsonWriter &add(const std::string &key, int value);
+
+    /// @copydoc add(const std::string &, int)
+    JsonWriter &add(const std::string &key, unsigned int value);
+
+    /// @copydoc add(const std::string &, int)
+    JsonWriter &add(const std::string &key, long value);
+
+    /// @copydoc add(const std::string &, int)
+    JsonWriter &add(const std::string &key, unsigned long value);
+
+    /// @copydoc add(const std::string &, int)
+    JsonWriter &add(const std::string &key, long long value);
+
+    /// @copydoc add(const std::string &, int)
+    JsonWriter &add(const std::string &key, unsigned long long value);
+
+    /**
+     * @brief Adds a floating-point member
+     *
+     * Infinity and NaN are written as @c null.
+     *
+     * @param[in] key the name of the member
+     * @param[in] value the value
+     * @return the writer itself
+     */
+    JsonWriter &add(const std::string &key, double value);
+
+    /**
+     * @brief Writes the record
+     *
+     * The line is written and flushed while holding a lock that is shared by all JsonWriter
+     * objects.
+     */
+    void end();
+
+protected:
+    /**
+     * @brief Adds a member whose value is already formatted
+     *
+     * @param[in] key the name of the member
+     * @param[in] value the JSON representation of the value
+     * @return the writer itself
+     */
+    JsonWriter &addRaw(const std::string &key, const std::string &value);
+
+private:
+    std::ostream &m_os;
+    std::string m_record;
+};
+
+/* }}} */
+
+} // end namespace core
+} // end namespace usbprog
+
+#endif /* USBPROG_JSONWRITER_H */
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
@@ -0,0 +1,142 @@
+/*
+ * (c) 2010, Bernhard Walle <bernhard@bwalle.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <cstring>
+
+#include <usbprog-core/logbuffer.h>
+
+namespace usbprog {
+namespace core {
+
+/* Helpers {{{ */
+
+// difference of two positions, correct even if the counter has wrapped around
+static long distance(long a, long b)
+{
+    return static_cast<long>(static_cast<unsigned long>(a) - static_cast<unsigned long>(b));
+}
+
+/* }}} */
+/* LogBuffer {{{ */
+
+const size_t LogBuffer::ENTRY_SIZE;
+
+LogBuffer::LogBuffer(size_t entries)
+    : m_entries(NULL)
+    , m_size(2)
+{
+    // with a power of two, the index stays continuous when the positions wrap around
+    while (m_size < entries)
+        m_size *= 2;
+
+    m_entries = new Entry[m_size];
+    for (size_t i = 0; i < m_size; ++i)
+        m_entries[i].sequence.set(i);
+}
+
+LogBuffer::~LogBuffer()
+{
+    delete[] m_entries;
+}
+
+bool LogBuffer::push(const char *text, size_t length, bool overwrite)
+{
+    Entry *entry;
+    long position = m_head.get();
+
+    for (;;) {
+        entry = &m_entries[static_cast<unsigned long>(position) & (m_size - 1)];
+        long diff = distance(entry->sequence.get(), position);
+
+        if (diff == 0) {
+            if (m_head.compareAndSet(position, position + 1))
+                break;
+            position = m_head.get();
+        } else if (diff < 0) {
+            // full: the entry still contains the message of the previous round
+            size_t discarded;
+            if (!overwrite) {
+                m_dropped.add(1);
+                return false;
+            }
+            take(NULL, discarded);
+            position = m_head.get();
+        } else
+            position = m_head.get();
+    }
+
+    entry->length = std::min(length, ENTRY_SIZE);
+    std::memcpy(entry->text, text, entry->length);
+    entry->sequence.set(position + 1);
+
+    return true;
+}
+
+size_t LogBuffer::pop(char *buffer)
+{
+    size_t length;
+    if (!take(buffer, length))
+        return 0;
+
+    return length;
+}
+
+bool LogBuffer::take(char *buffer, size_t &length)
+{
+    Entry *entry;
+    long position = m_tail.get();
+
+    for (;;) {
+        entry = &m_entries[static_cast<unsigned long>(position) & (m_size - 1)];
+        long diff = distance(entry->sequence.get(), position + 1);
+
+        if (diff == 0) {
+            if (m_tail.compareAndSet(position, position + 1))
+                break;
+            position = m_tail.get();
+        } else if (diff < 0)
+            return false;
+        else
+            position = m_tail.get();
+    }
+
+    length = entry->length;
+    if (buffer)
+        std::memcpy(buffer, entry->text, length);
+    entry->sequence.set(position + m_size);
+
+    return true;
+}
+
+unsigned long LogBuffer::takeDropped()
+{
+    long dropped = m_dropped.get();
+    m_dropped.add(-dropped);
+    return dropped;
+}
+
+size_t LogBuffer::capacity() const
+{
+    return m_size;
+}
+
+/* }}} */
+
+} // end namespace core
+} // end namespace usbprog
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
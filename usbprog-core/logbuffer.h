@@ -0,0 +1,145 @@
+/*
+ * (c) 2010, Bernhard Walle <bernhard@bwalle.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file logbuffer.h
+ * @brief Ring buffer for log messages
+ *
+ * @author Bernhard Walle <bernhard@bwalle.de>
+ * @ingroup core
+ */
+
+#ifndef USBPROG_LOGBUFFER_H
+#define USBPROG_LOGBUFFER_H
+
+#include <cstddef>
+
+#include <usbprog-core/thread.h>
+
+namespace usbprog {
+namespace core {
+
+/* LogBuffer {{{ */
+
+/**
+ * @brief Bounded queue of log messages without locks
+ *
+ * Any number of threads can push() and pop() at the same time. Each entry has its own
+ * sequence number that tells if it's free or filled, and the positions are claimed with a
+ * compare and swap of an AtomicCounter, so no thread ever waits for a Mutex. The memory for all
+ * entries is allocated in the constructor, a message only gets copied.
+ *
+ * If the buffer is full, push() either drops the new message and counts it (see
+ * takeDropped()) or removes the oldest message, which turns the buffer into a flight recorder
+ * that always contains the last messages.
+ *
+ * @author Bernhard Walle <bernhard@bwalle.de>
+ * @ingroup core
+ */
+class LogBuffer
+{
+public:
+    /// the maximum length of a message in bytes, longer messages are cut
+    static const size_t ENTRY_SIZE = 512;
+
+public:
+    /**
+     * @brief Constructor
+     *
+     * @param[in] entries the number of messages that fit into the buffer, rounded up to a power
+     *            of two
+     */
+    LogBuffer(size_t entries);
+
+    /**
+     * @brief Destructor
+     */
+    virtual ~LogBuffer();
+
+public:
+    /**
+     * @brief Appends a message
+     *
+     * @param[in] text the message, doesn't need to be terminated
+     * @param[in] length the length of @p text, at most ENTRY_SIZE bytes are copied
+     * @param[in] overwrite @c true if the oldest message should be removed if the buffer is
+     *            full, @c false if @p text should be dropped
+     * @return @c true if the message has been stored, @c false if it has been dropped
+     */
+    bool push(const char *text, size_t length, bool overwrite);
+
+    /**
+     * @brief Removes the oldest message
+     *
+     * @param[out] buffer the buffer for the message, must have room for ENTRY_SIZE bytes. The
+     *             message is not terminated.
+     * @return the length of the message, 0 if the buffer is empty
+     */
+    size_t pop(char *buffer);
+
+    /**
+     * @brief Returns the number of dropped messages and resets it
+     *
+     * @return the number of messages that push() has dropped since the last call
+     */
+    unsigned long takeDropped();
+
+    /**
+     * @brief Returns the number of messages that fit into the buffer
+     *
+     * @return the capacity
+     */
+    size_t capacity() const;
+
+protected:
+    /**
+     * @brief Removes the oldest message
+     *
+     * @param[out] buffer the buffer for the message or @c NULL if it should be discarded
+     * @param[out] length the length of the message
+     * @return @c true if a message has been removed, @c false if the buffer is empty
+     */
+    bool take(char *buffer, size_t &length);
+
+private:
+    // noncopyable
+    LogBuffer(const LogBuffer &other);
+    LogBuffer &operator=(const LogBuffer &other);
+
+private:
+    struct Entry {
+        // the position that may write the entry next, plus one if it has been written
+        AtomicCounter   sequence;
+        size_t          length;
+        char            text[ENTRY_SIZE];
+    };
+
+    Entry *m_entries;
+    size_t m_size;
+    AtomicCounter m_head;
+    AtomicCounter m_tail;
+    AtomicCounter m_dropped;
+};
+
+/* }}} */
+
+} // end namespace core
+} // end namespace usbprog
+
+#endif /* USBPROG_LOGBUFFER_H */
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
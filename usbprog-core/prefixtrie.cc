@@ -0,0 +1,125 @@
+/*
+ * (c) 2010, Bernhard Walle <bernhard@bwalle.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+
+#include <usbprog-core/prefixtrie.h>
+
+namespace usbprog {
+namespace core {
+
+/* PrefixTrie {{{ */
+
+PrefixTrie::PrefixTrie()
+{
+    clear();
+}
+
+PrefixTrie::PrefixTrie(const StringVector &words)
+{
+    build(words);
+}
+
+void PrefixTrie::build(const StringVector &words)
+{
+    m_words = words;
+    std::sort(m_words.begin(), m_words.end());
+    m_words.erase(std::unique(m_words.begin(), m_words.end()), m_words.end());
+
+    Node root;
+    root.character = '\0';
+    root.firstChild = 0;
+    root.children = 0;
+    root.first = 0;
+    root.last = m_words.size();
+
+    m_nodes.clear();
+    m_nodes.push_back(root);
+
+    // breadth first, so the children of a node get consecutive indexes; the depth of a node
+    // is the length of the prefix it stands for
+    std::vector<size_t> depths(1, 0);
+    for (size_t i = 0; i < m_nodes.size(); ++i) {
+        size_t depth = depths[i];
+        unsigned int word = m_nodes[i].first;
+        unsigned int last = m_nodes[i].last;
+
+        // the word that ends here is sorted before the longer ones
+        if (word < last && m_words[word].size() == depth)
+            word++;
+
+        m_nodes[i].firstChild = m_nodes.size();
+        while (word < last) {
+            Node child;
+            child.character = m_words[word][depth];
+            child.firstChild = 0;
+            child.children = 0;
+            child.first = word;
+            while (word < last && m_words[word][depth] == child.character)
+                word++;
+            child.last = word;
+
+            m_nodes.push_back(child);
+            depths.push_back(depth + 1);
+            m_nodes[i].children++;
+        }
+    }
+}
+
+void PrefixTrie::clear()
+{
+    build(StringVector());
+}
+
+size_t PrefixTrie::size() const
+{
+    return m_words.size();
+}
+
+PrefixTrie::Range PrefixTrie::find(const std::string &prefix) const
+{
+    const Node *node = &m_nodes[0];
+
+    for (std::string::const_iterator it = prefix.begin(); it != prefix.end(); ++it) {
+        // few children per node, searching linearly is fast enough
+        const Node *child = NULL;
+        for (unsigned int i = node->firstChild; i < node->firstChild + node->children; ++i) {
+            if (m_nodes[i].character == *it) {
+                child = &m_nodes[i];
+                break;
+            }
+        }
+
+        if (!child)
+            return Range(m_words.end(), m_words.end());
+        node = child;
+    }
+
+    return Range(m_words.begin() + node->first, m_words.begin() + node->last);
+}
+
+StringVector PrefixTrie::complete(const std::string &prefix) const
+{
+    Range range = find(prefix);
+    return StringVector(range.first, range.second);
+}
+
+/* }}} */
+
+} // end namespace core
+} // end namespace usbprog
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
@@ -0,0 +1,141 @@
+/*
+ * (c) 2010, Bernhard Walle <bernhard@bwalle.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file prefixtrie.h
+ * @brief Index for the completion of words
+ *
+ * @author Bernhard Walle <bernhard@bwalle.de>
+ * @ingroup core
+ */
+
+#ifndef USBPROG_PREFIXTRIE_H
+#define USBPROG_PREFIXTRIE_H
+
+#include <string>
+#include <vector>
+#include <utility>
+
+#include <usbprog-core/types.h>
+
+namespace usbprog {
+namespace core {
+
+/* PrefixTrie {{{ */
+
+/**
+ * @brief Finds all words that start with a prefix
+ *
+ * The trie is built once with build() and is read-only after that. The words are kept
+ * sorted and each node knows the range of the words below it, so find() only walks the
+ * characters of the prefix and returns that range without allocating memory. That's
+ * independent of the number of words, which matters for the completion in a firmware
+ * index with thousands of entries.
+ *
+ * @code
+ * PrefixTrie trie(words);
+ * PrefixTrie::Range range = trie.find("blink");
+ * for (PrefixTrie::const_iterator it = range.first; it != range.second; ++it)
+ *     std::cout << *it << std::endl;
+ * @endcode
+ *
+ * @author Bernhard Walle <bernhard@bwalle.de>
+ * @ingroup core
+ */
+class PrefixTrie
+{
+public:
+    /// Iterator over the words
+    typedef StringVector::const_iterator const_iterator;
+
+    /// Range of words, sorted
+    typedef std::pair<const_iterator, const_iterator> Range;
+
+public:
+    /**
+     * @brief Creates an empty trie
+     */
+    PrefixTrie();
+
+    /**
+     * @brief Creates a trie
+     *
+     * @param[in] words the words, see build()
+     */
+    PrefixTrie(const StringVector &words);
+
+public:
+    /**
+     * @brief Replaces the words of the trie
+     *
+     * @param[in] words the words in any order, duplicates are removed
+     */
+    void build(const StringVector &words);
+
+    /**
+     * @brief Removes all words
+     */
+    void clear();
+
+    /**
+     * @brief Returns the number of words
+     *
+     * @return the number of different words
+     */
+    size_t size() const;
+
+    /**
+     * @brief Returns all words that start with @p prefix
+     *
+     * Doesn't allocate memory. The range is valid until the trie is modified.
+     *
+     * @param[in] prefix the prefix, the empty string matches all words
+     * @return the sorted range of matching words, empty if no word matches
+     */
+    Range find(const std::string &prefix) const;
+
+    /**
+     * @brief Returns all words that start with @p prefix as vector
+     *
+     * @param[in] prefix the prefix, the empty string matches all words
+     * @return the sorted matching words
+     */
+    StringVector complete(const std::string &prefix) const;
+
+private:
+    struct Node {
+        char            character;
+        unsigned int    firstChild;
+        unsigned int    children;
+        // range in m_words of the words below the node
+        unsigned int    first;
+        unsigned int    last;
+    };
+
+    StringVector m_words;
+    // the children of each node are stored next to each other, sorted by character
+    std::vector<Node> m_nodes;
+};
+
+/* }}} */
+
+} // end namespace core
+} // end namespace usbprog
+
+#endif /* USBPROG_PREFIXTRIE_H */
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
@@ -66,6 +66,18 @@ public:
      */
     virtual int progressed(double total, double now) = 0;
 
+    /**
+     * @brief Gets called with the throughput before progressed()
+     *
+     * Only a ProgressReporter computes the throughput, so the function is not called if the
+     * notifier is passed directly to the operation. The default implementation does nothing.
+     *
+     * @param[in] perSecond the units of progressed() per second, @c 0 if unknown
+     * @param[in] secondsLeft the estimated time until the operation has finished in seconds,
+     *            negative if unknown
+     */
+    virtual void progressedRate(double /* perSecond */, double /* secondsLeft */) {}
+
     /**
      * @brief Gets called once when the operation has finished
      *
@@ -0,0 +1,192 @@
+/*
+ * (c) 2010, Bernhard Walle <bernhard@bwalle.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+
+#include <usbpp/clock.h>
+
+#include <usbprog-core/progressreporter.h>
+#include <usbprog-core/error.h>
+#include <usbprog-core/debug.h>
+
+// the reporter thread checks that often if it should stop, in microseconds
+#define STOP_CHECK_INTERVAL     10000
+
+// weight of the newest sample in the moving average of the throughput
+#define RATE_WEIGHT             0.3
+
+namespace usbprog {
+namespace core {
+
+/* ProgressReporterThread {{{ */
+
+class ProgressReporterThread : public Thread
+{
+public:
+    ProgressReporterThread(ProgressReporter *reporter)
+        : m_reporter(reporter)
+    {}
+
+protected:
+    void run()
+    {
+        unsigned long long interval = m_reporter->m_interval * 1000ULL;
+        unsigned long long next = usb::usbpp_now_us() + interval;
+
+        while (!m_reporter->m_stop.get()) {
+            unsigned long long now = usb::usbpp_now_us();
+            if (now >= next) {
+                m_reporter->sample();
+                next += interval;
+                continue;
+            }
+            usb::usbpp_usleep(std::min<unsigned long long>(next - now, STOP_CHECK_INTERVAL));
+        }
+    }
+
+private:
+    ProgressReporter *m_reporter;
+};
+
+/* }}} */
+/* ProgressReporter {{{ */
+
+ProgressReporter::ProgressReporter(ProgressNotifier *target, unsigned int interval)
+    : m_target(target)
+    , m_interval(std::max(interval, 1U))
+    , m_thread(NULL)
+    , m_reportAll(false)
+    , m_started(false)
+    , m_lastTime(0)
+    , m_lastNow(0)
+    , m_rate(0)
+{}
+
+ProgressReporter::~ProgressReporter()
+{
+    stop();
+}
+
+void ProgressReporter::setReportAll(bool all)
+{
+    m_reportAll = all;
+}
+
+int ProgressReporter::progressed(double total, double now)
+{
+    m_total.set(static_cast<long>(total));
+    m_now.set(static_cast<long>(now));
+
+    if (!m_started) {
+        m_started = true;
+        m_lastTime = usb::usbpp_now_us();
+        m_lastNow = 0;
+        m_rate = 0;
+        m_stop.set(0);
+
+        // the values of an operation that hasn't been finished
+        m_queue.clear();
+
+        m_thread = new ProgressReporterThread(this);
+        try {
+            m_thread->start();
+        } catch (const ApplicationError &err) {
+            USBPROG_DEBUG_DBG("%s, reporting the progress synchronously", err.what());
+            delete m_thread;
+            m_thread = NULL;
+        }
+    }
+
+    if (m_reportAll) {
+        Value value;
+        value.total = static_cast<long>(total);
+        value.now = static_cast<long>(now);
+        value.time = usb::usbpp_now_us();
+
+        MutexLocker locker(&m_queueMutex);
+        m_queue.push_back(value);
+    }
+
+    // without thread, every value is reported
+    if (!m_thread)
+        sample();
+
+    return true;
+}
+
+void ProgressReporter::finished()
+{
+    stop();
+    if (m_started)
+        sample();
+
+    m_started = false;
+    m_target->finished();
+}
+
+void ProgressReporter::stop()
+{
+    if (!m_thread)
+        return;
+
+    m_stop.set(1);
+    m_thread->join();
+    delete m_thread;
+    m_thread = NULL;
+}
+
+void ProgressReporter::sample()
+{
+    if (!m_reportAll) {
+        report(m_total.get(), m_now.get(), usb::usbpp_now_us());
+        return;
+    }
+
+    // report without the lock, so that progressed() never waits for the target
+    std::vector<Value> values;
+    {
+        MutexLocker locker(&m_queueMutex);
+        values.swap(m_queue);
+    }
+
+    for (std::vector<Value>::const_iterator it = values.begin(); it != values.end(); ++it)
+        report(it->total, it->now, it->time);
+}
+
+void ProgressReporter::report(long total, long now, unsigned long long time)
+{
+    if (now == m_lastNow)
+        return;
+
+    if (time > m_lastTime) {
+        double rate = (now - m_lastNow) * 1000000.0 / (time - m_lastTime);
+
+        // the moving average smoothes the bursts of a USB transfer
+        m_rate = m_rate > 0 ? RATE_WEIGHT * rate + (1 - RATE_WEIGHT) * m_rate : rate;
+    }
+    m_lastTime = time;
+    m_lastNow = now;
+
+    m_target->progressedRate(m_rate, m_rate > 0 ? (total - now) / m_rate : -1);
+    m_target->progressed(total, now);
+}
+
+/* }}} */
+
+} // end namespace core
+} // end namespace usbprog
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
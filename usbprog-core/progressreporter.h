@@ -0,0 +1,186 @@
+/*
+ * (c) 2010, Bernhard Walle <bernhard@bwalle.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file progressreporter.h
+ * @brief Reports progress from a separate thread
+ *
+ * @author Bernhard Walle <bernhard@bwalle.de>
+ * @ingroup core
+ */
+
+#ifndef USBPROG_PROGRESSREPORTER_H
+#define USBPROG_PROGRESSREPORTER_H
+
+#include <vector>
+
+#include <usbprog-core/progressnotifier.h>
+#include <usbprog-core/thread.h>
+
+namespace usbprog {
+namespace core {
+
+class ProgressReporterThread;
+
+/* ProgressReporter {{{ */
+
+/**
+ * @brief Decouples the reporting of progress from the operation
+ *
+ * The ProgressReporter is passed to the operation instead of the ProgressNotifier that
+ * displays the progress. progressed() only stores the values in two AtomicCounter objects, so
+ * the operation never waits for the terminal. A reporter thread samples the values in a fixed
+ * interval, computes the throughput and the remaining time and calls
+ * ProgressNotifier::progressedRate() and ProgressNotifier::progressed() of the target if the
+ * value has changed.
+ *
+ * The thread is started with the first progressed() call. finished() stops it, reports the last
+ * value and calls ProgressNotifier::finished() of the target in the calling thread, so no output
+ * of the target appears after the operation has returned. After that, the object can be used
+ * for the next operation.
+ *
+ * Only one thread may call progressed() and finished(). The target must be usable from another
+ * thread, which excludes widgets of a GUI toolkit.
+ *
+ * A target that needs every value, e.g. a machine-readable output, uses setReportAll():
+ * then progressed() queues the values and the reporter thread reports each of them, still
+ * with the throughput.
+ *
+ * @code
+ * HashNotifier hn(DEFAULT_TERMINAL_WIDTH);
+ * ProgressReporter reporter(&hn);
+ * updater.setProgress(&reporter);
+ * updater.writeFirmware(image);
+ * @endcode
+ *
+ * @author Bernhard Walle <bernhard@bwalle.de>
+ * @ingroup core
+ */
+class ProgressReporter : public ProgressNotifier
+{
+    friend class ProgressReporterThread;
+
+public:
+    /**
+     * @brief Constructor
+     *
+     * @param[in] target the notifier that displays the progress (still owned by the caller)
+     * @param[in] interval the interval in which the progress is sampled in milliseconds
+     */
+    ProgressReporter(ProgressNotifier *target, unsigned int interval = 100);
+
+    /**
+     * @brief Destructor
+     *
+     * Stops the reporter thread without calling ProgressNotifier::finished() of the target.
+     */
+    virtual ~ProgressReporter();
+
+public:
+    /**
+     * @brief Reports each value instead of samples
+     *
+     * progressed() appends the value to a queue that the reporter thread drains in each
+     * interval, so the operation still doesn't wait for the target. If the thread cannot be
+     * started, the values are reported in the calling thread. The setting must not be changed
+     * during an operation. The default is @c false.
+     *
+     * @param[in] all @c true if every progressed() call should be reported, @c false if the
+     *            values should be sampled by the reporter thread
+     */
+    void setReportAll(bool all);
+
+    /**
+     * @brief Publishes the progress
+     *
+     * Never blocks, apart from starting the reporter thread with the first call and from
+     * appending to the queue if setReportAll() has been called.
+     *
+     * @param[in] total the total number of bytes
+     * @param[in] now the number of bytes that have been processed
+     * @return always @c true
+     */
+    int progressed(double total, double now);
+
+    /**
+     * @brief Stops the reporter thread and reports the end to the target
+     *
+     * Waits at most 10 ms for the reporter thread.
+     */
+    void finished();
+
+protected:
+    /**
+     * @brief Stops the reporter thread
+     */
+    void stop();
+
+    /**
+     * @brief Samples the progress and reports it if it has changed
+     *
+     * With setReportAll(), reports the queued values instead. Called by the reporter thread
+     * and by finished().
+     */
+    void sample();
+
+    /**
+     * @brief Computes the throughput and calls the target if @p now has changed
+     *
+     * @param[in] total the total number of bytes
+     * @param[in] now the number of bytes that have been processed
+     * @param[in] time the time of the value in microseconds, see usb::usbpp_now_us()
+     */
+    void report(long total, long now, unsigned long long time);
+
+private:
+    // noncopyable
+    ProgressReporter(const ProgressReporter &other);
+    ProgressReporter &operator=(const ProgressReporter &other);
+
+private:
+    struct Value {
+        long total;
+        long now;
+        unsigned long long time;
+    };
+
+private:
+    ProgressNotifier *m_target;
+    unsigned int m_interval;
+    ProgressReporterThread *m_thread;
+    bool m_reportAll;
+    bool m_started;
+    AtomicCounter m_total;
+    AtomicCounter m_now;
+    AtomicCounter m_stop;
+    Mutex m_queueMutex;
+    std::vector<Value> m_queue;
+
+    // only used by the thread that samples
+    unsigned long long m_lastTime;
+    long m_lastNow;
+    double m_rate;
+};
+
+/* }}} */
+
+} // end namespace core
+} // end namespace usbprog
+
+#endif /* USBPROG_PROGRESSREPORTER_H */
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
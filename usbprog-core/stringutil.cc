@@ -204,6 +204,28 @@ bool str_starts_with(const std::string &string, const std::string &start)
     return start.size() == 0 || string.find(start, 0) == 0;
 }
 
+std::string json_string(const std::string &string)
+{
+    std::string ret = "\"";
+    for (std::string::const_iterator it = string.begin(); it != string.end(); ++it) {
+        switch (*it) {
+            case '"':   ret += "\\\""; break;
+            case '\\':  ret += "\\\\"; break;
+            case '\n':  ret += "\\n"; break;
+            case '\r':  ret += "\\r"; break;
+            case '\t':  ret += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(*it) < 0x20) {
+                    char buffer[8];
+                    std::sprintf(buffer, "\\u%04x", *it);
+                    ret += buffer;
+                } else
+                    ret += *it;
+        }
+    }
+    return ret + "\"";
+}
+
 StringVector empty_element_sv()
 {
     StringVector sv;
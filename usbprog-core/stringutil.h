@@ -170,6 +170,18 @@ char **stringvector_to_array(const StringVector &vec);
  */
 bool str_starts_with(const std::string &string, const std::string &start);
 
+/**
+ * @brief Quotes @p string as JSON string
+ *
+ * Quotes, backslashes and control characters are escaped. Other bytes are copied, so UTF-8
+ * stays UTF-8.
+ *
+ * @param[in] string the string to quote
+ * @return the string including the surrounding quotes
+ * @ingroup core
+ */
+std::string json_string(const std::string &string);
+
 /**
  * @brief Returns a string vector that contains one empty string
  *
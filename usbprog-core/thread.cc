@@ -0,0 +1,255 @@
+/*
+ * (c) 2010, Bernhard Walle <bernhard@bwalle.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef _WIN32
+#  include <windows.h>
+#else
+#  include <pthread.h>
+#endif
+
+#include <usbprog-core/thread.h>
+#include <usbprog-core/error.h>
+
+namespace usbprog {
+namespace core {
+
+#ifdef _WIN32
+
+/* Mutex {{{ */
+
+struct MutexPrivate {
+    CRITICAL_SECTION section;
+};
+
+Mutex::Mutex()
+    : m_data(new MutexPrivate)
+{
+    InitializeCriticalSection(&m_data->section);
+}
+
+Mutex::~Mutex()
+{
+    DeleteCriticalSection(&m_data->section);
+    delete m_data;
+}
+
+void Mutex::lock()
+{
+    EnterCriticalSection(&m_data->section);
+}
+
+void Mutex::unlock()
+{
+    LeaveCriticalSection(&m_data->section);
+}
+
+/* }}} */
+/* Thread {{{ */
+
+struct ThreadPrivate {
+    HANDLE handle;
+
+    static void runThread(Thread *thread) { thread->run(); }
+};
+
+static DWORD WINAPI thread_start_routine(LPVOID arg)
+{
+    ThreadPrivate::runThread(static_cast<Thread *>(arg));
+    return 0;
+}
+
+Thread::Thread()
+    : m_data(new ThreadPrivate)
+{
+    m_data->handle = NULL;
+}
+
+void Thread::start()
+{
+    m_data->handle = CreateThread(NULL, 0, thread_start_routine, this, 0, NULL);
+    if (m_data->handle == NULL)
+        throw ApplicationError("Unable to create thread");
+}
+
+void Thread::join()
+{
+    if (m_data->handle == NULL)
+        return;
+
+    WaitForSingleObject(m_data->handle, INFINITE);
+    CloseHandle(m_data->handle);
+    m_data->handle = NULL;
+}
+
+unsigned long Thread::currentId()
+{
+    return GetCurrentThreadId();
+}
+
+/* }}} */
+/* AtomicCounter {{{ */
+
+long AtomicCounter::get() const
+{
+    return InterlockedExchangeAdd(&m_value, 0);
+}
+
+void AtomicCounter::set(long value)
+{
+    InterlockedExchange(&m_value, value);
+}
+
+long AtomicCounter::add(long value)
+{
+    return InterlockedExchangeAdd(&m_value, value) + value;
+}
+
+bool AtomicCounter::compareAndSet(long expected, long value)
+{
+    return InterlockedCompareExchange(&m_value, value, expected) == expected;
+}
+
+/* }}} */
+
+#else
+
+/* Mutex {{{ */
+
+struct MutexPrivate {
+    pthread_mutex_t mutex;
+};
+
+Mutex::Mutex()
+    : m_data(new MutexPrivate)
+{
+    pthread_mutex_init(&m_data->mutex, NULL);
+}
+
+Mutex::~Mutex()
+{
+    pthread_mutex_destroy(&m_data->mutex);
+    delete m_data;
+}
+
+void Mutex::lock()
+{
+    pthread_mutex_lock(&m_data->mutex);
+}
+
+void Mutex::unlock()
+{
+    pthread_mutex_unlock(&m_data->mutex);
+}
+
+/* }}} */
+/* Thread {{{ */
+
+struct ThreadPrivate {
+    pthread_t   thread;
+    bool        running;
+
+    static void runThread(Thread *thread) { thread->run(); }
+};
+
+extern "C" {
+
+static void *thread_start_routine(void *arg)
+{
+    ThreadPrivate::runThread(static_cast<Thread *>(arg));
+    return NULL;
+}
+
+}
+
+Thread::Thread()
+    : m_data(new ThreadPrivate)
+{
+    m_data->running = false;
+}
+
+void Thread::start()
+{
+    if (pthread_create(&m_data->thread, NULL, thread_start_routine, this) != 0)
+        throw ApplicationError("Unable to create thread");
+    m_data->running = true;
+}
+
+void Thread::join()
+{
+    if (!m_data->running)
+        return;
+
+    pthread_join(m_data->thread, NULL);
+    m_data->running = false;
+}
+
+unsigned long Thread::currentId()
+{
+    // pthread_t is an integer on Linux and a pointer on Mac OS
+    return (unsigned long)pthread_self();
+}
+
+/* }}} */
+/* AtomicCounter {{{ */
+
+long AtomicCounter::get() const
+{
+    return __sync_fetch_and_add(&m_value, 0);
+}
+
+void AtomicCounter::set(long value)
+{
+    // there's no atomic store builtin, a compare and swap loop is the portable replacement
+    long old = m_value;
+    while (!__sync_bool_compare_and_swap(&m_value, old, value))
+        old = m_value;
+}
+
+long AtomicCounter::add(long value)
+{
+    return __sync_add_and_fetch(&m_value, value);
+}
+
+bool AtomicCounter::compareAndSet(long expected, long value)
+{
+    return __sync_bool_compare_and_swap(&m_value, expected, value);
+}
+
+/* }}} */
+
+#endif
+
+/* AtomicCounter {{{ */
+
+AtomicCounter::AtomicCounter(long value)
+    : m_value(value)
+{}
+
+/* }}} */
+/* Thread {{{ */
+
+Thread::~Thread()
+{
+    join();
+    delete m_data;
+}
+
+/* }}} */
+
+} // end namespace core
+} // end namespace usbprog
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
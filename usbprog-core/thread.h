@@ -0,0 +1,270 @@
+/*
+ * (c) 2010, Bernhard Walle <bernhard@bwalle.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file thread.h
+ * @brief Minimal thread abstraction
+ *
+ * Only what the core needs: threads that run a function and mutexes. POSIX threads are
+ * used on POSIX platforms and the native threads on Microsoft Windows.
+ *
+ * @author Bernhard Walle <bernhard@bwalle.de>
+ * @ingroup core
+ */
+
+#ifndef USBPROG_THREAD_H
+#define USBPROG_THREAD_H
+
+namespace usbprog {
+namespace core {
+
+/* Forward declarations {{{ */
+
+struct MutexPrivate;
+struct ThreadPrivate;
+
+/* }}} */
+/* Mutex {{{ */
+
+/**
+ * @brief Non-recursive mutex
+ *
+ * @ingroup core
+ * @author Bernhard Walle <bernhard@bwalle.de>
+ */
+class Mutex
+{
+public:
+    /**
+     * @brief Constructor
+     *
+     * Creates an unlocked mutex.
+     */
+    Mutex();
+
+    /**
+     * @brief Destructor
+     *
+     * The mutex must not be locked any more.
+     */
+    virtual ~Mutex();
+
+public:
+    /**
+     * @brief Locks the mutex
+     *
+     * Blocks until the mutex is available.
+     */
+    void lock();
+
+    /**
+     * @brief Unlocks the mutex
+     */
+    void unlock();
+
+private:
+    // noncopyable
+    Mutex(const Mutex &other);
+    Mutex &operator=(const Mutex &other);
+
+private:
+    MutexPrivate *const m_data;
+};
+
+/* }}} */
+/* MutexLocker {{{ */
+
+/**
+ * @brief Locks a mutex for the lifetime of the object
+ *
+ * @ingroup core
+ * @author Bernhard Walle <bernhard@bwalle.de>
+ */
+class MutexLocker
+{
+public:
+    /**
+     * @brief Constructor
+     *
+     * Locks @p mutex.
+     *
+     * @param[in] mutex the mutex, must be valid for the lifetime of the MutexLocker
+     */
+    MutexLocker(Mutex *mutex)
+        : m_mutex(mutex)
+    { m_mutex->lock(); }
+
+    /**
+     * @brief Destructor
+     *
+     * Unlocks the mutex.
+     */
+    ~MutexLocker()
+    { m_mutex->unlock(); }
+
+private:
+    // noncopyable
+    MutexLocker(const MutexLocker &other);
+    MutexLocker &operator=(const MutexLocker &other);
+
+private:
+    Mutex *m_mutex;
+};
+
+/* }}} */
+/* AtomicCounter {{{ */
+
+/**
+ * @brief Integer that can be read and written by several threads without a Mutex
+ *
+ * Each operation is atomic and a full memory barrier, so a thread can publish a value that
+ * another thread samples without ever blocking. Uses the GCC builtins on POSIX platforms and
+ * the Interlocked functions on Microsoft Windows.
+ *
+ * @ingroup core
+ * @author Bernhard Walle <bernhard@bwalle.de>
+ */
+class AtomicCounter
+{
+public:
+    /**
+     * @brief Constructor
+     *
+     * @param[in] value the initial value
+     */
+    AtomicCounter(long value = 0);
+
+public:
+    /**
+     * @brief Returns the current value
+     *
+     * @return the value
+     */
+    long get() const;
+
+    /**
+     * @brief Sets the value
+     *
+     * @param[in] value the new value
+     */
+    void set(long value);
+
+    /**
+     * @brief Adds to the value
+     *
+     * @param[in] value the value to add, can be negative
+     * @return the new value
+     */
+    long add(long value);
+
+    /**
+     * @brief Sets the value if it hasn't been changed
+     *
+     * @param[in] expected the value that has been read before
+     * @param[in] value the new value
+     * @return @c true if the value was @p expected and has been set, @c false if another
+     *         thread has changed it in between
+     */
+    bool compareAndSet(long expected, long value);
+
+private:
+    // noncopyable
+    AtomicCounter(const AtomicCounter &other);
+    AtomicCounter &operator=(const AtomicCounter &other);
+
+private:
+    mutable volatile long m_value;
+};
+
+/* }}} */
+/* Thread {{{ */
+
+/**
+ * @brief A thread
+ *
+ * Subclasses implement run(), which is executed in the new thread after start() has been
+ * called.
+ *
+ * @ingroup core
+ * @author Bernhard Walle <bernhard@bwalle.de>
+ */
+class Thread
+{
+    friend struct ThreadPrivate;
+
+public:
+    /**
+     * @brief Constructor
+     *
+     * The thread is not started.
+     */
+    Thread();
+
+    /**
+     * @brief Destructor
+     *
+     * Waits for the thread if it has been started and not been joined yet.
+     */
+    virtual ~Thread();
+
+public:
+    /**
+     * @brief Starts the thread
+     *
+     * @exception ApplicationError if the thread cannot be created
+     */
+    void start();
+
+    /**
+     * @brief Waits until run() has returned
+     *
+     * Does nothing if the thread has not been started.
+     */
+    void join();
+
+    /**
+     * @brief Returns an identifier of the calling thread
+     *
+     * @return a number that is unique among the running threads
+     */
+    static unsigned long currentId();
+
+protected:
+    /**
+     * @brief The function that is executed in the new thread
+     *
+     * Exceptions must not leave that function.
+     */
+    virtual void run() = 0;
+
+private:
+    // noncopyable
+    Thread(const Thread &other);
+    Thread &operator=(const Thread &other);
+
+private:
+    ThreadPrivate *const m_data;
+};
+
+/* }}} */
+
+} // end namespace core
+} // end namespace usbprog
+
+#endif /* USBPROG_THREAD_H */
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
@@ -0,0 +1,193 @@
+/*
+ * (c) 2010, Bernhard Walle <bernhard@bwalle.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <fstream>
+#include <sstream>
+
+#include <usbpp/clock.h>
+
+#include <usbprog-core/tracer.h>
+#include <usbprog-core/error.h>
+#include <usbprog-core/stringutil.h>
+
+// spans after that number are dropped
+#define MAX_SPANS           100000
+
+namespace usbprog {
+namespace core {
+
+/* Tracer {{{ */
+
+static Tracer *s_tracer = NULL;
+
+Tracer *Tracer::tracer()
+{
+    if (!s_tracer)
+        s_tracer = new Tracer();
+
+    return s_tracer;
+}
+
+Tracer::Tracer()
+    : m_enabled(false)
+    , m_dropped(0)
+{}
+
+void Tracer::setEnabled(bool enabled)
+{
+    m_enabled = enabled;
+}
+
+bool Tracer::isEnabled() const
+{
+    return m_enabled;
+}
+
+void Tracer::clear()
+{
+    MutexLocker locker(&m_mutex);
+
+    m_spans.clear();
+    m_threads.clear();
+    m_dropped = 0;
+}
+
+size_t Tracer::getNumberOfSpans() const
+{
+    MutexLocker locker(&m_mutex);
+    return m_spans.size();
+}
+
+void Tracer::addSpan(const char         *name,
+                     const std::string  &args,
+                     unsigned long long start,
+                     unsigned long long end)
+{
+    unsigned long threadId = Thread::currentId();
+
+    MutexLocker locker(&m_mutex);
+    if (m_spans.size() >= MAX_SPANS) {
+        m_dropped++;
+        return;
+    }
+
+    std::map<unsigned long, unsigned int>::const_iterator thread = m_threads.find(threadId);
+    if (thread == m_threads.end())
+        thread = m_threads.insert(std::make_pair(threadId, (unsigned int)m_threads.size() + 1)).first;
+
+    Span span;
+    span.name = name;
+    span.args = args;
+    span.start = start;
+    span.duration = end - start;
+    span.thread = thread->second;
+    m_spans.push_back(span);
+}
+
+void Tracer::writeChromeTrace(std::ostream &os) const
+{
+    MutexLocker locker(&m_mutex);
+
+    // the viewer needs no absolute time, so the timeline starts with the first span
+    unsigned long long origin = 0;
+    for (std::vector<Span>::const_iterator it = m_spans.begin(); it != m_spans.end(); ++it)
+        if (it == m_spans.begin() || it->start < origin)
+            origin = it->start;
+
+    os << "{\"traceEvents\":[\n";
+    os << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,"
+       << "\"args\":{\"name\":\"usbprog\"}}";
+    for (unsigned int thread = 1; thread <= m_threads.size(); ++thread)
+        os << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread
+           << ",\"args\":{\"name\":\"thread " << thread << "\"}}";
+
+    for (std::vector<Span>::const_iterator it = m_spans.begin(); it != m_spans.end(); ++it) {
+        os << ",\n{\"name\":" << json_string(it->name)
+           << ",\"cat\":\"usbprog\",\"ph\":\"X\""
+           << ",\"ts\":" << (it->start - origin)
+           << ",\"dur\":" << it->duration
+           << ",\"pid\":1,\"tid\":" << it->thread;
+        if (!it->args.empty())
+            os << ",\"args\":{" << it->args << "}";
+        os << "}";
+    }
+    os << "\n],\n\"displayTimeUnit\":\"ms\",\n"
+       << "\"otherData\":{\"droppedSpans\":" << m_dropped << "}}\n";
+}
+
+void Tracer::writeChromeTrace(const std::string &fileName) const
+{
+    std::ofstream file(fileName.c_str());
+    if (!file)
+        throw IOError("Unable to open " + fileName + " for writing");
+
+    writeChromeTrace(file);
+    file.close();
+    if (!file)
+        throw IOError("Unable to write " + fileName);
+}
+
+/* }}} */
+/* TraceSpan {{{ */
+
+TraceSpan::TraceSpan(const char *name)
+    : m_name(name)
+    , m_enabled(Tracer::tracer()->isEnabled())
+    , m_start(0)
+{
+    if (m_enabled)
+        m_start = usb::usbpp_now_us();
+}
+
+TraceSpan::~TraceSpan()
+{
+    if (m_enabled)
+        Tracer::tracer()->addSpan(m_name, m_args, m_start, usb::usbpp_now_us());
+}
+
+bool TraceSpan::isEnabled() const
+{
+    return m_enabled;
+}
+
+void TraceSpan::addArg(const char *name, const std::string &value)
+{
+    if (!m_enabled)
+        return;
+
+    if (!m_args.empty())
+        m_args += ",";
+    m_args += json_string(name) + ":" + json_string(value);
+}
+
+void TraceSpan::addArg(const char *name, long long value)
+{
+    if (!m_enabled)
+        return;
+
+    std::stringstream ss;
+    ss << value;
+    if (!m_args.empty())
+        m_args += ",";
+    m_args += json_string(name) + ":" + ss.str();
+}
+
+/* }}} */
+
+} // end namespace core
+} // end namespace usbprog
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
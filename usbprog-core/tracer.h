@@ -0,0 +1,246 @@
+/*
+ * (c) 2010, Bernhard Walle <bernhard@bwalle.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file tracer.h
+ * @brief Timeline of the operations of a program run
+ *
+ * @author Bernhard Walle <bernhard@bwalle.de>
+ * @ingroup core
+ */
+
+#ifndef USBPROG_TRACER_H
+#define USBPROG_TRACER_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <ostream>
+
+#include <usbprog-core/thread.h>
+
+namespace usbprog {
+namespace core {
+
+/* Tracer {{{ */
+
+/**
+ * @brief Records spans and exports them in the Chrome trace event format
+ *
+ * A span is an operation with a name, a start time, a duration, the thread that executed it
+ * and optional arguments, see TraceSpan. The exported file can be loaded in
+ * <tt>chrome://tracing</tt> or in Perfetto to see the timeline of a run.
+ *
+ * The tracer is disabled by default. As long as it is disabled, a TraceSpan costs only the
+ * check of isEnabled(), provided that arguments which have to be formatted first are only
+ * added if TraceSpan::isEnabled() returns @c true. At most 100000 spans are kept, later spans are counted but dropped.
+ *
+ * Example:
+ *
+ * @code
+ * Tracer::tracer()->setEnabled(true);
+ * // ...
+ * Tracer::tracer()->writeChromeTrace("usbprog.json");
+ * @endcode
+ *
+ * @author Bernhard Walle <bernhard@bwalle.de>
+ * @ingroup core
+ */
+class Tracer
+{
+    friend class TraceSpan;
+
+public:
+    /**
+     * @brief Singleton getter
+     *
+     * @return the only instance of Tracer
+     */
+    static Tracer *tracer();
+
+public:
+    /**
+     * @brief Enables or disables recording
+     *
+     * Must not be called while other threads create spans. Spans that are already recorded
+     * are kept.
+     *
+     * @param[in] enabled @c true if spans should be recorded, @c false otherwise
+     */
+    void setEnabled(bool enabled);
+
+    /**
+     * @brief Checks if spans are recorded
+     *
+     * @return @c true if spans are recorded, @c false otherwise
+     */
+    bool isEnabled() const;
+
+    /**
+     * @brief Forgets all recorded spans
+     */
+    void clear();
+
+    /**
+     * @brief Returns the number of recorded spans
+     *
+     * @return the number of spans, without the dropped ones
+     */
+    size_t getNumberOfSpans() const;
+
+    /**
+     * @brief Writes all recorded spans
+     *
+     * @param[in] os the stream to which the JSON document is written
+     */
+    void writeChromeTrace(std::ostream &os) const;
+
+    /**
+     * @brief Writes all recorded spans to a file
+     *
+     * @param[in] fileName the name of the file, an existing file is overwritten
+     * @exception IOError if the file cannot be written
+     */
+    void writeChromeTrace(const std::string &fileName) const;
+
+protected:
+    /**
+     * @brief Constructor
+     *
+     * Use tracer() to get the instance.
+     */
+    Tracer();
+
+    /**
+     * @brief Adds a finished span
+     *
+     * @param[in] name the name of the span
+     * @param[in] args the arguments as members of a JSON object, without braces
+     * @param[in] start the start time in microseconds, see usb::usbpp_now_us()
+     * @param[in] end the end time in microseconds
+     */
+    void addSpan(const char         *name,
+                 const std::string  &args,
+                 unsigned long long start,
+                 unsigned long long end);
+
+private:
+    struct Span {
+        const char          *name;
+        std::string         args;
+        unsigned long long  start;
+        unsigned long long  duration;
+        unsigned int        thread;
+    };
+
+    bool m_enabled;
+    std::vector<Span> m_spans;
+    unsigned long m_dropped;
+    // small thread numbers in the order of the first span
+    std::map<unsigned long, unsigned int> m_threads;
+    mutable Mutex m_mutex;
+};
+
+/* }}} */
+/* TraceSpan {{{ */
+
+/**
+ * @brief One operation on the timeline
+ *
+ * The span starts when the object is created and ends when it is destroyed, so it also covers
+ * operations that are left with an exception:
+ *
+ * @code
+ * void DeviceManager::switchUpdateMode()
+ * {
+ *     TraceSpan span("DeviceManager::switchUpdateMode");
+ *     if (span.isEnabled())
+ *         span.addArg("location", dev->getLocation());
+ *     // ...
+ * }
+ * @endcode
+ *
+ * The name must be a string literal since only the pointer is kept. The arguments are only
+ * recorded if the tracer was enabled when the span started, see isEnabled().
+ *
+ * @author Bernhard Walle <bernhard@bwalle.de>
+ * @ingroup core
+ */
+class TraceSpan
+{
+public:
+    /**
+     * @brief Starts a span
+     *
+     * @param[in] name the name of the operation, a string literal
+     */
+    TraceSpan(const char *name);
+
+    /**
+     * @brief Ends the span
+     */
+    ~TraceSpan();
+
+public:
+    /**
+     * @brief Checks if the span is recorded
+     *
+     * Call sites should check that before building a string argument, addArg() would only
+     * discard it.
+     *
+     * @return @c true if the tracer was enabled when the span started, @c false otherwise
+     */
+    bool isEnabled() const;
+
+    /**
+     * @brief Adds a string argument
+     *
+     * The arguments are shown when the span is selected in the trace viewer.
+     *
+     * @param[in] name the name of the argument, a string literal
+     * @param[in] value the value
+     */
+    void addArg(const char *name, const std::string &value);
+
+    /**
+     * @brief Adds a numeric argument
+     *
+     * @param[in] name the name of the argument, a string literal
+     * @param[in] value the value
+     */
+    void addArg(const char *name, long long value);
+
+private:
+    // noncopyable
+    TraceSpan(const TraceSpan &other);
+    TraceSpan &operator=(const TraceSpan &other);
+
+private:
+    const char *m_name;
+    bool m_enabled;
+    unsigned long long m_start;
+    std::string m_args;
+};
+
+/* }}} */
+
+} // end namespace core
+} // end namespace usbprog
+
+#endif /* USBPROG_TRACER_H */
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
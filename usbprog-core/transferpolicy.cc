@@ -0,0 +1,167 @@
+/*
+ * (c) 2010, Bernhard Walle <bernhard@bwalle.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+
+#include <usbprog-core/transferpolicy.h>
+#include <usbprog-core/devices.h>
+#include <usbprog-core/debug.h>
+
+// number of durations that are kept per device and transfer type
+#define MAX_SAMPLES         64
+
+// number of durations that are needed before the timeout adapts
+#define MIN_SAMPLES         16
+
+// the timeout is that multiple of the 99th percentile
+#define TIMEOUT_FACTOR      4
+
+namespace usbprog {
+namespace core {
+
+/* AdaptiveTransferPolicy {{{ */
+
+AdaptiveTransferPolicy::AdaptiveTransferPolicy()
+{
+    m_percentileBuffer.reserve(MAX_SAMPLES);
+
+    setTimeouts(TT_BULK_WRITE, 100, 20, 1000);
+    setRetries(TT_BULK_WRITE, 3, 10);
+    setTimeouts(TT_MODE_SWITCH, 1000, 200, 5000);
+    setRetries(TT_MODE_SWITCH, 4, 10);
+}
+
+void AdaptiveTransferPolicy::setTimeouts(TransferType   type,
+                                         unsigned int   defaultTimeout,
+                                         unsigned int   minTimeout,
+                                         unsigned int   maxTimeout)
+{
+    MutexLocker locker(&m_mutex);
+
+    m_settings[type].defaultTimeout = defaultTimeout;
+    m_settings[type].minTimeout = minTimeout;
+    m_settings[type].maxTimeout = std::max(minTimeout, maxTimeout);
+
+    for (StatisticsMap::iterator it = m_statistics.begin(); it != m_statistics.end(); ++it)
+        updateTimeout(it->second.types[type], m_settings[type]);
+}
+
+void AdaptiveTransferPolicy::setRetries(TransferType type, unsigned int retries, unsigned int initialDelay)
+{
+    MutexLocker locker(&m_mutex);
+
+    m_settings[type].retries = retries;
+    m_settings[type].initialDelay = initialDelay;
+}
+
+void AdaptiveTransferPolicy::reset()
+{
+    MutexLocker locker(&m_mutex);
+    m_statistics.clear();
+}
+
+unsigned int AdaptiveTransferPolicy::getTimeout(const Device *device, TransferType type)
+{
+    MutexLocker locker(&m_mutex);
+
+    StatisticsMap::const_iterator it = m_statistics.find(device->getLocation());
+    if (it == m_statistics.end())
+        return m_settings[type].defaultTimeout;
+
+    return it->second.types[type].timeout;
+}
+
+unsigned int AdaptiveTransferPolicy::getRetries(TransferType type)
+{
+    MutexLocker locker(&m_mutex);
+    return m_settings[type].retries;
+}
+
+unsigned int AdaptiveTransferPolicy::getRetryDelay(TransferType type, unsigned int retry)
+{
+    MutexLocker locker(&m_mutex);
+
+    unsigned int delay = m_settings[type].initialDelay;
+    for (unsigned int i = 1; i < retry && delay < m_settings[type].maxTimeout; ++i)
+        delay *= 2;
+
+    return delay;
+}
+
+void AdaptiveTransferPolicy::transferFinished(const Device         *device,
+                                              TransferType          type,
+                                              unsigned long long    us,
+                                              bool                  success)
+{
+    MutexLocker locker(&m_mutex);
+
+    StatisticsMap::iterator it = m_statistics.find(device->getLocation());
+    if (it == m_statistics.end()) {
+        it = m_statistics.insert(std::make_pair(device->getLocation(), DeviceStatistics())).first;
+        for (int i = 0; i < 2; i++) {
+            Statistics &statistics = it->second.types[i];
+            statistics.samples.reserve(MAX_SAMPLES);
+            statistics.next = 0;
+            statistics.failures = 0;
+            statistics.timeout = m_settings[i].defaultTimeout;
+        }
+    }
+
+    Statistics &statistics = it->second.types[type];
+    if (!success) {
+        statistics.failures++;
+        USBPROG_DEBUG_TRACE("Transfer to %s failed after %d us, %d failures in a row",
+                            device->getLocation().c_str(), int(us), statistics.failures);
+    } else {
+        statistics.failures = 0;
+        if (statistics.samples.size() < MAX_SAMPLES)
+            statistics.samples.push_back(us);
+        else
+            statistics.samples[statistics.next] = us;
+        statistics.next = (statistics.next + 1) % MAX_SAMPLES;
+    }
+
+    updateTimeout(statistics, m_settings[type]);
+}
+
+void AdaptiveTransferPolicy::updateTimeout(Statistics &statistics, const Settings &settings)
+{
+    unsigned long long timeout = settings.defaultTimeout;
+    if (statistics.samples.size() >= MIN_SAMPLES) {
+        // the buffer has room for MAX_SAMPLES, so that doesn't allocate
+        m_percentileBuffer.assign(statistics.samples.begin(), statistics.samples.end());
+        std::vector<unsigned long long>::iterator percentile =
+            m_percentileBuffer.begin() + (m_percentileBuffer.size() * 99 - 1) / 100;
+        std::nth_element(m_percentileBuffer.begin(), percentile, m_percentileBuffer.end());
+
+        // round up to the next millisecond
+        timeout = (*percentile * TIMEOUT_FACTOR + 999) / 1000;
+        timeout = std::max<unsigned long long>(timeout, settings.minTimeout);
+    }
+
+    // a device that has just failed gets more time
+    for (unsigned int i = 0; i < statistics.failures && timeout < settings.maxTimeout; ++i)
+        timeout *= 2;
+
+    statistics.timeout = std::min<unsigned long long>(timeout, settings.maxTimeout);
+}
+
+/* }}} */
+
+} // end namespace core
+} // end namespace usbprog
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
@@ -0,0 +1,241 @@
+/*
+ * (c) 2010, Bernhard Walle <bernhard@bwalle.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file transferpolicy.h
+ * @brief Timeouts and retries of USB transfers
+ *
+ * @author Bernhard Walle <bernhard@bwalle.de>
+ * @ingroup core
+ */
+
+#ifndef USBPROG_TRANSFERPOLICY_H
+#define USBPROG_TRANSFERPOLICY_H
+
+#include <string>
+#include <vector>
+#include <map>
+
+#include <usbprog-core/thread.h>
+
+namespace usbprog {
+namespace core {
+
+class Device;
+
+/* TransferPolicy {{{ */
+
+/**
+ * @brief Decides about timeouts and retries of USB transfers
+ *
+ * The DeviceManager and the UsbprogUpdater ask the policy for the timeout of each transfer
+ * and report the duration afterwards, so an implementation can learn how fast a device
+ * answers. A failed transfer is retried up to getRetries() times after waiting
+ * getRetryDelay().
+ *
+ * Only the failed transfer is retried, e.g. one message of a firmware upload, not the whole
+ * operation. A stalled bulk write is sent again. A message that timed out may have reached the
+ * bootloader nevertheless, so the UsbprogUpdater resynchronizes the bootloader and sends the
+ * command and the data of that page again.
+ *
+ * Implementations must be thread-safe because one policy may be shared by the uploads
+ * of a FlashScheduler.
+ *
+ * @ingroup core
+ * @author Bernhard Walle <bernhard@bwalle.de>
+ */
+class TransferPolicy
+{
+public:
+    /**
+     * @brief Type of a transfer
+     *
+     * Each type has its own timeouts and statistics.
+     */
+    enum TransferType {
+        TT_BULK_WRITE,      /**< bulk transfer of a command or a flash page to the bootloader */
+        TT_MODE_SWITCH      /**< control transfer that switches a firmware to update mode */
+    };
+
+public:
+    /**
+     * @brief The virtual destructor.
+     */
+    virtual ~TransferPolicy() {}
+
+public:
+    /**
+     * @brief Returns the timeout of the next transfer
+     *
+     * @param[in] device the device
+     * @param[in] type the type of the transfer
+     * @return the timeout in milliseconds
+     */
+    virtual unsigned int getTimeout(const Device *device, TransferType type) = 0;
+
+    /**
+     * @brief Returns how often a failed transfer is retried
+     *
+     * @param[in] type the type of the transfer
+     * @return the number of retries, @c 0 if failed transfers should not be retried
+     */
+    virtual unsigned int getRetries(TransferType type) = 0;
+
+    /**
+     * @brief Returns the time to wait before a retry
+     *
+     * @param[in] type the type of the transfer
+     * @param[in] retry the number of the retry, starting with 1
+     * @return the delay in milliseconds
+     */
+    virtual unsigned int getRetryDelay(TransferType type, unsigned int retry) = 0;
+
+    /**
+     * @brief Reports the result of a transfer
+     *
+     * @param[in] device the device
+     * @param[in] type the type of the transfer
+     * @param[in] us the duration of the transfer in microseconds
+     * @param[in] success @c true if the transfer has been successful, @c false otherwise
+     */
+    virtual void transferFinished(const Device         *device,
+                                  TransferType          type,
+                                  unsigned long long    us,
+                                  bool                  success) = 0;
+};
+
+/* }}} */
+/* AdaptiveTransferPolicy {{{ */
+
+/**
+ * @brief Sets the timeouts from the observed latency of each device
+ *
+ * The policy keeps the duration of the last successful transfers per device (identified by
+ * Device::getLocation()) and transfer type. As soon as enough samples are available, the
+ * timeout is four times the 99th percentile, limited by the minimum and maximum timeout.
+ * Before, the default timeout is used. Each failed transfer doubles the timeout until the
+ * next successful one. The timeout is computed when a transfer has finished, so
+ * getTimeout() is only a lookup.
+ *
+ * Retries wait with exponential backoff, starting with the initial delay.
+ *
+ * The defaults are
+ *
+ *  - for TransferPolicy::TT_BULK_WRITE: default timeout 100 ms, between 20 ms and 1 s,
+ *    3 retries, starting with 10 ms delay
+ *  - for TransferPolicy::TT_MODE_SWITCH: default timeout 1 s, between 200 ms and 5 s,
+ *    4 retries, starting with 10 ms delay
+ *
+ * @ingroup core
+ * @author Bernhard Walle <bernhard@bwalle.de>
+ */
+class AdaptiveTransferPolicy : public TransferPolicy
+{
+public:
+    /**
+     * @brief Constructor
+     *
+     * Creates a policy with the defaults and without samples.
+     */
+    AdaptiveTransferPolicy();
+
+public:
+    /**
+     * @brief Sets the timeouts of a transfer type
+     *
+     * @param[in] type the type of the transfer
+     * @param[in] defaultTimeout the timeout in milliseconds as long as there are not enough
+     *            samples
+     * @param[in] minTimeout the minimum timeout in milliseconds
+     * @param[in] maxTimeout the maximum timeout in milliseconds
+     */
+    void setTimeouts(TransferType   type,
+                     unsigned int   defaultTimeout,
+                     unsigned int   minTimeout,
+                     unsigned int   maxTimeout);
+
+    /**
+     * @brief Sets the retries of a transfer type
+     *
+     * @param[in] type the type of the transfer
+     * @param[in] retries the number of retries
+     * @param[in] initialDelay the delay before the first retry in milliseconds, each
+     *            further retry waits twice as long, up to the maximum timeout
+     */
+    void setRetries(TransferType type, unsigned int retries, unsigned int initialDelay);
+
+    /**
+     * @brief Forgets all samples
+     */
+    void reset();
+
+    /// @copydoc TransferPolicy::getTimeout()
+    unsigned int getTimeout(const Device *device, TransferType type);
+
+    /// @copydoc TransferPolicy::getRetries()
+    unsigned int getRetries(TransferType type);
+
+    /// @copydoc TransferPolicy::getRetryDelay()
+    unsigned int getRetryDelay(TransferType type, unsigned int retry);
+
+    /// @copydoc TransferPolicy::transferFinished()
+    void transferFinished(const Device         *device,
+                          TransferType          type,
+                          unsigned long long    us,
+                          bool                  success);
+
+private:
+    struct Settings {
+        unsigned int defaultTimeout;
+        unsigned int minTimeout;
+        unsigned int maxTimeout;
+        unsigned int retries;
+        unsigned int initialDelay;
+    };
+
+    // ring buffer of the last durations in microseconds
+    struct Statistics {
+        std::vector<unsigned long long> samples;
+        size_t next;
+        unsigned int failures;
+        unsigned int timeout;
+    };
+
+    // the statistics of each transfer type of one device
+    struct DeviceStatistics {
+        Statistics types[2];
+    };
+
+    typedef std::map<std::string, DeviceStatistics> StatisticsMap;
+
+    // computes the timeout of the next transfer, m_mutex must be held
+    void updateTimeout(Statistics &statistics, const Settings &settings);
+
+    Settings m_settings[2];
+    StatisticsMap m_statistics;
+    std::vector<unsigned long long> m_percentileBuffer;
+    Mutex m_mutex;
+};
+
+/* }}} */
+
+} // end namespace core
+} // end namespace usbprog
+
+#endif /* USBPROG_TRANSFERPOLICY_H */
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
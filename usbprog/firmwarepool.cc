@@ -29,6 +29,7 @@
 #include <QDomDocument>
 #include <QFile>
 #include <QDir>
+#include <QByteArray>
 
 #include <sys/types.h>
 
@@ -36,9 +37,12 @@
 #include <usbprog-core/util.h>
 #include <usbprog-core/digest.h>
 #include <usbprog-core/debug.h>
+#include <usbprog-core/tracer.h>
 #include <usbprog/firmwarepool.h>
 
-#define INDEX_FILE_NAME  "versions.xml"
+#define INDEX_FILE_NAME          "versions.xml"
+#define COMPRESSED_SUFFIX        ".z"
+#define COMPRESSION_LEVEL        9
 
 namespace usbprog {
 
@@ -356,6 +360,7 @@ Firmwarepool::Firmwarepool(const std::string &cacheDir)
     : m_cacheDir(cacheDir)
     , m_progressNotifier(NULL)
     , m_indexAutoUpdatetime(0)
+    , m_compressCache(false)
 {
     if (!core::Fileutil::isDir(cacheDir))
         if (!core::Fileutil::mkdir(cacheDir))
@@ -379,8 +384,17 @@ void Firmwarepool::setIndexUpdatetime(int minutes)
     m_indexAutoUpdatetime = minutes;
 }
 
+void Firmwarepool::setCompressCache(bool compress)
+{
+    m_compressCache = compress;
+}
+
 void Firmwarepool::downloadIndex(const std::string &url)
 {
+    core::TraceSpan span("Firmwarepool::downloadIndex");
+    if (span.isEnabled())
+        span.addArg("url", url);
+
     std::string newPath(core::pathconcat(m_cacheDir, std::string(INDEX_FILE_NAME) + ".new"));
     std::string oldPath(core::pathconcat(m_cacheDir, INDEX_FILE_NAME));
     std::string file(newPath);
@@ -421,6 +435,8 @@ void Firmwarepool::downloadIndex(const std::string &url)
 
 void Firmwarepool::readIndex()
 {
+    core::TraceSpan span("Firmwarepool::readIndex");
+
     QDomDocument doc("usbprog");
 
     std::string filename = core::pathconcat(m_cacheDir, INDEX_FILE_NAME);
@@ -444,6 +460,11 @@ void Firmwarepool::readIndex()
         if (element.tagName() == "pool")
             parser.parsePool(doc, element);
     }
+
+    core::StringVector names;
+    for (StringFirmwareMap::const_iterator it = m_firmware.begin(); it != m_firmware.end(); ++it)
+        names.push_back(it->first);
+    m_nameIndex.build(names);
 }
 
 void Firmwarepool::deleteIndex()
@@ -461,21 +482,34 @@ void Firmwarepool::setProgress(core::ProgressNotifier *notifier)
 
 void Firmwarepool::downloadFirmware(const std::string &name)
 {
+    core::TraceSpan span("Firmwarepool::downloadFirmware");
+    if (span.isEnabled())
+        span.addArg("firmware", name);
+
     Firmware *fw = getFirmware(name);
     if (!fw)
         throw core::ApplicationError("Firmware doesn't exist");
 
     std::string url = fw->getUrl() + "/" + fw->getFilename();
-    std::string file(core::pathconcat(m_cacheDir, fw->getVerFilename()));
-    if (core::Fileutil::isFile(file)) {
+    std::string file(getFirmwareFilename(fw));
+    if (isFirmwareOnDisk(name)) {
         // check md5 if available, if the checksum is wrong, then delete
         // the file and download again. Check the checksum after that
         // download again to verify that it's now correct.
         if (fw->getMD5Sum().size() > 0) {
-            if (core::check_digest(file, fw->getMD5Sum(), core::Digest::DA_MD5))
+            bool valid;
+            try {
+                valid = core::check_digest(readCachedFirmware(fw), fw->getMD5Sum(),
+                                           core::Digest::DA_MD5);
+            } catch (const core::IOError &err) {
+                USBPROG_DEBUG_DBG("Reading cached firmware failed: %s", err.what());
+                valid = false;
+            }
+
+            if (valid)
                 return;
             else
-                remove(file.c_str());
+                removeCachedFirmware(fw);
         } else
             return;
     }
@@ -504,6 +538,9 @@ void Firmwarepool::downloadFirmware(const std::string &name)
             throw DownloadError("Bad checksum");
         }
     }
+
+    if (m_compressCache)
+        compressCachedFirmware(fw);
 }
 
 void Firmwarepool::fillFirmware(const std::string &name)
@@ -512,8 +549,7 @@ void Firmwarepool::fillFirmware(const std::string &name)
     if (!fw)
         throw core::ApplicationError("Firmware doesn't exist");
 
-    std::string file = getFirmwareFilename(fw);
-    fw->setData(core::Fileutil::readBytesFromFile(file));
+    fw->setData(readCachedFirmware(fw));
 }
 
 std::string Firmwarepool::getFirmwareFilename(Firmware *fw) const
@@ -521,6 +557,60 @@ std::string Firmwarepool::getFirmwareFilename(Firmware *fw) const
     return core::pathconcat(m_cacheDir, fw->getVerFilename());
 }
 
+std::string Firmwarepool::getCompressedFirmwareFilename(Firmware *fw) const
+{
+    return getFirmwareFilename(fw) + COMPRESSED_SUFFIX;
+}
+
+core::ByteVector Firmwarepool::readCachedFirmware(Firmware *fw) const
+{
+    std::string compressed = getCompressedFirmwareFilename(fw);
+    if (!core::Fileutil::isFile(compressed))
+        return core::Fileutil::readBytesFromFile(getFirmwareFilename(fw));
+
+    QFile file(QString::fromStdString(compressed));
+    if (!file.open(QIODevice::ReadOnly))
+        throw core::IOError("Opening " + compressed + " failed");
+
+    // the qCompress() format starts with the uncompressed size, so qUncompress()
+    // allocates the target buffer only once
+    QByteArray data = qUncompress(file.readAll());
+    file.close();
+    if (data.isEmpty())
+        throw core::IOError("Unable to decompress " + compressed);
+
+    return core::ByteVector(data.constData(), data.constData() + data.size());
+}
+
+void Firmwarepool::compressCachedFirmware(Firmware *fw)
+{
+    std::string file = getFirmwareFilename(fw);
+    std::string compressed = getCompressedFirmwareFilename(fw);
+
+    QFile in(QString::fromStdString(file));
+    if (!in.open(QIODevice::ReadOnly))
+        throw core::IOError("Opening " + file + " failed");
+    QByteArray data = qCompress(in.readAll(), COMPRESSION_LEVEL);
+    in.close();
+
+    QFile out(QString::fromStdString(compressed));
+    if (!out.open(QIODevice::WriteOnly) || out.write(data) != data.size()) {
+        out.close();
+        out.remove();
+        throw core::IOError("Writing " + compressed + " failed");
+    }
+    out.close();
+
+    USBPROG_DEBUG_DBG("Compressed '%s' to %d bytes", file.c_str(), data.size());
+    remove(file.c_str());
+}
+
+void Firmwarepool::removeCachedFirmware(Firmware *fw)
+{
+    remove(getFirmwareFilename(fw).c_str());
+    remove(getCompressedFirmwareFilename(fw).c_str());
+}
+
 StringList Firmwarepool::getFirmwareNameList() const
 {
     StringList ret;
@@ -531,6 +621,11 @@ StringList Firmwarepool::getFirmwareNameList() const
     return ret;
 }
 
+const core::PrefixTrie &Firmwarepool::getFirmwareNameIndex() const
+{
+    return m_nameIndex;
+}
+
 Firmware *Firmwarepool::getFirmware(const std::string &name) const
 {
     StringFirmwareMap::const_iterator it = m_firmware.find(name);
@@ -585,7 +680,8 @@ bool Firmwarepool::isFirmwareOnDisk(const std::string &name)
     if (!fw)
         return false;
 
-    return core::Fileutil::isFile(getFirmwareFilename(fw));
+    return core::Fileutil::isFile(getFirmwareFilename(fw)) ||
+           core::Fileutil::isFile(getCompressedFirmwareFilename(fw));
 }
 
 void Firmwarepool::cleanCache()
@@ -600,6 +696,10 @@ void Firmwarepool::cleanCache()
             continue;
 
         std::string name = entry.toStdString();
+        if (name.size() > strlen(COMPRESSED_SUFFIX) &&
+                name.compare(name.size() - strlen(COMPRESSED_SUFFIX), std::string::npos, COMPRESSED_SUFFIX) == 0)
+            name.erase(name.size() - strlen(COMPRESSED_SUFFIX));
+
         std::string::size_type last_dot = name.rfind('.', name.length());
         if (last_dot == std::string::npos)
             continue;
@@ -39,6 +39,7 @@
 #include <usbprog-core/error.h>
 #include <usbprog-core/types.h>
 #include <usbprog-core/devices.h>
+#include <usbprog-core/prefixtrie.h>
 #include <usbprog/downloader.h>
 
 namespace usbprog {
@@ -376,6 +377,15 @@ public:
      */
     StringList getFirmwareNameList() const;
 
+    /**
+     * @brief Returns the index of the firmware names for the completion
+     *
+     * The index is built by readIndex().
+     *
+     * @return the names of all firmwares, valid until readIndex() is called again
+     */
+    const core::PrefixTrie &getFirmwareNameIndex() const;
+
     /**
      * @brief Returns the firmware @p name
      *
@@ -426,6 +436,18 @@ public:
      */
     void setIndexUpdatetime(int minutes);
 
+    /**
+     * @brief Enables compression of the firmware cache
+     *
+     * If enabled, downloadFirmware() stores the firmware compressed with zlib (using
+     * qCompress()) in the cache directory. Compressed and uncompressed files can be mixed
+     * in one cache, fillFirmware() handles both. The MD5 sum is always verified against the
+     * uncompressed content.
+     *
+     * @param[in] compress @c true if new downloads should be compressed, @c false otherwise
+     */
+    void setCompressCache(bool compress);
+
     /**
      * @brief Downloads the firmware @p name
      *
@@ -492,6 +514,42 @@ protected:
      */
     std::string getFirmwareFilename(Firmware *fw) const;
 
+    /**
+     * @brief Returns the compressed firmware file name
+     *
+     * @param[in] fw a pointer to the firmware object
+     * @return the name of the compressed file, i.e. getFirmwareFilename() with a suffix
+     */
+    std::string getCompressedFirmwareFilename(Firmware *fw) const;
+
+    /**
+     * @brief Reads the firmware @p fw from the cache
+     *
+     * If a compressed file exists, it's decompressed.
+     *
+     * @param[in] fw a pointer to the firmware object
+     * @return the (uncompressed) firmware bytes
+     * @exception core::IOError if the file cannot be read or decompressed
+     */
+    core::ByteVector readCachedFirmware(Firmware *fw) const;
+
+    /**
+     * @brief Compresses the cached firmware @p fw
+     *
+     * The uncompressed file is removed afterwards.
+     *
+     * @param[in] fw a pointer to the firmware object
+     * @exception core::IOError if reading or writing the file failed
+     */
+    void compressCachedFirmware(Firmware *fw);
+
+    /**
+     * @brief Removes the cached firmware @p fw, compressed or not
+     *
+     * @param[in] fw a pointer to the firmware object
+     */
+    void removeCachedFirmware(Firmware *fw);
+
     /**
      * @brief Adds the firmware @p fw to the list
      *
@@ -503,8 +561,10 @@ protected:
 private:
     const std::string       m_cacheDir;
     StringFirmwareMap       m_firmware;
+    core::PrefixTrie        m_nameIndex;
     core::ProgressNotifier  *m_progressNotifier;
     int                     m_indexAutoUpdatetime;
+    bool                    m_compressCache;
 };
 
 /* }}} */
@@ -0,0 +1,277 @@
+/*
+ * (c) 2010, Bernhard Walle <bernhard@bwalle.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <memory>
+#include <map>
+#include <algorithm>
+#include <cctype>
+
+#include <QFileInfo>
+#include <QDir>
+
+#include <usbprog-core/stringutil.h>
+#include <usbprog-core/util.h>
+#include <usbprog-core/digest.h>
+#include <usbprog-core/firmwareimage.h>
+#include <usbprog-core/debug.h>
+#include <usbprog/flashplan.h>
+
+namespace usbprog {
+
+/* Helpers {{{ */
+
+static std::string md5sum(core::ByteVector data)
+{
+    std::auto_ptr<core::Digest> digest(core::Digest::create(core::Digest::DA_MD5));
+    if (!data.empty())
+        digest->process(&data[0], data.size());
+    return digest->end();
+}
+
+static std::string lowercase(std::string string)
+{
+    std::transform(string.begin(), string.end(), string.begin(), ::tolower);
+    return string;
+}
+
+/* }}} */
+/* FlashPlan {{{ */
+
+FlashPlan::FlashPlan(Firmwarepool *firmwarepool)
+    : m_firmwarepool(firmwarepool)
+    , m_skipErasedPages(false)
+{}
+
+FlashPlan::~FlashPlan()
+{
+    for (std::vector<Image *>::const_iterator it = m_images.begin(); it != m_images.end(); ++it)
+        delete *it;
+}
+
+void FlashPlan::readFile(const std::string &fileName)
+{
+    std::ifstream file(fileName.c_str());
+    if (!file)
+        throw core::IOError("Cannot open the flash plan " + fileName + ".");
+
+    // relative file names are relative to the plan, not to the working directory
+    QDir planDir = QFileInfo(QString::fromStdString(fileName)).absoluteDir();
+
+    m_fileName = fileName;
+    m_reportFile.clear();
+    m_entries.clear();
+
+    std::map<std::string, size_t> locations;
+    std::string line;
+    for (size_t lineNumber = 1; std::getline(file, line); lineNumber++) {
+        std::stringstream prefix;
+        prefix << fileName << ":" << lineNumber << ": ";
+
+        line = core::strip(line);
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        if (line[0] == '[') {
+            if (line[line.size()-1] != ']')
+                throw core::ParseError(prefix.str() + "Missing ']'");
+
+            Entry entry;
+            entry.location = core::strip(line.substr(1, line.size()-2));
+            entry.line = lineNumber;
+            entry.image = 0;
+            if (entry.location.empty())
+                throw core::ParseError(prefix.str() + "Empty device location");
+            if (locations.find(entry.location) != locations.end())
+                throw core::ParseError(prefix.str() + "Device " + entry.location + " appears twice");
+
+            locations[entry.location] = m_entries.size();
+            m_entries.push_back(entry);
+            continue;
+        }
+
+        size_t equal = line.find('=');
+        if (equal == std::string::npos)
+            throw core::ParseError(prefix.str() + "Expected 'key = value'");
+
+        std::string key = core::strip(line.substr(0, equal));
+        std::string value = core::strip(line.substr(equal+1));
+        if (value.empty())
+            throw core::ParseError(prefix.str() + "Missing value of '" + key + "'");
+
+        if (key == "file" || key == "report")
+            value = planDir.absoluteFilePath(
+                        QString::fromStdString(core::Fileutil::resolvePath(value))).toStdString();
+
+        if (m_entries.empty()) {
+            if (key == "report")
+                m_reportFile = value;
+            else
+                throw core::ParseError(prefix.str() + "Unknown key '" + key + "' outside of a device");
+        } else {
+            Entry &entry = m_entries.back();
+            if (key == "firmware" || key == "file") {
+                if (!entry.firmware.empty() || !entry.file.empty())
+                    throw core::ParseError(prefix.str() + "More than one firmware for " +
+                                           entry.location);
+                (key == "firmware" ? entry.firmware : entry.file) = value;
+            } else if (key == "md5")
+                entry.md5 = value;
+            else
+                throw core::ParseError(prefix.str() + "Unknown key '" + key + "'");
+        }
+    }
+
+    if (m_entries.empty())
+        throw core::ParseError(fileName + ": No devices in the flash plan");
+
+    for (std::vector<Entry>::const_iterator it = m_entries.begin(); it != m_entries.end(); ++it) {
+        if (it->firmware.empty() && it->file.empty()) {
+            std::stringstream ss;
+            ss << fileName << ":" << it->line << ": No firmware for " << it->location;
+            throw core::ParseError(ss.str());
+        }
+    }
+}
+
+void FlashPlan::prepare(bool skipErasedPages)
+{
+    for (std::vector<Image *>::const_iterator it = m_images.begin(); it != m_images.end(); ++it)
+        delete *it;
+    m_images.clear();
+    m_skipErasedPages = skipErasedPages;
+
+    // each firmware is loaded once, even if many devices get it
+    std::map<std::string, size_t> images;
+    std::string errors;
+
+    for (std::vector<Entry>::iterator it = m_entries.begin(); it != m_entries.end(); ++it) {
+        std::string source = it->firmware.empty() ? it->file : it->firmware;
+
+        std::map<std::string, size_t>::const_iterator image = images.find(source);
+        if (image == images.end()) {
+            try {
+                m_images.push_back(loadImage(*it, skipErasedPages));
+            } catch (const core::ApplicationError &err) {
+                errors += it->location + ": " + err.what() + "\n";
+                m_images.push_back(NULL);
+            }
+            image = images.insert(std::make_pair(source, m_images.size() - 1)).first;
+        }
+        it->image = image->second;
+
+        Image *img = m_images[it->image];
+        if (img && !it->md5.empty() && lowercase(it->md5) != img->md5)
+            errors += it->location + ": MD5 sum of " + source + " is " + img->md5 +
+                      ", expected " + it->md5 + "\n";
+    }
+
+    if (!errors.empty())
+        throw core::ApplicationError("Invalid flash plan " + m_fileName + ":\n" +
+                                     errors.substr(0, errors.size()-1));
+}
+
+FlashPlan::Image *FlashPlan::loadImage(const Entry &entry, bool skipErasedPages)
+{
+    core::ByteVector data;
+    core::FirmwareImage firmwareImage;
+
+    if (!entry.firmware.empty()) {
+        Firmware *fw = m_firmwarepool->getFirmware(entry.firmware);
+        if (!fw)
+            throw core::ApplicationError(entry.firmware + ": Invalid firmware specified.");
+
+        try {
+            if (!m_firmwarepool->isFirmwareOnDisk(entry.firmware))
+                m_firmwarepool->downloadFirmware(entry.firmware);
+            m_firmwarepool->fillFirmware(entry.firmware);
+        } catch (const DownloadError &err) {
+            throw core::ApplicationError("Unable to download " + entry.firmware + ": " + err.what());
+        } catch (const core::IOError &err) {
+            throw core::ApplicationError(std::string("I/O Error: ") + err.what());
+        }
+
+        data = fw->getData();
+        firmwareImage = core::FirmwareImage(data);
+    } else {
+        try {
+            data = core::Fileutil::readBytesFromFile(entry.file);
+            firmwareImage = core::FirmwareImage::parse(data,
+                    core::FirmwareImage::detectFormat(entry.file, data));
+            if (firmwareImage.empty())
+                throw core::ParseError("No data");
+        } catch (const core::IOError &err) {
+            throw core::ApplicationError(std::string("Error while reading data from file: ") + err.what());
+        } catch (const core::ParseError &err) {
+            throw core::ApplicationError("Invalid firmware file " + entry.file + ": " + err.what());
+        }
+    }
+
+    std::auto_ptr<Image> image(new Image);
+    image->source = entry.firmware.empty() ? entry.file : entry.firmware;
+    image->md5 = md5sum(data);
+    try {
+        image->allPages = core::PageStream(firmwareImage, false);
+        if (skipErasedPages)
+            image->dataPages = core::PageStream(firmwareImage, true);
+    } catch (const core::IOError &err) {
+        throw core::ApplicationError(image->source + ": " + err.what());
+    }
+
+    USBPROG_DEBUG_DBG("Loaded %s with %d pages", image->source.c_str(),
+                      int(image->allPages.getNumberOfPages()));
+    return image.release();
+}
+
+std::string FlashPlan::getReportFile() const
+{
+    return m_reportFile;
+}
+
+size_t FlashPlan::getNumberOfEntries() const
+{
+    return m_entries.size();
+}
+
+std::string FlashPlan::getLocation(size_t entry) const
+{
+    return m_entries[entry].location;
+}
+
+std::string FlashPlan::getSource(size_t entry) const
+{
+    const Entry &e = m_entries[entry];
+    return e.firmware.empty() ? e.file : e.firmware;
+}
+
+std::string FlashPlan::getMD5Sum(size_t entry) const
+{
+    return m_images[m_entries[entry].image]->md5;
+}
+
+const core::PageStream &FlashPlan::getPageStream(size_t entry, bool chipErase) const
+{
+    const Image *image = m_images[m_entries[entry].image];
+    return m_skipErasedPages && chipErase ? image->dataPages : image->allPages;
+}
+
+/* }}} */
+
+} // end namespace usbprog
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
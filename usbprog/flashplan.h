@@ -0,0 +1,204 @@
+/*
+ * (c) 2010, Bernhard Walle <bernhard@bwalle.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file flashplan.h
+ * @brief Flash plans that assign firmwares to USB ports
+ *
+ * @author Bernhard Walle <bernhard@bwalle.de>
+ * @ingroup usbprog
+ */
+
+#ifndef FLASHPLAN_H
+#define FLASHPLAN_H
+
+#include <string>
+#include <vector>
+
+#include <usbprog-core/error.h>
+#include <usbprog-core/devices.h>
+#include <usbprog/firmwarepool.h>
+
+namespace usbprog {
+
+/* FlashPlan {{{ */
+
+/**
+ * @class FlashPlan usbprog/flashplan.h
+ * @brief Assigns a firmware to each port of a production station
+ *
+ * A flash plan is a text file with one section per device. The section name is the port
+ * path of the device (see core::Device::getLocation()), and the section contains either the
+ * name of a firmware of the pool or the name of a file, and optionally the expected MD5 sum
+ * of the firmware or the file:
+ *
+ * @code
+ * # comments start with a hash sign
+ * report = station1.report
+ *
+ * [1-1.1]
+ * firmware = blinkdemo
+ *
+ * [1-1.2]
+ * file = firmware/test.hex
+ * md5 = 0cc175b9c0f1b6a831c399e269772661
+ * @endcode
+ *
+ * Relative file names are relative to the directory of the plan. The optional @c report
+ * key before the first section names the file to which the result of each device should
+ * be written.
+ *
+ * prepare() loads and verifies each distinct firmware once and creates the messages for
+ * the bootloader (see core::PageStream), so all devices that get the same firmware share one
+ * read-only buffer and no error in the plan is detected after the first device has been
+ * touched.
+ *
+ * @author Bernhard Walle <bernhard@bwalle.de>
+ * @ingroup usbprog
+ */
+class FlashPlan {
+public:
+    /**
+     * @brief Constructor
+     *
+     * Creates an empty plan.
+     *
+     * @param[in] firmwarepool the pool that resolves firmware names (still owned by the caller)
+     */
+    FlashPlan(Firmwarepool *firmwarepool);
+
+    /**
+     * @brief Destructor
+     */
+    virtual ~FlashPlan();
+
+public:
+    /**
+     * @brief Reads a plan
+     *
+     * @param[in] fileName the name of the plan
+     * @exception core::IOError if @p fileName cannot be read
+     * @exception core::ParseError if the plan contains a syntax error, an unknown key,
+     *            a device twice or a device without firmware
+     */
+    void readFile(const std::string &fileName);
+
+    /**
+     * @brief Loads the firmwares and creates the messages
+     *
+     * Firmwares of the pool that are not in the cache are downloaded. All errors are
+     * collected, so one call reports all problems of the plan.
+     *
+     * @param[in] skipErasedPages @c true if erased pages should not be written to devices
+     *            whose bootloader erases the whole chip, see
+     *            core::UsbprogUpdater::setSkipErasedPages()
+     * @exception core::ApplicationError if a firmware cannot be found, read or decoded or if
+     *            a MD5 sum doesn't match, with one line per problem
+     */
+    void prepare(bool skipErasedPages);
+
+    /**
+     * @brief Returns the name of the report file
+     *
+     * @return the resolved file name or an empty string if the plan has no @c report key
+     */
+    std::string getReportFile() const;
+
+    /**
+     * @brief Returns the number of devices
+     *
+     * @return the number of sections in the plan
+     */
+    size_t getNumberOfEntries() const;
+
+    /**
+     * @brief Returns the location of a device
+     *
+     * @param[in] entry the number of the section, starting with 0
+     * @return the port path as written in the plan
+     */
+    std::string getLocation(size_t entry) const;
+
+    /**
+     * @brief Returns the firmware of a device
+     *
+     * @param[in] entry the number of the section, starting with 0
+     * @return the name of the firmware in the pool or the resolved file name
+     */
+    std::string getSource(size_t entry) const;
+
+    /**
+     * @brief Returns the MD5 sum of the firmware of a device
+     *
+     * Only valid after prepare().
+     *
+     * @param[in] entry the number of the section, starting with 0
+     * @return the MD5 sum of the firmware data or of the file
+     */
+    std::string getMD5Sum(size_t entry) const;
+
+    /**
+     * @brief Returns the messages for a device
+     *
+     * Only valid after prepare().
+     *
+     * @param[in] entry the number of the section, starting with 0
+     * @param[in] chipErase @c true if the bootloader of the device erases the whole chip
+     *            (see core::Device::isChipEraseOnUpdate())
+     * @return the messages that are owned by the plan
+     */
+    const core::PageStream &getPageStream(size_t entry, bool chipErase) const;
+
+private:
+    // noncopyable
+    FlashPlan(const FlashPlan &other);
+    FlashPlan &operator=(const FlashPlan &other);
+
+    struct Entry {
+        std::string location;
+        std::string firmware;
+        std::string file;
+        std::string md5;
+        size_t line;
+        size_t image;
+    };
+
+    struct Image {
+        std::string source;
+        std::string md5;
+        core::PageStream allPages;
+        core::PageStream dataPages;
+    };
+
+    Image *loadImage(const Entry &entry, bool skipErasedPages);
+
+private:
+    Firmwarepool *m_firmwarepool;
+    std::string m_fileName;
+    std::string m_reportFile;
+    std::vector<Entry> m_entries;
+    std::vector<Image *> m_images;
+    bool m_skipErasedPages;
+};
+
+/* }}} */
+
+} // end namespace usbprog
+
+#endif /* FLASHPLAN_H */
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1: